@@ -7,12 +7,17 @@
 
 typedef void (*hash_func_t)(const void *p, struct siphash *state);
 typedef int (*compare_func_t)(const void *a, const void *b);
+typedef uint64_t (*cached_hash_func_t)(const void *p);
 
 struct hash_ops {
         hash_func_t hash;
         compare_func_t compare;
         free_func_t free_key;
         free_func_t free_value;
+
+        /* Optional. Returns a hash stored along with the key, computed with a secret key already. Only that
+         * hash is then mixed with the key of the table, instead of hashing the whole key again. */
+        cached_hash_func_t cached_hash;
 };
 
 #define _DEFINE_HASH_OPS(uq, name, type, hash_func, compare_func, free_key_func, free_value_func, scope) \
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "hashed-string.h"
+#include "random-util.h"
+#include "siphash24.h"
+#include "strv.h"
+
+typedef struct HashedString {
+        uint64_t hash;
+        char s[];
+} HashedString;
+
+assert_cc(offsetof(HashedString, s) == sizeof(uint64_t));
+
+static uint8_t hashed_string_key[16];
+
+static void hashed_string_key_initialize(void) {
+        random_bytes(hashed_string_key, sizeof(hashed_string_key));
+}
+
+static const uint8_t* get_hashed_string_key(void) {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+        assert_se(pthread_once(&once, hashed_string_key_initialize) == 0);
+        return hashed_string_key;
+}
+
+static HashedString* hashed_string_from_str(const char *s) {
+        return (HashedString*) ((uint8_t*) s - offsetof(HashedString, s));
+}
+
+static HashedString* hashed_string_new(const char *s, size_t n) {
+        HashedString *h;
+
+        h = malloc(offsetof(HashedString, s) + n + 1);
+        if (!h)
+                return NULL;
+
+        memcpy(h->s, s, n);
+        h->s[n] = 0;
+        return h;
+}
+
+char* hashed_string_init(void *buf, const char *s, size_t n) {
+        HashedString *h = buf;
+
+        assert(buf);
+        assert(s);
+
+        memcpy(h->s, s, n);
+        h->s[n] = 0;
+        h->hash = siphash24(h->s, n + 1, get_hashed_string_key());
+
+        return h->s;
+}
+
+char* hashed_strndup(const char *s, size_t n) {
+        void *buf;
+
+        assert(s);
+
+        n = strnlen(s, n);
+
+        buf = malloc(HASHED_STRING_SIZE(n));
+        if (!buf)
+                return NULL;
+
+        return hashed_string_init(buf, s, n);
+}
+
+char* hashed_strdup(const char *s) {
+        return hashed_strndup(s, SIZE_MAX);
+}
+
+char* hashed_string_copy(const char *s) {
+        HashedString *h;
+
+        assert(s);
+
+        /* Copies a hashed string along with its hash, without hashing it again */
+
+        h = hashed_string_new(s, strlen(s));
+        if (!h)
+                return NULL;
+
+        h->hash = hashed_string_hash(s);
+        return h->s;
+}
+
+char* hashed_string_free(char *s) {
+        if (!s)
+                return NULL;
+
+        free(hashed_string_from_str(s));
+        return NULL;
+}
+
+uint64_t hashed_string_hash(const char *s) {
+        assert(s);
+
+        return hashed_string_from_str(s)->hash;
+}
+
+int hashed_strv_dup(char * const *l, char ***ret) {
+        _cleanup_free_ const void **in = NULL;
+        _cleanup_free_ size_t *inlen = NULL;
+        _cleanup_free_ uint64_t *hashes = NULL;
+        _cleanup_(hashed_strv_freep) char **k = NULL;
+        size_t n;
+
+        assert(ret);
+
+        /* Hashes all the strings in one go, which is faster than one by one */
+
+        n = strv_length(l);
+
+        k = new0(char*, n + 1);
+        in = new(const void*, n);
+        inlen = new(size_t, n);
+        hashes = new(uint64_t, n);
+        if (!k || !in || !inlen || !hashes)
+                return -ENOMEM;
+
+        for (size_t i = 0; i < n; i++) {
+                HashedString *h;
+                size_t len = strlen(l[i]);
+
+                h = hashed_string_new(l[i], len);
+                if (!h)
+                        return -ENOMEM;
+
+                k[i] = h->s;
+                in[i] = h->s;
+                inlen[i] = len + 1;
+        }
+
+        siphash24_many(in, inlen, n, get_hashed_string_key(), hashes);
+
+        for (size_t i = 0; i < n; i++)
+                hashed_string_from_str(k[i])->hash = hashes[i];
+
+        *ret = TAKE_PTR(k);
+        return 0;
+}
+
+char** hashed_strv_free(char **l) {
+        char **i;
+
+        STRV_FOREACH(i, l)
+                hashed_string_free(*i);
+
+        return mfree(l);
+}
+
+void hashed_string_hash_func(const char *s, struct siphash *state) {
+        uint64_t hash = hashed_string_hash(s);
+
+        siphash24_compress(&hash, sizeof(hash), state);
+}
+
+int hashed_string_compare_func(const char *a, const char *b) {
+        if (a == b)
+                return 0;
+
+        return strcmp(a, b);
+}
+
+static void hashed_string_free_void(void *p) {
+        hashed_string_free(p);
+}
+
+const struct hash_ops hashed_string_hash_ops = {
+        .hash = (hash_func_t) hashed_string_hash_func,
+        .compare = (compare_func_t) hashed_string_compare_func,
+        .cached_hash = (cached_hash_func_t) hashed_string_hash,
+};
+
+const struct hash_ops hashed_string_hash_ops_free = {
+        .hash = (hash_func_t) hashed_string_hash_func,
+        .compare = (compare_func_t) hashed_string_compare_func,
+        .free_key = hashed_string_free_void,
+        .cached_hash = (cached_hash_func_t) hashed_string_hash,
+};
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <alloca.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "hash-funcs.h"
+#include "macro.h"
+
+/* Strings that carry their hash with them, computed once when they are allocated, so that hash tables
+ * don't need to hash them again on each lookup. They are regular NUL terminated strings otherwise, the
+ * hash is stored right in front of them. They must be freed with hashed_string_free() though, and can
+ * only be looked up in tables using hashed_string_hash_ops with other hashed strings. */
+
+char* hashed_strdup(const char *s);
+char* hashed_strndup(const char *s, size_t n);
+char* hashed_string_copy(const char *s);
+char* hashed_string_free(char *s);
+DEFINE_TRIVIAL_CLEANUP_FUNC(char*, hashed_string_free);
+
+uint64_t hashed_string_hash(const char *s) _pure_;
+
+/* Initializes a hashed string in a buffer of HASHED_STRING_SIZE(n) bytes, for temporary lookup keys */
+#define HASHED_STRING_SIZE(n) (sizeof(uint64_t) + (n) + 1)
+char* hashed_string_init(void *buf, const char *s, size_t n);
+
+#define hashed_strdupa(s)                                               \
+        ({                                                              \
+                const char *_s_ = (s);                                  \
+                size_t _len_ = strlen(_s_);                             \
+                hashed_string_init(alloca_safe(HASHED_STRING_SIZE(_len_)), _s_, _len_); \
+        })
+
+int hashed_strv_dup(char * const *l, char ***ret);
+char** hashed_strv_free(char **l);
+DEFINE_TRIVIAL_CLEANUP_FUNC(char**, hashed_strv_free);
+
+void hashed_string_hash_func(const char *s, struct siphash *state);
+int hashed_string_compare_func(const char *a, const char *b) _pure_;
+extern const struct hash_ops hashed_string_hash_ops;
+extern const struct hash_ops hashed_string_hash_ops_free;
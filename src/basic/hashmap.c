@@ -336,11 +336,21 @@ static unsigned base_bucket_hash(HashmapBase *h, const void *p) {
         struct siphash state;
         uint64_t hash;
 
-        siphash24_init(&state, hash_key(h));
+        if (h->hash_ops->cached_hash) {
+                /* The cached hash is keyed with a secret of its own, but the same for all tables. Rehash it
+                 * with the key of the table, so that a new key on resize gives a different distribution of
+                 * the entries, and not just the same collisions in other buckets. That's a single 8 byte
+                 * block for siphash24, regardless of how long the key is. */
+                uint64_t cached = h->hash_ops->cached_hash(p);
+
+                hash = siphash24(&cached, sizeof(cached), hash_key(h));
+        } else {
+                siphash24_init(&state, hash_key(h));
 
-        h->hash_ops->hash(p, &state);
+                h->hash_ops->hash(p, &state);
 
-        hash = siphash24_finalize(&state);
+                hash = siphash24_finalize(&state);
+        }
 
         return (unsigned) (hash % n_buckets(h));
 }
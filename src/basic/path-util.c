@@ -467,6 +467,10 @@ char *path_startswith_full(const char *path, const char *prefix, bool accept_dot
 int path_compare(const char *a, const char *b) {
         int r;
 
+        /* The same string, e.g. when interned */
+        if (a == b)
+                return 0;
+
         /* Order NULL before non-NULL */
         r = CMP(!!a, !!b);
         if (r != 0)
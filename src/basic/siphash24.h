@@ -47,6 +47,7 @@ static inline void siphash24_compress_string(const char *in, struct siphash *sta
 uint64_t siphash24_finalize(struct siphash *state);
 
 uint64_t siphash24(const void *in, size_t inlen, const uint8_t k[static 16]);
+void siphash24_many(const void * const *in, const size_t *inlen, size_t n, const uint8_t k[static 16], uint64_t *ret);
 
 static inline uint64_t siphash24_string(const char *s, const uint8_t k[static 16]) {
         return siphash24(s, strlen(s) + 1, k);
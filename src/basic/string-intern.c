@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <errno.h>
+
+#include "hashed-string.h"
+#include "hashmap.h"
+#include "string-intern.h"
+#include "string-util.h"
+
+/* Lookup keys up to this length are hashed on the stack, longer ones on the heap */
+#define STRING_INTERN_STACK_MAX 256U
+
+/* Maps the interned strings to their reference counter */
+static Hashmap *interned = NULL;
+static uint64_t n_lookups = 0, n_hits = 0;
+
+const char* string_intern(const char *s) {
+        _alignas_(uint64_t) uint8_t buf[HASHED_STRING_SIZE(STRING_INTERN_STACK_MAX)];
+        _cleanup_(hashed_string_freep) char *heap = NULL;
+        unsigned n_ref;
+        char *k, *t;
+        size_t l;
+        void *v;
+
+        assert(s);
+
+        n_lookups++;
+
+        /* Hash the string once, for the lookup and for the copy. The strings interned are mostly paths,
+         * which are short, but nothing stops them from being arbitrarily long, hence don't put those on
+         * the stack. */
+        l = strlen(s);
+        if (l <= STRING_INTERN_STACK_MAX)
+                k = hashed_string_init(buf, s, l);
+        else {
+                k = heap = hashed_strndup(s, l);
+                if (!heap)
+                        return NULL;
+        }
+
+        v = hashmap_get2(interned, k, (void**) &t);
+        if (v) {
+                n_ref = PTR_TO_UINT(v);
+                assert_se(hashmap_update(interned, t, UINT_TO_PTR(n_ref + 1)) >= 0);
+
+                n_hits++;
+                return t;
+        }
+
+        /* A key on the heap already is the copy */
+        t = heap ? TAKE_PTR(heap) : hashed_string_copy(k);
+        if (!t)
+                return NULL;
+
+        if (hashmap_ensure_put(&interned, &hashed_string_hash_ops, t, UINT_TO_PTR(1)) < 0) {
+                hashed_string_free(t);
+                return NULL;
+        }
+
+        return t;
+}
+
+const char* string_intern_ref(const char *s) {
+        unsigned n_ref;
+
+        if (!s)
+                return NULL;
+
+        n_ref = PTR_TO_UINT(hashmap_get(interned, s));
+        assert(n_ref > 0);
+
+        assert_se(hashmap_update(interned, s, UINT_TO_PTR(n_ref + 1)) >= 0);
+        return s;
+}
+
+const char* string_intern_unref(const char *s) {
+        unsigned n_ref;
+
+        if (!s)
+                return NULL;
+
+        n_ref = PTR_TO_UINT(hashmap_get(interned, s));
+        assert(n_ref > 0);
+
+        if (n_ref > 1) {
+                assert_se(hashmap_update(interned, s, UINT_TO_PTR(n_ref - 1)) >= 0);
+                return NULL;
+        }
+
+        assert_se(hashmap_remove(interned, s));
+        hashed_string_free((char*) s);
+
+        if (hashmap_isempty(interned))
+                interned = hashmap_free(interned);
+
+        return NULL;
+}
+
+int string_intern_replace(const char **p, const char *s) {
+        const char *t = NULL;
+
+        assert(p);
+
+        /* Like free_and_strdup(), for interned strings */
+
+        if (s) {
+                t = string_intern(s);
+                if (!t)
+                        return -ENOMEM;
+        }
+
+        string_intern_unref(*p);
+
+        if (t == *p)
+                return 0;
+
+        *p = t;
+        return 1;
+}
+
+void string_intern_get_stats(StringInternStats *ret) {
+        const char *s;
+        void *v;
+
+        assert(ret);
+
+        *ret = (StringInternStats) {
+                .n_lookups = n_lookups,
+                .n_hits = n_hits,
+        };
+
+        HASHMAP_FOREACH_KEY(v, s, interned) {
+                unsigned n_ref = PTR_TO_UINT(v);
+                size_t l = strlen(s) + 1;
+
+                ret->n_strings++;
+                ret->n_refs += n_ref;
+                ret->n_bytes += l;
+                ret->n_bytes_saved += (n_ref - 1) * l;
+        }
+}
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "macro.h"
+
+/* A process-wide table of reference counted strings. All users interning the same string get the same
+ * copy, hence interned strings may be compared by pointer. Interned strings are hashed strings (see
+ * hashed-string.h), and may be used as keys of tables using hashed_string_hash_ops too. The table is not
+ * protected by any lock, it's meant for the state of the service manager, which is single-threaded. */
+
+const char* string_intern(const char *s);
+const char* string_intern_ref(const char *s);
+const char* string_intern_unref(const char *s);
+DEFINE_TRIVIAL_CLEANUP_FUNC(const char*, string_intern_unref);
+
+int string_intern_replace(const char **p, const char *s);
+
+typedef struct StringInternStats {
+        size_t n_strings;       /* Strings in the table */
+        size_t n_refs;          /* References to them */
+        size_t n_bytes;         /* Bytes used by the strings */
+        size_t n_bytes_saved;   /* Bytes separate copies of each reference would take in addition */
+        uint64_t n_lookups;
+        uint64_t n_hits;        /* Lookups that found the string in the table already */
+} StringInternStats;
+
+void string_intern_get_stats(StringInternStats *ret);
@@ -123,12 +123,31 @@ int utf8_encoded_to_unichar(const char *str, char32_t *ret_unichar) {
         return 0;
 }
 
+#define ASCII_BLOCK_SIZE 16U
+
+static bool ascii_block_is_printable(const uint8_t *p, bool allow_newline) {
+        uint8_t bad = 0;
+
+        /* No branches on the individual bytes, so that the compiler can check the whole block at once
+         * with vector instructions. DEL and anything that is not plain ASCII is left to the full check. */
+        for (size_t i = 0; i < ASCII_BLOCK_SIZE; i++)
+                bad |= (p[i] < ' ' && p[i] != '\t' && (p[i] != '\n' || !allow_newline)) | (p[i] >= 0x7F);
+
+        return !bad;
+}
+
 bool utf8_is_printable_newline(const char* str, size_t length, bool allow_newline) {
         const char *p;
 
         assert(str);
 
-        for (p = str; length > 0;) {
+        /* Most of what we check is plain printable ASCII, skip over that quickly */
+        for (p = str; length >= ASCII_BLOCK_SIZE && ascii_block_is_printable((const uint8_t*) p, allow_newline);) {
+                length -= ASCII_BLOCK_SIZE;
+                p += ASCII_BLOCK_SIZE;
+        }
+
+        while (length > 0) {
                 int encoded_len, r;
                 char32_t val;
 
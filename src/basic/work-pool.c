@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "alloc-util.h"
+#include "process-util.h"
+#include "signal-util.h"
+#include "work-pool.h"
+
+struct WorkPool {
+        pid_t pid;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t queued; /* Signalled when an item was queued, or the threads shall stop */
+        pthread_cond_t idle;   /* Broadcast when an item is idle again */
+
+        LIST_HEAD(WorkItem, queue);
+        WorkItem *queue_tail;
+        unsigned n_queued;
+
+        pthread_t *threads;
+        unsigned n_threads, n_threads_max;
+        unsigned n_idle_threads;
+
+        bool stop;
+};
+
+static pthread_mutex_t default_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static WorkPool *default_pool = NULL;
+
+int work_pool_new(unsigned n_threads_max, WorkPool **ret) {
+        _cleanup_free_ WorkPool *p = NULL;
+
+        assert(n_threads_max > 0);
+        assert(ret);
+
+        p = new(WorkPool, 1);
+        if (!p)
+                return -ENOMEM;
+
+        *p = (WorkPool) {
+                .pid = getpid_cached(),
+                .n_threads_max = n_threads_max,
+        };
+
+        p->threads = new(pthread_t, n_threads_max);
+        if (!p->threads)
+                return -ENOMEM;
+
+        assert_se(pthread_mutex_init(&p->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&p->queued, NULL) == 0);
+        assert_se(pthread_cond_init(&p->idle, NULL) == 0);
+
+        *ret = TAKE_PTR(p);
+        return 0;
+}
+
+WorkPool* work_pool_free(WorkPool *p) {
+        if (!p)
+                return NULL;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        /* What didn't start yet never does */
+        while (p->queue) {
+                WorkItem *w = p->queue;
+
+                LIST_REMOVE(queue, p->queue, w);
+                w->state = WORK_ITEM_IDLE;
+
+                if (w->floating)
+                        free(w);
+        }
+        p->queue_tail = NULL;
+        p->n_queued = 0;
+
+        p->stop = true;
+        assert_se(pthread_cond_broadcast(&p->queued) == 0);
+        assert_se(pthread_cond_broadcast(&p->idle) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        /* But what is running is waited for */
+        for (unsigned i = 0; i < p->n_threads; i++)
+                (void) pthread_join(p->threads[i], NULL);
+
+        assert_se(pthread_cond_destroy(&p->queued) == 0);
+        assert_se(pthread_cond_destroy(&p->idle) == 0);
+        assert_se(pthread_mutex_destroy(&p->mutex) == 0);
+
+        free(p->threads);
+        return mfree(p);
+}
+
+int work_pool_get_default(WorkPool **ret) {
+        int r = 0;
+
+        assert(ret);
+
+        assert_se(pthread_mutex_lock(&default_pool_mutex) == 0);
+
+        /* The threads of the pool didn't make it into a child process. Forget about the pool there, its
+         * mutex might even be locked forever. */
+        if (default_pool && default_pool->pid != getpid_cached())
+                default_pool = NULL;
+
+        if (!default_pool)
+                r = work_pool_new(WORK_POOL_THREADS_MAX, &default_pool);
+
+        *ret = default_pool;
+
+        assert_se(pthread_mutex_unlock(&default_pool_mutex) == 0);
+        return r;
+}
+
+static void* work_pool_thread(void *userdata) {
+        WorkPool *p = userdata;
+
+        (void) pthread_setname_np(pthread_self(), "sd-work");
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        for (;;) {
+                WorkItem *w;
+                int r;
+
+                while (!p->stop && !p->queue) {
+                        p->n_idle_threads++;
+                        assert_se(pthread_cond_wait(&p->queued, &p->mutex) == 0);
+                        p->n_idle_threads--;
+                }
+                if (p->stop)
+                        break;
+
+                w = p->queue;
+                LIST_REMOVE(queue, p->queue, w);
+                if (p->queue_tail == w)
+                        p->queue_tail = NULL;
+                p->n_queued--;
+
+                w->state = WORK_ITEM_RUNNING;
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                r = w->func(w->userdata);
+                if (w->done)
+                        w->done(w, r, w->userdata);
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                if (w->floating)
+                        free(w);
+                else {
+                        w->state = WORK_ITEM_IDLE;
+                        assert_se(pthread_cond_broadcast(&p->idle) == 0);
+                }
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+        return NULL;
+}
+
+static int work_pool_start_thread(WorkPool *p) {
+        sigset_t ss, saved_ss;
+        int r, k;
+
+        assert(p);
+        assert(p->n_threads < p->n_threads_max);
+
+        /* Start the thread with all signals blocked, so that it doesn't affect signal handling of the other
+         * threads. Except for SIGBUS, which is synchronous, and would kill us right away if blocked, while
+         * the work might access memory mapped files. */
+        assert_se(sigfillset(&ss) >= 0);
+        assert_se(sigdelset(&ss, SIGBUS) >= 0);
+
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0)
+                return -r;
+
+        r = pthread_create(p->threads + p->n_threads, NULL, work_pool_thread, p);
+
+        k = pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        if (r > 0)
+                return -r;
+
+        p->n_threads++;
+
+        if (k > 0)
+                return -k;
+
+        return 0;
+}
+
+int work_pool_submit(WorkPool *p, WorkItem *w) {
+        int r = 0;
+
+        assert(p);
+        assert(w);
+        assert(w->func);
+        assert(w->state == WORK_ITEM_IDLE);
+        assert(p->pid == getpid_cached());
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        LIST_INSERT_AFTER(queue, p->queue, p->queue_tail, w);
+        p->queue_tail = w;
+        p->n_queued++;
+        w->state = WORK_ITEM_QUEUED;
+
+        /* Idle threads are woken up, but might not have taken their item off the queue yet */
+        if (p->n_queued > p->n_idle_threads && p->n_threads < p->n_threads_max) {
+                r = work_pool_start_thread(p);
+
+                /* If there's some thread already, it will get to it eventually */
+                if (r < 0 && p->n_threads == 0) {
+                        p->queue_tail = w->queue_prev;
+                        LIST_REMOVE(queue, p->queue, w);
+                        p->n_queued--;
+                        w->state = WORK_ITEM_IDLE;
+                } else
+                        r = 0;
+        }
+
+        if (r >= 0)
+                assert_se(pthread_cond_signal(&p->queued) == 0);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+        return r;
+}
+
+bool work_pool_cancel(WorkPool *p, WorkItem *w) {
+        bool cancelled = false;
+
+        assert(p);
+        assert(w);
+
+        /* Takes the item off the queue, unless it started already. Returns true if it did, in which case
+         * neither of its functions are called. */
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        if (w->state == WORK_ITEM_QUEUED) {
+                if (p->queue_tail == w)
+                        p->queue_tail = w->queue_prev;
+                LIST_REMOVE(queue, p->queue, w);
+                p->n_queued--;
+
+                w->state = WORK_ITEM_IDLE;
+                cancelled = true;
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+        return cancelled;
+}
+
+void work_pool_wait(WorkPool *p, WorkItem *w) {
+        assert(p);
+        assert(w);
+        assert(!w->floating);
+
+        /* Waits until the item is done, including its 'done' function */
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        while (w->state != WORK_ITEM_IDLE)
+                assert_se(pthread_cond_wait(&p->idle, &p->mutex) == 0);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+}
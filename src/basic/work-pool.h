@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <stdbool.h>
+
+#include "list.h"
+#include "macro.h"
+
+/* A bounded pool of threads to run blocking work on. Threads are started as needed, up to the maximum
+ * number, and kept around until the pool is freed. What doesn't find a free thread waits in a queue. */
+
+typedef struct WorkPool WorkPool;
+typedef struct WorkItem WorkItem;
+
+typedef int (*work_func_t)(void *userdata);
+typedef void (*work_done_func_t)(WorkItem *w, int result, void *userdata);
+
+#define WORK_POOL_THREADS_MAX 16U
+
+typedef enum WorkItemState {
+        WORK_ITEM_IDLE,
+        WORK_ITEM_QUEUED,
+        WORK_ITEM_RUNNING,
+} WorkItemState;
+
+struct WorkItem {
+        /* Both called on a thread of the pool. 'done' must not free the item: once it returned, the pool
+         * marks the item idle again, or frees it if it is 'floating'. */
+        work_func_t func;
+        work_done_func_t done;
+        void *userdata;
+        bool floating;
+
+        WorkItemState state;
+        LIST_FIELDS(WorkItem, queue);
+};
+
+int work_pool_new(unsigned n_threads_max, WorkPool **ret);
+WorkPool* work_pool_free(WorkPool *p);
+DEFINE_TRIVIAL_CLEANUP_FUNC(WorkPool*, work_pool_free);
+
+int work_pool_get_default(WorkPool **ret);
+
+int work_pool_submit(WorkPool *p, WorkItem *w);
+bool work_pool_cancel(WorkPool *p, WorkItem *w);
+void work_pool_wait(WorkPool *p, WorkItem *w);
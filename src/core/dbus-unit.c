@@ -2138,7 +2138,7 @@ static int bus_unit_set_transient_property(
          * the unit has been created. */
 
         if (streq(name, "SourcePath"))
-                return bus_set_transient_path(u, name, &u->source_path, message, flags, error);
+                return bus_set_transient_interned_path(u, name, &u->source_path, message, flags, error);
 
         if (streq(name, "StopWhenUnneeded"))
                 return bus_set_transient_bool(u, name, &u->stop_when_unneeded, message, flags, error);
@@ -6,6 +6,7 @@
 #include "escape.h"
 #include "parse-util.h"
 #include "path-util.h"
+#include "string-intern.h"
 #include "unit-printf.h"
 #include "user-util.h"
 #include "unit.h"
@@ -69,6 +70,38 @@ int bus_set_transient_string(
         return 1;
 }
 
+int bus_set_transient_interned_path(
+                Unit *u,
+                const char *name,
+                const char **p,
+                sd_bus_message *message,
+                UnitWriteFlags flags,
+                sd_bus_error *error) {
+
+        const char *v;
+        int r;
+
+        assert(p);
+
+        r = sd_bus_message_read(message, "s", &v);
+        if (r < 0)
+                return r;
+
+        if (!isempty(v) && !path_is_absolute(v))
+                return sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "Invalid %s setting: %s", name, v);
+
+        if (!UNIT_WRITE_FLAGS_NOOP(flags)) {
+                r = string_intern_replace(p, empty_to_null(v));
+                if (r < 0)
+                        return r;
+
+                unit_write_settingf(u, flags|UNIT_ESCAPE_SPECIFIERS, name,
+                                    "%s=%s", name, strempty(v));
+        }
+
+        return 1;
+}
+
 int bus_set_transient_bool(
                 Unit *u,
                 const char *name,
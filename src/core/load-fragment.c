@@ -61,6 +61,7 @@
 #include "socket-netlink.h"
 #include "specifier.h"
 #include "stat-util.h"
+#include "string-intern.h"
 #include "string-util.h"
 #include "strv.h"
 #include "syslog-util.h"
@@ -397,6 +398,54 @@ int config_parse_unit_path_printf(
         return config_parse_path(unit, filename, line, section, section_line, lvalue, ltype, k, data, userdata);
 }
 
+int config_parse_unit_interned_path_printf(
+                const char *unit,
+                const char *filename,
+                unsigned line,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                int ltype,
+                const char *rvalue,
+                void *data,
+                void *userdata) {
+
+        _cleanup_free_ char *k = NULL;
+        const char **p = data;
+        const Unit *u = userdata;
+        int r;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(data);
+        assert(u);
+
+        /* Like config_parse_unit_path_printf(), but stores an interned string */
+
+        if (isempty(rvalue)) {
+                *p = string_intern_unref(*p);
+                return 0;
+        }
+
+        r = unit_path_printf(u, rvalue, &k);
+        if (r < 0) {
+                log_syntax(unit, LOG_WARNING, filename, line, r,
+                           "Failed to resolve unit specifiers in '%s', ignoring: %m", rvalue);
+                return 0;
+        }
+
+        r = path_simplify_and_warn(k, PATH_CHECK_ABSOLUTE, unit, filename, line, lvalue);
+        if (r < 0)
+                return 0;
+
+        r = string_intern_replace(p, k);
+        if (r < 0)
+                return log_oom();
+
+        return 0;
+}
+
 int config_parse_colon_separated_paths(
                 const char *unit,
                 const char *filename,
@@ -6100,7 +6149,7 @@ int unit_load_fragment(Unit *u) {
                 if (fstat(fileno(f), &st) < 0)
                         return -errno;
 
-                r = free_and_strdup(&u->fragment_path, fragment);
+                r = string_intern_replace(&u->fragment_path, fragment);
                 if (r < 0)
                         return r;
 
@@ -6174,6 +6223,7 @@ void unit_dump_config_items(FILE *f) {
                 { config_parse_string,                "STRING" },
                 { config_parse_path,                  "PATH" },
                 { config_parse_unit_path_printf,      "PATH" },
+                { config_parse_unit_interned_path_printf, "PATH" },
                 { config_parse_colon_separated_paths, "PATH" },
                 { config_parse_strv,                  "STRING [...]" },
                 { config_parse_exec_nice,             "NICE" },
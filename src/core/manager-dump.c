@@ -3,8 +3,10 @@
 #include "build.h"
 #include "fd-util.h"
 #include "fileio.h"
+#include "format-util.h"
 #include "hashmap.h"
 #include "manager-dump.h"
+#include "string-intern.h"
 #include "unit-serialize.h"
 
 void manager_dump_jobs(Manager *s, FILE *f, const char *prefix) {
@@ -29,6 +31,18 @@ void manager_dump_units(Manager *s, FILE *f, const char *prefix) {
                         unit_dump(u, f, prefix);
 }
 
+static void manager_dump_string_intern(FILE *f, const char *prefix) {
+        StringInternStats stats;
+
+        assert(f);
+
+        string_intern_get_stats(&stats);
+
+        fprintf(f, "%sInterned Strings: %zu (%s)\n", strempty(prefix), stats.n_strings, FORMAT_BYTES(stats.n_bytes));
+        fprintf(f, "%sInterned String References: %zu (%s saved)\n", strempty(prefix), stats.n_refs, FORMAT_BYTES(stats.n_bytes_saved));
+        fprintf(f, "%sInterned String Lookups: %" PRIu64 " (%" PRIu64 " hits)\n", strempty(prefix), stats.n_lookups, stats.n_hits);
+}
+
 void manager_dump(Manager *m, FILE *f, const char *prefix) {
         assert(m);
         assert(f);
@@ -47,6 +61,8 @@ void manager_dump(Manager *m, FILE *f, const char *prefix) {
                                                                 FORMAT_TIMESPAN(t->monotonic, 1));
         }
 
+        manager_dump_string_intern(f, prefix);
+
         manager_dump_units(m, f, prefix);
         manager_dump_jobs(m, f, prefix);
 }
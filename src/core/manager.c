@@ -71,6 +71,7 @@
 #include "socket-util.h"
 #include "special.h"
 #include "stat-util.h"
+#include "string-intern.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strv.h"
@@ -2135,7 +2136,7 @@ int manager_load_unit_prepare(
         }
 
         if (path) {
-                r = free_and_strdup(&ret->fragment_path, path);
+                r = string_intern_replace(&ret->fragment_path, path);
                 if (r < 0)
                         return r;
         }
@@ -26,6 +26,7 @@
 #include "process-util.h"
 #include "serialize.h"
 #include "special.h"
+#include "string-intern.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strv.h"
@@ -1562,7 +1563,7 @@ static int mount_setup_new_unit(
         if (r < 0)
                 return r;
 
-        r = free_and_strdup(&u->source_path, "/proc/self/mountinfo");
+        r = string_intern_replace(&u->source_path, "/proc/self/mountinfo");
         if (r < 0)
                 return r;
 
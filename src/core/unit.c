@@ -48,6 +48,7 @@
 #include "specifier.h"
 #include "stat-util.h"
 #include "stdio-util.h"
+#include "string-intern.h"
 #include "string-table.h"
 #include "string-util.h"
 #include "strv.h"
@@ -602,7 +603,7 @@ static void unit_free_requires_mounts_for(Unit *u) {
         assert(u);
 
         for (;;) {
-                _cleanup_free_ char *path = NULL;
+                _cleanup_(string_intern_unrefp) const char *path = NULL;
 
                 path = hashmap_steal_first_key(u->requires_mounts_for);
                 if (!path)
@@ -611,7 +612,7 @@ static void unit_free_requires_mounts_for(Unit *u) {
                         char s[strlen(path) + 1];
 
                         PATH_FOREACH_PREFIX_MORE(s, path) {
-                                char *y;
+                                const char *y;
                                 Set *x;
 
                                 x = hashmap_get2(u->manager->units_requiring_mounts_for, s, (void**) &y);
@@ -622,7 +623,7 @@ static void unit_free_requires_mounts_for(Unit *u) {
 
                                 if (set_isempty(x)) {
                                         (void) hashmap_remove(u->manager->units_requiring_mounts_for, y);
-                                        free(y);
+                                        string_intern_unref(y);
                                         set_free(x);
                                 }
                         }
@@ -783,8 +784,8 @@ Unit* unit_free(Unit *u) {
 
         free(u->description);
         strv_free(u->documentation);
-        free(u->fragment_path);
-        free(u->source_path);
+        string_intern_unref(u->fragment_path);
+        string_intern_unref(u->source_path);
         strv_free(u->dropin_paths);
         free(u->instance);
 
@@ -4403,6 +4404,7 @@ int unit_write_settingf(Unit *u, UnitWriteFlags flags, const char *name, const c
 }
 
 int unit_make_transient(Unit *u) {
+        _cleanup_(string_intern_unrefp) const char *fragment = NULL;
         _cleanup_free_ char *path = NULL;
         FILE *f;
 
@@ -4417,6 +4419,10 @@ int unit_make_transient(Unit *u) {
         if (!path)
                 return -ENOMEM;
 
+        fragment = string_intern(path);
+        if (!fragment)
+                return -ENOMEM;
+
         /* Let's open the file we'll write the transient settings into. This file is kept open as long as we are
          * creating the transient, and is closed in unit_load(), as soon as we start loading the file. */
 
@@ -4429,9 +4435,10 @@ int unit_make_transient(Unit *u) {
         safe_fclose(u->transient_file);
         u->transient_file = f;
 
-        free_and_replace(u->fragment_path, path);
+        string_intern_unref(u->fragment_path);
+        u->fragment_path = TAKE_PTR(fragment);
 
-        u->source_path = mfree(u->source_path);
+        u->source_path = string_intern_unref(u->source_path);
         u->dropin_paths = strv_free(u->dropin_paths);
         u->fragment_mtime = u->source_mtime = u->dropin_mtime = 0;
 
@@ -4637,20 +4644,25 @@ int unit_require_mounts_for(Unit *u, const char *path, UnitDependencyMask mask)
         /* Use the canonical form of the path as the stored key. We call path_is_normalized()
          * only after simplification, since path_is_normalized() rejects paths with '.'.
          * path_is_normalized() also verifies that the path fits in PATH_MAX. */
-        path = path_simplify(p);
+        path_simplify(p);
 
-        if (!path_is_normalized(path))
+        if (!path_is_normalized(p))
                 return -EPERM;
 
+        /* The same paths are required by many units, share them */
+        _cleanup_(string_intern_unrefp) const char *interned = string_intern(p);
+        if (!interned)
+                return -ENOMEM;
+
         UnitDependencyInfo di = {
                 .origin_mask = mask
         };
 
-        r = hashmap_ensure_put(&u->requires_mounts_for, &path_hash_ops, p, di.data);
+        r = hashmap_ensure_put(&u->requires_mounts_for, &path_hash_ops, interned, di.data);
         if (r < 0)
                 return r;
         assert(r > 0);
-        TAKE_PTR(p); /* path remains a valid pointer to the string stored in the hashmap */
+        path = TAKE_PTR(interned); /* path remains a valid pointer to the string stored in the hashmap */
 
         char prefix[strlen(path) + 1];
         PATH_FOREACH_PREFIX_MORE(prefix, path) {
@@ -4658,13 +4670,13 @@ int unit_require_mounts_for(Unit *u, const char *path, UnitDependencyMask mask)
 
                 x = hashmap_get(u->manager->units_requiring_mounts_for, prefix);
                 if (!x) {
-                        _cleanup_free_ char *q = NULL;
+                        _cleanup_(string_intern_unrefp) const char *q = NULL;
 
                         r = hashmap_ensure_allocated(&u->manager->units_requiring_mounts_for, &path_hash_ops);
                         if (r < 0)
                                 return r;
 
-                        q = strdup(prefix);
+                        q = string_intern(prefix);
                         if (!q)
                                 return -ENOMEM;
 
@@ -148,8 +148,10 @@ typedef struct Unit {
         char *description;
         char **documentation;
 
-        char *fragment_path; /* if loaded from a config file this is the primary path to it */
-        char *source_path; /* if converted, the source file */
+        /* Interned, as they are shared by many units, e.g. instances of the same template, or mount units
+         * converted from the same file */
+        const char *fragment_path; /* if loaded from a config file this is the primary path to it */
+        const char *source_path; /* if converted, the source file */
         char **dropin_paths;
 
         usec_t fragment_not_found_timestamp_hash;
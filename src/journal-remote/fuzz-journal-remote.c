@@ -2,6 +2,7 @@
 
 #include "fuzz.h"
 
+#include <fcntl.h>
 #include <sys/mman.h>
 
 #include "sd-journal.h"
@@ -10,11 +11,48 @@
 #include "fd-util.h"
 #include "fileio.h"
 #include "fs-util.h"
+#include "journal-importer.h"
 #include "journal-remote.h"
 #include "logs-show.h"
 #include "memfd-util.h"
 #include "strv.h"
 
+static int push_and_process(const uint8_t *data, size_t size, size_t chunk, unsigned *ret_entries, size_t *ret_fields) {
+        _cleanup_(journal_importer_cleanup) JournalImporter imp = JOURNAL_IMPORTER_INIT(-1);
+        _cleanup_close_ int fd = -1;
+        unsigned entries = 0;
+        size_t fields = 0;
+        int r = 0;
+
+        /* Like journal-remote does with data it receives over HTTP: whatever came in is processed before
+         * the next piece is pushed */
+        fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        assert_se(fd >= 0);
+        imp.fd = fd;
+        imp.passive_fd = true;
+
+        for (size_t pos = 0; pos < size; ) {
+                size_t n = MIN(chunk, size - pos);
+
+                r = journal_importer_push_data(&imp, (const char*) data + pos, n);
+                if (r < 0)
+                        break;
+                pos += n;
+
+                while ((r = journal_importer_process_data(&imp)) == 1) {
+                        entries++;
+                        fields += imp.iovw.count;
+                        journal_importer_drop_iovw(&imp);
+                }
+                if (r != -EAGAIN)
+                        break;
+        }
+
+        *ret_entries = entries;
+        *ret_fields = fields;
+        return r;
+}
+
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
         int fdin;
         void *mem;
@@ -30,6 +68,19 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
         if (!getenv("SYSTEMD_LOG_LEVEL"))
                 log_set_max_level(LOG_ERR);
 
+        /* Pushed */
+
+        unsigned entries_whole, entries_pieces;
+        size_t fields_whole, fields_pieces;
+        int r_whole, r_pieces;
+
+        /* How the data is split up must not make a difference */
+        r_whole = push_and_process(data, size, size, &entries_whole, &fields_whole);
+        r_pieces = push_and_process(data, size, 1 + data[0] % 64, &entries_pieces, &fields_pieces);
+        assert_se(r_whole == r_pieces);
+        assert_se(entries_whole == entries_pieces);
+        assert_se(fields_whole == fields_pieces);
+
         fdin = memfd_new_and_map("fuzz-journal-remote", size, &mem);
         if (fdin < 0)
                 return log_error_errno(fdin, "memfd_new_and_map() failed: %m");
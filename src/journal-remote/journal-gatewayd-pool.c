@@ -0,0 +1,426 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "journal-gatewayd-pool.h"
+#include "log.h"
+#include "strv.h"
+
+/* Opening the journal means enumerating and mapping all journal files, which is by far the most expensive part
+ * of most requests. Hence journals are not closed when a request is done, but kept around for the next one.
+ * A request that continues where an earlier one stopped — like a client paging through the journal with the
+ * cursor of the last entry it got — preferably gets the very journal the earlier request used: that one still
+ * points to the entry, so there is no need to seek to the cursor again.
+ *
+ * Clients following the journal don't each get an inotify watch. Journals in the pool never ask for one,
+ * instead a single journal only used for watching is processed on a thread of its own, and followers wait for
+ * it to see a change. New entries show up in the journals of the followers by themselves. When files are
+ * added or removed though, journals opened earlier don't know about it: they are not taken back into the pool
+ * anymore, and followers open a new one. */
+
+/* How many journals to keep around for the next requests */
+#define POOL_IDLE_MAX 16U
+
+struct JournalPoolEntry {
+        sd_journal *journal;
+
+        char *cursor; /* The entry the journal points to */
+        char **matches;
+
+        LIST_FIELDS(JournalPoolEntry, idle);
+};
+
+static JournalPoolEntry* pool_entry_free(JournalPoolEntry *e) {
+        if (!e)
+                return NULL;
+
+        sd_journal_close(e->journal);
+        free(e->cursor);
+        strv_free(e->matches);
+
+        return mfree(e);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalPoolEntry*, pool_entry_free);
+
+static void pool_entry_free_all(JournalPoolEntry *head) {
+        JournalPoolEntry *e, *n;
+
+        LIST_FOREACH_SAFE(idle, e, n, head)
+                pool_entry_free(e);
+}
+
+int journal_pool_new(JournalPool **ret, const char *directory, char **files, int flags) {
+        _cleanup_(journal_pool_freep) JournalPool *p = NULL;
+        pthread_condattr_t attr;
+
+        assert(ret);
+
+        p = new(JournalPool, 1);
+        if (!p)
+                return -ENOMEM;
+
+        *p = (JournalPool) {
+                .flags = flags,
+                .stop_fd = -1,
+        };
+
+        assert_se(pthread_mutex_init(&p->mutex, NULL) == 0);
+
+        /* Followers wait with a timeout, which shouldn't depend on the wall clock */
+        assert_se(pthread_condattr_init(&attr) == 0);
+        assert_se(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+        assert_se(pthread_cond_init(&p->cond, &attr) == 0);
+        assert_se(pthread_condattr_destroy(&attr) == 0);
+
+        if (directory) {
+                p->directory = strdup(directory);
+                if (!p->directory)
+                        return -ENOMEM;
+        }
+
+        if (files) {
+                p->files = strv_copy(files);
+                if (!p->files)
+                        return -ENOMEM;
+        }
+
+        *ret = TAKE_PTR(p);
+        return 0;
+}
+
+JournalPool* journal_pool_free(JournalPool *p) {
+        if (!p)
+                return NULL;
+
+        if (p->started) {
+                uint64_t one = 1;
+
+                (void) write(p->stop_fd, &one, sizeof(one));
+                (void) pthread_join(p->thread, NULL);
+        }
+
+        pool_entry_free_all(p->idle);
+
+        sd_journal_close(p->watch);
+        safe_close(p->stop_fd);
+
+        assert_se(pthread_cond_destroy(&p->cond) == 0);
+        assert_se(pthread_mutex_destroy(&p->mutex) == 0);
+
+        free(p->directory);
+        strv_free(p->files);
+
+        log_debug("Journal pool: %"PRIu64" journals opened, %"PRIu64" reused, %"PRIu64" of them at the requested cursor.",
+                  p->n_opened, p->n_reused, p->n_positioned);
+
+        return mfree(p);
+}
+
+static int pool_open(JournalPool *p, sd_journal **ret) {
+        assert(p);
+        assert(ret);
+
+        if (p->directory)
+                return sd_journal_open_directory(ret, p->directory, p->flags);
+        if (p->files)
+                return sd_journal_open_files(ret, (const char**) p->files, 0);
+
+        return sd_journal_open(ret, p->flags);
+}
+
+static int pool_apply_matches(sd_journal *j, char **matches) {
+        char **m;
+        int r;
+
+        assert(j);
+
+        sd_journal_flush_matches(j);
+
+        STRV_FOREACH(m, matches) {
+                r = sd_journal_add_match(j, *m, 0);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int journal_pool_get(JournalPool *p, const char *cursor, char **matches, sd_journal **ret, uint64_t *ret_generation) {
+        _cleanup_(pool_entry_freep) JournalPoolEntry *e = NULL;
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        bool positioned = false;
+        uint64_t generation;
+        int r;
+
+        assert(p);
+        assert(ret);
+        assert(ret_generation);
+
+        /* Returns a journal with the specified matches applied. Returns 1 if the journal points to the entry
+         * with the specified cursor, as the last request that used it stopped there, and 0 otherwise. The
+         * journal then points to wherever it did before, so needs to be seeked. */
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        if (cursor)
+                LIST_FOREACH(idle, e, p->idle)
+                        if (streq_ptr(e->cursor, cursor) && strv_equal(e->matches, matches)) {
+                                positioned = true;
+                                break;
+                        }
+
+        if (!e)
+                e = p->idle;
+        if (e) {
+                LIST_REMOVE(idle, p->idle, e);
+                p->n_idle--;
+                p->n_reused++;
+                p->n_positioned += positioned;
+        } else
+                p->n_opened++;
+
+        /* For a journal opened now, everything that happens from here on counts as a change, hence take
+         * the generation before opening it */
+        generation = p->generation;
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        if (e)
+                j = TAKE_PTR(e->journal);
+        else {
+                r = pool_open(p, &j);
+                if (r < 0)
+                        return r;
+        }
+
+        r = pool_apply_matches(j, matches);
+        if (r < 0)
+                return r;
+
+        *ret = TAKE_PTR(j);
+        *ret_generation = generation;
+        return positioned;
+}
+
+void journal_pool_put(JournalPool *p, sd_journal *j, char **matches, uint64_t generation) {
+        _cleanup_(pool_entry_freep) JournalPoolEntry *e = NULL, *evicted = NULL;
+        _cleanup_free_ char *cursor = NULL;
+        _cleanup_strv_free_ char **m = NULL;
+
+        assert(p);
+
+        if (!j)
+                return;
+
+        /* Takes the journal over in any case. generation is what journal_pool_get() or the last
+         * journal_pool_wait() returned for it. */
+
+        e = new(JournalPoolEntry, 1);
+        if (!e) {
+                sd_journal_close(j);
+                return;
+        }
+
+        *e = (JournalPoolEntry) {
+                .journal = j,
+        };
+
+        (void) sd_journal_get_cursor(j, &cursor);
+
+        m = strv_copy(matches);
+        if (!m && matches)
+                return;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        /* If files were added or removed since, the journal won't see them. Let's get rid of it. */
+        if (generation >= p->invalidated) {
+                e->cursor = TAKE_PTR(cursor);
+                e->matches = TAKE_PTR(m);
+
+                if (p->n_idle >= POOL_IDLE_MAX) {
+                        LIST_FIND_TAIL(idle, p->idle, evicted);
+                        LIST_REMOVE(idle, p->idle, evicted);
+                        p->n_idle--;
+                }
+
+                LIST_PREPEND(idle, p->idle, e);
+                p->n_idle++;
+                TAKE_PTR(e);
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+}
+
+static void pool_changed(JournalPool *p, bool invalidated) {
+        JournalPoolEntry *stale = NULL;
+
+        assert(p);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        p->generation++;
+
+        if (invalidated) {
+                p->invalidated = p->generation;
+
+                stale = TAKE_PTR(p->idle);
+                p->n_idle = 0;
+        }
+
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        pool_entry_free_all(stale);
+}
+
+static void* pool_watch_thread(void *userdata) {
+        JournalPool *p = userdata;
+        int fd, r;
+
+        assert(p);
+
+        fd = sd_journal_get_fd(p->watch);
+
+        for (;;) {
+                struct pollfd pollfd[] = {
+                        { .fd = fd,         .events = sd_journal_get_events(p->watch) },
+                        { .fd = p->stop_fd, .events = POLLIN                          },
+                };
+                usec_t t;
+
+                r = sd_journal_get_timeout(p->watch, &t);
+                if (r < 0)
+                        break;
+
+                if (t != USEC_INFINITY)
+                        t = usec_sub_unsigned(t, now(CLOCK_MONOTONIC));
+
+                r = ppoll_usec(pollfd, ELEMENTSOF(pollfd), t);
+                if (r == -EINTR)
+                        continue;
+                if (r < 0)
+                        break;
+
+                if (pollfd[1].revents != 0) {
+                        r = 0;
+                        break;
+                }
+
+                r = sd_journal_process(p->watch);
+                if (r < 0)
+                        break;
+                if (r != SD_JOURNAL_NOP)
+                        pool_changed(p, r == SD_JOURNAL_INVALIDATE);
+        }
+
+        if (r < 0) {
+                log_error_errno(r, "Failed to watch journal: %m");
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+                p->watch_error = r;
+                assert_se(pthread_cond_broadcast(&p->cond) == 0);
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+        }
+
+        return NULL;
+}
+
+static int pool_start_watch(JournalPool *p) {
+        sigset_t ss, saved_ss;
+        int r, k;
+
+        assert(p);
+
+        /* Called with the mutex held */
+
+        if (p->started)
+                return 0;
+        if (p->watch_error < 0)
+                return p->watch_error;
+
+        if (!p->watch) {
+                r = pool_open(p, &p->watch);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to open journal to watch: %m");
+        }
+
+        r = sd_journal_get_fd(p->watch);
+        if (r < 0)
+                return log_error_errno(r, "Failed to watch journal: %m");
+
+        if (p->stop_fd < 0) {
+                p->stop_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+                if (p->stop_fd < 0)
+                        return log_error_errno(errno, "Failed to create eventfd for journal watch: %m");
+        }
+
+        assert_se(sigfillset(&ss) >= 0);
+        k = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (k > 0)
+                return log_error_errno(k, "Failed to block signals for journal watch thread: %m");
+
+        k = pthread_create(&p->thread, NULL, pool_watch_thread, p);
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        if (k > 0)
+                return log_error_errno(k, "Failed to start journal watch thread: %m");
+
+        p->started = true;
+        return 0;
+}
+
+int journal_pool_wait(JournalPool *p, uint64_t *generation, usec_t timeout) {
+        struct timespec ts;
+        usec_t until;
+        int r;
+
+        assert(p);
+        assert(generation);
+
+        /* Like sd_journal_wait(), but for all journals handed out by the pool at once. Returns
+         * SD_JOURNAL_INVALIDATE if files were added or removed, after which the journal should be replaced
+         * by a new one from the pool, SD_JOURNAL_APPEND if something else changed, and SD_JOURNAL_NOP if
+         * nothing happened within the timeout. */
+
+        until = usec_add(now(CLOCK_MONOTONIC), timeout);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        r = pool_start_watch(p);
+        if (r < 0)
+                goto finish;
+
+        while (p->generation == *generation && p->watch_error == 0) {
+                if (until == USEC_INFINITY)
+                        r = pthread_cond_wait(&p->cond, &p->mutex);
+                else
+                        r = pthread_cond_timedwait(&p->cond, &p->mutex, timespec_store(&ts, until));
+                if (r == ETIMEDOUT)
+                        break;
+                assert(r == 0);
+        }
+
+        if (p->watch_error < 0)
+                r = p->watch_error;
+        else if (p->invalidated > *generation)
+                r = SD_JOURNAL_INVALIDATE;
+        else if (p->generation > *generation)
+                r = SD_JOURNAL_APPEND;
+        else
+                r = SD_JOURNAL_NOP;
+
+        *generation = p->generation;
+
+finish:
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+        return r;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <pthread.h>
+
+#include "sd-journal.h"
+
+#include "list.h"
+#include "time-util.h"
+
+typedef struct JournalPoolEntry JournalPoolEntry;
+
+typedef struct JournalPool {
+        char *directory;
+        char **files;
+        int flags;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond; /* Signalled when the generation changed or the watch failed */
+
+        LIST_HEAD(JournalPoolEntry, idle);
+        size_t n_idle;
+
+        /* Bumped whenever the watch saw a change, and the value it was bumped to the last time files were
+         * added or removed. Journals opened before that don't know about the new files. */
+        uint64_t generation;
+        uint64_t invalidated;
+
+        /* The inotify watch shared by all followers */
+        sd_journal *watch;
+        pthread_t thread;
+        bool started;
+        int stop_fd;
+        int watch_error;
+
+        uint64_t n_opened;
+        uint64_t n_reused;
+        uint64_t n_positioned;
+} JournalPool;
+
+int journal_pool_new(JournalPool **ret, const char *directory, char **files, int flags);
+JournalPool* journal_pool_free(JournalPool *p);
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalPool*, journal_pool_free);
+
+int journal_pool_get(JournalPool *p, const char *cursor, char **matches, sd_journal **ret, uint64_t *ret_generation);
+void journal_pool_put(JournalPool *p, sd_journal *j, char **matches, uint64_t generation);
+
+int journal_pool_wait(JournalPool *p, uint64_t *generation, usec_t timeout);
@@ -20,6 +20,7 @@
 #include "fileio.h"
 #include "glob-util.h"
 #include "hostname-util.h"
+#include "journal-gatewayd-pool.h"
 #include "log.h"
 #include "logs-show.h"
 #include "main-func.h"
@@ -29,6 +30,7 @@
 #include "parse-util.h"
 #include "pretty-print.h"
 #include "sigbus.h"
+#include "strv.h"
 #include "tmpfile-util.h"
 #include "util.h"
 
@@ -47,7 +49,10 @@ STATIC_DESTRUCTOR_REGISTER(arg_cert_pem, freep);
 STATIC_DESTRUCTOR_REGISTER(arg_trust_pem, freep);
 
 typedef struct RequestMeta {
+        JournalPool *pool;
         sd_journal *journal;
+        uint64_t generation;
+        char **matches;
 
         OutputMode mode;
 
@@ -63,6 +68,7 @@ typedef struct RequestMeta {
 
         bool follow;
         bool discrete;
+        bool positioned; /* The journal already points to the entry of the cursor */
 } RequestMeta;
 
 static const char* const mime_types[_OUTPUT_MODE_MAX] = {
@@ -73,10 +79,11 @@ static const char* const mime_types[_OUTPUT_MODE_MAX] = {
         [OUTPUT_EXPORT] = "application/vnd.fdo.journal",
 };
 
-static RequestMeta *request_meta(void **connection_cls) {
+static RequestMeta *request_meta(void **connection_cls, JournalPool *pool) {
         RequestMeta *m;
 
         assert(connection_cls);
+        assert(pool);
         if (*connection_cls)
                 return *connection_cls;
 
@@ -84,6 +91,8 @@ static RequestMeta *request_meta(void **connection_cls) {
         if (!m)
                 return NULL;
 
+        m->pool = pool;
+
         *connection_cls = m;
         return m;
 }
@@ -99,26 +108,78 @@ static void request_meta_free(
         if (!m)
                 return;
 
-        sd_journal_close(m->journal);
+        journal_pool_put(m->pool, m->journal, m->matches, m->generation);
 
         safe_fclose(m->tmp);
 
+        strv_free(m->matches);
         free(m->cursor);
         free(m);
 }
 
-static int open_journal(RequestMeta *m) {
+static int open_journal(RequestMeta *m, const char *cursor) {
+        int r;
+
         assert(m);
 
         if (m->journal)
                 return 0;
 
-        if (arg_directory)
-                return sd_journal_open_directory(&m->journal, arg_directory, arg_journal_type);
-        else if (arg_file)
-                return sd_journal_open_files(&m->journal, (const char**) arg_file, 0);
-        else
-                return sd_journal_open(&m->journal, (arg_merge ? 0 : SD_JOURNAL_LOCAL_ONLY) | arg_journal_type);
+        r = journal_pool_get(m->pool, cursor, m->matches, &m->journal, &m->generation);
+        if (r < 0)
+                return r;
+
+        m->positioned = r;
+        return 0;
+}
+
+static int request_seek(RequestMeta *m) {
+        assert(m);
+
+        if (m->cursor)
+                return sd_journal_seek_cursor(m->journal, m->cursor);
+        if (m->n_skip >= 0)
+                return sd_journal_seek_head(m->journal);
+        return sd_journal_seek_tail(m->journal);
+}
+
+static int request_reopen_journal(RequestMeta *m) {
+        _cleanup_free_ char *cursor = NULL;
+        int r;
+
+        assert(m);
+
+        /* Files were added or removed, which the journal doesn't know about. Let's continue after the last
+         * entry we sent with a new one. */
+
+        r = sd_journal_get_cursor(m->journal, &cursor);
+        if (r < 0 && r != -EADDRNOTAVAIL)
+                return r;
+
+        sd_journal_close(m->journal);
+        m->journal = NULL;
+
+        r = open_journal(m, NULL);
+        if (r < 0)
+                return r;
+
+        if (!cursor)
+                return request_seek(m);
+
+        r = sd_journal_seek_cursor(m->journal, cursor);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_next(m->journal);
+        if (r <= 0)
+                return r;
+
+        /* If the entry is gone, we are at one that wasn't sent yet. Step back so that it is read next. */
+        r = sd_journal_test_cursor(m->journal, cursor);
+        if (r == 0)
+                r = sd_journal_previous(m->journal);
+
+        return r < 0 ? r : 0;
 }
 
 static int request_meta_ensure_tmp(RequestMeta *m) {
@@ -168,10 +229,12 @@ static ssize_t request_reader_entries(
                     m->n_entries <= 0)
                         return MHD_CONTENT_READER_END_OF_STREAM;
 
+                /* Unless the journal already points to the entry of the cursor, the first step only gets
+                 * us there */
                 if (m->n_skip < 0)
-                        r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + 1);
+                        r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + !m->positioned);
                 else if (m->n_skip > 0)
-                        r = sd_journal_next_skip(m->journal, (uint64_t) m->n_skip + 1);
+                        r = sd_journal_next_skip(m->journal, (uint64_t) m->n_skip + !m->positioned);
                 else
                         r = sd_journal_next(m->journal);
 
@@ -181,7 +244,7 @@ static ssize_t request_reader_entries(
                 } else if (r == 0) {
 
                         if (m->follow) {
-                                r = sd_journal_wait(m->journal, (uint64_t) JOURNAL_WAIT_TIMEOUT);
+                                r = journal_pool_wait(m->pool, &m->generation, JOURNAL_WAIT_TIMEOUT);
                                 if (r < 0) {
                                         log_error_errno(r, "Couldn't wait for journal event: %m");
                                         return MHD_CONTENT_READER_END_WITH_ERROR;
@@ -189,6 +252,14 @@ static ssize_t request_reader_entries(
                                 if (r == SD_JOURNAL_NOP)
                                         break;
 
+                                if (r == SD_JOURNAL_INVALIDATE) {
+                                        r = request_reopen_journal(m);
+                                        if (r < 0) {
+                                                log_error_errno(r, "Failed to reopen journal: %m");
+                                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                                        }
+                                }
+
                                 continue;
                         }
 
@@ -215,6 +286,7 @@ static ssize_t request_reader_entries(
                         m->n_entries -= 1;
 
                 m->n_skip = 0;
+                m->positioned = false;
 
                 r = request_meta_ensure_tmp(m);
                 if (r < 0) {
@@ -424,9 +496,8 @@ static mhd_result request_parse_arguments_iterator(
                         }
 
                         sd_id128_to_string(bid, match + 9);
-                        r = sd_journal_add_match(m->journal, match, sizeof(match)-1);
-                        if (r < 0) {
-                                m->argument_parse_error = r;
+                        if (strv_extend(&m->matches, match) < 0) {
+                                m->argument_parse_error = log_oom();
                                 return MHD_NO;
                         }
                 }
@@ -440,9 +511,9 @@ static mhd_result request_parse_arguments_iterator(
                 return MHD_NO;
         }
 
-        r = sd_journal_add_match(m->journal, p, 0);
-        if (r < 0) {
-                m->argument_parse_error = r;
+        /* The matches are applied when the journal is opened */
+        if (strv_consume(&m->matches, TAKE_PTR(p)) < 0) {
+                m->argument_parse_error = log_oom();
                 return MHD_NO;
         }
 
@@ -473,10 +544,6 @@ static int request_handler_entries(
         assert(connection);
         assert(m);
 
-        r = open_journal(m);
-        if (r < 0)
-                return mhd_respondf(connection, r, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to open journal: %m");
-
         if (request_parse_accept(m, connection) < 0)
                 return mhd_respond(connection, MHD_HTTP_BAD_REQUEST, "Failed to parse Accept header.");
 
@@ -494,12 +561,13 @@ static int request_handler_entries(
                 m->n_entries_set = true;
         }
 
-        if (m->cursor)
-                r = sd_journal_seek_cursor(m->journal, m->cursor);
-        else if (m->n_skip >= 0)
-                r = sd_journal_seek_head(m->journal);
-        else if (m->n_skip < 0)
-                r = sd_journal_seek_tail(m->journal);
+        /* A journal pointing to the entry of the cursor is only of use if we move on from it */
+        r = open_journal(m, m->cursor && m->n_skip != 0 && !m->discrete ? m->cursor : NULL);
+        if (r < 0)
+                return mhd_respondf(connection, r, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to open journal: %m");
+
+        if (!m->positioned)
+                r = request_seek(m);
         if (r < 0)
                 return mhd_respond(connection, MHD_HTTP_BAD_REQUEST, "Failed to seek in journal.");
 
@@ -622,7 +690,7 @@ static int request_handler_fields(
         assert(connection);
         assert(m);
 
-        r = open_journal(m);
+        r = open_journal(m, NULL);
         if (r < 0)
                 return mhd_respondf(connection, r, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to open journal: %m");
 
@@ -744,7 +812,7 @@ static int request_handler_machine(
         assert(connection);
         assert(m);
 
-        r = open_journal(m);
+        r = open_journal(m, NULL);
         if (r < 0)
                 return mhd_respondf(connection, r, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to open journal: %m");
 
@@ -811,6 +879,7 @@ static mhd_result request_handler(
                 const char *upload_data,
                 size_t *upload_data_size,
                 void **connection_cls) {
+        JournalPool *pool = cls;
         int r, code;
 
         assert(connection);
@@ -822,7 +891,7 @@ static mhd_result request_handler(
                 return mhd_respond(connection, MHD_HTTP_NOT_ACCEPTABLE, "Unsupported method.");
 
         if (!*connection_cls) {
-                if (!request_meta(connection_cls))
+                if (!request_meta(connection_cls, pool))
                         return respond_oom(connection);
                 return MHD_YES;
         }
@@ -1011,6 +1080,7 @@ static int parse_argv(int argc, char *argv[]) {
 }
 
 static int run(int argc, char *argv[]) {
+        _cleanup_(journal_pool_freep) JournalPool *pool = NULL;
         _cleanup_(MHD_stop_daemonp) struct MHD_Daemon *d = NULL;
         struct MHD_OptionItem opts[] = {
                 { MHD_OPTION_NOTIFY_COMPLETED,
@@ -1049,6 +1119,13 @@ static int run(int argc, char *argv[]) {
 
         sigbus_install();
 
+        /* Journals are shared between requests, see journal-gatewayd-pool.c */
+        r = journal_pool_new(&pool, arg_directory, arg_file,
+                             arg_directory || arg_file ? arg_journal_type :
+                             (arg_merge ? 0 : SD_JOURNAL_LOCAL_ONLY) | arg_journal_type);
+        if (r < 0)
+                return log_oom();
+
         r = setup_gnutls_logger(NULL);
         if (r < 0)
                 return r;
@@ -1080,7 +1157,7 @@ static int run(int argc, char *argv[]) {
 
         d = MHD_start_daemon(flags, 19531,
                              NULL, NULL,
-                             request_handler, NULL,
+                             request_handler, pool,
                              MHD_OPTION_ARRAY, opts,
                              MHD_OPTION_END);
         if (!d)
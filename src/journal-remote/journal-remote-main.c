@@ -15,6 +15,7 @@
 #include "main-func.h"
 #include "memory-util.h"
 #include "parse-argument.h"
+#include "parse-util.h"
 #include "pretty-print.h"
 #include "process-util.h"
 #include "rlimit-util.h"
@@ -37,6 +38,7 @@ static const char* arg_listen_https = NULL;
 static char** arg_files = NULL; /* Do not free this. */
 static bool arg_compress = true;
 static bool arg_seal = false;
+static unsigned arg_worker_threads = 0;
 static int http_socket = -1, https_socket = -1;
 static char** arg_gnutls_log = NULL;
 
@@ -158,15 +160,24 @@ static int request_meta(void **connection_cls, int fd, char *hostname) {
         if (*connection_cls)
                 return 0;
 
-        r = journal_remote_get_writer(journal_remote_server_global, hostname, &writer);
-        if (r < 0)
-                return log_warning_errno(r, "Failed to get writer for source %s: %m",
-                                         hostname);
+        if (journal_remote_server_global->n_workers > 0) {
+                /* The worker gets the writer, once it processes data of this source */
+                source = source_new(fd, true, hostname, NULL);
+                if (!source)
+                        return log_oom();
 
-        source = source_new(fd, true, hostname, writer);
-        if (!source) {
-                writer_unref(writer);
-                return log_oom();
+                source->worker = journal_remote_pick_worker(journal_remote_server_global, hostname);
+        } else {
+                r = journal_remote_get_writer(journal_remote_server_global, NULL, hostname, &writer);
+                if (r < 0)
+                        return log_warning_errno(r, "Failed to get writer for source %s: %m",
+                                                 hostname);
+
+                source = source_new(fd, true, hostname, writer);
+                if (!source) {
+                        writer_unref(writer);
+                        return log_oom();
+                }
         }
 
         log_debug("Added RemoteSource as connection metadata %p", source);
@@ -186,11 +197,40 @@ static void request_meta_free(void *cls,
 
         if (s) {
                 log_debug("Cleaning up connection metadata %p", s);
+
+                /* The worker might still be processing data of an aborted upload */
+                if (s->worker && !s->worker_finished)
+                        (void) remote_worker_finish(s->worker, s, NULL);
+
                 source_free(s);
                 *connection_cls = NULL;
         }
 }
 
+static int process_http_entries(struct MHD_Connection *connection, RemoteSource *source) {
+        int r;
+
+        for (;;) {
+                r = process_source(source,
+                                   journal_remote_server_global->compress,
+                                   journal_remote_server_global->seal);
+                if (r == -EAGAIN)
+                        return 0;
+                if (r < 0) {
+                        if (r == -ENOBUFS)
+                                log_warning_errno(r, "Entry is above the maximum of %u, aborting connection %p.",
+                                                  DATA_SIZE_MAX, connection);
+                        else if (r == -E2BIG)
+                                log_warning_errno(r, "Entry with more fields than the maximum of %u, aborting connection %p.",
+                                                  ENTRY_FIELD_COUNT_MAX, connection);
+                        else
+                                log_warning_errno(r, "Failed to process data, aborting connection %p: %m",
+                                                  connection);
+                        return r;
+                }
+        }
+}
+
 static int process_http_upload(
                 struct MHD_Connection *connection,
                 const char *upload_data,
@@ -206,36 +246,56 @@ static int process_http_upload(
         log_trace("%s: connection %p, %zu bytes",
                   __func__, connection, *upload_data_size);
 
+        if (source->worker) {
+                /* Everything is processed on the worker, this only waits for it if it has a lot to do */
+                if (*upload_data_size) {
+                        log_trace("Received %zu bytes", *upload_data_size);
+
+                        r = remote_worker_push_data(source->worker, source, upload_data, *upload_data_size);
+                        if (r == -ENOMEM)
+                                return mhd_respond_oom(connection);
+                        if (r < 0)
+                                return MHD_NO;
+
+                        *upload_data_size = 0;
+                        return MHD_YES;
+                }
+
+                r = remote_worker_finish(source->worker, source, &remaining);
+                if (r < 0)
+                        return MHD_NO;
+
+                goto finish;
+        }
+
         if (*upload_data_size) {
                 log_trace("Received %zu bytes", *upload_data_size);
 
-                r = journal_importer_push_data(&source->importer,
-                                               upload_data, *upload_data_size);
-                if (r < 0)
-                        return mhd_respond_oom(connection);
+                /* Compressed data is pushed piecewise, so that entries are processed in between and the
+                 * buffer only holds a limited amount of decompressed data. */
+                while (*upload_data_size > 0) {
+                        size_t n;
 
-                *upload_data_size = 0;
-        } else
+                        r = source_push_data(source, upload_data, *upload_data_size, &n);
+                        if (r == -ENOMEM)
+                                return mhd_respond_oom(connection);
+                        if (r < 0)
+                                return mhd_respondf(connection, r, MHD_HTTP_BAD_REQUEST,
+                                                    "Failed to process received data: %m");
+
+                        upload_data += n;
+                        *upload_data_size -= n;
+
+                        r = process_http_entries(connection, source);
+                        if (r < 0)
+                                return MHD_NO;
+                }
+        } else {
                 finished = true;
 
-        for (;;) {
-                r = process_source(source,
-                                   journal_remote_server_global->compress,
-                                   journal_remote_server_global->seal);
-                if (r == -EAGAIN)
-                        break;
-                if (r < 0) {
-                        if (r == -ENOBUFS)
-                                log_warning_errno(r, "Entry is above the maximum of %u, aborting connection %p.",
-                                                  DATA_SIZE_MAX, connection);
-                        else if (r == -E2BIG)
-                                log_warning_errno(r, "Entry with more fields than the maximum of %u, aborting connection %p.",
-                                                  ENTRY_FIELD_COUNT_MAX, connection);
-                        else
-                                log_warning_errno(r, "Failed to process data, aborting connection %p: %m",
-                                                  connection);
+                r = process_http_entries(connection, source);
+                if (r < 0)
                         return MHD_NO;
-                }
         }
 
         if (!finished)
@@ -244,6 +304,7 @@ static int process_http_upload(
         /* The upload is finished */
 
         remaining = journal_importer_bytes_remaining(&source->importer);
+finish:
         if (remaining > 0) {
                 log_warning("Premature EOF byte. %zu bytes lost.", remaining);
                 return mhd_respondf(connection,
@@ -269,6 +330,9 @@ static mhd_result request_handler(
         int r, code, fd;
         _cleanup_free_ char *hostname = NULL;
         bool chunked = false;
+#if HAVE_ZSTD
+        bool compressed = false;
+#endif
 
         assert(connection);
         assert(connection_cls);
@@ -302,6 +366,17 @@ static mhd_result request_handler(
                 chunked = true;
         }
 
+        header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Content-Encoding");
+        if (header && !strcaseeq(header, "identity")) {
+#if HAVE_ZSTD
+                if (strcaseeq(header, "zstd"))
+                        compressed = true;
+                else
+#endif
+                        return mhd_respondf(connection, 0, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
+                                            "Unsupported Content-Encoding type: %s", header);
+        }
+
         header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Content-Length");
         if (header) {
                 size_t len;
@@ -358,6 +433,17 @@ static mhd_result request_handler(
                 return mhd_respondf(connection, r, MHD_HTTP_INTERNAL_SERVER_ERROR, "%m");
 
         hostname = NULL;
+
+#if HAVE_ZSTD
+        if (compressed) {
+                RemoteSource *source = *connection_cls;
+
+                source->zstd = ZSTD_createDCtx();
+                if (!source->zstd)
+                        return respond_oom(connection);
+        }
+#endif
+
         return MHD_YES;
 }
 
@@ -604,6 +690,15 @@ static int create_remoteserver(
         if (r < 0)
                 return log_error_errno(r, "Failed to set up signals: %m");
 
+        if (arg_worker_threads > 0) {
+                if (arg_split_mode == JOURNAL_WRITE_SPLIT_HOST) {
+                        r = journal_remote_start_workers(s, arg_worker_threads);
+                        if (r < 0)
+                                return r;
+                } else
+                        log_notice("Worker threads are only used with --split-mode=host, ignoring.");
+        }
+
         n = sd_listen_fds(true);
         if (n < 0)
                 return log_error_errno(n, "Failed to read listening file descriptors from environment: %m");
@@ -729,7 +824,7 @@ static int create_remoteserver(
                 /* In this case we know what the writer will be
                    called, so we can create it and verify that we can
                    create output as expected. */
-                r = journal_remote_get_writer(s, NULL, &s->_single_writer);
+                r = journal_remote_get_writer(s, NULL, NULL, &s->_single_writer);
                 if (r < 0)
                         return r;
         }
@@ -754,11 +849,12 @@ static int negative_fd(const char *spec) {
 
 static int parse_config(void) {
         const ConfigTableItem items[] = {
-                { "Remote",  "Seal",                   config_parse_bool,             0, &arg_seal       },
-                { "Remote",  "SplitMode",              config_parse_write_split_mode, 0, &arg_split_mode },
-                { "Remote",  "ServerKeyFile",          config_parse_path,             0, &arg_key        },
-                { "Remote",  "ServerCertificateFile",  config_parse_path,             0, &arg_cert       },
-                { "Remote",  "TrustedCertificateFile", config_parse_path,             0, &arg_trust      },
+                { "Remote",  "Seal",                   config_parse_bool,             0, &arg_seal           },
+                { "Remote",  "SplitMode",              config_parse_write_split_mode, 0, &arg_split_mode     },
+                { "Remote",  "ServerKeyFile",          config_parse_path,             0, &arg_key            },
+                { "Remote",  "ServerCertificateFile",  config_parse_path,             0, &arg_cert           },
+                { "Remote",  "TrustedCertificateFile", config_parse_path,             0, &arg_trust          },
+                { "Remote",  "WorkerThreads",          config_parse_unsigned,         0, &arg_worker_threads },
                 {}
         };
 
@@ -801,6 +897,7 @@ static int help(void) {
                "     --gnutls-log=CATEGORY...\n"
                "                            Specify a list of gnutls logging categories\n"
                "     --split-mode=none|host How many output files to create\n"
+               "     --worker-threads=N     Write the output files of hosts on N threads\n"
                "\nNote: file descriptors from sd_listen_fds() will be consumed, too.\n"
                "\nSee the %s for details.\n",
                program_invocation_short_name,
@@ -824,24 +921,26 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CERT,
                 ARG_TRUST,
                 ARG_GNUTLS_LOG,
+                ARG_WORKER_THREADS,
         };
 
         static const struct option options[] = {
-                { "help",         no_argument,       NULL, 'h'              },
-                { "version",      no_argument,       NULL, ARG_VERSION      },
-                { "url",          required_argument, NULL, ARG_URL          },
-                { "getter",       required_argument, NULL, ARG_GETTER       },
-                { "listen-raw",   required_argument, NULL, ARG_LISTEN_RAW   },
-                { "listen-http",  required_argument, NULL, ARG_LISTEN_HTTP  },
-                { "listen-https", required_argument, NULL, ARG_LISTEN_HTTPS },
-                { "output",       required_argument, NULL, 'o'              },
-                { "split-mode",   required_argument, NULL, ARG_SPLIT_MODE   },
-                { "compress",     optional_argument, NULL, ARG_COMPRESS     },
-                { "seal",         optional_argument, NULL, ARG_SEAL         },
-                { "key",          required_argument, NULL, ARG_KEY          },
-                { "cert",         required_argument, NULL, ARG_CERT         },
-                { "trust",        required_argument, NULL, ARG_TRUST        },
-                { "gnutls-log",   required_argument, NULL, ARG_GNUTLS_LOG   },
+                { "help",           no_argument,       NULL, 'h'                },
+                { "version",        no_argument,       NULL, ARG_VERSION        },
+                { "url",            required_argument, NULL, ARG_URL            },
+                { "getter",         required_argument, NULL, ARG_GETTER         },
+                { "listen-raw",     required_argument, NULL, ARG_LISTEN_RAW     },
+                { "listen-http",    required_argument, NULL, ARG_LISTEN_HTTP    },
+                { "listen-https",   required_argument, NULL, ARG_LISTEN_HTTPS   },
+                { "output",         required_argument, NULL, 'o'                },
+                { "split-mode",     required_argument, NULL, ARG_SPLIT_MODE     },
+                { "compress",       optional_argument, NULL, ARG_COMPRESS       },
+                { "seal",           optional_argument, NULL, ARG_SEAL           },
+                { "key",            required_argument, NULL, ARG_KEY            },
+                { "cert",           required_argument, NULL, ARG_CERT           },
+                { "trust",          required_argument, NULL, ARG_TRUST          },
+                { "gnutls-log",     required_argument, NULL, ARG_GNUTLS_LOG     },
+                { "worker-threads", required_argument, NULL, ARG_WORKER_THREADS },
                 {}
         };
 
@@ -999,6 +1098,12 @@ static int parse_argv(int argc, char *argv[]) {
                                                "Option --gnutls-log is not available.");
 #endif
 
+                case ARG_WORKER_THREADS:
+                        r = safe_atou(optarg, &arg_worker_threads);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to parse --worker-threads= argument: %s", optarg);
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -1162,9 +1267,9 @@ static int run(int argc, char **argv) {
         notify_message = NULL;
         (void) sd_notifyf(false,
                           "STOPPING=1\n"
-                          "STATUS=Shutting down after writing %" PRIu64 " entries...", s.event_count);
+                          "STATUS=Shutting down after writing %" PRIu64 " entries...", journal_remote_event_count(&s));
 
-        log_info("Finishing after writing %" PRIu64 " entries", s.event_count);
+        log_info("Finishing after writing %" PRIu64 " entries", journal_remote_event_count(&s));
 
         return 0;
 }
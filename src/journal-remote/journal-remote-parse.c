@@ -13,12 +13,18 @@ void source_free(RemoteSource *source) {
 
         journal_importer_cleanup(&source->importer);
 
-        log_debug("Writer ref count %i", source->writer->n_ref);
-        writer_unref(source->writer);
+        if (source->writer) {
+                log_debug("Writer ref count %i", source->writer->n_ref);
+                writer_unref(source->writer);
+        }
 
         sd_event_source_unref(source->event);
         sd_event_source_unref(source->buffer_event);
 
+#if HAVE_ZSTD
+        ZSTD_freeDCtx(source->zstd);
+#endif
+
         free(source);
 }
 
@@ -47,6 +53,26 @@ RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer) {
         return source;
 }
 
+int source_push_data(RemoteSource *source, const char *data, size_t size, size_t *ret_consumed) {
+        int r;
+
+        assert(source);
+        assert(ret_consumed);
+
+#if HAVE_ZSTD
+        if (source->zstd)
+                return journal_importer_push_data_zstd(&source->importer, source->zstd,
+                                                       data, size, ret_consumed);
+#endif
+
+        r = journal_importer_push_data(&source->importer, data, size);
+        if (r < 0)
+                return r;
+
+        *ret_consumed = size;
+        return 0;
+}
+
 int process_source(RemoteSource *source, bool compress, bool seal) {
         int r;
 
@@ -1,20 +1,37 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 #pragma once
 
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "sd-event.h"
 
 #include "journal-importer.h"
 #include "journal-remote-write.h"
 
+typedef struct RemoteWorker RemoteWorker;
+
 typedef struct RemoteSource {
         JournalImporter importer;
 
         Writer *writer;
 
+        /* Set if the source is handled by a worker thread. The rest is protected by the worker's mutex. */
+        RemoteWorker *worker;
+        int worker_error;
+        size_t worker_remaining;
+        bool worker_finished;
+
         sd_event_source *event;
         sd_event_source *buffer_event;
+
+#if HAVE_ZSTD
+        ZSTD_DCtx *zstd;            /* Set if the data is zstd compressed */
+#endif
 } RemoteSource;
 
 RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer);
 void source_free(RemoteSource *source);
+int source_push_data(RemoteSource *source, const char *data, size_t size, size_t *ret_consumed);
 int process_source(RemoteSource *source, bool compress, bool seal);
@@ -0,0 +1,618 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "journal-remote-worker.h"
+#include "journal-remote.h"
+#include "set.h"
+#include "siphash24.h"
+
+/* With WorkerThreads= set, the output of each host is written on one of a few threads, chosen by a hash of the
+ * host name. The thread also does the parsing of whatever the host sends: it reads the raw connections of the
+ * host itself, and gets the data of HTTP uploads handed over by the event loop, which still accepts all
+ * connections and runs the HTTP server. Since a journal file is only ever touched by the thread of its host,
+ * hosts are written in parallel without any locking around the journal files.
+ *
+ * Everything is passed to a thread as records on its queue, in order. For raw connections that's only the
+ * connection itself, for uploads every piece of data that comes in. If a thread can't keep up, the event loop
+ * stops taking data of uploads once its queue is full, which pushes back on the clients of that thread. */
+
+#define WORKER_THREADS_MAX 16U
+
+/* How many entries to process from a raw connection in one go, before looking at the other sources */
+#define WORKER_ENTRIES_MAX 64U
+
+/* How much upload data a thread queues up before the event loop waits for it */
+#define WORKER_QUEUE_SIZE_MAX (4U * 1024U * 1024U)
+
+typedef enum RemoteRecordType {
+        REMOTE_RECORD_ADD,    /* A raw connection the thread reads from now on */
+        REMOTE_RECORD_DATA,   /* A piece of an upload */
+        REMOTE_RECORD_FINISH, /* The upload is complete, or the connection went away */
+} RemoteRecordType;
+
+struct RemoteRecord {
+        RemoteRecordType type;
+        RemoteRecord *next;
+
+        RemoteSource *source;
+
+        size_t size;
+        char data[];
+};
+
+static RemoteRecord* remote_record_new(RemoteRecordType type, RemoteSource *source, const char *data, size_t size) {
+        RemoteRecord *record;
+
+        record = malloc(offsetof(RemoteRecord, data) + size);
+        if (!record)
+                return NULL;
+
+        *record = (RemoteRecord) {
+                .type = type,
+                .source = source,
+                .size = size,
+        };
+
+        memcpy_safe(record->data, data, size);
+
+        return record;
+}
+
+static void worker_queue(RemoteWorker *w, RemoteRecord *record) {
+        uint64_t one = 1;
+
+        assert(w);
+        assert(record);
+
+        /* Called with the mutex held */
+
+        if (w->queue_tail)
+                w->queue_tail->next = record;
+        else
+                w->queue = record;
+
+        w->queue_tail = record;
+        w->queue_size += record->size;
+
+        (void) write(w->wakeup_fd, &one, sizeof(one));
+}
+
+static void worker_remove_source(RemoteWorker *w, RemoteSource *source) {
+        uint64_t one = 1;
+
+        assert(w);
+        assert(source);
+
+        (void) epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, source->importer.fd, NULL);
+
+        set_remove(w->busy, source);
+        set_remove(w->sources, source);
+
+        /* this closes fd too */
+        source_free(source);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        w->n_closed++;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        (void) write(w->notify_fd, &one, sizeof(one));
+}
+
+static int worker_get_writer(RemoteWorker *w, RemoteSource *source) {
+        int r;
+
+        assert(w);
+        assert(source);
+
+        if (source->writer)
+                return 0;
+
+        r = journal_remote_get_writer(w->server, w, source->importer.name, &source->writer);
+        if (r < 0)
+                return log_warning_errno(r, "Failed to get writer for source %s: %m",
+                                         source->importer.name);
+
+        return 0;
+}
+
+static bool worker_read_source(RemoteWorker *w, RemoteSource *source) {
+        RemoteServer *s = w->server;
+        int r;
+
+        /* Like journal_remote_handle_raw_source(). Returns true if there might be more data pending. */
+
+        for (unsigned i = 0; i < WORKER_ENTRIES_MAX; i++) {
+                r = process_source(source, s->compress, s->seal);
+                if (journal_importer_eof(&source->importer)) {
+                        size_t remaining;
+
+                        log_debug("EOF reached with source %s (fd=%d)",
+                                  source->importer.name, source->importer.fd);
+
+                        remaining = journal_importer_bytes_remaining(&source->importer);
+                        if (remaining > 0)
+                                log_notice("Premature EOF. %zu bytes lost.", remaining);
+                        worker_remove_source(w, source);
+                        return false;
+                } else if (r == -E2BIG)
+                        log_notice("Entry with too many fields, skipped");
+                else if (r == -ENOBUFS)
+                        log_notice("Entry too big, skipped");
+                else if (r == -EAGAIN)
+                        return false;
+                else if (r < 0) {
+                        log_debug_errno(r, "Closing connection: %m");
+                        worker_remove_source(w, source);
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static void worker_add_source(RemoteWorker *w, RemoteSource *source) {
+        int r;
+
+        assert(w);
+        assert(source);
+
+        r = set_ensure_put(&w->sources, NULL, source);
+        if (r < 0) {
+                log_oom();
+                goto fail;
+        }
+
+        r = worker_get_writer(w, source);
+        if (r < 0)
+                goto fail;
+
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, source->importer.fd,
+                      &(struct epoll_event) { .events = EPOLLIN, .data.ptr = source }) >= 0)
+                return;
+
+        if (errno != EPERM) {
+                log_error_errno(errno, "Failed to register source %s with worker thread: %m",
+                                source->importer.name);
+                goto fail;
+        }
+
+        /* A regular file, it's always readable */
+        r = set_ensure_put(&w->busy, NULL, source);
+        if (r >= 0)
+                return;
+
+        log_oom();
+fail:
+        worker_remove_source(w, source);
+}
+
+static int worker_push_data(RemoteWorker *w, RemoteSource *source, const char *data, size_t size) {
+        RemoteServer *s = w->server;
+        int r;
+
+        /* Like process_http_upload(), but on the thread */
+
+        r = worker_get_writer(w, source);
+        if (r < 0)
+                return r;
+
+        do {
+                size_t n = 0;
+
+                if (size > 0) {
+                        r = source_push_data(source, data, size, &n);
+                        if (r < 0)
+                                return log_warning_errno(r, "Failed to process data received from %s: %m",
+                                                         source->importer.name);
+
+                        data += n;
+                        size -= n;
+                }
+
+                for (;;) {
+                        r = process_source(source, s->compress, s->seal);
+                        if (r == -EAGAIN)
+                                break;
+                        if (r == -ENOBUFS)
+                                return log_warning_errno(r, "Entry is above the maximum of %u, aborting upload from %s.",
+                                                         DATA_SIZE_MAX, source->importer.name);
+                        if (r == -E2BIG)
+                                return log_warning_errno(r, "Entry with more fields than the maximum of %u, aborting upload from %s.",
+                                                         ENTRY_FIELD_COUNT_MAX, source->importer.name);
+                        if (r < 0)
+                                return log_warning_errno(r, "Failed to process data, aborting upload from %s: %m",
+                                                         source->importer.name);
+                }
+        } while (size > 0);
+
+        return 0;
+}
+
+static void worker_dispatch_record(RemoteWorker *w, RemoteRecord *record) {
+        RemoteSource *source = record->source;
+        size_t remaining;
+        int error, r;
+
+        assert(w);
+        assert(record);
+
+        switch (record->type) {
+
+        case REMOTE_RECORD_ADD:
+                worker_add_source(w, source);
+                break;
+
+        case REMOTE_RECORD_DATA:
+                assert_se(pthread_mutex_lock(&w->mutex) == 0);
+                error = source->worker_error;
+                assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+                /* Once an upload failed the rest of it is ignored */
+                if (error < 0)
+                        break;
+
+                r = worker_push_data(w, source, record->data, record->size);
+                if (r < 0) {
+                        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+                        source->worker_error = r;
+                        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+                }
+                break;
+
+        case REMOTE_RECORD_FINISH:
+                remaining = journal_importer_bytes_remaining(&source->importer);
+
+                /* The source is freed by the event loop, but the writer belongs to this thread */
+                source->writer = writer_unref(source->writer);
+
+                assert_se(pthread_mutex_lock(&w->mutex) == 0);
+                source->worker_remaining = remaining;
+                source->worker_finished = true;
+                assert_se(pthread_cond_broadcast(&w->cond) == 0);
+                assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+                break;
+
+        default:
+                assert_not_reached();
+        }
+}
+
+static void* worker_thread(void *p) {
+        RemoteWorker *w = p;
+
+        for (;;) {
+                struct epoll_event events[16];
+                RemoteRecord *records;
+                RemoteSource *source;
+                bool stop;
+                int n;
+
+                /* Don't sleep while a source may still have data without its fd becoming readable */
+                n = epoll_wait(w->epoll_fd, events, ELEMENTSOF(events), set_isempty(w->busy) ? -1 : 0);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        log_error_errno(errno, "Worker thread failed to wait for events: %m");
+                        break;
+                }
+
+                for (int i = 0; i < n; i++) {
+                        void *ptr = events[i].data.ptr;
+
+                        if (ptr == w)
+                                (void) flush_fd(w->wakeup_fd);
+                        else {
+                                source = ptr;
+
+                                if (worker_read_source(w, source))
+                                        if (set_ensure_put(&w->busy, NULL, source) < 0) {
+                                                log_oom();
+                                                worker_remove_source(w, source);
+                                        }
+                        }
+                }
+
+                SET_FOREACH(source, w->busy)
+                        if (!worker_read_source(w, source))
+                                set_remove(w->busy, source);
+
+                assert_se(pthread_mutex_lock(&w->mutex) == 0);
+                records = TAKE_PTR(w->queue);
+                w->queue_tail = NULL;
+                w->queue_size = 0;
+                stop = w->stop;
+                assert_se(pthread_cond_broadcast(&w->cond) == 0);
+                assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+                while (records) {
+                        RemoteRecord *record = records;
+
+                        records = record->next;
+
+                        worker_dispatch_record(w, record);
+                        free(record);
+                }
+
+                if (stop)
+                        break;
+        }
+
+        return NULL;
+}
+
+static int dispatch_worker(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        RemoteWorker *w = userdata;
+        size_t n;
+
+        assert(w);
+
+        (void) flush_fd(w->notify_fd);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        n = w->n_closed;
+        w->n_closed = 0;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        assert(w->server->active >= n);
+        w->server->active -= n;
+
+        log_debug("%zu active sources remaining", w->server->active);
+        return 0;
+}
+
+static int worker_init(RemoteWorker *w, RemoteServer *s) {
+        int r;
+
+        assert(w);
+        assert(s);
+
+        *w = (RemoteWorker) {
+                .server = s,
+                .epoll_fd = -1,
+                .wakeup_fd = -1,
+                .notify_fd = -1,
+        };
+
+        assert_se(pthread_mutex_init(&w->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&w->cond, NULL) == 0);
+
+        r = journal_remote_init_writers(s, &w->writers);
+        if (r < 0)
+                return r;
+
+        w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->epoll_fd < 0)
+                return log_error_errno(errno, "Failed to create epoll fd for worker thread: %m");
+
+        w->wakeup_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (w->wakeup_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd for worker thread: %m");
+
+        w->notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (w->notify_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd for worker thread: %m");
+
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wakeup_fd,
+                      &(struct epoll_event) { .events = EPOLLIN, .data.ptr = w }) < 0)
+                return log_error_errno(errno, "Failed to add eventfd to worker thread: %m");
+
+        r = sd_event_add_io(s->events, &w->event_source, w->notify_fd, EPOLLIN, dispatch_worker, w);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add worker thread to event loop: %m");
+
+        return 0;
+}
+
+static void worker_done(RemoteWorker *w) {
+        RemoteSource *source;
+
+        assert(w);
+
+        /* The thread is gone, whatever it still had is dropped here */
+        while (w->queue) {
+                RemoteRecord *record = w->queue;
+
+                w->queue = record->next;
+
+                if (record->type == REMOTE_RECORD_ADD)
+                        source_free(record->source);
+                free(record);
+        }
+
+        SET_FOREACH(source, w->sources)
+                source_free(source);
+        set_free(w->sources);
+        set_free(w->busy);
+
+        /* The writers remove themselves from the hashmap once the last source is gone */
+        hashmap_free(w->writers);
+
+        sd_event_source_disable_unref(w->event_source);
+        safe_close(w->epoll_fd);
+        safe_close(w->wakeup_fd);
+        safe_close(w->notify_fd);
+
+        assert_se(pthread_cond_destroy(&w->cond) == 0);
+        assert_se(pthread_mutex_destroy(&w->mutex) == 0);
+}
+
+int journal_remote_start_workers(RemoteServer *s, unsigned n) {
+        sigset_t ss, saved_ss;
+        int r;
+
+        assert(s);
+        assert(!s->workers);
+
+        n = MIN(n, WORKER_THREADS_MAX);
+        if (n == 0)
+                return 0;
+
+        s->workers = new(RemoteWorker, n);
+        if (!s->workers)
+                return log_oom();
+
+        for (; s->n_workers < n; s->n_workers++) {
+                r = worker_init(s->workers + s->n_workers, s);
+                if (r < 0) {
+                        worker_done(s->workers + s->n_workers);
+                        goto fail;
+                }
+        }
+
+        assert_se(sigfillset(&ss) >= 0);
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0) {
+                log_error_errno(r, "Failed to block signals for worker threads: %m");
+                goto fail;
+        }
+
+        for (size_t i = 0; i < s->n_workers; i++) {
+                RemoteWorker *w = s->workers + i;
+
+                r = pthread_create(&w->thread, NULL, worker_thread, w);
+                if (r > 0) {
+                        log_error_errno(r, "Failed to start worker thread: %m");
+                        break;
+                }
+
+                w->started = true;
+        }
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        if (r > 0)
+                goto fail;
+
+        log_debug("Started %zu worker threads.", s->n_workers);
+        return 0;
+
+fail:
+        /* Not worth failing for, do everything on the event loop then */
+        log_warning("Writing everything on the event loop.");
+        journal_remote_stop_workers(s);
+        return 0;
+}
+
+void journal_remote_stop_workers(RemoteServer *s) {
+        assert(s);
+
+        for (size_t i = 0; i < s->n_workers; i++) {
+                RemoteWorker *w = s->workers + i;
+                uint64_t one = 1;
+
+                if (!w->started)
+                        continue;
+
+                assert_se(pthread_mutex_lock(&w->mutex) == 0);
+                w->stop = true;
+                assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+                (void) write(w->wakeup_fd, &one, sizeof(one));
+                (void) pthread_join(w->thread, NULL);
+        }
+
+        for (size_t i = 0; i < s->n_workers; i++)
+                worker_done(s->workers + i);
+
+        s->workers = mfree(s->workers);
+        s->n_workers = 0;
+}
+
+RemoteWorker* journal_remote_pick_worker(RemoteServer *s, const char *host) {
+        /* Fixed, so that a host always ends up on the same thread */
+        static const uint8_t key[16] = "journal-remote-w";
+
+        assert(s);
+        assert(s->n_workers > 0);
+        assert(host);
+
+        return s->workers + siphash24_string(host, key) % s->n_workers;
+}
+
+int remote_worker_add_source(RemoteWorker *w, RemoteSource *source) {
+        RemoteRecord *record;
+
+        assert(w);
+        assert(source);
+        assert(source->worker == w);
+
+        record = remote_record_new(REMOTE_RECORD_ADD, source, NULL, 0);
+        if (!record)
+                return log_oom();
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        worker_queue(w, record);
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return 0;
+}
+
+int remote_worker_push_data(RemoteWorker *w, RemoteSource *source, const char *data, size_t size) {
+        RemoteRecord *record;
+        int r;
+
+        assert(w);
+        assert(source);
+        assert(source->worker == w);
+        assert(data || size == 0);
+
+        record = remote_record_new(REMOTE_RECORD_DATA, source, data, size);
+        if (!record)
+                return log_oom();
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        while (w->queue_size >= WORKER_QUEUE_SIZE_MAX && source->worker_error >= 0)
+                assert_se(pthread_cond_wait(&w->cond, &w->mutex) == 0);
+
+        /* Errors are reported with the next piece of data, or when the upload is finished */
+        r = source->worker_error;
+        if (r >= 0)
+                worker_queue(w, TAKE_PTR(record));
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        free(record);
+        return r;
+}
+
+int remote_worker_finish(RemoteWorker *w, RemoteSource *source, size_t *ret_remaining) {
+        RemoteRecord *record;
+        int r;
+
+        assert(w);
+        assert(source);
+        assert(source->worker == w);
+
+        record = remote_record_new(REMOTE_RECORD_FINISH, source, NULL, 0);
+        if (!record) {
+                /* We can't free the source while the thread may still use it, hence wait for memory */
+                log_oom();
+                while (!(record = remote_record_new(REMOTE_RECORD_FINISH, source, NULL, 0)))
+                        (void) usleep(10 * USEC_PER_MSEC);
+        }
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        worker_queue(w, record);
+
+        while (!source->worker_finished)
+                assert_se(pthread_cond_wait(&w->cond, &w->mutex) == 0);
+
+        r = source->worker_error;
+        if (ret_remaining)
+                *ret_remaining = source->worker_remaining;
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return r;
+}
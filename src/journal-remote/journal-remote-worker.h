@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <pthread.h>
+
+#include "sd-event.h"
+
+#include "hashmap.h"
+#include "journal-remote-parse.h"
+
+typedef struct RemoteServer RemoteServer;
+typedef struct RemoteRecord RemoteRecord;
+
+struct RemoteWorker {
+        RemoteServer *server;
+
+        pthread_t thread;
+        bool started;
+
+        int epoll_fd;
+        int wakeup_fd; /* Makes the thread look at its queue */
+        int notify_fd; /* Tells the event loop about sources the thread is done with */
+        sd_event_source *event_source;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond; /* Signalled when the thread took records off the queue or finished a source */
+        RemoteRecord *queue, *queue_tail;
+        size_t queue_size;
+        size_t n_closed;
+        bool stop;
+
+        /* Only used by the thread, and by the event loop once the thread is stopped */
+        Hashmap *writers;
+        Set *sources;
+        Set *busy; /* Sources that may have more data without the fd becoming readable */
+
+        uint64_t event_count;
+};
+
+int journal_remote_start_workers(RemoteServer *s, unsigned n);
+void journal_remote_stop_workers(RemoteServer *s);
+
+RemoteWorker* journal_remote_pick_worker(RemoteServer *s, const char *host);
+
+int remote_worker_add_source(RemoteWorker *w, RemoteSource *source);
+int remote_worker_push_data(RemoteWorker *w, RemoteSource *source, const char *data, size_t size);
+int remote_worker_finish(RemoteWorker *w, RemoteSource *source, size_t *ret_remaining);
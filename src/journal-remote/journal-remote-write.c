@@ -15,7 +15,15 @@ static int do_rotate(JournalFile **f, bool compress, bool seal) {
         return r;
 }
 
-Writer* writer_new(RemoteServer *server) {
+static void writer_count_event(Writer *w) {
+        if (w->worker)
+                /* Read by the event loop while the worker is running */
+                __atomic_add_fetch(&w->worker->event_count, 1, __ATOMIC_RELAXED);
+        else if (w->server)
+                w->server->event_count += 1;
+}
+
+Writer* writer_new(RemoteServer *server, RemoteWorker *worker) {
         Writer *w;
 
         w = new0(Writer, 1);
@@ -30,6 +38,7 @@ Writer* writer_new(RemoteServer *server) {
 
         w->n_ref = 1;
         w->server = server;
+        w->worker = worker;
 
         return w;
 }
@@ -43,7 +52,9 @@ static Writer* writer_free(Writer *w) {
                 journal_file_close(w->journal);
         }
 
-        if (w->server && w->hashmap_key)
+        if (w->worker && w->hashmap_key)
+                hashmap_remove(w->worker->writers, w->hashmap_key);
+        else if (w->server && w->hashmap_key)
                 hashmap_remove(w->server->writers, w->hashmap_key);
 
         free(w->hashmap_key);
@@ -80,8 +91,7 @@ int writer_write(Writer *w,
                                       iovw->iovec, iovw->count,
                                       &w->seqnum, NULL, NULL);
         if (r >= 0) {
-                if (w->server)
-                        w->server->event_count += 1;
+                writer_count_event(w);
                 return 0;
         } else if (r == -EBADMSG)
                 return r;
@@ -100,7 +110,6 @@ int writer_write(Writer *w,
         if (r < 0)
                 return r;
 
-        if (w->server)
-                w->server->event_count += 1;
+        writer_count_event(w);
         return 0;
 }
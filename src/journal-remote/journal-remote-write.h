@@ -5,6 +5,7 @@
 #include "journal-importer.h"
 
 typedef struct RemoteServer RemoteServer;
+typedef struct RemoteWorker RemoteWorker;
 
 typedef struct Writer {
         JournalFile *journal;
@@ -12,6 +13,7 @@ typedef struct Writer {
 
         MMapCache *mmap;
         RemoteServer *server;
+        RemoteWorker *worker; /* If set, the writer belongs to this worker thread */
         char *hashmap_key;
 
         uint64_t seqnum;
@@ -19,7 +21,7 @@ typedef struct Writer {
         unsigned n_ref;
 } Writer;
 
-Writer* writer_new(RemoteServer* server);
+Writer* writer_new(RemoteServer* server, RemoteWorker *worker);
 Writer* writer_ref(Writer *w);
 Writer* writer_unref(Writer *w);
 
@@ -78,7 +78,7 @@ static int open_output(RemoteServer *s, Writer *w, const char* host) {
  **********************************************************************
  **********************************************************************/
 
-static int init_writer_hashmap(RemoteServer *s) {
+int journal_remote_init_writers(RemoteServer *s, Hashmap **writers) {
         static const struct hash_ops* const hash_ops[] = {
                 [JOURNAL_WRITE_SPLIT_NONE] = NULL,
                 [JOURNAL_WRITE_SPLIT_HOST] = &string_hash_ops,
@@ -86,19 +86,24 @@ static int init_writer_hashmap(RemoteServer *s) {
 
         assert(s);
         assert(s->split_mode >= 0 && s->split_mode < (int) ELEMENTSOF(hash_ops));
+        assert(writers);
 
-        s->writers = hashmap_new(hash_ops[s->split_mode]);
-        if (!s->writers)
+        *writers = hashmap_new(hash_ops[s->split_mode]);
+        if (!*writers)
                 return log_oom();
 
         return 0;
 }
 
-int journal_remote_get_writer(RemoteServer *s, const char *host, Writer **writer) {
+int journal_remote_get_writer(RemoteServer *s, RemoteWorker *worker, const char *host, Writer **writer) {
         _cleanup_(writer_unrefp) Writer *w = NULL;
+        Hashmap *writers;
         const void *key;
         int r;
 
+        /* A worker keeps its own writers, so that each journal file is only ever touched by one thread */
+        writers = worker ? worker->writers : s->writers;
+
         switch(s->split_mode) {
         case JOURNAL_WRITE_SPLIT_NONE:
                 key = "one and only";
@@ -113,11 +118,11 @@ int journal_remote_get_writer(RemoteServer *s, const char *host, Writer **writer
                 assert_not_reached();
         }
 
-        w = hashmap_get(s->writers, key);
+        w = hashmap_get(writers, key);
         if (w)
                 writer_ref(w);
         else {
-                w = writer_new(s);
+                w = writer_new(s, worker);
                 if (!w)
                         return log_oom();
 
@@ -131,7 +136,7 @@ int journal_remote_get_writer(RemoteServer *s, const char *host, Writer **writer
                 if (r < 0)
                         return r;
 
-                r = hashmap_put(s->writers, w->hashmap_key ?: key, w);
+                r = hashmap_put(writers, w->hashmap_key ?: key, w);
                 if (r < 0)
                         return r;
         }
@@ -141,6 +146,18 @@ int journal_remote_get_writer(RemoteServer *s, const char *host, Writer **writer
         return 0;
 }
 
+uint64_t journal_remote_event_count(RemoteServer *s) {
+        uint64_t n;
+
+        assert(s);
+
+        n = s->event_count;
+        for (size_t i = 0; i < s->n_workers; i++)
+                n += __atomic_load_n(&s->workers[i].event_count, __ATOMIC_RELAXED);
+
+        return n;
+}
+
 /**********************************************************************
  **********************************************************************
  **********************************************************************/
@@ -174,7 +191,7 @@ static int get_source_for_fd(RemoteServer *s,
         if (!GREEDY_REALLOC0(s->sources, fd + 1))
                 return log_oom();
 
-        r = journal_remote_get_writer(s, name, &writer);
+        r = journal_remote_get_writer(s, NULL, name, &writer);
         if (r < 0)
                 return log_warning_errno(r, "Failed to get writer for source %s: %m",
                                          name);
@@ -226,6 +243,30 @@ int journal_remote_add_source(RemoteServer *s, int fd, char* name, bool own_name
                         return log_oom();
         }
 
+        if (s->n_workers > 0) {
+                RemoteWorker *w;
+
+                /* The worker opens the output itself, so that it is only used on its thread */
+                source = source_new(fd, false, name, NULL);
+                if (!source) {
+                        free(name);
+                        return log_oom();
+                }
+
+                w = journal_remote_pick_worker(s, name);
+                source->worker = w;
+
+                r = remote_worker_add_source(w, source);
+                if (r < 0) {
+                        /* this closes fd too */
+                        source_free(source);
+                        return r;
+                }
+
+                s->active++;
+                return 1; /* work to do */
+        }
+
         r = get_source_for_fd(s, fd, name, &source);
         if (r < 0) {
                 log_error_errno(r, "Failed to create source for fd:%d (%s): %m",
@@ -329,7 +370,7 @@ int journal_remote_server_init(
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate event loop: %m");
 
-        r = init_writer_hashmap(s);
+        r = journal_remote_init_writers(s, &s->writers);
         if (r < 0)
                 return r;
 
@@ -352,6 +393,9 @@ void journal_remote_server_destroy(RemoteServer *s) {
         hashmap_free_with_destructor(s->daemons, MHDDaemonWrapper_free);
 #endif
 
+        /* After the daemons, which hand the remaining data of their connections to the workers */
+        journal_remote_stop_workers(s);
+
         for (i = 0; i < MALLOC_ELEMENTSOF(s->sources); i++)
                 remove_source(s, i);
         free(s->sources);
@@ -5,6 +5,7 @@
 
 #include "hashmap.h"
 #include "journal-remote-parse.h"
+#include "journal-remote-worker.h"
 #include "journal-remote-write.h"
 
 #if HAVE_MICROHTTPD
@@ -32,6 +33,10 @@ struct RemoteServer {
         Writer *_single_writer;
         uint64_t event_count;
 
+        /* With workers, the sources of each host are read and its journal file is written by one of them */
+        RemoteWorker *workers;
+        size_t n_workers;
+
 #if HAVE_MICROHTTPD
         Hashmap *daemons;
 #endif
@@ -51,7 +56,9 @@ int journal_remote_server_init(
                 bool compress,
                 bool seal);
 
-int journal_remote_get_writer(RemoteServer *s, const char *host, Writer **writer);
+int journal_remote_init_writers(RemoteServer *s, Hashmap **writers);
+int journal_remote_get_writer(RemoteServer *s, RemoteWorker *worker, const char *host, Writer **writer);
+uint64_t journal_remote_event_count(RemoteServer *s);
 
 int journal_remote_add_source(RemoteServer *s, int fd, char* name, bool own_name);
 int journal_remote_add_raw_socket(RemoteServer *s, int fd);
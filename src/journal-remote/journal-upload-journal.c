@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
 #include <curl/curl.h>
+#include <endian.h>
 #include <stdbool.h>
 
 #include "sd-daemon.h"
@@ -8,231 +9,238 @@
 #include "alloc-util.h"
 #include "journal-upload.h"
 #include "log.h"
+#include "memory-util.h"
 #include "string-util.h"
 #include "utf8.h"
 #include "util.h"
 
+static void put(char *buf, size_t size, size_t *pos, const void *data, size_t n) {
+        /* Only copies data as long as there is space, but always counts, so that we learn how much space an
+         * entry needs even if it doesn't fit. */
+        if (n <= size && *pos <= size - n)
+                memcpy(buf + *pos, data, n);
+        *pos += n;
+}
+
 /**
- * Write up to size bytes to buf. Return negative on error, and number of
- * bytes written otherwise. The last case is a kind of an error too.
+ * Serialize the current entry in export format to buf, straight from the
+ * data the journal hands us. Return negative on error, and the size of the
+ * entry otherwise. If that is larger than size, buf contains garbage and
+ * the entry has to be serialized again into a larger buffer.
  */
-static ssize_t write_entry(char *buf, size_t size, Uploader *u) {
+static ssize_t entry_export(Uploader *u, char *buf, size_t size) {
+        char header[STRLEN("\n__REALTIME_TIMESTAMP=\n__MONOTONIC_TIMESTAMP=\n_BOOT_ID=\n") +
+                    2 * DECIMAL_STR_MAX(usec_t) + SD_ID128_STRING_MAX];
+        usec_t realtime, monotonic;
+        sd_id128_t boot_id;
+        const void *data;
+        size_t pos = 0, length;
         int r;
-        size_t pos = 0;
-
-        assert(size <= SSIZE_MAX);
 
-        for (;;) {
-
-                switch(u->entry_state) {
-                case ENTRY_CURSOR: {
-                        u->current_cursor = mfree(u->current_cursor);
-
-                        r = sd_journal_get_cursor(u->journal, &u->current_cursor);
-                        if (r < 0)
-                                return log_error_errno(r, "Failed to get cursor: %m");
+        assert(u);
+        assert(buf || size == 0);
 
-                        r = snprintf(buf + pos, size - pos,
-                                     "__CURSOR=%s\n", u->current_cursor);
-                        assert(r >= 0);
-                        if ((size_t) r > size - pos)
-                                /* not enough space */
-                                return pos;
+        if (!u->pending_cursor) {
+                r = sd_journal_get_cursor(u->journal, &u->pending_cursor);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to get cursor: %m");
+        }
 
-                        u->entry_state++;
+        r = sd_journal_get_realtime_usec(u->journal, &realtime);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get realtime timestamp: %m");
 
-                        if (pos + r == size) {
-                                /* exactly one character short, but we don't need it */
-                                buf[size - 1] = '\n';
-                                return size;
-                        }
+        r = sd_journal_get_monotonic_usec(u->journal, &monotonic, &boot_id);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get monotonic timestamp: %m");
+
+        put(buf, size, &pos, "__CURSOR=", STRLEN("__CURSOR="));
+        put(buf, size, &pos, u->pending_cursor, strlen(u->pending_cursor));
+
+        r = snprintf(header, sizeof(header),
+                     "\n__REALTIME_TIMESTAMP="USEC_FMT
+                     "\n__MONOTONIC_TIMESTAMP="USEC_FMT
+                     "\n_BOOT_ID=%s\n",
+                     realtime, monotonic, SD_ID128_TO_STRING(boot_id));
+        assert(r > 0 && (size_t) r < sizeof(header));
+        put(buf, size, &pos, header, r);
+
+        sd_journal_restart_data(u->journal);
+        while ((r = sd_journal_enumerate_data(u->journal, &data, &length)) > 0) {
+                const char *c;
+                uint64_t le64;
+
+                /* We already printed the boot id from the data in
+                 * the header, hence let's suppress it here */
+                if (memory_startswith(data, length, "_BOOT_ID="))
+                        continue;
 
-                        pos += r;
+                if (utf8_is_printable_newline(data, length, false)) {
+                        put(buf, size, &pos, data, length);
+                        put(buf, size, &pos, "\n", 1);
+                        continue;
                 }
-                        _fallthrough_;
-                case ENTRY_REALTIME: {
-                        usec_t realtime;
 
-                        r = sd_journal_get_realtime_usec(u->journal, &realtime);
-                        if (r < 0)
-                                return log_error_errno(r, "Failed to get realtime timestamp: %m");
+                c = memchr(data, '=', length);
+                if (!c || c == data)
+                        return log_error_errno(SYNTHETIC_ERRNO(EINVAL),
+                                               "Invalid field.");
+                c++;
 
-                        r = snprintf(buf + pos, size - pos,
-                                     "__REALTIME_TIMESTAMP="USEC_FMT"\n", realtime);
-                        assert(r >= 0);
-                        if ((size_t) r > size - pos)
-                                /* not enough space */
-                                return pos;
+                le64 = htole64(length - (c - (const char*) data));
 
-                        u->entry_state++;
+                put(buf, size, &pos, data, c - (const char*) data - 1);
+                put(buf, size, &pos, "\n", 1);
+                put(buf, size, &pos, &le64, sizeof(le64));
+                put(buf, size, &pos, c, length - (c - (const char*) data));
+                put(buf, size, &pos, "\n", 1);
+        }
+        if (r < 0)
+                return log_error_errno(r, "Failed to move to next field in entry: %m");
 
-                        if (r + pos == size) {
-                                /* exactly one character short, but we don't need it */
-                                buf[size - 1] = '\n';
-                                return size;
-                        }
+        put(buf, size, &pos, "\n", 1);
 
-                        pos += r;
-                }
-                        _fallthrough_;
-                case ENTRY_MONOTONIC: {
-                        usec_t monotonic;
-                        sd_id128_t boot_id;
+        assert(pos <= SSIZE_MAX);
+        return pos;
+}
 
-                        r = sd_journal_get_monotonic_usec(u->journal, &monotonic, &boot_id);
-                        if (r < 0)
-                                return log_error_errno(r, "Failed to get monotonic timestamp: %m");
+static void entry_done(Uploader *u) {
+        assert(u);
+        assert(u->entry_pending);
 
-                        r = snprintf(buf + pos, size - pos,
-                                     "__MONOTONIC_TIMESTAMP="USEC_FMT"\n", monotonic);
-                        assert(r >= 0);
-                        if ((size_t) r > size - pos)
-                                /* not enough space */
-                                return pos;
+        u->entry_pending = false;
+        u->entries_sent++;
+        free_and_replace(u->current_cursor, u->pending_cursor);
 
-                        u->entry_state++;
+        log_debug("Entry %zu (%s) has been uploaded.",
+                  u->entries_sent, u->current_cursor);
+}
 
-                        if (r + pos == size) {
-                                /* exactly one character short, but we don't need it */
-                                buf[size - 1] = '\n';
-                                return size;
+/**
+ * Serialize as many whole entries as fit into buf. Return negative on error,
+ * and the number of bytes written otherwise. If an entry doesn't fit anymore,
+ * it is left pending.
+ */
+static ssize_t write_entries(char *buf, size_t size, Uploader *u) {
+        size_t filled = 0;
+        ssize_t n;
+        int r;
+
+        while (!u->journal_drained) {
+                if (!u->entry_pending) {
+                        r = sd_journal_next(u->journal);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to move to next entry in journal: %m");
+                        if (r == 0) {
+                                u->journal_drained = true;
+                                break;
                         }
 
-                        pos += r;
+                        u->entry_pending = true;
+                        u->pending_cursor = mfree(u->pending_cursor);
                 }
-                        _fallthrough_;
-                case ENTRY_BOOT_ID: {
-                        sd_id128_t boot_id;
 
-                        r = sd_journal_get_monotonic_usec(u->journal, NULL, &boot_id);
-                        if (r < 0)
-                                return log_error_errno(r, "Failed to get monotonic timestamp: %m");
+                n = entry_export(u, buf + filled, size - filled);
+                if (n < 0)
+                        return n;
+                if ((size_t) n > size - filled)
+                        break;
 
-                        r = snprintf(buf + pos, size - pos,
-                                     "_BOOT_ID=%s\n", SD_ID128_TO_STRING(boot_id));
-                        assert(r >= 0);
-                        if ((size_t) r > size - pos)
-                                /* not enough space */
-                                return pos;
+                filled += n;
+                entry_done(u);
+        }
 
-                        u->entry_state++;
+        return filled;
+}
 
-                        if (r + pos == size) {
-                                /* exactly one character short, but we don't need it */
-                                buf[size - 1] = '\n';
-                                return size;
-                        }
+/**
+ * Serialize entries into our own buffer, as many as fit into max bytes, but
+ * at least one, however large it is.
+ */
+static int fill_buffer(Uploader *u, size_t max) {
+        ssize_t n = 0;
 
-                        pos += r;
-                }
-                        _fallthrough_;
-                case ENTRY_NEW_FIELD: {
-                        u->field_pos = 0;
+        assert(u);
 
-                        r = sd_journal_enumerate_data(u->journal,
-                                                      &u->field_data,
-                                                      &u->field_length);
-                        if (r < 0)
-                                return log_error_errno(r, "Failed to move to next field in entry: %m");
-                        else if (r == 0) {
-                                u->entry_state = ENTRY_OUTRO;
-                                continue;
-                        }
+        u->buffer_pos = u->buffer_filled = 0;
 
-                        /* We already printed the boot id from the data in
-                         * the header, hence let's suppress it here */
-                        if (memory_startswith(u->field_data, u->field_length, "_BOOT_ID="))
-                                continue;
+        if (max > 0) {
+                if (!GREEDY_REALLOC(u->buffer, max))
+                        return log_oom();
 
-                        if (!utf8_is_printable_newline(u->field_data, u->field_length, false)) {
-                                u->entry_state = ENTRY_BINARY_FIELD_START;
-                                continue;
-                        }
+                n = write_entries(u->buffer, max, u);
+                if (n < 0)
+                        return n;
+        }
 
-                        u->entry_state++;
-                }
-                        _fallthrough_;
-                case ENTRY_TEXT_FIELD:
-                case ENTRY_BINARY_FIELD: {
-                        bool done;
-                        size_t tocopy;
-
-                        done = size - pos > u->field_length - u->field_pos;
-                        if (done)
-                                tocopy = u->field_length - u->field_pos;
-                        else
-                                tocopy = size - pos;
-
-                        memcpy(buf + pos,
-                               (char*) u->field_data + u->field_pos,
-                               tocopy);
-
-                        if (done) {
-                                buf[pos + tocopy] = '\n';
-                                pos += tocopy + 1;
-                                u->entry_state = ENTRY_NEW_FIELD;
-                                continue;
-                        } else {
-                                u->field_pos += tocopy;
-                                return size;
-                        }
-                }
+        if (n == 0 && u->entry_pending) {
+                n = entry_export(u, NULL, 0);
+                if (n < 0)
+                        return n;
 
-                case ENTRY_BINARY_FIELD_START: {
-                        const char *c;
-                        size_t len;
+                if (!GREEDY_REALLOC(u->buffer, n))
+                        return log_oom();
 
-                        c = memchr(u->field_data, '=', u->field_length);
-                        if (!c || c == u->field_data)
-                                return log_error_errno(SYNTHETIC_ERRNO(EINVAL),
-                                                       "Invalid field.");
+                n = entry_export(u, u->buffer, n);
+                if (n < 0)
+                        return n;
 
-                        len = c - (const char*)u->field_data;
+                entry_done(u);
+        }
 
-                        /* need space for label + '\n' */
-                        if (size - pos < len + 1)
-                                return pos;
+        u->buffer_filled = n;
+        return 0;
+}
 
-                        memcpy(buf + pos, u->field_data, len);
-                        buf[pos + len] = '\n';
-                        pos += len + 1;
+static size_t read_buffer(Uploader *u, char *buf, size_t size) {
+        size_t n;
 
-                        u->field_pos = len + 1;
-                        u->entry_state++;
-                }
-                        _fallthrough_;
-                case ENTRY_BINARY_FIELD_SIZE: {
-                        uint64_t le64;
+        n = MIN(u->buffer_filled - u->buffer_pos, size);
+        memcpy_safe(buf, u->buffer + u->buffer_pos, n);
+        u->buffer_pos += n;
 
-                        /* need space for uint64_t */
-                        if (size - pos < 8)
-                                return pos;
+        return n;
+}
 
-                        le64 = htole64(u->field_length - u->field_pos);
-                        memcpy(buf + pos, &le64, 8);
-                        pos += 8;
+#if HAVE_ZSTD
+/**
+ * Compress what is in our buffer into buf, and finish the frame once the
+ * journal is drained. Return negative on error, 0 once the frame is complete,
+ * and positive otherwise.
+ */
+static int compress_buffer(Uploader *u, char *buf, size_t size, size_t *ret_size) {
+        ZSTD_inBuffer input = {
+                .src = u->buffer + u->buffer_pos,
+                .size = u->buffer_filled - u->buffer_pos,
+        };
+        ZSTD_outBuffer output = {
+                .dst = buf,
+                .size = size,
+        };
+        size_t k;
 
-                        u->entry_state++;
-                        continue;
-                }
+        assert(u);
+        assert(u->zstd);
+        assert(ret_size);
 
-                case ENTRY_OUTRO:
-                        /* need space for '\n' */
-                        if (size - pos < 1)
-                                return pos;
+        if (u->journal_drained && input.size == 0 && !u->zstd_frame_open) {
+                *ret_size = 0;
+                return 0;
+        }
 
-                        buf[pos++] = '\n';
-                        u->entry_state++;
-                        u->entries_sent++;
+        k = ZSTD_compressStream2(u->zstd, &output, &input,
+                                 u->journal_drained ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(k))
+                return log_error_errno(SYNTHETIC_ERRNO(EIO),
+                                       "Failed to compress entries: %s", ZSTD_getErrorName(k));
 
-                        return pos;
+        u->buffer_pos += input.pos;
+        u->zstd_frame_open = !u->journal_drained || k > 0;
 
-                default:
-                        assert_not_reached();
-                }
-        }
-        assert_not_reached();
+        *ret_size = output.pos;
+        return u->zstd_frame_open;
 }
+#endif
 
 static void check_update_watchdog(Uploader *u) {
         usec_t after;
@@ -252,54 +260,74 @@ static void check_update_watchdog(Uploader *u) {
 
 static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void *userp) {
         Uploader *u = userp;
-        int r;
-        sd_journal *j;
-        size_t filled = 0;
+        size_t filled = 0, total;
         ssize_t w;
+        int r;
 
         assert(u);
         assert(nmemb <= SSIZE_MAX / size);
 
         check_update_watchdog(u);
 
-        j = u->journal;
+        total = size * nmemb;
 
-        while (j && filled < size * nmemb) {
-                if (u->entry_state == ENTRY_DONE) {
-                        r = sd_journal_next(j);
-                        if (r < 0) {
-                                log_error_errno(r, "Failed to move to next entry in journal: %m");
-                                return CURL_READFUNC_ABORT;
-                        } else if (r == 0) {
-                                if (u->input_event)
-                                        log_debug("No more entries, waiting for journal.");
-                                else {
-                                        log_info("No more entries, closing journal.");
-                                        close_journal_input(u);
-                                }
+        while (u->journal && filled < total) {
+#if HAVE_ZSTD
+                if (u->zstd) {
+                        size_t n;
 
-                                u->uploading = false;
+                        /* Compression works best on large chunks, hence collect a full buffer of entries
+                         * before passing them through the compressor. */
+                        if (u->buffer_pos >= u->buffer_filled && !u->journal_drained) {
+                                r = fill_buffer(u, JOURNAL_UPLOAD_BUFFER_SIZE);
+                                if (r < 0)
+                                        return CURL_READFUNC_ABORT;
+                        }
+
+                        r = compress_buffer(u, (char*) buf + filled, total - filled, &n);
+                        if (r < 0)
+                                return CURL_READFUNC_ABORT;
+                        filled += n;
 
+                        if (r == 0)
                                 break;
-                        }
 
-                        u->entry_state = ENTRY_CURSOR;
+                        continue;
+                }
+#endif
+
+                /* First hand over what is left of an entry that didn't fit last time */
+                if (u->buffer_pos < u->buffer_filled) {
+                        filled += read_buffer(u, (char*) buf + filled, total - filled);
+                        continue;
                 }
 
-                w = write_entry((char*)buf + filled, size * nmemb - filled, u);
+                if (u->journal_drained)
+                        break;
+
+                /* Then serialize entries straight into curl's buffer, and only take the detour through our
+                 * own buffer for the one entry that doesn't fit anymore. */
+                w = write_entries((char*) buf + filled, total - filled, u);
                 if (w < 0)
                         return CURL_READFUNC_ABORT;
                 filled += w;
 
-                if (filled == 0) {
-                        log_error("Buffer space is too small to write entry.");
-                        return CURL_READFUNC_ABORT;
-                } else if (u->entry_state != ENTRY_DONE)
-                        /* This means that all available space was used up */
-                        break;
+                if (u->entry_pending) {
+                        r = fill_buffer(u, 0);
+                        if (r < 0)
+                                return CURL_READFUNC_ABORT;
+                }
+        }
+
+        if (u->uploading && u->journal_drained && filled < total) {
+                if (u->input_event)
+                        log_debug("No more entries, waiting for journal.");
+                else {
+                        log_info("No more entries, closing journal.");
+                        close_journal_input(u);
+                }
 
-                log_debug("Entry %zu (%s) has been uploaded.",
-                          u->entries_sent, u->current_cursor);
+                u->uploading = false;
         }
 
         return filled;
@@ -330,7 +358,18 @@ static int process_journal_input(Uploader *u, int skip) {
                 return 0;
 
         /* have data */
-        u->entry_state = ENTRY_CURSOR;
+        u->entry_pending = true;
+        u->pending_cursor = mfree(u->pending_cursor);
+        u->journal_drained = false;
+        u->buffer_pos = u->buffer_filled = 0;
+
+#if HAVE_ZSTD
+        if (u->zstd) {
+                (void) ZSTD_CCtx_reset(u->zstd, ZSTD_reset_session_only);
+                u->zstd_frame_open = false;
+        }
+#endif
+
         return start_upload(u, journal_input_callback, u);
 }
 
@@ -371,13 +410,26 @@ int open_journal_for_upload(Uploader *u,
                             sd_journal *j,
                             const char *cursor,
                             bool after_cursor,
-                            bool follow) {
+                            bool follow,
+                            bool compress) {
         int fd, r, events;
 
         u->journal = j;
 
         sd_journal_set_data_threshold(j, 0);
 
+        if (compress) {
+#if HAVE_ZSTD
+                u->zstd = ZSTD_createCCtx();
+                if (!u->zstd)
+                        return log_oom();
+
+                u->compress = true;
+#else
+                log_warning("Compression requested, but zstd support is not compiled in, uploading uncompressed.");
+#endif
+        }
+
         if (follow) {
                 fd = sd_journal_get_fd(j);
                 if (fd < 0)
@@ -55,6 +55,7 @@ static bool arg_merge = false;
 static int arg_follow = -1;
 static const char *arg_save_state = NULL;
 static usec_t arg_network_timeout_usec = USEC_INFINITY;
+static bool arg_compress = false;
 
 static void close_fd_input(Uploader *u);
 
@@ -202,6 +203,13 @@ int start_upload(Uploader *u,
                         return log_oom();
                 h = l;
 
+                if (u->compress) {
+                        l = curl_slist_append(h, "Content-Encoding: zstd");
+                        if (!l)
+                                return log_oom();
+                        h = l;
+                }
+
                 u->header = TAKE_PTR(h);
         }
 
@@ -240,6 +248,12 @@ int start_upload(Uploader *u,
                 easy_setopt(curl, CURLOPT_READDATA, data,
                             LOG_ERR, return -EXFULL);
 
+#if LIBCURL_VERSION_NUM >= 0x073e00
+                /* Let curl ask for large chunks, so that fewer calls are needed */
+                easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, (long) JOURNAL_UPLOAD_BUFFER_SIZE,
+                            LOG_WARNING, );
+#endif
+
                 /* use our special own mime type and chunked transfer */
                 easy_setopt(curl, CURLOPT_HTTPHEADER, u->header,
                             LOG_ERR, return -EXFULL);
@@ -473,6 +487,12 @@ static void destroy_uploader(Uploader *u) {
 
         free(u->last_cursor);
         free(u->current_cursor);
+        free(u->pending_cursor);
+
+        free(u->buffer);
+#if HAVE_ZSTD
+        ZSTD_freeCCtx(u->zstd);
+#endif
 
         free(u->url);
 
@@ -574,6 +594,7 @@ static int parse_config(void) {
                 { "Upload",  "ServerCertificateFile",  config_parse_path_or_ignore, 0, &arg_cert                 },
                 { "Upload",  "TrustedCertificateFile", config_parse_path_or_ignore, 0, &arg_trust                },
                 { "Upload",  "NetworkTimeoutSec",      config_parse_sec,            0, &arg_network_timeout_usec },
+                { "Upload",  "Compress",               config_parse_bool,           0, &arg_compress             },
                 {}
         };
 
@@ -618,6 +639,7 @@ static int help(void) {
                "     --follow[=BOOL]        Do [not] wait for input\n"
                "     --save-state[=FILE]    Save uploaded cursors (default \n"
                "                            " STATE_FILE ")\n"
+               "     --compress[=BOOL]      Compress uploaded entries with zstd (default: no)\n"
                "\nSee the %s for details.\n",
                program_invocation_short_name,
                link);
@@ -638,6 +660,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_AFTER_CURSOR,
                 ARG_FOLLOW,
                 ARG_SAVE_STATE,
+                ARG_COMPRESS,
         };
 
         static const struct option options[] = {
@@ -657,6 +680,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "after-cursor", required_argument, NULL, ARG_AFTER_CURSOR   },
                 { "follow",       optional_argument, NULL, ARG_FOLLOW         },
                 { "save-state",   optional_argument, NULL, ARG_SAVE_STATE     },
+                { "compress",     optional_argument, NULL, ARG_COMPRESS       },
                 {}
         };
 
@@ -769,6 +793,12 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_save_state = optarg ?: STATE_FILE;
                         break;
 
+                case ARG_COMPRESS:
+                        r = parse_boolean_argument("--compress", optarg, &arg_compress);
+                        if (r < 0)
+                                return r;
+                        break;
+
                 case '?':
                         return log_error_errno(SYNTHETIC_ERRNO(EINVAL),
                                                "Unknown option %s.",
@@ -863,7 +893,8 @@ static int run(int argc, char **argv) {
                 r = open_journal_for_upload(&u, j,
                                             arg_cursor ?: u.last_cursor,
                                             arg_cursor ? arg_after_cursor : true,
-                                            arg_follow != 0);
+                                            arg_follow != 0,
+                                            arg_compress);
                 if (r < 0)
                         return r;
         }
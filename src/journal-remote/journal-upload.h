@@ -4,25 +4,15 @@
 
 #include <inttypes.h>
 
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "sd-event.h"
 #include "sd-journal.h"
 
 #include "time-util.h"
 
-typedef enum {
-        ENTRY_CURSOR = 0,           /* Nothing actually written yet. */
-        ENTRY_REALTIME,
-        ENTRY_MONOTONIC,
-        ENTRY_BOOT_ID,
-        ENTRY_NEW_FIELD,            /* In between fields. */
-        ENTRY_TEXT_FIELD,           /* In the middle of a text field. */
-        ENTRY_BINARY_FIELD_START,   /* Writing the name of a binary field. */
-        ENTRY_BINARY_FIELD_SIZE,    /* Writing the size of a binary field. */
-        ENTRY_BINARY_FIELD,         /* In the middle of a binary field. */
-        ENTRY_OUTRO,                /* Writing '\n' */
-        ENTRY_DONE,                 /* Need to move to a new field. */
-} entry_state;
-
 typedef struct Uploader {
         sd_event *events;
         sd_event_source *sigint_event, *sigterm_event;
@@ -42,10 +32,19 @@ typedef struct Uploader {
 
         /* journal stuff */
         sd_journal* journal;
+        bool entry_pending;         /* The current entry still needs to be serialized. */
+        bool journal_drained;       /* No more entries for the running upload. */
+        char *pending_cursor;
 
-        entry_state entry_state;
-        const void *field_data;
-        size_t field_pos, field_length;
+        /* Entries that have been serialized, but not handed to curl yet */
+        char *buffer;
+        size_t buffer_pos, buffer_filled;
+
+        bool compress;
+#if HAVE_ZSTD
+        ZSTD_CCtx *zstd;
+        bool zstd_frame_open;
+#endif
 
         /* general metrics */
         const char *state_file;
@@ -58,6 +57,10 @@ typedef struct Uploader {
 
 #define JOURNAL_UPLOAD_POLL_TIMEOUT (10 * USEC_PER_SEC)
 
+/* The largest buffer curl hands to our read callback. Compressed uploads collect this much of serialized
+ * entries before they are passed through the compressor. */
+#define JOURNAL_UPLOAD_BUFFER_SIZE (512U * 1024U)
+
 int start_upload(Uploader *u,
                  size_t (*input_callback)(void *ptr,
                                           size_t size,
@@ -69,6 +72,7 @@ int open_journal_for_upload(Uploader *u,
                             sd_journal *j,
                             const char *cursor,
                             bool after_cursor,
-                            bool follow);
+                            bool follow,
+                            bool compress);
 void close_journal_input(Uploader *u);
 int check_journal_input(Uploader *u);
@@ -0,0 +1,315 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "journal-gatewayd-pool.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "sort-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "tmpfile-util.h"
+
+/* Runs the journal pool of journal-gatewayd through what requests do with it: paging through the journal
+ * with cursors, and following it. The benchmark compares many concurrent clients paging through the journal
+ * with journals from the pool against opening a journal for each request, as gatewayd did before. */
+
+#define N_CLIENTS 100U
+#define PAGE_SIZE 100U
+#define N_FILES 20U
+
+static unsigned arg_n_entries;
+
+static JournalFile* make_journal(const char *dir, const char *name, unsigned n) {
+        _cleanup_free_ char *path = NULL;
+        JournalFile *f;
+
+        assert_se(path = path_join(dir, name));
+        assert_se(journal_file_open(-1, path, O_RDWR|O_CREAT, 0644, true, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (unsigned i = 0; i < n; i++) {
+                char message[STRLEN("MESSAGE=entry ") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec;
+                dual_timestamp ts;
+
+                xsprintf(message, "MESSAGE=entry %u", i);
+                iovec = IOVEC_MAKE_STRING(message);
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        return f;
+}
+
+static void assert_message(sd_journal *j, const char *expected) {
+        const void *d;
+        size_t l;
+
+        assert_se(sd_journal_get_data(j, "MESSAGE", &d, &l) >= 0);
+        assert_se(l == strlen("MESSAGE=") + strlen(expected));
+        assert_se(memcmp((const char*) d + strlen("MESSAGE="), expected, l - strlen("MESSAGE=")) == 0);
+}
+
+static void test_reuse(const char *dir) {
+        _cleanup_(journal_pool_freep) JournalPool *p = NULL;
+        _cleanup_free_ char *cursor = NULL;
+        sd_journal *j;
+        uint64_t generation;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_pool_new(&p, dir, NULL, 0) >= 0);
+
+        assert_se(journal_pool_get(p, NULL, NULL, &j, &generation) == 0);
+        assert_se(sd_journal_seek_head(j) >= 0);
+        for (unsigned i = 0; i < 10; i++)
+                assert_se(sd_journal_next(j) == 1);
+        assert_message(j, "entry 9");
+        assert_se(sd_journal_get_cursor(j, &cursor) >= 0);
+        journal_pool_put(p, j, NULL, generation);
+
+        /* The same journal, still pointing to the entry of the cursor */
+        assert_se(journal_pool_get(p, cursor, NULL, &j, &generation) == 1);
+        assert_se(sd_journal_next(j) == 1);
+        assert_message(j, "entry 10");
+        journal_pool_put(p, j, NULL, generation);
+
+        /* Different matches, so it needs to be seeked */
+        assert_se(journal_pool_get(p, cursor, STRV_MAKE("MESSAGE=entry 12"), &j, &generation) == 0);
+        assert_se(sd_journal_seek_cursor(j, cursor) >= 0);
+        assert_se(sd_journal_next(j) == 1);
+        assert_message(j, "entry 12");
+        assert_se(sd_journal_next(j) == 0);
+        journal_pool_put(p, j, STRV_MAKE("MESSAGE=entry 12"), generation);
+
+        /* The matches are gone again */
+        assert_se(journal_pool_get(p, NULL, NULL, &j, &generation) == 0);
+        assert_se(sd_journal_seek_head(j) >= 0);
+        assert_se(sd_journal_next(j) == 1);
+        assert_message(j, "entry 0");
+        assert_se(sd_journal_next(j) == 1);
+        journal_pool_put(p, j, NULL, generation);
+
+        assert_se(p->n_opened == 1);
+        assert_se(p->n_reused == 3);
+        assert_se(p->n_positioned == 1);
+        assert_se(p->n_idle == 1);
+}
+
+static void test_follow(const char *dir, JournalFile *f) {
+        _cleanup_(journal_pool_freep) JournalPool *p = NULL;
+        struct iovec iovec = IOVEC_MAKE_STRING("MESSAGE=followed");
+        JournalFile *other;
+        sd_journal *j;
+        uint64_t generation, g;
+        dual_timestamp ts;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_pool_new(&p, dir, NULL, 0) >= 0);
+
+        assert_se(journal_pool_get(p, NULL, NULL, &j, &generation) == 0);
+        assert_se(sd_journal_seek_tail(j) >= 0);
+        assert_se(sd_journal_previous(j) == 1);
+        assert_se(sd_journal_next(j) == 0);
+
+        assert_se(journal_pool_wait(p, &generation, 0) == SD_JOURNAL_NOP);
+
+        /* New entries show up without the journal doing anything */
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+
+        assert_se(journal_pool_wait(p, &generation, 10 * USEC_PER_SEC) == SD_JOURNAL_APPEND);
+        assert_se(sd_journal_next(j) == 1);
+        assert_message(j, "followed");
+
+        /* A new file is not seen by journals opened before, and those aren't taken back anymore */
+        g = generation;
+        other = make_journal(dir, "other.journal", 1);
+        do
+                assert_se((r = journal_pool_wait(p, &generation, 10 * USEC_PER_SEC)) != SD_JOURNAL_NOP);
+        while (r != SD_JOURNAL_INVALIDATE);
+
+        journal_pool_put(p, j, NULL, g);
+        assert_se(p->n_idle == 0);
+
+        assert_se(journal_pool_get(p, NULL, NULL, &j, &generation) == 0);
+        assert_se(sd_journal_seek_tail(j) >= 0);
+        assert_se(sd_journal_previous(j) == 1);
+        assert_message(j, "entry 0");
+        journal_pool_put(p, j, NULL, generation);
+        assert_se(p->n_idle == 1);
+
+        (void) journal_file_close(other);
+}
+
+static int usec_compare(const usec_t *a, const usec_t *b) {
+        return CMP(*a, *b);
+}
+
+typedef struct Client {
+        pthread_t thread;
+        JournalPool *pool; /* NULL: open a journal for every request */
+        const char *dir;
+
+        char *cursor;
+        usec_t *latencies;
+        unsigned n_requests;
+} Client;
+
+static void client_request(Client *c) {
+        sd_journal *j;
+        uint64_t generation = 0;
+        usec_t start;
+        int r;
+
+        start = now(CLOCK_MONOTONIC);
+
+        if (c->pool)
+                r = journal_pool_get(c->pool, c->cursor, NULL, &j, &generation);
+        else
+                r = sd_journal_open_directory(&j, c->dir, 0);
+        assert_se(r >= 0);
+
+        /* Like "Range: entries=cursor:1:PAGE_SIZE" */
+        if (r == 0) {
+                if (c->cursor) {
+                        assert_se(sd_journal_seek_cursor(j, c->cursor) >= 0);
+                        assert_se(sd_journal_next(j) == 1);
+                } else
+                        assert_se(sd_journal_seek_head(j) >= 0);
+        }
+
+        for (unsigned i = 0; i < PAGE_SIZE; i++) {
+                const void *d;
+                size_t l;
+
+                r = sd_journal_next(j);
+                assert_se(r >= 0);
+                if (r == 0)
+                        break;
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &d, &l) >= 0);
+        }
+
+        c->cursor = mfree(c->cursor);
+        (void) sd_journal_get_cursor(j, &c->cursor);
+
+        if (c->pool)
+                journal_pool_put(c->pool, j, NULL, generation);
+        else
+                sd_journal_close(j);
+
+        c->latencies[c->n_requests++] = now(CLOCK_MONOTONIC) - start;
+}
+
+static void* client_thread(void *userdata) {
+        Client *c = userdata;
+        unsigned n = arg_n_entries / PAGE_SIZE / N_CLIENTS;
+
+        for (unsigned i = 0; i < n; i++)
+                client_request(c);
+
+        return NULL;
+}
+
+static void run_clients(const char *dir, JournalPool *pool) {
+        _cleanup_free_ usec_t *latencies = NULL;
+        Client clients[N_CLIENTS];
+        unsigned n = 0;
+        usec_t start, t, sum = 0;
+
+        assert_se(latencies = new(usec_t, arg_n_entries / PAGE_SIZE + N_CLIENTS));
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (unsigned i = 0; i < N_CLIENTS; i++) {
+                clients[i] = (Client) {
+                        .pool = pool,
+                        .dir = dir,
+                        .latencies = latencies + i * (arg_n_entries / PAGE_SIZE / N_CLIENTS),
+                };
+
+                assert_se(pthread_create(&clients[i].thread, NULL, client_thread, clients + i) == 0);
+        }
+
+        for (unsigned i = 0; i < N_CLIENTS; i++) {
+                assert_se(pthread_join(clients[i].thread, NULL) == 0);
+                n += clients[i].n_requests;
+                free(clients[i].cursor);
+        }
+
+        t = now(CLOCK_MONOTONIC) - start;
+
+        typesafe_qsort(latencies, n, usec_compare);
+        for (unsigned i = 0; i < n; i++)
+                sum += latencies[i];
+
+        log_info("%u requests from %u clients %s: %s, latency avg %s, p50 %s, p99 %s",
+                 n, N_CLIENTS, pool ? "with the pool" : "opening the journal each time",
+                 FORMAT_TIMESPAN(t, USEC_PER_MSEC),
+                 FORMAT_TIMESPAN(sum / MAX(n, 1U), 1),
+                 FORMAT_TIMESPAN(n > 0 ? latencies[n / 2] : 0, 1),
+                 FORMAT_TIMESPAN(n > 0 ? latencies[n * 99 / 100] : 0, 1));
+}
+
+static void test_benchmark(const char *dir) {
+        _cleanup_(journal_pool_freep) JournalPool *p = NULL;
+
+        log_info("/* %s */", __func__);
+
+        run_clients(dir, NULL);
+
+        assert_se(journal_pool_new(&p, dir, NULL, 0) >= 0);
+        run_clients(dir, p);
+
+        log_info("Journals opened: %"PRIu64", reused: %"PRIu64", at the cursor: %"PRIu64,
+                 p->n_opened, p->n_reused, p->n_positioned);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL, *bench_dir = NULL;
+        JournalFile *f;
+
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_entries) >= 0 && arg_n_entries > 0);
+        else
+                arg_n_entries = slow_tests_enabled() ? 1000000 : 100000;
+
+        assert_se(mkdtemp_malloc("/tmp/test-journal-gatewayd-pool-XXXXXX", &dir) >= 0);
+        f = make_journal(dir, "test.journal", 20);
+
+        test_reuse(dir);
+        test_follow(dir, f);
+
+        (void) journal_file_close(f);
+
+        assert_se(mkdtemp_malloc("/tmp/test-journal-gatewayd-pool-XXXXXX", &bench_dir) >= 0);
+        /* Like a journal directory that saw a couple of rotations */
+        for (unsigned i = 0; i < N_FILES; i++) {
+                char name[STRLEN("test-.journal") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "test-%u.journal", i);
+                (void) journal_file_close(make_journal(bench_dir, name, arg_n_entries / N_FILES));
+        }
+
+        test_benchmark(bench_dir);
+
+        return 0;
+}
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fd-util.h"
+#include "fs-util.h"
+#include "journal-remote.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "process-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "tmpfile-util.h"
+
+/* Feeds the output of log-generator.py to journal-remote as coming from a number of hosts at once, and compares
+ * how long it takes to write it all on the event loop and with worker threads. */
+
+static unsigned arg_n_entries;
+static unsigned arg_n_hosts;
+static unsigned arg_n_workers;
+
+static int generate_input(const char *generator, int fd) {
+        char n[DECIMAL_STR_MAX(unsigned)];
+        int r;
+
+        xsprintf(n, "%u", arg_n_entries);
+
+        r = safe_fork("(log-generator)", FORK_DEATHSIG|FORK_LOG|FORK_WAIT, NULL);
+        if (r < 0)
+                return r;
+        if (r == 0) {
+                r = rearrange_stdio(-1, fd, -1);
+                if (r < 0)
+                        _exit(EXIT_FAILURE);
+
+                execlp("python3", "python3", generator, n, "--data-type=simple", "--data-size=400", NULL);
+                _exit(EXIT_FAILURE);
+        }
+
+        return 0;
+}
+
+static void run(const char *input, unsigned n_workers) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL;
+        RemoteServer s = {};
+        usec_t start, t;
+
+        assert_se(mkdtemp_malloc("/tmp/test-journal-remote-workers-XXXXXX", &dir) >= 0);
+
+        assert_se(journal_remote_server_init(&s, dir, JOURNAL_WRITE_SPLIT_HOST, false, false) >= 0);
+        assert_se(journal_remote_start_workers(&s, n_workers) >= 0);
+        assert_se(s.n_workers == n_workers);
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (unsigned i = 0; i < arg_n_hosts; i++) {
+                char name[STRLEN("host-") + DECIMAL_STR_MAX(unsigned)];
+                int fd;
+
+                xsprintf(name, "host-%u", i);
+
+                assert_se((fd = open(input, O_RDONLY|O_CLOEXEC)) >= 0);
+                assert_se(journal_remote_add_source(&s, fd, name, false) > 0);
+        }
+
+        while (s.active)
+                assert_se(sd_event_run(s.events, UINT64_MAX) >= 0);
+
+        t = now(CLOCK_MONOTONIC) - start;
+
+        assert_se(journal_remote_event_count(&s) == (uint64_t) arg_n_entries * arg_n_hosts);
+
+        journal_remote_server_destroy(&s);
+
+        log_info("%u entries from %u hosts with %u worker threads: %s, %.0f entries/s",
+                 arg_n_entries * arg_n_hosts, arg_n_hosts, n_workers,
+                 FORMAT_TIMESPAN(t, USEC_PER_MSEC),
+                 arg_n_entries * arg_n_hosts / ((double) t / USEC_PER_SEC));
+}
+
+static void test_workers(const char *input) {
+        log_info("/* %s */", __func__);
+
+        run(input, 0);
+        run(input, 1);
+        run(input, arg_n_workers);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(unlink_tempfilep) char input[] = "/tmp/test-journal-remote-workers.XXXXXX";
+        _cleanup_close_ int fd = -1;
+        const char *generator;
+
+        test_setup_logging(LOG_INFO);
+
+        generator = getenv("SYSTEMD_LOG_GENERATOR") ?: LOG_GENERATOR_PATH;
+        if (access(generator, R_OK) < 0)
+                return log_tests_skipped_errno(errno, "log-generator.py not found");
+        if (find_executable("python3", NULL) < 0)
+                return log_tests_skipped("python3 not found");
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_entries) >= 0 && arg_n_entries > 0);
+        else
+                arg_n_entries = slow_tests_enabled() ? 20000 : 2000;
+
+        if (argc >= 3)
+                assert_se(safe_atou(argv[2], &arg_n_hosts) >= 0 && arg_n_hosts > 0);
+        else
+                arg_n_hosts = 16;
+
+        if (argc >= 4)
+                assert_se(safe_atou(argv[3], &arg_n_workers) >= 0 && arg_n_workers > 0);
+        else
+                arg_n_workers = 4;
+
+        assert_se((fd = mkostemp_safe(input)) >= 0);
+        assert_se(generate_input(generator, fd) >= 0);
+
+        test_workers(input);
+
+        return 0;
+}
@@ -5,6 +5,7 @@
 #include <fnmatch.h>
 #include <getopt.h>
 #include <linux/fs.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -42,6 +43,7 @@
 #include "io-util.h"
 #include "journal-def.h"
 #include "journal-internal.h"
+#include "journal-recompress.h"
 #include "journal-util.h"
 #include "journal-vacuum.h"
 #include "journal-verify.h"
@@ -153,6 +155,7 @@ static enum {
         ACTION_ROTATE,
         ACTION_VACUUM,
         ACTION_ROTATE_AND_VACUUM,
+        ACTION_RECOMPRESS,
         ACTION_LIST_FIELDS,
         ACTION_LIST_FIELD_NAMES,
 } arg_action = ACTION_SHOW;
@@ -188,8 +191,165 @@ static int pattern_compile(const char *pattern, unsigned flags, pcre2_code **out
         *out = p;
         return 0;
 }
+
+static int end_run(char **best, size_t *n_best, const char *run, size_t *n) {
+        if (*n > *n_best) {
+                free(*best);
+                *best = strndup(run, *n);
+                if (!*best)
+                        return -ENOMEM;
+
+                *n_best = *n;
+        }
+
+        *n = 0;
+        return 0;
+}
+
+static int pattern_literal(const char *pattern, char **ret) {
+        _cleanup_free_ char *best = NULL;
+        size_t n_best = 0, n = 0, len;
+        const char *run = NULL, *p;
+
+        assert(pattern);
+        assert(ret);
+
+        /* Find the longest string that every match of the pattern must contain, so that it can be passed
+         * as hint to the journal index. This is deliberately simplistic: whenever in doubt we cut the run,
+         * and we give up completely on alternatives and inline options, which could make any part of the
+         * pattern optional. Note that we do not compile patterns in UTF mode, hence case folding only
+         * applies to ASCII, like in the index. */
+
+        if (strchr(pattern, '|') || strstr(pattern, "(?") || strstr(pattern, "\\Q"))
+                goto finish;
+
+
+        len = strlen(pattern);
+        for (p = pattern; p < pattern + len; p++) {
+                switch (*p) {
+
+                case '\\':
+                        /* Escapes are not worth the trouble. Letters and digits introduce sequences that
+                         * might take arguments (\x41, \p{L}, \k<name>, …), skip those entirely. */
+                        if (end_run(&best, &n_best, run, &n) < 0)
+                                return -ENOMEM;
+                        if (p[1] == 0)
+                                break;
+                        p++;
+                        if (!strchr(ALPHANUMERICAL, *p))
+                                break;
+                        while (p[1] != 0 && strchr(ALPHANUMERICAL "{}<>'+-", p[1]))
+                                p++;
+                        break;
+
+                case '[': {
+                        /* Skip the whole character class, "]" right at the start is part of it */
+                        if (end_run(&best, &n_best, run, &n) < 0)
+                                return -ENOMEM;
+                        p++;
+                        if (*p == '^')
+                                p++;
+                        if (*p == ']')
+                                p++;
+                        for (; *p && *p != ']'; p++)
+                                if (*p == '\\' && p[1] != 0)
+                                        p++;
+                        if (*p == 0)
+                                goto finish;
+                        break;
+                }
+
+                case '(': {
+                        unsigned depth = 1;
+
+                        /* Groups might be optional, skip them */
+                        if (end_run(&best, &n_best, run, &n) < 0)
+                                return -ENOMEM;
+                        for (p++; *p && depth > 0; p++)
+                                if (*p == '\\' && p[1] != 0)
+                                        p++;
+                                else if (*p == '(')
+                                        depth++;
+                                else if (*p == ')')
+                                        depth--;
+                        if (depth > 0)
+                                goto finish;
+                        p--;
+                        break;
+                }
+
+                case '*':
+                case '?':
+                case '{':
+                        /* The preceding character is optional */
+                        if (n > 0)
+                                n--;
+                        if (end_run(&best, &n_best, run, &n) < 0)
+                                return -ENOMEM;
+                        if (*p == '{') {
+                                p += strcspn(p, "}");
+                                if (*p == 0)
+                                        p--;
+                        }
+                        break;
+
+                case '+':
+                        /* The preceding character is required, but might be repeated */
+                        if (end_run(&best, &n_best, run, &n) < 0)
+                                return -ENOMEM;
+                        break;
+
+                case '.':
+                case '^':
+                case '$':
+                case ')':
+                        if (end_run(&best, &n_best, run, &n) < 0)
+                                return -ENOMEM;
+                        break;
+
+                default:
+                        if (n == 0)
+                                run = p;
+                        n++;
+                }
+        }
+
+        if (end_run(&best, &n_best, run, &n) < 0)
+                return -ENOMEM;
+
+finish:
+        if (n_best < 3)
+                best = mfree(best);
+
+        *ret = TAKE_PTR(best);
+        return 0;
+}
+#endif
+
+static int parallel_flag(int argc) {
+        /* When the whole journal is dumped into a pipe, for example to export it, let the files be read
+         * ahead in parallel. That's not worth it if only a few entries at the end, around a cursor or
+         * matching some filter are shown, nor if somebody pages through the output interactively. */
+        if (arg_action != ACTION_SHOW || arg_follow || arg_lines >= 0 || arg_boot || arg_dmesg ||
+            arg_cursor || arg_after_cursor || arg_since_set || arg_until_set || arg_field)
+                return 0;
+
+        if (optind < argc || arg_priorities != 0xFF || !set_isempty(arg_facilities) ||
+            !strv_isempty(arg_syslog_identifier) || !strv_isempty(arg_system_units) ||
+            !strv_isempty(arg_user_units))
+                return 0;
+
+#if HAVE_PCRE2
+        if (arg_pattern)
+                return 0;
 #endif
 
+        if (on_tty())
+                return 0;
+
+        return SD_JOURNAL_PARALLEL;
+}
+
 static int add_matches_for_device(sd_journal *j, const char *devpath) {
         _cleanup_(sd_device_unrefp) sd_device *device = NULL;
         sd_device *d = NULL;
@@ -391,6 +551,7 @@ static int help(void) {
                "     --vacuum-size=BYTES     Reduce disk usage below specified size\n"
                "     --vacuum-files=INT      Leave only the specified number of journal files\n"
                "     --vacuum-time=TIME      Remove journal files older than specified time\n"
+               "     --recompress            Recompress archived journal files\n"
                "     --verify                Verify journal file consistency\n"
                "     --sync                  Synchronize unwritten journal messages to disk\n"
                "     --relinquish-var        Stop logging to disk, log to temporary file system\n"
@@ -453,6 +614,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_VACUUM_SIZE,
                 ARG_VACUUM_FILES,
                 ARG_VACUUM_TIME,
+                ARG_RECOMPRESS,
                 ARG_NO_HOSTNAME,
                 ARG_OUTPUT_FIELDS,
                 ARG_NAMESPACE,
@@ -520,6 +682,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "vacuum-size",          required_argument, NULL, ARG_VACUUM_SIZE          },
                 { "vacuum-files",         required_argument, NULL, ARG_VACUUM_FILES         },
                 { "vacuum-time",          required_argument, NULL, ARG_VACUUM_TIME          },
+                { "recompress",           no_argument,       NULL, ARG_RECOMPRESS           },
                 { "no-hostname",          no_argument,       NULL, ARG_NO_HOSTNAME          },
                 { "output-fields",        required_argument, NULL, ARG_OUTPUT_FIELDS        },
                 { "namespace",            required_argument, NULL, ARG_NAMESPACE            },
@@ -782,6 +945,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = arg_action == ACTION_ROTATE ? ACTION_ROTATE_AND_VACUUM : ACTION_VACUUM;
                         break;
 
+                case ARG_RECOMPRESS:
+                        arg_action = ACTION_RECOMPRESS;
+                        break;
+
 #if HAVE_GCRYPT
                 case ARG_FORCE:
                         arg_force = true;
@@ -1990,48 +2157,195 @@ static int setup_keys(void) {
 #endif
 }
 
+/* Files are verified in parallel, each on its own instance of the JournalFile object, since the ones in
+ * the sd_journal object share an mmap cache. Results are shown in order nonetheless. */
+
+#define VERIFY_THREADS_MAX 8U
+
+typedef struct VerifyFile {
+        JournalFile *file;
+        usec_t first, validated, last;
+        int r;
+        bool done;
+} VerifyFile;
+
+typedef struct VerifyFiles {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        VerifyFile *files;
+        size_t n_files, next;
+        unsigned n_threads_per_file;
+        bool quit;
+} VerifyFiles;
+
+static void* verify_thread(void *userdata) {
+        VerifyFiles *v = userdata;
+
+        assert(v);
+
+        assert_se(pthread_mutex_lock(&v->mutex) == 0);
+
+        while (!v->quit && v->next < v->n_files) {
+                VerifyFile *i = v->files + v->next++;
+                JournalFile *f;
+                int r;
+
+                assert_se(pthread_mutex_unlock(&v->mutex) == 0);
+
+                r = journal_file_dup(i->file, &f);
+                if (r >= 0) {
+                        r = journal_file_verify(f, arg_verify_key, &i->first, &i->validated, &i->last,
+                                                v->n_threads_per_file, false);
+                        (void) journal_file_close(f);
+                }
+
+                assert_se(pthread_mutex_lock(&v->mutex) == 0);
+
+                i->r = r;
+                i->done = true;
+                assert_se(pthread_cond_broadcast(&v->cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&v->mutex) == 0);
+
+        return NULL;
+}
+
+static unsigned verify_start_threads(VerifyFiles *v, pthread_t *threads, unsigned n_threads) {
+        sigset_t ss, saved_ss;
+        unsigned n = 0;
+        int r;
+
+        assert(v);
+        assert(threads);
+
+        /* Returns how many threads were started. If none, the caller verifies the files itself. */
+
+        if (sigfillset(&ss) < 0)
+                return 0;
+
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r != 0)
+                return 0;
+
+        for (; n < n_threads; n++) {
+                r = pthread_create(threads + n, NULL, verify_thread, v);
+                if (r != 0) {
+                        log_debug_errno(r, "Failed to start verification thread, continuing with %u: %m", n);
+                        break;
+                }
+        }
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        return n;
+}
+
 static int verify(sd_journal *j) {
-        int r = 0;
+        _cleanup_free_ VerifyFile *files = NULL;
+        pthread_t threads[VERIFY_THREADS_MAX];
+        VerifyFiles v = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .cond = PTHREAD_COND_INITIALIZER,
+        };
+        unsigned n_cpus = 1, n_threads = 0;
+        uint64_t size = 0;
+        usec_t start, t;
         JournalFile *f;
+        size_t n = 0;
+        long k;
+        int r = 0;
 
         assert(j);
 
         log_show_color(true);
 
-        ORDERED_HASHMAP_FOREACH(f, j->files) {
-                int k;
-                usec_t first = 0, validated = 0, last = 0;
+        files = new(VerifyFile, ordered_hashmap_size(j->files));
+        if (!files)
+                return log_oom();
 
+        ORDERED_HASHMAP_FOREACH(f, j->files) {
 #if HAVE_GCRYPT
                 if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
                         log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
 #endif
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL)
+                files[n++] = (VerifyFile) {
+                        .file = f,
+                };
+
+                size += f->last_stat.st_size;
+        }
+
+        start = now(CLOCK_MONOTONIC);
+
+        k = sysconf(_SC_NPROCESSORS_ONLN);
+        if (k > 0)
+                n_cpus = MIN((unsigned) k, VERIFY_THREADS_MAX);
+
+        /* With a single file, or a single CPU, just go through the files one by one, with a progress bar.
+         * Otherwise verify several files at once, and split the CPUs between them. */
+        if (n > 1 && n_cpus > 1) {
+                v.files = files;
+                v.n_files = n;
+                v.n_threads_per_file = MAX(1U, n_cpus / (unsigned) MIN(n, (size_t) n_cpus));
+
+                n_threads = verify_start_threads(&v, threads, MIN(n, (size_t) n_cpus));
+        }
+
+        for (size_t i = 0; i < n; i++) {
+                VerifyFile *x = files + i;
+
+                if (n_threads > 0) {
+                        assert_se(pthread_mutex_lock(&v.mutex) == 0);
+                        while (!x->done)
+                                assert_se(pthread_cond_wait(&v.cond, &v.mutex) == 0);
+                        assert_se(pthread_mutex_unlock(&v.mutex) == 0);
+                } else
+                        x->r = journal_file_verify(x->file, arg_verify_key, &x->first, &x->validated, &x->last, 0, true);
+
+                if (x->r == -EINVAL) {
                         /* If the key was invalid give up right-away. */
-                        return k;
-                else if (k < 0)
-                        r = log_warning_errno(k, "FAIL: %s (%m)", f->path);
+                        r = x->r;
+                        break;
+                } else if (x->r < 0)
+                        r = log_warning_errno(x->r, "FAIL: %s (%m)", x->file->path);
                 else {
                         char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX];
-                        log_info("PASS: %s", f->path);
+                        log_info("PASS: %s", x->file->path);
 
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
+                        if (arg_verify_key && JOURNAL_HEADER_SEALED(x->file->header)) {
+                                if (x->validated > 0) {
                                         log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp_maybe_utc(a, sizeof(a), first),
-                                                 format_timestamp_maybe_utc(b, sizeof(b), validated),
-                                                 FORMAT_TIMESPAN(last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
+                                                 format_timestamp_maybe_utc(a, sizeof(a), x->first),
+                                                 format_timestamp_maybe_utc(b, sizeof(b), x->validated),
+                                                 FORMAT_TIMESPAN(x->last > x->validated ? x->last - x->validated : 0, 0));
+                                } else if (x->last > 0)
                                         log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 FORMAT_TIMESPAN(last - first, 0));
+                                                 FORMAT_TIMESPAN(x->last - x->first, 0));
                                 else
                                         log_info("=> No sealing yet, no entries in file.");
                         }
                 }
         }
 
+        assert_se(pthread_mutex_lock(&v.mutex) == 0);
+        v.quit = true;
+        assert_se(pthread_mutex_unlock(&v.mutex) == 0);
+
+        for (unsigned i = 0; i < n_threads; i++)
+                (void) pthread_join(threads[i], NULL);
+
+        if (r == -EINVAL)
+                return r;
+
+        t = now(CLOCK_MONOTONIC) - start;
+        log_info("Verified %zu journal files (%s) in %s, %s/s.",
+                 n, FORMAT_BYTES(size),
+                 FORMAT_TIMESPAN(t, USEC_PER_MSEC),
+                 FORMAT_BYTES(t > 0 ? size * USEC_PER_SEC / t : size));
+
         return r;
 }
 
@@ -2229,6 +2543,7 @@ int main(int argc, char *argv[]) {
         case ACTION_LIST_BOOTS:
         case ACTION_VACUUM:
         case ACTION_ROTATE_AND_VACUUM:
+        case ACTION_RECOMPRESS:
         case ACTION_LIST_FIELDS:
         case ACTION_LIST_FIELD_NAMES:
                 /* These ones require access to the journal files, continue below. */
@@ -2239,9 +2554,9 @@ int main(int argc, char *argv[]) {
         }
 
         if (arg_directory)
-                r = sd_journal_open_directory(&j, arg_directory, arg_journal_type);
+                r = sd_journal_open_directory(&j, arg_directory, arg_journal_type | parallel_flag(argc));
         else if (arg_root)
-                r = sd_journal_open_directory(&j, arg_root, arg_journal_type | SD_JOURNAL_OS_ROOT);
+                r = sd_journal_open_directory(&j, arg_root, arg_journal_type | parallel_flag(argc) | SD_JOURNAL_OS_ROOT);
         else if (arg_file_stdin)
                 r = sd_journal_open_files_fd(&j, (int[]) { STDIN_FILENO }, 1, 0);
         else if (arg_file)
@@ -2299,7 +2614,7 @@ int main(int argc, char *argv[]) {
                                 &j,
                                 arg_namespace,
                                 (arg_merge ? 0 : SD_JOURNAL_LOCAL_ONLY) |
-                                arg_namespace_flags | arg_journal_type);
+                                arg_namespace_flags | arg_journal_type | parallel_flag(argc));
         if (r < 0) {
                 log_error_errno(r, "Failed to open %s: %m", arg_directory ?: arg_file ? "files" : "journal");
                 goto finish;
@@ -2369,6 +2684,24 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        case ACTION_RECOMPRESS: {
+                Directory *d;
+
+                HASHMAP_FOREACH(d, j->directories_by_path) {
+                        int q;
+
+                        q = journal_directory_recompress(d->path, JOURNAL_RECOMPRESS_LEVEL, !arg_quiet);
+                        if (q == -EOPNOTSUPP) {
+                                r = log_error_errno(q, "Recompressing journal files requires zstd support.");
+                                break;
+                        }
+                        if (q < 0)
+                                r = log_error_errno(q, "Failed to recompress %s: %m", d->path);
+                }
+
+                goto finish;
+        }
+
         case ACTION_LIST_FIELD_NAMES: {
                 const char *field;
 
@@ -2430,6 +2763,28 @@ int main(int argc, char *argv[]) {
         if (r < 0)
                 goto finish;
 
+#if HAVE_PCRE2
+        if (arg_pattern) {
+                _cleanup_free_ char *literal = NULL;
+
+                r = pattern_literal(arg_pattern, &literal);
+                if (r < 0) {
+                        log_oom();
+                        goto finish;
+                }
+
+                if (literal) {
+                        log_debug("Using \"%s\" as hint for the journal index.", literal);
+
+                        r = journal_set_message_hint(j, literal);
+                        if (r < 0) {
+                                log_oom();
+                                goto finish;
+                        }
+                }
+        }
+#endif
+
         if (DEBUG_LOGGING) {
                 _cleanup_free_ char *filter = NULL;
 
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
 #include <malloc.h>
+#include <sys/epoll.h>
 
 #include "alloc-util.h"
 #include "audit-type.h"
@@ -12,6 +13,15 @@
 #include "missing_audit.h"
 #include "string-util.h"
 
+/* How many messages to receive from the audit socket with a single recvmmsg() */
+#define AUDIT_BATCH_SIZE 16U
+
+/* How many messages to read in one go at most, before giving other event sources a chance */
+#define AUDIT_READ_MAX 256U
+
+/* We use the same fixed value as auditd here, plus room for a trailing NUL */
+#define AUDIT_BUFFER_SIZE (ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH) + 1)
+
 typedef struct MapField {
         const char *audit_field;
         const char *journal_field;
@@ -467,6 +477,93 @@ void server_process_audit_message(
         process_audit_string(s, nl->nlmsg_type, NLMSG_DATA(nl), nl->nlmsg_len - ALIGN(sizeof(struct nlmsghdr)));
 }
 
+static int dispatch_audit(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        unsigned n_read = 0;
+
+        assert(s);
+        assert(fd == s->audit_fd);
+
+        if (revents != EPOLLIN)
+                return log_error_errno(SYNTHETIC_ERRNO(EIO),
+                                       "Got invalid event from epoll for audit fd: %" PRIx32,
+                                       revents);
+
+        if (!s->audit_buffer) {
+                s->audit_buffer = malloc(AUDIT_BATCH_SIZE * AUDIT_BUFFER_SIZE);
+                if (!s->audit_buffer)
+                        return log_oom();
+        }
+
+        /* Receive a couple of messages per system call, and keep going until the socket is drained. The
+         * messages are written to the journal in one batch afterwards. */
+
+        while (n_read < AUDIT_READ_MAX) {
+                CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(struct ucred))) control[AUDIT_BATCH_SIZE];
+                union sockaddr_union sa[AUDIT_BATCH_SIZE];
+                struct mmsghdr mmsg[AUDIT_BATCH_SIZE];
+                struct iovec iovec[AUDIT_BATCH_SIZE];
+                int n;
+
+                for (unsigned i = 0; i < AUDIT_BATCH_SIZE; i++) {
+                        iovec[i] = IOVEC_MAKE((uint8_t*) s->audit_buffer + i * AUDIT_BUFFER_SIZE, AUDIT_BUFFER_SIZE - 1);
+                        mmsg[i] = (struct mmsghdr) {
+                                .msg_hdr = {
+                                        .msg_name = sa + i,
+                                        .msg_namelen = sizeof(sa[i]),
+                                        .msg_iov = iovec + i,
+                                        .msg_iovlen = 1,
+                                        .msg_control = control + i,
+                                        .msg_controllen = sizeof(control[i]),
+                                },
+                        };
+                }
+
+                n = recvmmsg(fd, mmsg, AUDIT_BATCH_SIZE, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+                if (n < 0) {
+                        if (IN_SET(errno, EINTR, EAGAIN))
+                                break;
+
+                        /* The socket buffer overflowed and the kernel dropped messages. Nothing we can do
+                         * about those, but let's go on with the ones that came after. */
+                        if (errno == ENOBUFS) {
+                                s->n_audit_overruns++;
+                                log_debug("Audit socket buffer overrun, some messages lost.");
+                                continue;
+                        }
+
+                        return log_error_errno(errno, "recvmmsg() failed on audit socket: %m");
+                }
+
+                for (int i = 0; i < n; i++) {
+                        struct msghdr *mh = &mmsg[i].msg_hdr;
+                        uint8_t *buffer = mh->msg_iov->iov_base;
+
+                        if (mh->msg_flags & MSG_CTRUNC) {
+                                log_debug("Got audit message with truncated control data, ignoring.");
+                                continue;
+                        }
+
+                        /* And a trailing NUL, just in case */
+                        buffer[mmsg[i].msg_len] = 0;
+
+                        server_process_audit_message(s, buffer, mmsg[i].msg_len,
+                                                     CMSG_FIND_DATA(mh, SOL_SOCKET, SCM_CREDENTIALS, struct ucred),
+                                                     sa + i, mh->msg_namelen);
+                }
+
+                s->n_audit_records += n;
+                n_read += n;
+
+                /* Fewer than we asked for means there's nothing more right now */
+                if ((unsigned) n < AUDIT_BATCH_SIZE)
+                        break;
+        }
+
+        server_refresh_idle_timer(s);
+        return 0;
+}
+
 static int enable_audit(int fd, bool b) {
         struct {
                 union {
@@ -547,7 +644,7 @@ int server_open_audit(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to set SO_PASSCRED on audit socket: %m");
 
-        r = sd_event_add_io(s->event, &s->audit_event_source, s->audit_fd, EPOLLIN, server_process_datagram, s);
+        r = sd_event_add_io(s->event, &s->audit_event_source, s->audit_fd, EPOLLIN, dispatch_audit, s);
         if (r < 0)
                 return log_error_errno(r, "Failed to add audit fd to event loop: %m");
 
@@ -1,5 +1,10 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/inotify.h>
+
 #if HAVE_SELINUX
 #include <selinux/selinux.h>
 #endif
@@ -18,6 +23,8 @@
 #include "path-util.h"
 #include "process-util.h"
 #include "procfs-util.h"
+#include "random-util.h"
+#include "socket-util.h"
 #include "string-util.h"
 #include "syslog-util.h"
 #include "unaligned.h"
@@ -48,6 +55,16 @@
  *    stream connection. This should improve cases where a service process logs immediately before exiting and we
  *    previously had trouble associating the log message with the service.
  *
+ * If the kernel tells us about process events through the proc connector (which only the main instance subscribes to),
+ * the time based rules above don't apply. Instead an entry is reread when its process executed a new binary, changed
+ * its name or credentials, or when its PID was reused by a new process, and is never flushed out just because of its
+ * age. Processes may still be moved to a different cgroup without executing anything, which nothing tells us about,
+ * hence we check the cgroup of an entry (but nothing else) if the entry wasn't checked for 1s.
+ *
+ * The settings PID 1 exports for a unit in /run/systemd/units/ (maximum log level, extra fields, rate limit) are
+ * cached separately, once per unit, and shared by the entries of all processes of that unit. They are reread when
+ * the files in /run/systemd/units/ change, or, if we can't watch that directory, at most once every 1s.
+ *
  * NB: With and without the metadata cache: the implicitly added entry metadata in the journal (with the exception of
  *     UID/PID/GID and SELinux label) must be understood as possibly slightly out of sync (i.e. sometimes slightly older
  *     and sometimes slightly newer than what was current at the log event).
@@ -59,6 +76,9 @@
 /* Data older than 5s we flush out */
 #define MAX_USEC (5*USEC_PER_SEC)
 
+/* The proc connector reports all processes of the system, let's not lose events when lots of them fork at once */
+#define PROC_CONNECTOR_RCVBUF_SIZE (8*1024*1024)
+
 /* Keep at most 16K entries in the cache. (Note though that this limit may be violated if enough streams pin entries in
  * the cache, in which case we *do* permit this limit to be breached. That's safe however, as the number of stream
  * clients itself is limited.) */
@@ -90,6 +110,89 @@ static size_t cache_max(void) {
         return cached;
 }
 
+static void unit_context_reset(Server *s, UnitContext *u) {
+        assert(s);
+        assert(u);
+
+        u->timestamp = USEC_INFINITY;
+
+        u->log_level_max = -1;
+
+        u->extra_fields_iovec = mfree(u->extra_fields_iovec);
+        u->extra_fields_n_iovec = 0;
+        u->extra_fields_data = mfree(u->extra_fields_data);
+        u->extra_fields_mtime = NSEC_INFINITY;
+
+        u->log_ratelimit_interval = s->ratelimit_interval;
+        u->log_ratelimit_burst = s->ratelimit_burst;
+}
+
+static int unit_context_acquire(Server *s, const char *id, UnitContext **ret) {
+        _cleanup_free_ UnitContext *u = NULL;
+        UnitContext *existing;
+        int r;
+
+        assert(s);
+        assert(id);
+        assert(ret);
+
+        existing = hashmap_get(s->unit_contexts, id);
+        if (existing) {
+                existing->n_ref++;
+                *ret = existing;
+                return 0;
+        }
+
+        u = new(UnitContext, 1);
+        if (!u)
+                return -ENOMEM;
+
+        *u = (UnitContext) {
+                .n_ref = 1,
+                .timestamp = USEC_INFINITY,
+                .log_level_max = -1,
+                .extra_fields_mtime = NSEC_INFINITY,
+                .log_ratelimit_interval = s->ratelimit_interval,
+                .log_ratelimit_burst = s->ratelimit_burst,
+        };
+
+        u->id = strdup(id);
+        if (!u->id)
+                return -ENOMEM;
+
+        /* Saves hashing the id for every message that goes through the rate limiter */
+        u->ratelimit_hash = journal_ratelimit_hash(s->ratelimit, u->id);
+
+        r = hashmap_ensure_put(&s->unit_contexts, &string_hash_ops, u->id, u);
+        if (r < 0) {
+                free(u->id);
+                return r;
+        }
+
+        *ret = TAKE_PTR(u);
+        return 0;
+}
+
+static UnitContext* unit_context_unref(Server *s, UnitContext *u) {
+        assert(s);
+
+        if (!u)
+                return NULL;
+
+        assert(u->n_ref > 0);
+
+        u->n_ref--;
+        if (u->n_ref > 0)
+                return NULL;
+
+        assert_se(hashmap_remove(s->unit_contexts, u->id) == u);
+
+        unit_context_reset(s, u);
+        free(u->id);
+
+        return mfree(u);
+}
+
 static int client_context_compare(const void *a, const void *b) {
         const ClientContext *x = a, *y = b;
         int r;
@@ -126,10 +229,6 @@ static int client_context_new(Server *s, pid_t pid, ClientContext **ret) {
                 .owner_uid = UID_INVALID,
                 .lru_index = PRIOQ_IDX_NULL,
                 .timestamp = USEC_INFINITY,
-                .extra_fields_mtime = NSEC_INFINITY,
-                .log_level_max = -1,
-                .log_ratelimit_interval = s->ratelimit_interval,
-                .log_ratelimit_burst = s->ratelimit_burst,
         };
 
         r = hashmap_ensure_put(&s->client_contexts, NULL, PID_TO_PTR(pid), c);
@@ -170,15 +269,7 @@ static void client_context_reset(Server *s, ClientContext *c) {
         c->label = mfree(c->label);
         c->label_size = 0;
 
-        c->extra_fields_iovec = mfree(c->extra_fields_iovec);
-        c->extra_fields_n_iovec = 0;
-        c->extra_fields_data = mfree(c->extra_fields_data);
-        c->extra_fields_mtime = NSEC_INFINITY;
-
-        c->log_level_max = -1;
-
-        c->log_ratelimit_interval = s->ratelimit_interval;
-        c->log_ratelimit_burst = s->ratelimit_burst;
+        c->unit_context = unit_context_unref(s, c->unit_context);
 }
 
 static ClientContext* client_context_free(Server *s, ClientContext *c) {
@@ -316,6 +407,19 @@ static int client_context_read_cgroup(Server *s, ClientContext *c, const char *u
         return 0;
 }
 
+static bool client_context_cgroup_changed(Server *s, ClientContext *c) {
+        _cleanup_free_ char *t = NULL;
+
+        assert(s);
+        assert(c);
+
+        /* If the process is gone or in the root cgroup, client_context_read_cgroup() would keep what we have */
+        if (cg_pid_get_path_shifted(c->pid, s->cgroup_root, &t) < 0 || empty_or_root(t))
+                return false;
+
+        return !streq_ptr(c->cgroup, t);
+}
+
 static int client_context_read_invocation_id(
                 Server *s,
                 ClientContext *c) {
@@ -350,18 +454,14 @@ static int client_context_read_invocation_id(
         return sd_id128_from_string(value, &c->invocation_id);
 }
 
-static int client_context_read_log_level_max(
-                Server *s,
-                ClientContext *c) {
-
+static int unit_context_read_log_level_max(UnitContext *u) {
         _cleanup_free_ char *value = NULL;
         const char *p;
         int r, ll;
 
-        if (!c->unit)
-                return 0;
+        assert(u);
 
-        p = strjoina("/run/systemd/units/log-level-max:", c->unit);
+        p = strjoina("/run/systemd/units/log-level-max:", u->id);
         r = readlink_malloc(p, &value);
         if (r < 0)
                 return r;
@@ -370,13 +470,11 @@ static int client_context_read_log_level_max(
         if (ll < 0)
                 return ll;
 
-        c->log_level_max = ll;
+        u->log_level_max = ll;
         return 0;
 }
 
-static int client_context_read_extra_fields(
-                Server *s,
-                ClientContext *c) {
+static int unit_context_read_extra_fields(UnitContext *u) {
 
         _cleanup_free_ struct iovec *iovec = NULL;
         size_t size = 0, n_iovec = 0, left;
@@ -387,27 +485,26 @@ static int client_context_read_extra_fields(
         uint8_t *q;
         int r;
 
-        if (!c->unit)
-                return 0;
+        assert(u);
 
-        p = strjoina("/run/systemd/units/log-extra-fields:", c->unit);
+        p = strjoina("/run/systemd/units/log-extra-fields:", u->id);
 
-        if (c->extra_fields_mtime != NSEC_INFINITY) {
+        if (u->extra_fields_mtime != NSEC_INFINITY) {
                 if (stat(p, &st) < 0) {
                         if (errno == ENOENT)
-                                return 0;
+                                goto drop;
 
                         return -errno;
                 }
 
-                if (timespec_load_nsec(&st.st_mtim) == c->extra_fields_mtime)
+                if (timespec_load_nsec(&st.st_mtim) == u->extra_fields_mtime)
                         return 0;
         }
 
         f = fopen(p, "re");
         if (!f) {
                 if (errno == ENOENT)
-                        return 0;
+                        goto drop;
 
                 return -errno;
         }
@@ -453,51 +550,192 @@ static int client_context_read_extra_fields(
                 left -= n, q += n;
         }
 
-        free(c->extra_fields_iovec);
-        free(c->extra_fields_data);
+        free(u->extra_fields_iovec);
+        free(u->extra_fields_data);
 
-        c->extra_fields_iovec = TAKE_PTR(iovec);
-        c->extra_fields_n_iovec = n_iovec;
-        c->extra_fields_data = TAKE_PTR(data);
-        c->extra_fields_mtime = timespec_load_nsec(&st.st_mtim);
+        u->extra_fields_iovec = TAKE_PTR(iovec);
+        u->extra_fields_n_iovec = n_iovec;
+        u->extra_fields_data = TAKE_PTR(data);
+        u->extra_fields_mtime = timespec_load_nsec(&st.st_mtim);
+
+        return 0;
+
+drop:
+        /* The unit has no extra fields (anymore) */
+        u->extra_fields_iovec = mfree(u->extra_fields_iovec);
+        u->extra_fields_n_iovec = 0;
+        u->extra_fields_data = mfree(u->extra_fields_data);
+        u->extra_fields_mtime = NSEC_INFINITY;
 
         return 0;
 }
 
-static int client_context_read_log_ratelimit_interval(ClientContext *c) {
+static int unit_context_read_log_ratelimit_interval(UnitContext *u) {
         _cleanup_free_ char *value = NULL;
         const char *p;
         int r;
 
-        assert(c);
+        assert(u);
 
-        if (!c->unit)
-                return 0;
-
-        p = strjoina("/run/systemd/units/log-rate-limit-interval:", c->unit);
+        p = strjoina("/run/systemd/units/log-rate-limit-interval:", u->id);
         r = readlink_malloc(p, &value);
         if (r < 0)
                 return r;
 
-        return safe_atou64(value, &c->log_ratelimit_interval);
+        return safe_atou64(value, &u->log_ratelimit_interval);
 }
 
-static int client_context_read_log_ratelimit_burst(ClientContext *c) {
+static int unit_context_read_log_ratelimit_burst(UnitContext *u) {
         _cleanup_free_ char *value = NULL;
         const char *p;
         int r;
 
-        assert(c);
-
-        if (!c->unit)
-                return 0;
+        assert(u);
 
-        p = strjoina("/run/systemd/units/log-rate-limit-burst:", c->unit);
+        p = strjoina("/run/systemd/units/log-rate-limit-burst:", u->id);
         r = readlink_malloc(p, &value);
         if (r < 0)
                 return r;
 
-        return safe_atou(value, &c->log_ratelimit_burst);
+        return safe_atou(value, &u->log_ratelimit_burst);
+}
+
+static void unit_contexts_invalidate_all(Server *s) {
+        UnitContext *u;
+
+        assert(s);
+
+        HASHMAP_FOREACH(u, s->unit_contexts)
+                u->timestamp = USEC_INFINITY;
+}
+
+static int on_units_directory_event(sd_event_source *source, const struct inotify_event *event, void *userdata) {
+        Server *s = userdata;
+        UnitContext *u;
+        const char *id;
+
+        assert(s);
+        assert(event);
+
+        if (event->mask & (IN_IGNORED|IN_UNMOUNT)) {
+                /* The directory is gone, go back to rereading the settings of units every now and then */
+                log_debug("/run/systemd/units/ disappeared, no longer watching it.");
+                s->units_event_source = sd_event_source_disable_unref(s->units_event_source);
+                unit_contexts_invalidate_all(s);
+                return 0;
+        }
+
+        if (event->mask & IN_Q_OVERFLOW) {
+                log_debug("Lost track of changes in /run/systemd/units/, rereading settings of all units.");
+                unit_contexts_invalidate_all(s);
+                return 0;
+        }
+
+        /* All files are named after the unit they are about, prefixed with the setting and a colon */
+        id = event->len > 0 ? strchr(event->name, ':') : NULL;
+        if (!id)
+                return 0;
+
+        u = hashmap_get(s->unit_contexts, id + 1);
+        if (u)
+                u->timestamp = USEC_INFINITY;
+
+        return 0;
+}
+
+static void unit_contexts_maybe_watch(Server *s, usec_t timestamp) {
+        int r;
+
+        assert(s);
+
+        if (s->units_event_source)
+                return;
+
+        /* PID 1 creates the directory only when it exports the first setting, and might remove it again. Hence try
+         * to watch it now and then, but not every time we look at a unit. */
+        if (s->last_units_watch != 0 && s->last_units_watch + REFRESH_USEC >= timestamp)
+                return;
+
+        s->last_units_watch = timestamp;
+
+        r = sd_event_add_inotify(s->event, &s->units_event_source, "/run/systemd/units",
+                                 IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR,
+                                 on_units_directory_event, s);
+        if (r < 0) {
+                log_full_errno(r == -ENOENT ? LOG_DEBUG : LOG_WARNING, r,
+                               "Failed to watch /run/systemd/units/, ignoring: %m");
+                return;
+        }
+
+        r = sd_event_source_set_priority(s->units_event_source, SD_EVENT_PRIORITY_NORMAL);
+        if (r < 0)
+                log_debug_errno(r, "Failed to set priority of /run/systemd/units/ watch, ignoring: %m");
+
+        (void) sd_event_source_set_description(s->units_event_source, "units-directory");
+
+        /* We might have missed changes until now */
+        unit_contexts_invalidate_all(s);
+}
+
+static void unit_context_maybe_refresh(Server *s, UnitContext *u, usec_t timestamp) {
+        assert(s);
+        assert(u);
+
+        unit_contexts_maybe_watch(s, timestamp);
+
+        /* While we watch /run/systemd/units/ cached settings stay valid until the files change */
+        if (u->timestamp != USEC_INFINITY &&
+            (s->units_event_source || u->timestamp + REFRESH_USEC >= timestamp))
+                return;
+
+        /* A setting that isn't exported (anymore) means the default */
+        u->log_level_max = -1;
+        u->log_ratelimit_interval = s->ratelimit_interval;
+        u->log_ratelimit_burst = s->ratelimit_burst;
+
+        (void) unit_context_read_log_level_max(u);
+        (void) unit_context_read_extra_fields(u);
+        (void) unit_context_read_log_ratelimit_interval(u);
+        (void) unit_context_read_log_ratelimit_burst(u);
+
+        u->timestamp = timestamp;
+}
+
+static void client_context_attach_unit(Server *s, ClientContext *c, usec_t timestamp) {
+        UnitContext *u;
+        int r;
+
+        assert(s);
+        assert(c);
+
+        if (!c->unit_context || !streq_ptr(c->unit_context->id, c->unit)) {
+                c->unit_context = unit_context_unref(s, c->unit_context);
+
+                if (!c->unit)
+                        return;
+
+                r = unit_context_acquire(s, c->unit, &u);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to acquire context of unit %s, ignoring: %m", c->unit);
+                        return;
+                }
+
+                c->unit_context = u;
+        }
+
+        unit_context_maybe_refresh(s, c->unit_context, timestamp);
+}
+
+static void client_context_touch(Server *s, ClientContext *c, usec_t timestamp) {
+        assert(s);
+        assert(c);
+
+        c->timestamp = timestamp;
+
+        if (c->in_lru) {
+                assert(c->n_ref == 0);
+                assert_se(prioq_reshuffle(s->client_contexts_lru, c, &c->lru_index) >= 0);
+        }
 }
 
 static void client_context_really_refresh(
@@ -524,17 +762,10 @@ static void client_context_really_refresh(
 
         (void) client_context_read_cgroup(s, c, unit_id);
         (void) client_context_read_invocation_id(s, c);
-        (void) client_context_read_log_level_max(s, c);
-        (void) client_context_read_extra_fields(s, c);
-        (void) client_context_read_log_ratelimit_interval(c);
-        (void) client_context_read_log_ratelimit_burst(c);
-
-        c->timestamp = timestamp;
+        client_context_attach_unit(s, c, timestamp);
 
-        if (c->in_lru) {
-                assert(c->n_ref == 0);
-                assert_se(prioq_reshuffle(s->client_contexts_lru, c, &c->lru_index) >= 0);
-        }
+        c->invalidated = false;
+        client_context_touch(s, c, timestamp);
 }
 
 void client_context_maybe_refresh(
@@ -555,16 +786,33 @@ void client_context_maybe_refresh(
         if (c->timestamp == USEC_INFINITY)
                 goto refresh;
 
-        /* If the data isn't pinned and if the cashed data is older than the upper limit, we flush it out
-         * entirely. This follows the logic that as long as an entry is pinned the PID reuse is unlikely. */
-        if (c->n_ref == 0 && c->timestamp + MAX_USEC < timestamp) {
-                client_context_reset(s, c);
-                goto refresh;
-        }
+        if (s->proc_events_active) {
+                /* The kernel told us that something changed */
+                if (c->invalidated)
+                        goto refresh;
 
-        /* If the data is older than the lower limit, we refresh, but keep the old data for all we can't update */
-        if (c->timestamp + REFRESH_USEC < timestamp)
-                goto refresh;
+                /* Moving a process to another cgroup generates no event, hence check that now and then. Once
+                 * the process exited nothing can change anymore. */
+                if (!c->exited && c->timestamp + REFRESH_USEC < timestamp) {
+                        if (client_context_cgroup_changed(s, c))
+                                goto refresh;
+
+                        client_context_touch(s, c, timestamp);
+                }
+        } else {
+                /* If the data isn't pinned and if the cashed data is older than the upper limit, we flush it
+                 * out entirely. This follows the logic that as long as an entry is pinned the PID reuse is
+                 * unlikely. */
+                if (c->n_ref == 0 && c->timestamp + MAX_USEC < timestamp) {
+                        client_context_reset(s, c);
+                        goto refresh;
+                }
+
+                /* If the data is older than the lower limit, we refresh, but keep the old data for all we
+                 * can't update */
+                if (c->timestamp + REFRESH_USEC < timestamp)
+                        goto refresh;
+        }
 
         /* If the data passed along doesn't match the cached data we also do a refresh */
         if (ucred && uid_is_valid(ucred->uid) && c->uid != ucred->uid)
@@ -576,9 +824,14 @@ void client_context_maybe_refresh(
         if (label_size > 0 && (label_size != c->label_size || memcmp(label, c->label, label_size) != 0))
                 goto refresh;
 
+        if (c->unit_context)
+                unit_context_maybe_refresh(s, c->unit_context, timestamp);
+
+        s->n_client_context_hits++;
         return;
 
 refresh:
+        s->n_client_context_refreshes++;
         client_context_really_refresh(s, c, ucred, label, label_size, unit_id, timestamp);
 }
 
@@ -589,7 +842,8 @@ static void client_context_try_shrink_to(Server *s, size_t limit) {
         assert(s);
 
         /* Flush any cache entries for PIDs that have already moved on. Don't do this
-         * too often, since it's a slow process. */
+         * too often, since it's a slow process. If we get process events from the kernel we know which
+         * processes exited without asking for each of them. */
         t = now(CLOCK_MONOTONIC);
         if (s->last_cache_pid_flush + MAX_USEC < t) {
                 unsigned n = prioq_size(s->client_contexts_lru), idx = 0;
@@ -602,7 +856,7 @@ static void client_context_try_shrink_to(Server *s, size_t limit) {
 
                         assert(c->n_ref == 0);
 
-                        if (!pid_is_unwaited(c->pid))
+                        if (s->proc_events_active ? c->exited : !pid_is_unwaited(c->pid))
                                 client_context_free(s, c);
                         else
                                 idx ++;
@@ -641,9 +895,11 @@ void client_context_flush_all(Server *s) {
 
         assert(prioq_size(s->client_contexts_lru) == 0);
         assert(hashmap_size(s->client_contexts) == 0);
+        assert(hashmap_size(s->unit_contexts) == 0);
 
         s->client_contexts_lru = prioq_free(s->client_contexts_lru);
         s->client_contexts = hashmap_free(s->client_contexts);
+        s->unit_contexts = hashmap_free(s->unit_contexts);
 }
 
 static int client_context_get_internal(
@@ -684,6 +940,8 @@ static int client_context_get_internal(
                 return 0;
         }
 
+        s->n_client_context_misses++;
+
         client_context_try_shrink_to(s, cache_max()-1);
 
         r = client_context_new(s, pid, &c);
@@ -784,3 +1042,265 @@ void client_context_acquire_default(Server *s) {
 
         }
 }
+
+static void client_contexts_invalidate_all(Server *s) {
+        ClientContext *c;
+
+        assert(s);
+
+        /* We don't know what we missed, hence drop everything that isn't pinned, and reread the rest */
+        client_context_try_shrink_to(s, 0);
+
+        HASHMAP_FOREACH(c, s->client_contexts) {
+                c->invalidated = true;
+                s->n_client_context_invalidations++;
+        }
+}
+
+static void client_context_process_event(Server *s, const struct proc_event *ev, size_t size) {
+        ClientContext *c;
+        pid_t pid;
+
+        assert(s);
+        assert(ev);
+
+#define EVENT_DATA_SIZE(field) (offsetof(struct proc_event, event_data) + sizeof(ev->event_data.field))
+
+        switch (ev->what) {
+
+        case PROC_EVENT_FORK:
+                /* Only new processes are interesting, not new threads */
+                if (size < EVENT_DATA_SIZE(fork) || ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+                        return;
+
+                c = hashmap_get(s->client_contexts, PID_TO_PTR(ev->event_data.fork.child_tgid));
+                if (!c)
+                        return;
+
+                /* The PID was reused, hence whatever we know belongs to a process that is gone. Streams keep
+                 * their entries though, and they are going to be reread. */
+                s->n_client_context_invalidations++;
+
+                if (c->n_ref == 0)
+                        client_context_free(s, c);
+                else {
+                        c->invalidated = true;
+                        c->exited = false;
+                }
+
+                return;
+
+        case PROC_EVENT_EXEC:
+                if (size < EVENT_DATA_SIZE(exec))
+                        return;
+
+                pid = ev->event_data.exec.process_tgid;
+                break;
+
+        case PROC_EVENT_COMM:
+                if (size < EVENT_DATA_SIZE(comm))
+                        return;
+
+                pid = ev->event_data.comm.process_tgid;
+                break;
+
+        case PROC_EVENT_UID:
+        case PROC_EVENT_GID:
+                if (size < EVENT_DATA_SIZE(id))
+                        return;
+
+                pid = ev->event_data.id.process_tgid;
+                break;
+
+        case PROC_EVENT_EXIT:
+                if (size < EVENT_DATA_SIZE(exit) || ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+                        return;
+
+                /* Keep the data around for messages the process sent before it exited, nothing changes anymore */
+                c = hashmap_get(s->client_contexts, PID_TO_PTR(ev->event_data.exit.process_tgid));
+                if (c)
+                        c->exited = true;
+
+                return;
+
+        default:
+                return;
+        }
+
+#undef EVENT_DATA_SIZE
+
+        c = hashmap_get(s->client_contexts, PID_TO_PTR(pid));
+        if (!c || c->invalidated)
+                return;
+
+        c->invalidated = true;
+        s->n_client_context_invalidations++;
+}
+
+static void server_stop_proc_events(Server *s) {
+        assert(s);
+
+        s->proc_event_source = sd_event_source_disable_unref(s->proc_event_source);
+
+        if (s->proc_events_active) {
+                /* Go back to rereading entries after a while, and assume everything changed in between */
+                s->proc_events_active = false;
+                client_contexts_invalidate_all(s);
+        }
+}
+
+static int dispatch_proc_connector(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        /* Read until there's nothing left, so that the events are processed before any log message that was sent
+         * after them */
+        for (;;) {
+                union {
+                        struct nlmsghdr header;
+                        uint8_t buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(struct proc_event))];
+                } msg;
+                union sockaddr_union sa = {};
+                socklen_t salen = sizeof(sa);
+                ssize_t n;
+
+                n = recvfrom(fd, &msg, sizeof(msg), MSG_DONTWAIT, &sa.sa, &salen);
+                if (n < 0) {
+                        if (IN_SET(errno, EAGAIN, EINTR))
+                                return 0;
+
+                        if (errno == ENOBUFS) {
+                                log_debug("Process event queue overran, rereading metadata of all clients.");
+                                client_contexts_invalidate_all(s);
+                                continue;
+                        }
+
+                        log_warning_errno(errno, "Failed to read process events, ignoring: %m");
+                        server_stop_proc_events(s);
+                        return 0;
+                }
+
+                /* Only the kernel may tell us about processes */
+                if (salen < sizeof(sa.nl) || sa.nl.nl_family != AF_NETLINK || sa.nl.nl_pid != 0)
+                        continue;
+
+                for (struct nlmsghdr *h = &msg.header; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+                        const struct cn_msg *cn;
+                        const struct proc_event *ev;
+
+                        if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg)))
+                                break;
+
+                        cn = NLMSG_DATA(h);
+                        if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC ||
+                            NLMSG_LENGTH(sizeof(struct cn_msg) + cn->len) > h->nlmsg_len ||
+                            cn->len < offsetof(struct proc_event, event_data))
+                                continue;
+
+                        ev = (const struct proc_event*) cn->data;
+
+                        if (ev->what != PROC_EVENT_NONE) {
+                                if (s->proc_events_active)
+                                        client_context_process_event(s, ev, cn->len);
+                                continue;
+                        }
+
+                        /* The kernel acknowledges subscriptions of everybody to everybody, find ours by the
+                         * cookie it returns incremented by one */
+                        if (s->proc_events_active || cn->ack != s->proc_connector_cookie + 1 ||
+                            cn->len < offsetof(struct proc_event, event_data) + sizeof(ev->event_data.ack))
+                                continue;
+
+                        if (ev->event_data.ack.err != 0) {
+                                log_debug_errno(ev->event_data.ack.err,
+                                                "Kernel refused to send process events, refreshing metadata of clients periodically: %m");
+                                server_stop_proc_events(s);
+                                return 0;
+                        }
+
+                        log_debug("Receiving process events from the kernel, refreshing metadata of clients on changes.");
+
+                        s->proc_events_active = true;
+                        client_contexts_invalidate_all(s);
+                }
+        }
+}
+
+int server_open_proc_connector(Server *s) {
+        static const union sockaddr_union sa = {
+                .nl.nl_family = AF_NETLINK,
+                .nl.nl_pid    = 0,
+                .nl.nl_groups = CN_IDX_PROC,
+        };
+        union {
+                struct nlmsghdr header;
+                uint8_t buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+        } msg = {};
+        _cleanup_close_ int fd = -1;
+        struct cn_msg *cn;
+        int r;
+
+        assert(s);
+
+        /* Subscribe to the events the kernel generates when processes fork, execute something, change their
+         * name or credentials and exit, so that we know when cached metadata of clients goes stale. Without
+         * this we fall back to rereading the metadata periodically. Whether it worked we only learn from the
+         * acknowledgement the kernel sends, and not at all if we run in a container, hence until that arrives
+         * we stick to the periodic refreshes. */
+
+        fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, NETLINK_CONNECTOR);
+        if (fd < 0) {
+                log_debug_errno(errno, "Failed to create process connector socket, ignoring: %m");
+                return 0;
+        }
+
+        if (bind(fd, &sa.sa, sizeof(sa.nl)) < 0) {
+                log_debug_errno(errno, "Failed to join process connector multicast group, ignoring: %m");
+                return 0;
+        }
+
+        r = fd_inc_rcvbuf(fd, PROC_CONNECTOR_RCVBUF_SIZE);
+        if (r < 0)
+                log_debug_errno(r, "Failed to increase receive buffer of process connector socket, ignoring: %m");
+
+        s->proc_connector_cookie = random_u32();
+
+        msg.header = (struct nlmsghdr) {
+                .nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op)),
+                .nlmsg_type = NLMSG_DONE,
+        };
+
+        cn = NLMSG_DATA(&msg.header);
+        *cn = (struct cn_msg) {
+                .id.idx = CN_IDX_PROC,
+                .id.val = CN_VAL_PROC,
+                .ack = s->proc_connector_cookie,
+                .len = sizeof(enum proc_cn_mcast_op),
+        };
+        *(enum proc_cn_mcast_op*) cn->data = PROC_CN_MCAST_LISTEN;
+
+        if (send(fd, &msg, msg.header.nlmsg_len, 0) < 0) {
+                log_debug_errno(errno, "Failed to subscribe to process events, ignoring: %m");
+                return 0;
+        }
+
+        r = sd_event_add_io(s->event, &s->proc_event_source, fd, EPOLLIN, dispatch_proc_connector, s);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add process connector fd to event loop: %m");
+
+        r = sd_event_source_set_io_fd_own(s->proc_event_source, true);
+        if (r < 0)
+                return log_error_errno(r, "Failed to pass ownership of process connector fd to event source: %m");
+
+        TAKE_FD(fd);
+
+        /* Process events before the log messages that are sent after them */
+        r = sd_event_source_set_priority(s->proc_event_source, SD_EVENT_PRIORITY_NORMAL);
+        if (r < 0)
+                return log_error_errno(r, "Failed to adjust priority of process connector event source: %m");
+
+        (void) sd_event_source_set_description(s->proc_event_source, "proc-connector");
+
+        return 0;
+}
@@ -10,14 +10,35 @@
 #include "time-util.h"
 
 typedef struct ClientContext ClientContext;
+typedef struct UnitContext UnitContext;
 
 #include "journald-server.h"
 
+/* The settings PID 1 publishes for a unit in /run/systemd/units/, shared by all clients of that unit */
+struct UnitContext {
+        unsigned n_ref;
+        char *id;
+        uint64_t ratelimit_hash;
+        usec_t timestamp;
+
+        int log_level_max;
+
+        struct iovec *extra_fields_iovec;
+        size_t extra_fields_n_iovec;
+        void *extra_fields_data;
+        nsec_t extra_fields_mtime;
+
+        usec_t log_ratelimit_interval;
+        unsigned log_ratelimit_burst;
+};
+
 struct ClientContext {
         unsigned n_ref;
         unsigned lru_index;
         usec_t timestamp;
         bool in_lru;
+        bool invalidated;
+        bool exited;
 
         pid_t pid;
         uid_t uid;
@@ -46,15 +67,7 @@ struct ClientContext {
         char *label;
         size_t label_size;
 
-        int log_level_max;
-
-        struct iovec *extra_fields_iovec;
-        size_t extra_fields_n_iovec;
-        void *extra_fields_data;
-        nsec_t extra_fields_mtime;
-
-        usec_t log_ratelimit_interval;
-        unsigned log_ratelimit_burst;
+        UnitContext *unit_context;
 };
 
 int client_context_get(
@@ -86,16 +99,18 @@ void client_context_maybe_refresh(
 void client_context_acquire_default(Server *s);
 void client_context_flush_all(Server *s);
 
+int server_open_proc_connector(Server *s);
+
 static inline size_t client_context_extra_fields_n_iovec(const ClientContext *c) {
-        return c ? c->extra_fields_n_iovec : 0;
+        return c && c->unit_context ? c->unit_context->extra_fields_n_iovec : 0;
 }
 
 static inline bool client_context_test_priority(const ClientContext *c, int priority) {
-        if (!c)
+        if (!c || !c->unit_context)
                 return true;
 
-        if (c->log_level_max < 0)
+        if (c->unit_context->log_level_max < 0)
                 return true;
 
-        return LOG_PRI(priority) <= c->log_level_max;
+        return LOG_PRI(priority) <= c->unit_context->log_level_max;
 }
@@ -24,6 +24,9 @@
 #include "stdio-util.h"
 #include "string-util.h"
 
+/* How many records to read from /dev/kmsg in one go at most, before giving other event sources a chance */
+#define DEV_KMSG_READ_MAX 1024U
+
 void server_forward_kmsg(
                 Server *s,
                 int priority,
@@ -142,12 +145,14 @@ void dev_kmsg_record(Server *s, char *p, size_t l) {
                         return;
 
                 /* Did we lose any? */
-                if (serial > *s->kernel_seqnum)
+                if (serial > *s->kernel_seqnum) {
+                        s->n_kmsg_lost += serial - *s->kernel_seqnum;
                         server_driver_message(s, 0,
                                               "MESSAGE_ID=" SD_MESSAGE_JOURNAL_MISSED_STR,
                                               LOG_MESSAGE("Missed %"PRIu64" kernel messages",
                                                           serial - *s->kernel_seqnum),
                                               NULL);
+                }
 
                 /* Make sure we never read this one again. Note that
                  * we always store the next message serial we expect
@@ -296,31 +301,48 @@ finish:
 
 static int server_read_dev_kmsg(Server *s) {
         char buffer[8192+1]; /* the kernel-side limit per record is 8K currently */
+        unsigned n;
         ssize_t l;
 
         assert(s);
         assert(s->dev_kmsg_fd >= 0);
 
-        l = read(s->dev_kmsg_fd, buffer, sizeof(buffer) - 1);
-        if (l == 0)
-                return 0;
-        if (l < 0) {
-                /* Old kernels who don't allow reading from /dev/kmsg
-                 * return EINVAL when we try. So handle this cleanly,
-                 * but don' try to ever read from it again. */
-                if (errno == EINVAL) {
-                        s->dev_kmsg_event_source = sd_event_source_unref(s->dev_kmsg_event_source);
-                        return 0;
-                }
+        /* Each read() returns a single record. During a storm of kernel messages the ring buffer fills up
+         * quickly, hence let's read everything there is right away rather than a record per event loop
+         * iteration. The records are written to the journal in one batch afterwards. Returns the number of
+         * records read. */
 
-                if (IN_SET(errno, EAGAIN, EINTR, EPIPE))
-                        return 0;
+        for (n = 0; n < DEV_KMSG_READ_MAX; n++) {
+                l = read(s->dev_kmsg_fd, buffer, sizeof(buffer) - 1);
+                if (l == 0)
+                        break;
+                if (l < 0) {
+                        /* Old kernels who don't allow reading from /dev/kmsg
+                         * return EINVAL when we try. So handle this cleanly,
+                         * but don' try to ever read from it again. */
+                        if (errno == EINVAL) {
+                                s->dev_kmsg_event_source = sd_event_source_unref(s->dev_kmsg_event_source);
+                                break;
+                        }
+
+                        /* The next record was overwritten before we got to it, the kernel skipped ahead to the
+                         * oldest one still there. How many were lost we learn from its serial. */
+                        if (errno == EPIPE) {
+                                s->n_kmsg_overruns++;
+                                continue;
+                        }
+
+                        if (IN_SET(errno, EAGAIN, EINTR))
+                                break;
+
+                        return log_error_errno(errno, "Failed to read from /dev/kmsg: %m");
+                }
 
-                return log_error_errno(errno, "Failed to read from /dev/kmsg: %m");
+                s->n_kmsg_records++;
+                dev_kmsg_record(s, buffer, l);
         }
 
-        dev_kmsg_record(s, buffer, l);
-        return 1;
+        return n;
 }
 
 int server_flush_dev_kmsg(Server *s) {
@@ -11,15 +11,19 @@
 #include "fs-util.h"
 #include "io-util.h"
 #include "journal-importer.h"
+#include "journal-ring.h"
 #include "journal-util.h"
 #include "journald-console.h"
 #include "journald-kmsg.h"
 #include "journald-native.h"
+#include "journald-reader.h"
 #include "journald-server.h"
 #include "journald-syslog.h"
 #include "journald-wall.h"
+#include "list.h"
 #include "memfd-util.h"
 #include "memory-util.h"
+#include "missing_syscall.h"
 #include "parse-util.h"
 #include "path-util.h"
 #include "process-util.h"
@@ -92,27 +96,29 @@ static void server_process_entry_meta(
         }
 }
 
-static int server_process_entry(
-                Server *s,
+int native_entry_parse(
+                NativeEntry *entry,
                 const void *buffer, size_t *remaining,
-                ClientContext *context,
-                const struct ucred *ucred,
-                const struct timeval *tv,
-                const char *label, size_t label_len) {
+                const struct ucred *ucred) {
 
-        /* Process a single entry from a native message. Returns 0 if nothing special happened and the message
-         * processing should continue, and a negative or positive value otherwise.
+        /* Parses a single entry from a native message into 'entry', which has to be released with
+         * native_entry_done() afterwards. Returns 0 if an entry was read and the message processing should
+         * continue, and a negative or positive value otherwise. This doesn't look at any server state, hence
+         * may be called on a reader thread, see journald-reader.c.
          *
          * Note that *remaining is altered on both success and failure. */
 
-        size_t n = 0, j, tn = SIZE_MAX, entry_size = 0;
-        char *identifier = NULL, *message = NULL;
-        struct iovec *iovec = NULL;
-        int priority = LOG_INFO;
-        pid_t object_pid = 0;
+        size_t n = 0, entry_size = 0;
         const char *p;
         int r = 1;
 
+        assert(entry);
+
+        *entry = (NativeEntry) {
+                .priority = LOG_INFO,
+                .buffer = buffer,
+        };
+
         p = buffer;
 
         while (*remaining > 0) {
@@ -145,11 +151,9 @@ static int server_process_entry(
                         goto finish;
                 }
 
-                /* n existing properties, 1 new, +1 for _TRANSPORT */
-                if (!GREEDY_REALLOC(iovec,
-                                    n + 2 +
-                                    N_IOVEC_META_FIELDS + N_IOVEC_OBJECT_FIELDS +
-                                    client_context_extra_fields_n_iovec(context))) {
+                /* n existing properties, 1 new, +1 for _TRANSPORT. The fields the context adds are made room for
+                 * when the entry is dispatched. */
+                if (!GREEDY_REALLOC(entry->iovec, n + 2 + N_IOVEC_META_FIELDS + N_IOVEC_OBJECT_FIELDS)) {
                         r = log_oom();
                         goto finish;
                 }
@@ -173,14 +177,15 @@ static int server_process_entry(
 
                                 /* If the field name starts with an underscore, skip the variable, since that indicates
                                  * a trusted field */
-                                iovec[n++] = IOVEC_MAKE((char*) p, l);
+                                entry->iovec[n++] = IOVEC_MAKE((char*) p, l);
+                                entry->n_fields = n;
                                 entry_size += l;
 
                                 server_process_entry_meta(p, l, ucred,
-                                                          &priority,
-                                                          &identifier,
-                                                          &message,
-                                                          &object_pid);
+                                                          &entry->priority,
+                                                          &entry->identifier,
+                                                          &entry->message,
+                                                          &entry->object_pid);
                         }
 
                         *remaining -= (e - p) + 1;
@@ -225,15 +230,15 @@ static int server_process_entry(
                         memcpy(k + (e - p) + 1, e + 1 + sizeof(uint64_t), l);
 
                         if (journal_field_valid(p, e - p, false)) {
-                                iovec[n] = IOVEC_MAKE(k, (e - p) + 1 + l);
-                                entry_size += iovec[n].iov_len;
-                                n++;
+                                entry->iovec[n] = IOVEC_MAKE(k, (e - p) + 1 + l);
+                                entry_size += entry->iovec[n].iov_len;
+                                entry->n_fields = ++n;
 
                                 server_process_entry_meta(k, (e - p) + 1 + l, ucred,
-                                                          &priority,
-                                                          &identifier,
-                                                          &message,
-                                                          &object_pid);
+                                                          &entry->priority,
+                                                          &entry->identifier,
+                                                          &entry->message,
+                                                          &entry->object_pid);
                         } else
                                 free(k);
 
@@ -245,8 +250,7 @@ static int server_process_entry(
         if (n <= 0)
                 goto finish;
 
-        tn = n++;
-        iovec[tn] = IOVEC_MAKE_STRING("_TRANSPORT=journal");
+        entry->iovec[n++] = IOVEC_MAKE_STRING("_TRANSPORT=journal");
         entry_size += STRLEN("_TRANSPORT=journal");
 
         if (entry_size + n + 1 > ENTRY_SIZE_MAX) { /* data + separators + trailer */
@@ -254,42 +258,83 @@ static int server_process_entry(
                 goto finish;
         }
 
+        entry->n_iovec = n;
         r = 0; /* Success, we read the message. */
 
-        if (!client_context_test_priority(context, priority))
-                goto finish;
+finish:
+        /* Fields that don't point into the message were allocated */
+        entry->buffer_end = p + *remaining;
+        return r;
+}
+
+void native_entry_done(NativeEntry *e) {
+        assert(e);
+
+        for (size_t j = 0; j < e->n_fields; j++)
+                if ((const char*) e->iovec[j].iov_base < e->buffer ||
+                    (const char*) e->iovec[j].iov_base >= e->buffer_end)
+                        free(e->iovec[j].iov_base);
+
+        free(e->iovec);
+        free(e->identifier);
+        free(e->message);
 
-        if (message) {
+        *e = (NativeEntry) {};
+}
+
+static void server_dispatch_native_entry(
+                Server *s,
+                NativeEntry *e,
+                ClientContext *context,
+                const struct ucred *ucred,
+                const struct timeval *tv) {
+
+        assert(s);
+        assert(e);
+
+        if (!client_context_test_priority(context, e->priority))
+                return;
+
+        if (e->message) {
                 if (s->forward_to_syslog)
-                        server_forward_syslog(s, syslog_fixup_facility(priority), identifier, message, ucred, tv);
+                        server_forward_syslog(s, syslog_fixup_facility(e->priority), e->identifier, e->message, ucred, tv);
 
                 if (s->forward_to_kmsg)
-                        server_forward_kmsg(s, priority, identifier, message, ucred);
+                        server_forward_kmsg(s, e->priority, e->identifier, e->message, ucred);
 
                 if (s->forward_to_console)
-                        server_forward_console(s, priority, identifier, message, ucred);
+                        server_forward_console(s, e->priority, e->identifier, e->message, ucred);
 
                 if (s->forward_to_wall)
-                        server_forward_wall(s, priority, identifier, message, ucred);
+                        server_forward_wall(s, e->priority, e->identifier, e->message, ucred);
         }
 
-        server_dispatch_message(s, iovec, n, MALLOC_ELEMENTSOF(iovec), context, tv, priority, object_pid);
+        if (!GREEDY_REALLOC(e->iovec,
+                            e->n_iovec +
+                            N_IOVEC_META_FIELDS + N_IOVEC_OBJECT_FIELDS +
+                            client_context_extra_fields_n_iovec(context))) {
+                log_oom();
+                return;
+        }
 
-finish:
-        for (j = 0; j < n; j++)  {
-                if (j == tn)
-                        continue;
+        server_dispatch_message(s, e->iovec, e->n_iovec, MALLOC_ELEMENTSOF(e->iovec), context, tv, e->priority, e->object_pid);
+}
 
-                if (iovec[j].iov_base < buffer ||
-                    (const char*) iovec[j].iov_base >= p + *remaining)
-                        free(iovec[j].iov_base);
-        }
+static ClientContext* native_client_context(
+                Server *s,
+                const struct ucred *ucred,
+                const char *label, size_t label_len) {
 
-        free(iovec);
-        free(identifier);
-        free(message);
+        ClientContext *context = NULL;
+        int r;
 
-        return r;
+        if (ucred && pid_is_valid(ucred->pid)) {
+                r = client_context_get(s, ucred->pid, ucred, label, label_len, NULL, &context);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to retrieve credentials for PID " PID_FMT ", ignoring: %m", ucred->pid);
+        }
+
+        return context;
 }
 
 void server_process_native_message(
@@ -300,25 +345,44 @@ void server_process_native_message(
                 const char *label, size_t label_len) {
 
         size_t remaining = buffer_size;
-        ClientContext *context = NULL;
+        ClientContext *context;
         int r;
 
         assert(s);
         assert(buffer || buffer_size == 0);
 
-        if (ucred && pid_is_valid(ucred->pid)) {
-                r = client_context_get(s, ucred->pid, ucred, label, label_len, NULL, &context);
-                if (r < 0)
-                        log_warning_errno(r, "Failed to retrieve credentials for PID " PID_FMT ", ignoring: %m", ucred->pid);
-        }
+        context = native_client_context(s, ucred, label, label_len);
 
         do {
-                r = server_process_entry(s,
-                                         (const uint8_t*) buffer + (buffer_size - remaining), &remaining,
-                                         context, ucred, tv, label, label_len);
+                _cleanup_(native_entry_done) NativeEntry e = {};
+
+                r = native_entry_parse(&e, (const uint8_t*) buffer + (buffer_size - remaining), &remaining, ucred);
+                if (r == 0)
+                        server_dispatch_native_entry(s, &e, context, ucred, tv);
         } while (r == 0);
 }
 
+void server_process_native_entries(
+                Server *s,
+                NativeEntry *entries,
+                size_t n_entries,
+                const struct ucred *ucred,
+                const struct timeval *tv,
+                const char *label, size_t label_len) {
+
+        ClientContext *context;
+
+        assert(s);
+        assert(entries || n_entries == 0);
+
+        /* Entries of a message that a reader thread already parsed with native_entry_parse() */
+
+        context = native_client_context(s, ucred, label, label_len);
+
+        for (size_t i = 0; i < n_entries; i++)
+                server_dispatch_native_entry(s, entries + i, context, ucred, tv);
+}
+
 void server_process_native_file(
                 Server *s,
                 int fd,
@@ -450,6 +514,390 @@ void server_process_native_file(
         }
 }
 
+/* Clients that log a lot can pass their messages through a ring buffer in shared memory instead of the
+ * socket, see journal-ring.c. While a client keeps logging we look at its ring every now and then, rather
+ * than having it wake us up for each message. */
+
+#define NATIVE_RINGS_MAX 256U
+#define NATIVE_RING_POLL_USEC (10 * USEC_PER_MSEC)
+
+/* How many messages to read from a ring in one go before giving others a chance */
+#define NATIVE_RING_BATCH_MAX 1024U
+
+struct NativeRing {
+        Server *server;
+
+        JournalRing *ring;
+        sd_event_source *event_source;
+
+        /* Everything in the ring is attributed to the process that registered it. The ring lives only as
+         * long as that process, which we keep track of through a pidfd. */
+        struct ucred ucred;
+        char *label;
+        size_t label_len;
+        int pidfd;
+        sd_event_source *pidfd_event_source;
+
+        /* Look at the ring again on the next poll, rather than waiting to be woken up */
+        bool polling;
+
+        LIST_FIELDS(NativeRing, native_rings);
+};
+
+NativeRing* native_ring_free(NativeRing *r) {
+        if (!r)
+                return NULL;
+
+        if (r->server) {
+                assert(r->server->n_native_rings > 0);
+                r->server->n_native_rings--;
+                LIST_REMOVE(native_rings, r->server->native_rings, r);
+
+                (void) server_start_or_stop_idle_timer(r->server); /* Maybe we are idle now? */
+        }
+
+        /* The event source watches the wakeup fd owned by the ring, hence drop it first */
+        sd_event_source_disable_unref(r->event_source);
+        sd_event_source_disable_unref(r->pidfd_event_source);
+        safe_close(r->pidfd);
+
+        if (r->ring) {
+                /* Tell the client to stop using the ring */
+                journal_ring_set_state(r->ring, JOURNAL_RING_CLOSED);
+                journal_ring_free(r->ring);
+        }
+
+        free(r->label);
+
+        return mfree(r);
+}
+
+static int native_ring_verify(NativeRing *r) {
+        uid_t uid;
+        gid_t gid;
+        int k;
+
+        assert(r);
+
+        /* Checks whether the process that registered the ring still has the credentials it registered it
+         * with. Returns > 0 if so, 0 if they changed and -ESRCH if the process is gone. */
+
+        k = get_process_uid(r->ucred.pid, &uid);
+        if (k == -ENOENT)
+                return -ESRCH;
+        if (k < 0)
+                return k;
+
+        k = get_process_gid(r->ucred.pid, &gid);
+        if (k == -ENOENT)
+                return -ESRCH;
+        if (k < 0)
+                return k;
+
+        /* Make sure the PID still refers to the process we pinned, and wasn't recycled while we looked */
+        if (pidfd_send_signal(r->pidfd, 0, NULL, 0) < 0)
+                return -errno;
+
+        return uid == r->ucred.uid && gid == r->ucred.gid;
+}
+
+static void native_ring_process_message(NativeRing *r, const char *buffer, size_t buffer_size, bool verified) {
+        size_t remaining = buffer_size;
+        ClientContext *context;
+        int k;
+
+        assert(r);
+
+        context = native_client_context(r->server, &r->ucred, r->label, r->label_len);
+
+        /* OBJECT_PID= is only honoured for privileged clients, hence only if we could make sure that the
+         * credentials still apply */
+
+        do {
+                _cleanup_(native_entry_done) NativeEntry e = {};
+
+                k = native_entry_parse(&e, buffer + (buffer_size - remaining), &remaining, verified ? &r->ucred : NULL);
+                if (k == 0)
+                        server_dispatch_native_entry(r->server, &e, context, &r->ucred, NULL);
+        } while (k == 0);
+}
+
+static int native_ring_read(NativeRing *r, size_t max) {
+        Server *s;
+        size_t n = 0;
+        bool verified = false;
+        int k;
+
+        assert(r);
+
+        s = r->server;
+
+        /* Returns the number of messages read, or negative if the ring is broken or its process changed
+         * credentials */
+
+        while (n < max) {
+                size_t size;
+
+                k = journal_ring_read(r->ring, &s->buffer, &size);
+                if (k == -ENOMEM)
+                        return log_oom();
+                if (k < 0)
+                        return log_warning_errno(k, "Ring buffer of PID " PID_FMT " is corrupted, dropping it.",
+                                                 r->ucred.pid);
+                if (k == 0)
+                        break;
+
+                /* The credentials were captured when the ring was registered, make sure they still apply
+                 * before attributing a batch of messages to them. Once the process is gone we can't tell
+                 * anymore, hence what it left behind is still logged, but not trusted. */
+                if (n == 0) {
+                        k = native_ring_verify(r);
+                        if (k == 0)
+                                return log_debug_errno(SYNTHETIC_ERRNO(EPERM),
+                                                       "Credentials of PID " PID_FMT " changed, dropping its ring buffer.",
+                                                       r->ucred.pid);
+                        if (k < 0 && k != -ESRCH)
+                                return log_warning_errno(k, "Failed to verify credentials of PID " PID_FMT ", dropping its ring buffer: %m",
+                                                         r->ucred.pid);
+
+                        verified = k > 0;
+                }
+
+                native_ring_process_message(r, s->buffer, size, verified);
+                n++;
+        }
+
+        return (int) MIN(n, (size_t) INT_MAX);
+}
+
+static void native_ring_schedule(Server *s, usec_t usec);
+
+static int native_ring_process(NativeRing *r) {
+        int n;
+
+        assert(r);
+
+        n = native_ring_read(r, NATIVE_RING_BATCH_MAX);
+        if (n < 0)
+                return n;
+
+        /* If there was something, the client is likely to log more soon. Only if there wasn't anything,
+         * ask to be woken up. */
+        r->polling = n > 0 || !journal_ring_wait(r->ring);
+        if (r->polling)
+                native_ring_schedule(r->server, (unsigned) n >= NATIVE_RING_BATCH_MAX ? 0 : NATIVE_RING_POLL_USEC);
+
+        return 0;
+}
+
+static int dispatch_native_rings(sd_event_source *es, usec_t usec, void *userdata) {
+        Server *s = userdata;
+        NativeRing *r, *n;
+
+        assert(s);
+
+        LIST_FOREACH_SAFE(native_rings, r, n, s->native_rings) {
+                if (!r->polling)
+                        continue;
+
+                if (native_ring_process(r) < 0)
+                        native_ring_free(r);
+        }
+
+        server_refresh_idle_timer(s);
+        return 0;
+}
+
+static void native_ring_schedule(Server *s, usec_t usec) {
+        usec_t now_usec, next = USEC_INFINITY;
+        int enabled = SD_EVENT_OFF, r;
+
+        assert(s);
+
+        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &now_usec) >= 0);
+
+        if (!s->native_ring_event_source) {
+                r = sd_event_add_time(s->event, &s->native_ring_event_source, CLOCK_MONOTONIC,
+                                      now_usec + usec, 0, dispatch_native_rings, s);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to add ring buffer timer event source: %m");
+                        return;
+                }
+
+                r = sd_event_source_set_priority(s->native_ring_event_source, SD_EVENT_PRIORITY_NORMAL+5);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to adjust ring buffer timer event source priority, ignoring: %m");
+
+                return;
+        }
+
+        /* Don't postpone what is already scheduled earlier */
+        (void) sd_event_source_get_enabled(s->native_ring_event_source, &enabled);
+        if (enabled != SD_EVENT_OFF)
+                (void) sd_event_source_get_time(s->native_ring_event_source, &next);
+        if (next <= now_usec + usec)
+                return;
+
+        r = sd_event_source_set_time(s->native_ring_event_source, now_usec + usec);
+        if (r >= 0)
+                r = sd_event_source_set_enabled(s->native_ring_event_source, SD_EVENT_ONESHOT);
+        if (r < 0)
+                log_error_errno(r, "Failed to schedule ring buffer timer: %m");
+}
+
+static int dispatch_native_ring_wakeup(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        NativeRing *r = userdata;
+        Server *s;
+
+        assert(r);
+
+        s = r->server;
+
+        if (revents & EPOLLIN)
+                (void) flush_fd(fd);
+
+        if (revents & (EPOLLHUP|EPOLLERR)) {
+                /* The client is gone, pick up what it left behind and let go of the ring. It can't write
+                 * anymore, but it might have filled the ring, hence only take one batch as usual. */
+                (void) native_ring_read(r, NATIVE_RING_BATCH_MAX);
+                native_ring_free(r);
+        } else if (native_ring_process(r) < 0)
+                native_ring_free(r);
+
+        server_refresh_idle_timer(s);
+        return 0;
+}
+
+static int dispatch_native_ring_exit(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        NativeRing *r = userdata;
+        Server *s;
+
+        assert(r);
+
+        s = r->server;
+
+        /* The process that registered the ring exited. Anything else that still has the ring mapped or the
+         * wakeup socket open, e.g. because it was forked off, must not log in its name. */
+        log_debug("Process " PID_FMT " with ring buffer exited.", r->ucred.pid);
+
+        (void) native_ring_read(r, NATIVE_RING_BATCH_MAX);
+        native_ring_free(r);
+
+        server_refresh_idle_timer(s);
+        return 0;
+}
+
+void server_process_native_ring(
+                Server *s,
+                int fds[static 2],
+                const struct ucred *ucred,
+                const char *label, size_t label_len) {
+
+        _cleanup_(native_ring_freep) NativeRing *r = NULL;
+        int k;
+
+        /* A client registers a ring buffer by passing the memfd with it and one end of a socket pair, over
+         * which it wakes us up, and which is closed once the client is gone. */
+
+        assert(s);
+        assert(fds);
+
+        if (!ucred || !pid_is_valid(ucred->pid)) {
+                log_warning("Got ring buffer from unknown client, ignoring.");
+                return;
+        }
+
+        if (s->n_native_rings >= NATIVE_RINGS_MAX) {
+                log_warning("Too many ring buffers registered, refusing ring buffer of PID " PID_FMT ".", ucred->pid);
+                return;
+        }
+
+        r = new(NativeRing, 1);
+        if (!r) {
+                log_oom();
+                return;
+        }
+
+        *r = (NativeRing) {
+                .server = s,
+                .ucred = *ucred,
+                .label_len = label_len,
+                .pidfd = -1,
+        };
+
+        /* Link it in right away, so that freeing it below does the right thing */
+        LIST_PREPEND(native_rings, s->native_rings, r);
+        s->n_native_rings++;
+
+        if (label) {
+                r->label = memdup(label, label_len);
+                if (!r->label) {
+                        log_oom();
+                        return;
+                }
+        }
+
+        k = journal_ring_map(fds[0], &r->ring);
+        if (k < 0) {
+                log_warning_errno(k, "Failed to map ring buffer of PID " PID_FMT ", ignoring: %m", ucred->pid);
+                return;
+        }
+
+        r->ring->wakeup_fd = TAKE_FD(fds[1]);
+
+        /* Pin the process, so that we notice when it exits, and that its PID can't be passed off as
+         * another process' while we look at it */
+        r->pidfd = pidfd_open(ucred->pid, 0);
+        if (r->pidfd < 0) {
+                log_debug_errno(errno, "Failed to open pidfd of PID " PID_FMT ", refusing ring buffer: %m", ucred->pid);
+                return;
+        }
+
+        k = native_ring_verify(r);
+        if (k < 0) {
+                log_debug_errno(k, "Failed to verify credentials of PID " PID_FMT ", refusing ring buffer: %m", ucred->pid);
+                return;
+        }
+        if (k == 0) {
+                log_debug("Credentials of PID " PID_FMT " changed, refusing ring buffer.", ucred->pid);
+                return;
+        }
+
+        k = sd_event_add_io(s->event, &r->pidfd_event_source, r->pidfd, EPOLLIN, dispatch_native_ring_exit, r);
+        if (k < 0) {
+                log_error_errno(k, "Failed to add pidfd of ring buffer to event loop: %m");
+                return;
+        }
+
+        k = sd_event_source_set_priority(r->pidfd_event_source, SD_EVENT_PRIORITY_NORMAL+5);
+        if (k < 0) {
+                log_error_errno(k, "Failed to adjust pidfd event source priority: %m");
+                return;
+        }
+
+        k = sd_event_add_io(s->event, &r->event_source, r->ring->wakeup_fd, EPOLLIN, dispatch_native_ring_wakeup, r);
+        if (k < 0) {
+                log_error_errno(k, "Failed to add ring buffer wakeup fd to event loop: %m");
+                return;
+        }
+
+        k = sd_event_source_set_priority(r->event_source, SD_EVENT_PRIORITY_NORMAL+5);
+        if (k < 0) {
+                log_error_errno(k, "Failed to adjust ring buffer event source priority: %m");
+                return;
+        }
+
+        journal_ring_set_state(r->ring, JOURNAL_RING_ACTIVE);
+
+        log_debug("Ring buffer of PID " PID_FMT " registered.", ucred->pid);
+        (void) server_start_or_stop_idle_timer(s); /* Maybe no longer idle? */
+
+        if (native_ring_process(r) < 0)
+                return;
+
+        TAKE_PTR(r);
+}
+
 int server_open_native_socket(Server *s, const char *native_socket) {
         int r;
 
@@ -493,6 +941,9 @@ int server_open_native_socket(Server *s, const char *native_socket) {
         if (r < 0)
                 return log_error_errno(r, "SO_TIMESTAMP failed: %m");
 
+        if (s->n_readers > 0)
+                return server_reader_add_socket(s, &s->native_fd);
+
         r = sd_event_add_io(s->event, &s->native_event_source, s->native_fd, EPOLLIN, server_process_datagram, s);
         if (r < 0)
                 return log_error_errno(r, "Failed to add native server fd to event loop: %m");
@@ -3,6 +3,28 @@
 
 #include "journald-server.h"
 
+/* A single entry of a native protocol message. The fields point into the message, except for binary ones,
+ * which are copied out. */
+typedef struct NativeEntry {
+        struct iovec *iovec;
+        size_t n_iovec;  /* The fields plus _TRANSPORT=, 0 if the entry is to be ignored */
+        size_t n_fields;
+
+        int priority;
+        char *identifier;
+        char *message;
+        pid_t object_pid;
+
+        const char *buffer, *buffer_end;
+} NativeEntry;
+
+int native_entry_parse(
+                NativeEntry *entry,
+                const void *buffer,
+                size_t *remaining,
+                const struct ucred *ucred);
+void native_entry_done(NativeEntry *e);
+
 void server_process_native_message(
                 Server *s,
                 const char *buffer,
@@ -12,6 +34,15 @@ void server_process_native_message(
                 const char *label,
                 size_t label_len);
 
+void server_process_native_entries(
+                Server *s,
+                NativeEntry *entries,
+                size_t n_entries,
+                const struct ucred *ucred,
+                const struct timeval *tv,
+                const char *label,
+                size_t label_len);
+
 void server_process_native_file(
                 Server *s,
                 int fd,
@@ -20,4 +51,14 @@ void server_process_native_file(
                 const char *label,
                 size_t label_len);
 
+void server_process_native_ring(
+                Server *s,
+                int fds[static 2],
+                const struct ucred *ucred,
+                const char *label,
+                size_t label_len);
+
+NativeRing* native_ring_free(NativeRing *r);
+DEFINE_TRIVIAL_CLEANUP_FUNC(NativeRing*, native_ring_free);
+
 int server_open_native_socket(Server *s, const char *native_socket);
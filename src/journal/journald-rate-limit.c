@@ -3,16 +3,19 @@
 #include <errno.h>
 
 #include "alloc-util.h"
-#include "hashmap.h"
 #include "journald-rate-limit.h"
-#include "list.h"
 #include "random-util.h"
+#include "siphash24.h"
+#include "sort-util.h"
 #include "string-util.h"
 #include "time-util.h"
+#include "util.h"
 
 #define POOLS_MAX 5
-#define BUCKETS_MAX 127
-#define GROUPS_MAX 2047
+
+/* Keep at most this many groups. The table has twice as many slots at most, so that probe sequences stay short. */
+#define GROUPS_MAX 16384U
+#define SLOTS_MIN 64U
 
 static const int priority_map[] = {
         [LOG_EMERG]   = 0,
@@ -27,34 +30,47 @@ static const int priority_map[] = {
 
 typedef struct JournalRateLimitPool JournalRateLimitPool;
 typedef struct JournalRateLimitGroup JournalRateLimitGroup;
+typedef struct JournalRateLimitSlot JournalRateLimitSlot;
 
+/* A token bucket that holds up to 'burst' tokens and is refilled with 'burst' tokens per 'interval'. Tokens are
+ * counted in fractions of 1/interval, so that the refill is exact in integer arithmetic: every microsecond adds
+ * 'burst' to the level, and every message takes 'interval' from it. */
 struct JournalRateLimitPool {
-        usec_t begin;
-        unsigned num;
+        uint64_t level;
+        usec_t last;
+
+        /* Messages suppressed since we last reported, and when we started or last reported suppressing them */
         unsigned suppressed;
+        usec_t reported;
 };
 
 struct JournalRateLimitGroup {
-        JournalRateLimit *parent;
-
         char *id;
+        uint64_t hash;
 
-        /* Interval is stored to keep track of when the group expires */
+        /* Interval and burst are stored to keep track of when the group expires, and for introspection */
         usec_t interval;
+        unsigned burst;
+        usec_t last;
+
+        uint64_t dropped;
 
         JournalRateLimitPool pools[POOLS_MAX];
-        uint64_t hash;
+};
 
-        LIST_FIELDS(JournalRateLimitGroup, bucket);
-        LIST_FIELDS(JournalRateLimitGroup, lru);
+struct JournalRateLimitSlot {
+        uint64_t hash;
+        JournalRateLimitGroup *group;
 };
 
 struct JournalRateLimit {
+        /* Open addressing with linear probing, the number of slots is a power of two */
+        JournalRateLimitSlot *slots;
+        size_t n_slots;
+        size_t n_groups;
 
-        JournalRateLimitGroup* buckets[BUCKETS_MAX];
-        JournalRateLimitGroup *lru, *lru_tail;
-
-        unsigned n_groups;
+        uint64_t n_dropped;
+        uint64_t n_evicted;
 
         uint8_t hash_key[16];
 };
@@ -71,89 +87,200 @@ JournalRateLimit *journal_ratelimit_new(void) {
         return r;
 }
 
-static void journal_ratelimit_group_free(JournalRateLimitGroup *g) {
-        assert(g);
+static JournalRateLimitGroup* journal_ratelimit_group_free(JournalRateLimitGroup *g) {
+        if (!g)
+                return NULL;
 
-        if (g->parent) {
-                assert(g->parent->n_groups > 0);
+        free(g->id);
+        return mfree(g);
+}
 
-                if (g->parent->lru_tail == g)
-                        g->parent->lru_tail = g->lru_prev;
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalRateLimitGroup*, journal_ratelimit_group_free);
 
-                LIST_REMOVE(lru, g->parent->lru, g);
-                LIST_REMOVE(bucket, g->parent->buckets[g->hash % BUCKETS_MAX], g);
+void journal_ratelimit_free(JournalRateLimit *r) {
+        assert(r);
 
-                g->parent->n_groups--;
-        }
+        for (size_t i = 0; i < r->n_slots; i++)
+                journal_ratelimit_group_free(r->slots[i].group);
 
-        free(g->id);
-        free(g);
+        free(r->slots);
+        free(r);
 }
 
-void journal_ratelimit_free(JournalRateLimit *r) {
+uint64_t journal_ratelimit_hash(JournalRateLimit *r, const char *id) {
+        assert(id);
+
+        if (!r)
+                return 0;
+
+        return siphash24_string(id, r->hash_key);
+}
+
+static JournalRateLimitGroup* journal_ratelimit_find(JournalRateLimit *r, const char *id, uint64_t hash) {
         assert(r);
+        assert(id);
 
-        while (r->lru)
-                journal_ratelimit_group_free(r->lru);
+        if (r->n_slots == 0)
+                return NULL;
 
-        free(r);
+        for (size_t i = hash & (r->n_slots - 1); r->slots[i].group; i = (i + 1) & (r->n_slots - 1))
+                if (r->slots[i].hash == hash && streq(r->slots[i].group->id, id))
+                        return r->slots[i].group;
+
+        return NULL;
 }
 
-static bool journal_ratelimit_group_expired(JournalRateLimitGroup *g, usec_t ts) {
-        unsigned i;
+static void journal_ratelimit_put(JournalRateLimit *r, JournalRateLimitGroup *g) {
+        size_t i;
+
+        assert(r);
+        assert(g);
+        assert(r->n_groups < r->n_slots);
+
+        for (i = g->hash & (r->n_slots - 1); r->slots[i].group; i = (i + 1) & (r->n_slots - 1))
+                ;
+
+        r->slots[i] = (JournalRateLimitSlot) {
+                .hash = g->hash,
+                .group = g,
+        };
+        r->n_groups++;
+}
+
+static int journal_ratelimit_rehash(JournalRateLimit *r, size_t n_slots) {
+        JournalRateLimitSlot *old_slots;
+        size_t old_n_slots;
+
+        assert(r);
+        assert(n_slots > 0 && (n_slots & (n_slots - 1)) == 0);
+
+        /* Also used to rebuild the table in place after groups were dropped from it, since linear probing doesn't
+         * allow simply clearing slots */
+
+        old_slots = TAKE_PTR(r->slots);
+        old_n_slots = r->n_slots;
+
+        r->slots = new0(JournalRateLimitSlot, n_slots);
+        if (!r->slots) {
+                r->slots = old_slots;
+                return -ENOMEM;
+        }
+
+        r->n_slots = n_slots;
+        r->n_groups = 0;
+
+        for (size_t i = 0; i < old_n_slots; i++)
+                if (old_slots[i].group)
+                        journal_ratelimit_put(r, old_slots[i].group);
+
+        free(old_slots);
+        return 0;
+}
 
+static bool journal_ratelimit_group_expired(JournalRateLimitGroup *g, usec_t ts) {
         assert(g);
 
-        for (i = 0; i < POOLS_MAX; i++)
-                if (g->pools[i].begin + g->interval >= ts)
+        /* A group whose buckets are all full again and which has nothing left to report is no different from a
+         * new one */
+
+        for (unsigned i = 0; i < POOLS_MAX; i++)
+                if (g->pools[i].suppressed > 0 || (g->pools[i].last > 0 && g->pools[i].last + g->interval > ts))
                         return false;
 
         return true;
 }
 
-static void journal_ratelimit_vacuum(JournalRateLimit *r, usec_t ts) {
+static int journal_ratelimit_group_compare(JournalRateLimitGroup * const *a, JournalRateLimitGroup * const *b) {
+        return CMP((*a)->last, (*b)->last);
+}
+
+static int journal_ratelimit_vacuum(JournalRateLimit *r, usec_t ts) {
+        _cleanup_free_ JournalRateLimitGroup **groups = NULL;
+        size_t n = 0, n_groups;
+
+        assert(r);
+
+        /* The table is full. Drop all expired groups, and if that frees less than an eighth of the table, the least
+         * recently used groups on top. Freeing a fixed fraction each time means the next vacuum is that many new
+         * groups away, instead of rescanning the whole table for every new group once only few of them expire. */
+
+        n_groups = r->n_groups;
+
+        groups = new(JournalRateLimitGroup*, n_groups);
+        if (!groups)
+                return -ENOMEM;
+
+        for (size_t i = 0; i < r->n_slots; i++) {
+                JournalRateLimitGroup *g = r->slots[i].group;
+
+                if (!g)
+                        continue;
+
+                r->slots[i].group = NULL;
+
+                if (journal_ratelimit_group_expired(g, ts))
+                        journal_ratelimit_group_free(g);
+                else
+                        groups[n++] = g;
+        }
+
+        r->n_groups = 0;
+
+        if (n_groups - n < GROUPS_MAX / 8) {
+                size_t k = MIN(GROUPS_MAX / 8 - (n_groups - n), n);
+
+                typesafe_qsort(groups, n, journal_ratelimit_group_compare);
+
+                for (size_t i = 0; i < k; i++) {
+                        r->n_evicted++;
+                        journal_ratelimit_group_free(groups[i]);
+                }
+
+                n -= k;
+                memmove(groups, groups + k, n * sizeof(JournalRateLimitGroup*));
+        }
+
+        for (size_t i = 0; i < n; i++)
+                journal_ratelimit_put(r, groups[i]);
+
+        return 0;
+}
+
+static int journal_ratelimit_make_room(JournalRateLimit *r, usec_t ts) {
         assert(r);
 
-        /* Makes room for at least one new item, but drop all
-         * expored items too. */
+        /* Keep the load factor at 1/2 at most */
+        if ((r->n_groups + 1) * 2 <= r->n_slots)
+                return 0;
+
+        if (r->n_slots < GROUPS_MAX * 2)
+                return journal_ratelimit_rehash(r, MAX(r->n_slots * 2, SLOTS_MIN));
 
-        while (r->n_groups >= GROUPS_MAX ||
-               (r->lru_tail && journal_ratelimit_group_expired(r->lru_tail, ts)))
-                journal_ratelimit_group_free(r->lru_tail);
+        return journal_ratelimit_vacuum(r, ts);
 }
 
-static JournalRateLimitGroup* journal_ratelimit_group_new(JournalRateLimit *r, const char *id, usec_t interval, usec_t ts) {
-        JournalRateLimitGroup *g;
+static JournalRateLimitGroup* journal_ratelimit_group_new(JournalRateLimit *r, const char *id, uint64_t hash, usec_t ts) {
+        _cleanup_(journal_ratelimit_group_freep) JournalRateLimitGroup *g = NULL;
 
         assert(r);
         assert(id);
 
+        if (journal_ratelimit_make_room(r, ts) < 0)
+                return NULL;
+
         g = new0(JournalRateLimitGroup, 1);
         if (!g)
                 return NULL;
 
         g->id = strdup(id);
         if (!g->id)
-                goto fail;
-
-        g->hash = siphash24_string(g->id, r->hash_key);
-
-        g->interval = interval;
-
-        journal_ratelimit_vacuum(r, ts);
+                return NULL;
 
-        LIST_PREPEND(bucket, r->buckets[g->hash % BUCKETS_MAX], g);
-        LIST_PREPEND(lru, r->lru, g);
-        if (!g->lru_next)
-                r->lru_tail = g;
-        r->n_groups++;
+        g->hash = hash;
 
-        g->parent = r;
-        return g;
+        journal_ratelimit_put(r, g);
 
-fail:
-        journal_ratelimit_group_free(g);
-        return NULL;
+        return TAKE_PTR(g);
 }
 
 static unsigned burst_modulate(unsigned burst, uint64_t available) {
@@ -184,12 +311,20 @@ static unsigned burst_modulate(unsigned burst, uint64_t available) {
         return burst;
 }
 
-int journal_ratelimit_test(JournalRateLimit *r, const char *id, usec_t rl_interval, unsigned rl_burst, int priority, uint64_t available) {
-        uint64_t h;
+int journal_ratelimit_test(
+                JournalRateLimit *r,
+                const char *id,
+                uint64_t hash,
+                usec_t ts,
+                usec_t rl_interval,
+                unsigned rl_burst,
+                int priority,
+                uint64_t available) {
+
         JournalRateLimitGroup *g;
         JournalRateLimitPool *p;
+        uint64_t capacity;
         unsigned burst;
-        usec_t ts;
 
         assert(id);
 
@@ -198,57 +333,123 @@ int journal_ratelimit_test(JournalRateLimit *r, const char *id, usec_t rl_interv
          * 0     → the log message shall be suppressed,
          * 1 + n → the log message shall be permitted, and n messages were dropped from the peer before
          * < 0   → error
-         */
+         *
+         * The hash must have been calculated with journal_ratelimit_hash(), so that callers can keep it around
+         * with the id and don't need to hash it for every message. */
 
         if (!r)
                 return 1;
 
-        ts = now(CLOCK_MONOTONIC);
-
-        h = siphash24_string(id, r->hash_key);
-        g = r->buckets[h % BUCKETS_MAX];
-
-        LIST_FOREACH(bucket, g, g)
-                if (streq(g->id, id))
-                        break;
+        if (rl_interval == 0 || rl_burst == 0)
+                return 1;
 
+        g = journal_ratelimit_find(r, id, hash);
         if (!g) {
-                g = journal_ratelimit_group_new(r, id, rl_interval, ts);
+                g = journal_ratelimit_group_new(r, id, hash, ts);
                 if (!g)
                         return -ENOMEM;
-        } else
-                g->interval = rl_interval;
+        }
 
-        if (rl_interval == 0 || rl_burst == 0)
-                return 1;
+        g->interval = rl_interval;
+        g->burst = rl_burst;
+        g->last = ts;
 
         burst = burst_modulate(rl_burst, available);
+        capacity = (uint64_t) burst * rl_interval;
 
         p = &g->pools[priority_map[priority]];
 
-        if (p->begin <= 0) {
-                p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
-                return 1;
+        /* Refill the bucket, a new one starts out full */
+        if (p->last == 0 || ts >= p->last + rl_interval)
+                p->level = capacity;
+        else if (ts > p->last)
+                p->level = MIN(p->level + (ts - p->last) * burst, capacity);
+        else
+                p->level = MIN(p->level, capacity);
+
+        p->last = ts;
+
+        if (p->level < rl_interval) {
+                if (p->suppressed == 0)
+                        p->reported = ts;
+
+                p->suppressed++;
+                g->dropped++;
+                r->n_dropped++;
+                return 0;
         }
 
-        if (p->begin + rl_interval < ts) {
-                unsigned s;
+        p->level -= rl_interval;
 
-                s = p->suppressed;
-                p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
+        /* Report suppressed messages at most once per interval, not every time a token trickles in */
+        if (p->suppressed > 0 && p->reported + rl_interval <= ts) {
+                unsigned s = p->suppressed;
 
+                p->suppressed = 0;
+                p->reported = ts;
                 return 1 + s;
         }
 
-        if (p->num < burst) {
-                p->num++;
-                return 1;
+        return 1;
+}
+
+int journal_ratelimit_build_json(JournalRateLimit *r, JsonVariant **ret) {
+        _cleanup_(json_variant_unrefp) JsonVariant *groups = NULL;
+        JsonVariant **elements = NULL;
+        uint64_t dropped = 0, evicted = 0;
+        size_t n_groups = 0, n_elements = 0;
+        int k;
+
+        assert(ret);
+
+        /* Only groups that dropped something are listed, everything else is just the default state. The array is
+         * built in one go, appending to it element by element would copy it each time. */
+
+        if (r) {
+                elements = new(JsonVariant*, r->n_groups);
+                if (!elements)
+                        return -ENOMEM;
+
+                for (size_t i = 0; i < r->n_slots; i++) {
+                        JournalRateLimitGroup *g = r->slots[i].group;
+                        unsigned suppressed = 0;
+
+                        if (!g || g->dropped == 0)
+                                continue;
+
+                        for (unsigned j = 0; j < POOLS_MAX; j++)
+                                suppressed += g->pools[j].suppressed;
+
+                        k = json_build(elements + n_elements, JSON_BUILD_OBJECT(
+                                        JSON_BUILD_PAIR("Unit", JSON_BUILD_STRING(g->id)),
+                                        JSON_BUILD_PAIR("IntervalUSec", JSON_BUILD_UNSIGNED(g->interval)),
+                                        JSON_BUILD_PAIR("Burst", JSON_BUILD_UNSIGNED(g->burst)),
+                                        JSON_BUILD_PAIR("Dropped", JSON_BUILD_UNSIGNED(g->dropped)),
+                                        JSON_BUILD_PAIR("Suppressed", JSON_BUILD_UNSIGNED(suppressed))));
+                        if (k < 0)
+                                goto finish;
+
+                        n_elements++;
+                }
+
+                n_groups = r->n_groups;
+                dropped = r->n_dropped;
+                evicted = r->n_evicted;
         }
 
-        p->suppressed++;
-        return 0;
+        k = json_variant_new_array(&groups, elements, n_elements);
+        if (k < 0)
+                goto finish;
+
+        k = json_build(ret, JSON_BUILD_OBJECT(
+                                JSON_BUILD_PAIR("Groups", JSON_BUILD_UNSIGNED(n_groups)),
+                                JSON_BUILD_PAIR("Dropped", JSON_BUILD_UNSIGNED(dropped)),
+                                JSON_BUILD_PAIR("Evicted", JSON_BUILD_UNSIGNED(evicted)),
+                                JSON_BUILD_PAIR("Units", JSON_BUILD_VARIANT(groups))));
+
+finish:
+        json_variant_unref_many(elements, n_elements);
+        free(elements);
+
+        return k;
 }
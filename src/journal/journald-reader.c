@@ -0,0 +1,801 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <linux/sockios.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "journald-native.h"
+#include "journald-reader.h"
+#include "journald-stream.h"
+#include "journald-syslog.h"
+#include "signal-util.h"
+#include "socket-util.h"
+
+/* With ReaderThreads= set, the native and syslog sockets and the stdout streams aren't read on the event loop but
+ * on a few threads. Each socket and each stream is read by one of them, which also does the parsing: native
+ * messages are split into fields and streams into lines. The results are queued up in order as records, which
+ * the event loop picks up to do everything else: look up the client context, apply the rate limit, forward
+ * the messages and write them to the journal files, which hence are still only ever touched by the event loop.
+ *
+ * That way whatever comes in on one socket or stream stays in order. A thread reads each of its sources in turn
+ * and only a batch at a time, so that a chatty client can't keep it from the others. If the event loop can't
+ * keep up the threads stop reading once their queue is full, which pushes back on the clients just like a busy
+ * event loop does.
+ *
+ * /dev/kmsg and audit are still read on the event loop, they are a lot less busy. */
+
+#define READER_THREADS_MAX 8U
+
+/* How many datagrams to read from a socket in one go, before looking at the other sources */
+#define READER_DATAGRAMS_MAX 16U
+
+/* How many records a thread queues up before it waits for the event loop */
+#define READER_QUEUE_MAX 256U
+
+/* How many records the event loop processes in one go, before giving other event sources a chance */
+#define READER_BATCH_MAX 64U
+
+typedef enum ReaderRecordType {
+        READER_RECORD_NATIVE,   /* Entries parsed from a message on the native socket */
+        READER_RECORD_DATAGRAM, /* A syslog message, or file descriptors passed to the native socket */
+        READER_RECORD_LINES,    /* Lines read from a stdout stream */
+        READER_RECORD_CLOSED,   /* The thread is done with a stdout stream, this is its last record */
+} ReaderRecordType;
+
+typedef struct ReaderLine {
+        size_t length;
+        int line_break;
+        char text[]; /* NUL terminated */
+} ReaderLine;
+
+#define READER_LINE_SIZE(l) ALIGN(offsetof(ReaderLine, text) + (l) + 1)
+
+typedef struct ReaderRecord ReaderRecord;
+
+struct ReaderRecord {
+        ReaderRecordType type;
+        ReaderRecord *next;
+
+        int fd; /* The socket the message came in on */
+        StdoutStream *stream;
+
+        struct ucred ucred;
+        bool have_ucred;
+        struct timeval tv;
+        bool have_tv;
+        const char *label;
+        size_t label_len;
+        int fds[2];
+        size_t n_fds;
+
+        NativeEntry *entries;
+        size_t n_entries;
+
+        /* The message followed by the label, or the lines */
+        size_t size, allocated;
+        uint64_t data[];
+};
+
+struct JournalReader {
+        Server *server;
+
+        pthread_t thread;
+        bool started;
+
+        int epoll_fd;
+        int wakeup_fd; /* Makes the thread look at 'stop' */
+        int notify_fd; /* Tells the event loop about new records */
+        sd_event_source *event_source;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond; /* Signalled when the event loop took records off the queue */
+        ReaderRecord *queue, *queue_tail;
+        size_t n_queue;
+        bool stop;
+
+        /* Only used by the event loop, to spread the streams */
+        unsigned n_sources;
+
+        /* Only used by the thread */
+        char *buffer;
+        ReaderRecord *lines;
+};
+
+static ReaderRecord* reader_record_free(ReaderRecord *record) {
+        if (!record)
+                return NULL;
+
+        for (size_t i = 0; i < record->n_entries; i++)
+                native_entry_done(record->entries + i);
+        free(record->entries);
+
+        close_many(record->fds, record->n_fds);
+
+        return mfree(record);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(ReaderRecord*, reader_record_free);
+
+static ReaderRecord* reader_record_new(ReaderRecordType type, size_t size) {
+        ReaderRecord *record;
+
+        record = malloc(offsetof(ReaderRecord, data) + size);
+        if (!record)
+                return NULL;
+
+        *record = (ReaderRecord) {
+                .type = type,
+                .fd = -1,
+                .allocated = size,
+        };
+
+        return record;
+}
+
+static char* reader_record_data(ReaderRecord *record) {
+        return (char*) record->data;
+}
+
+static void reader_queue(JournalReader *r, ReaderRecord *record) {
+        assert(r);
+        assert(record);
+
+        assert_se(pthread_mutex_lock(&r->mutex) == 0);
+
+        while (r->n_queue >= READER_QUEUE_MAX && !r->stop)
+                assert_se(pthread_cond_wait(&r->cond, &r->mutex) == 0);
+
+        if (r->queue_tail)
+                r->queue_tail->next = record;
+        else {
+                uint64_t one = 1;
+
+                /* The event loop empties the eventfd only along with the queue */
+                r->queue = record;
+                (void) write(r->notify_fd, &one, sizeof(one));
+        }
+
+        r->queue_tail = record;
+        r->n_queue++;
+
+        assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+}
+
+static ReaderRecord* reader_datagram_record(
+                int fd,
+                const char *buffer, size_t size,
+                const struct ucred *ucred,
+                const struct timeval *tv,
+                const char *label, size_t label_len) {
+
+        ReaderRecord *record;
+        char *p;
+
+        record = reader_record_new(READER_RECORD_DATAGRAM, size + 1 + label_len);
+        if (!record)
+                return NULL;
+
+        record->fd = fd;
+        record->size = size;
+
+        p = reader_record_data(record);
+        memcpy_safe(p, buffer, size);
+        p += size;
+        *(p++) = 0;
+
+        if (label) {
+                record->label = memcpy(p, label, label_len);
+                record->label_len = label_len;
+        }
+
+        if (ucred) {
+                record->ucred = *ucred;
+                record->have_ucred = true;
+        }
+
+        if (tv) {
+                record->tv = *tv;
+                record->have_tv = true;
+        }
+
+        return record;
+}
+
+static int reader_parse_native(ReaderRecord *record) {
+        const struct ucred *ucred;
+        size_t remaining;
+        int k;
+
+        assert(record);
+
+        ucred = record->have_ucred ? &record->ucred : NULL;
+        remaining = record->size;
+
+        do {
+                if (!GREEDY_REALLOC(record->entries, record->n_entries + 1))
+                        return log_oom();
+
+                k = native_entry_parse(record->entries + record->n_entries,
+                                       reader_record_data(record) + (record->size - remaining), &remaining,
+                                       ucred);
+                if (k == 0)
+                        record->n_entries++;
+                else
+                        native_entry_done(record->entries + record->n_entries);
+        } while (k == 0);
+
+        return 0;
+}
+
+static int reader_read_datagram(JournalReader *r, int fd) {
+        _cleanup_(reader_record_freep) ReaderRecord *record = NULL;
+        size_t label_len = 0, m;
+        Server *s = r->server;
+        struct ucred *ucred = NULL;
+        struct timeval *tv = NULL;
+        struct cmsghdr *cmsg;
+        char *label = NULL;
+        struct iovec iovec;
+        ssize_t n;
+        int *fds = NULL, v = 0;
+        size_t n_fds = 0;
+
+        /* See server_process_datagram() */
+        CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(struct ucred)) +
+                         CMSG_SPACE_TIMEVAL +
+                         CMSG_SPACE(sizeof(int) * 2) + /* fds */
+                         CMSG_SPACE(NAME_MAX) /* selinux label */) control = {};
+
+        struct msghdr msghdr = {
+                .msg_iov = &iovec,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+
+        /* Returns 1 if a message was read, 0 if there was nothing to read */
+
+        (void) ioctl(fd, SIOCINQ, &v);
+        m = PAGE_ALIGN(MAX((size_t) v + 1, (size_t) LINE_MAX) + 1);
+
+        if (!GREEDY_REALLOC(r->buffer, m))
+                return log_oom();
+
+        iovec = IOVEC_MAKE(r->buffer, MALLOC_ELEMENTSOF(r->buffer) - 1);
+
+        n = recvmsg_safe(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+        if (IN_SET(n, -EINTR, -EAGAIN))
+                return 0;
+        if (n == -EXFULL) {
+                log_warning("Got message with truncated control data (too many fds sent?), ignoring.");
+                return 1;
+        }
+        if (n < 0)
+                return log_error_errno(n, "recvmsg() failed: %m");
+
+        CMSG_FOREACH(cmsg, &msghdr)
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_CREDENTIALS &&
+                    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+                        assert(!ucred);
+                        ucred = (struct ucred*) CMSG_DATA(cmsg);
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                         cmsg->cmsg_type == SCM_SECURITY) {
+                        assert(!label);
+                        label = (char*) CMSG_DATA(cmsg);
+                        label_len = cmsg->cmsg_len - CMSG_LEN(0);
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                           cmsg->cmsg_type == SO_TIMESTAMP &&
+                           cmsg->cmsg_len == CMSG_LEN(sizeof(struct timeval))) {
+                        assert(!tv);
+                        tv = (struct timeval*) CMSG_DATA(cmsg);
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                           cmsg->cmsg_type == SCM_RIGHTS) {
+                        assert(!fds);
+                        fds = (int*) CMSG_DATA(cmsg);
+                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                }
+
+        /* Running out of memory costs us the message, but we go on reading */
+
+        if (fd == s->syslog_fd) {
+                if (n_fds > 0) {
+                        log_warning("Got file descriptors via syslog socket. Ignoring.");
+                        close_many(fds, n_fds);
+                        return 1;
+                }
+                if (n == 0)
+                        return 1;
+
+                record = reader_datagram_record(fd, r->buffer, n, ucred, tv, label, label_len);
+                if (!record)
+                        return log_oom(), 1;
+
+        } else if (n_fds == 0) {
+                assert(fd == s->native_fd);
+
+                if (n == 0)
+                        return 1;
+
+                record = reader_datagram_record(fd, r->buffer, n, ucred, tv, label, label_len);
+                if (!record)
+                        return log_oom(), 1;
+
+                record->type = READER_RECORD_NATIVE;
+
+                if (reader_parse_native(record) < 0 || record->n_entries == 0)
+                        return 1;
+
+        } else {
+                assert(fd == s->native_fd);
+
+                if (n > 0 || n_fds > 2) {
+                        log_warning("Got too many file descriptors via native socket. Ignoring.");
+                        close_many(fds, n_fds);
+                        return 1;
+                }
+
+                record = reader_datagram_record(fd, NULL, 0, ucred, tv, label, label_len);
+                if (!record) {
+                        close_many(fds, n_fds);
+                        return log_oom(), 1;
+                }
+
+                memcpy(record->fds, fds, sizeof(int) * n_fds);
+                record->n_fds = n_fds;
+        }
+
+        reader_queue(r, TAKE_PTR(record));
+        return 1;
+}
+
+static int reader_add_line(
+                StdoutStream *stream,
+                const struct ucred *ucred,
+                const char *p,
+                size_t l,
+                int line_break,
+                void *userdata) {
+
+        JournalReader *r = userdata;
+        ReaderRecord *record;
+        ReaderLine *line;
+        size_t need;
+
+        assert(stream);
+        assert(ucred);
+        assert(r);
+
+        /* Lines are collected in one record per read, unless the sender changes in between */
+        record = r->lines;
+        if (record && memcmp(&record->ucred, ucred, sizeof(struct ucred)) != 0) {
+                reader_queue(r, TAKE_PTR(r->lines));
+                record = NULL;
+        }
+
+        need = READER_LINE_SIZE(l);
+
+        if (!record) {
+                record = reader_record_new(READER_RECORD_LINES, MAX(need, (size_t) 4096));
+                if (!record)
+                        return log_oom();
+
+                record->stream = stream;
+                record->ucred = *ucred;
+                record->have_ucred = true;
+
+                r->lines = record;
+
+        } else if (record->size + need > record->allocated) {
+                size_t allocated;
+
+                allocated = MAX(record->allocated * 2, record->size + need);
+
+                record = realloc(record, offsetof(ReaderRecord, data) + allocated);
+                if (!record)
+                        return log_oom();
+
+                record->allocated = allocated;
+                r->lines = record;
+        }
+
+        line = (ReaderLine*) (reader_record_data(record) + record->size);
+        line->length = l;
+        line->line_break = line_break;
+        memcpy(line->text, p, l);
+        line->text[l] = 0;
+
+        record->size += need;
+        return 0;
+}
+
+static void reader_read_stream(JournalReader *r, StdoutStream *stream) {
+        ReaderRecord *record;
+        int k;
+
+        assert(r);
+        assert(stream);
+
+        k = stdout_stream_read(stream, reader_add_line, r);
+
+        if (r->lines)
+                reader_queue(r, TAKE_PTR(r->lines));
+
+        if (k >= 0)
+                return;
+
+        /* EOF, or the stream is broken. Hand it back, after that we must not touch it anymore. */
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, stdout_stream_get_fd(stream), NULL) < 0)
+                log_warning_errno(errno, "Failed to remove stream from reader thread, ignoring: %m");
+
+        record = reader_record_new(READER_RECORD_CLOSED, 0);
+        if (!record) {
+                /* We can't leave the stream behind, hence wait for memory */
+                log_oom();
+                while (!(record = reader_record_new(READER_RECORD_CLOSED, 0)))
+                        (void) usleep(10 * USEC_PER_MSEC);
+        }
+
+        record->stream = stream;
+        reader_queue(r, record);
+}
+
+static void* reader_thread(void *p) {
+        JournalReader *r = p;
+        Server *s = r->server;
+
+        for (;;) {
+                struct epoll_event events[16];
+                bool stop;
+                int n;
+
+                n = epoll_wait(r->epoll_fd, events, ELEMENTSOF(events), -1);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        log_error_errno(errno, "Reader thread failed to wait for events: %m");
+                        break;
+                }
+
+                for (int i = 0; i < n; i++) {
+                        void *ptr = events[i].data.ptr;
+
+                        if (ptr == r)
+                                (void) flush_fd(r->wakeup_fd);
+
+                        else if (ptr == &s->native_fd || ptr == &s->syslog_fd) {
+                                int fd = *(int*) ptr;
+
+                                for (unsigned j = 0; j < READER_DATAGRAMS_MAX; j++) {
+                                        int k;
+
+                                        k = reader_read_datagram(r, fd);
+                                        if (k == 0)
+                                                break;
+                                        if (k < 0) {
+                                                /* Like sd-event does with an event source that fails */
+                                                log_error("Not reading from socket anymore.");
+                                                (void) epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                                                break;
+                                        }
+                                }
+                        } else
+                                reader_read_stream(r, ptr);
+                }
+
+                assert_se(pthread_mutex_lock(&r->mutex) == 0);
+                stop = r->stop;
+                assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+
+                if (stop)
+                        break;
+        }
+
+        return NULL;
+}
+
+static void reader_record_dispatch(JournalReader *r, ReaderRecord *record) {
+        const struct ucred *ucred;
+        const struct timeval *tv;
+        Server *s = r->server;
+
+        assert(record);
+
+        ucred = record->have_ucred ? &record->ucred : NULL;
+        tv = record->have_tv ? &record->tv : NULL;
+
+        switch (record->type) {
+
+        case READER_RECORD_NATIVE:
+                server_process_native_entries(s, record->entries, record->n_entries, ucred, tv, record->label, record->label_len);
+                break;
+
+        case READER_RECORD_DATAGRAM:
+                if (record->fd == s->syslog_fd)
+                        server_process_syslog_message(s, reader_record_data(record), record->size, ucred, tv, record->label, record->label_len);
+                else if (record->n_fds == 1)
+                        server_process_native_file(s, record->fds[0], ucred, tv, record->label, record->label_len);
+                else
+                        server_process_native_ring(s, record->fds, ucred, record->label, record->label_len);
+                break;
+
+        case READER_RECORD_LINES:
+                for (size_t offset = 0; offset < record->size; ) {
+                        ReaderLine *line = (ReaderLine*) (reader_record_data(record) + offset);
+
+                        stdout_stream_process_line(record->stream, &record->ucred, line->text, line->line_break);
+                        offset += READER_LINE_SIZE(line->length);
+                }
+                break;
+
+        case READER_RECORD_CLOSED:
+                assert(r->n_sources > 0);
+                r->n_sources--;
+
+                stdout_stream_release(record->stream);
+                break;
+
+        default:
+                assert_not_reached();
+        }
+}
+
+static size_t reader_dispatch_records(JournalReader *r, size_t max) {
+        ReaderRecord *records, *last = NULL;
+        size_t n = 0;
+
+        assert(r);
+
+        assert_se(pthread_mutex_lock(&r->mutex) == 0);
+
+        records = r->queue;
+        while (r->queue && n < max) {
+                last = r->queue;
+                r->queue = r->queue->next;
+                n++;
+        }
+
+        if (last)
+                last->next = NULL;
+
+        /* Only once the queue is empty the event loop may go to sleep */
+        if (!r->queue) {
+                r->queue_tail = NULL;
+                (void) flush_fd(r->notify_fd);
+        }
+
+        r->n_queue -= n;
+        assert_se(pthread_cond_signal(&r->cond) == 0);
+
+        assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+
+        while (records) {
+                ReaderRecord *record = records;
+
+                records = record->next;
+
+                reader_record_dispatch(r, record);
+                reader_record_free(record);
+        }
+
+        return n;
+}
+
+static int dispatch_reader(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        JournalReader *r = userdata;
+
+        assert(r);
+
+        (void) reader_dispatch_records(r, READER_BATCH_MAX);
+
+        server_refresh_idle_timer(r->server);
+        return 0;
+}
+
+static int reader_init(JournalReader *r, Server *s) {
+        int k;
+
+        assert(r);
+        assert(s);
+
+        *r = (JournalReader) {
+                .server = s,
+                .epoll_fd = -1,
+                .wakeup_fd = -1,
+                .notify_fd = -1,
+        };
+
+        assert_se(pthread_mutex_init(&r->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&r->cond, NULL) == 0);
+
+        r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (r->epoll_fd < 0)
+                return log_error_errno(errno, "Failed to create epoll fd for reader thread: %m");
+
+        r->wakeup_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (r->wakeup_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd for reader thread: %m");
+
+        r->notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (r->notify_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd for reader thread: %m");
+
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wakeup_fd,
+                      &(struct epoll_event) { .events = EPOLLIN, .data.ptr = r }) < 0)
+                return log_error_errno(errno, "Failed to add eventfd to reader thread: %m");
+
+        k = sd_event_add_io(s->event, &r->event_source, r->notify_fd, EPOLLIN, dispatch_reader, r);
+        if (k < 0)
+                return log_error_errno(k, "Failed to add reader thread to event loop: %m");
+
+        /* The same priority as the sockets and streams get if they are read on the event loop */
+        k = sd_event_source_set_priority(r->event_source, SD_EVENT_PRIORITY_NORMAL+5);
+        if (k < 0)
+                return log_error_errno(k, "Failed to adjust reader thread event source priority: %m");
+
+        return 0;
+}
+
+static void reader_done(JournalReader *r) {
+        assert(r);
+
+        /* Whatever is still queued was consumed from the clients already, hence process it */
+        while (reader_dispatch_records(r, SIZE_MAX) > 0)
+                ;
+
+        reader_record_free(r->lines);
+        free(r->buffer);
+
+        sd_event_source_disable_unref(r->event_source);
+        safe_close(r->epoll_fd);
+        safe_close(r->wakeup_fd);
+        safe_close(r->notify_fd);
+
+        assert_se(pthread_cond_destroy(&r->cond) == 0);
+        assert_se(pthread_mutex_destroy(&r->mutex) == 0);
+}
+
+int server_start_readers(Server *s) {
+        sigset_t ss, saved_ss;
+        unsigned n;
+        int k;
+
+        assert(s);
+        assert(!s->readers);
+
+        n = MIN(s->reader_threads, READER_THREADS_MAX);
+        if (n == 0)
+                return 0;
+
+        s->readers = new(JournalReader, n);
+        if (!s->readers)
+                return log_oom();
+
+        for (; s->n_readers < n; s->n_readers++) {
+                k = reader_init(s->readers + s->n_readers, s);
+                if (k < 0) {
+                        reader_done(s->readers + s->n_readers);
+                        goto fail;
+                }
+        }
+
+        assert_se(sigfillset(&ss) >= 0);
+        k = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (k > 0) {
+                log_error_errno(k, "Failed to block signals for reader threads: %m");
+                goto fail;
+        }
+
+        for (unsigned i = 0; i < s->n_readers; i++) {
+                JournalReader *r = s->readers + i;
+
+                k = pthread_create(&r->thread, NULL, reader_thread, r);
+                if (k > 0) {
+                        log_error_errno(k, "Failed to start reader thread: %m");
+                        break;
+                }
+
+                r->started = true;
+        }
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        if (k > 0)
+                goto fail;
+
+        log_debug("Started %u reader threads.", s->n_readers);
+        return 0;
+
+fail:
+        /* Not worth failing for, read everything on the event loop then */
+        log_warning("Reading everything on the event loop.");
+        server_stop_readers(s);
+        return 0;
+}
+
+void server_stop_readers(Server *s) {
+        assert(s);
+
+        for (unsigned i = 0; i < s->n_readers; i++) {
+                JournalReader *r = s->readers + i;
+                uint64_t one = 1;
+
+                if (!r->started)
+                        continue;
+
+                assert_se(pthread_mutex_lock(&r->mutex) == 0);
+                r->stop = true;
+                assert_se(pthread_cond_broadcast(&r->cond) == 0);
+                assert_se(pthread_mutex_unlock(&r->mutex) == 0);
+
+                (void) write(r->wakeup_fd, &one, sizeof(one));
+                (void) pthread_join(r->thread, NULL);
+        }
+
+        for (unsigned i = 0; i < s->n_readers; i++)
+                reader_done(s->readers + i);
+
+        s->readers = mfree(s->readers);
+        s->n_readers = 0;
+}
+
+static JournalReader* server_pick_reader(Server *s) {
+        JournalReader *best = NULL;
+
+        assert(s);
+        assert(s->n_readers > 0);
+
+        for (unsigned i = 0; i < s->n_readers; i++)
+                if (!best || s->readers[i].n_sources < best->n_sources)
+                        best = s->readers + i;
+
+        return best;
+}
+
+int server_reader_add_socket(Server *s, int *fd) {
+        JournalReader *r;
+
+        assert(s);
+        assert(fd);
+        assert(fd == &s->native_fd || fd == &s->syslog_fd);
+        assert(*fd >= 0);
+
+        r = server_pick_reader(s);
+
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, *fd,
+                      &(struct epoll_event) { .events = EPOLLIN, .data.ptr = fd }) < 0)
+                return log_error_errno(errno, "Failed to add socket to reader thread: %m");
+
+        r->n_sources++;
+        return 0;
+}
+
+int server_reader_add_stream(Server *s, StdoutStream *stream, int fd, JournalReader **ret) {
+        JournalReader *r;
+
+        assert(s);
+        assert(stream);
+        assert(fd >= 0);
+        assert(ret);
+
+        r = server_pick_reader(s);
+
+        /* The thread may start reading right away */
+        *ret = r;
+
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd,
+                      &(struct epoll_event) { .events = EPOLLIN, .data.ptr = stream }) < 0) {
+                *ret = NULL;
+                return log_error_errno(errno, "Failed to add stream to reader thread: %m");
+        }
+
+        r->n_sources++;
+        return 0;
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "journald-server.h"
+
+int server_start_readers(Server *s);
+void server_stop_readers(Server *s);
+
+int server_reader_add_socket(Server *s, int *fd);
+int server_reader_add_stream(Server *s, StdoutStream *stream, int fd, JournalReader **ret);
@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "format-util.h"
+#include "io-util.h"
+#include "journal-recompress.h"
+#include "journald-recompress.h"
+#include "list.h"
+#include "missing_ioprio.h"
+#include "missing_syscall.h"
+#include "signal-util.h"
+#include "time-util.h"
+
+/* With Recompress= enabled, every file journald archives is handed to a thread that rewrites it with all
+ * its data compressed at a high zstd level, see journal_file_recompress(). The thread runs in the idle I/O
+ * scheduling class and at the lowest CPU priority, so that it only uses what nothing else wants.
+ *
+ * Right after rotation the archived file might still be being offlined, in which case it is tried again a
+ * little later. Files that were recompressed are passed back to the event loop, which tells the vacuum
+ * index that they shrank. */
+
+#define RECOMPRESS_RETRY_USEC (1 * USEC_PER_SEC)
+#define RECOMPRESS_TRIES_MAX 30U
+
+typedef struct RecompressItem RecompressItem;
+
+struct RecompressItem {
+        char *path;
+        unsigned n_tries;
+        LIST_FIELDS(RecompressItem, queue);
+};
+
+struct JournalRecompressor {
+        Server *server;
+
+        pthread_t thread;
+        bool thread_started;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond; /* Signalled when a file was queued, or the thread shall stop */
+        LIST_HEAD(RecompressItem, queue);
+        RecompressItem *queue_tail;
+        uint64_t n_queue;
+        volatile bool stop;
+
+        /* Files that were recompressed, until the event loop picks them up. The eventfd is readable
+         * while there are any. */
+        LIST_HEAD(RecompressItem, done);
+        int notify_fd;
+        sd_event_source *event_source;
+
+        uint64_t n_files;
+        uint64_t n_freed;
+};
+
+static RecompressItem* recompress_item_free(RecompressItem *i) {
+        if (!i)
+                return NULL;
+
+        free(i->path);
+        return mfree(i);
+}
+
+static void recompress_one(JournalRecompressor *c, RecompressItem *i) {
+        uint64_t freed = 0;
+        int r;
+
+        r = journal_file_recompress(i->path, JOURNAL_RECOMPRESS_LEVEL, &c->stop, &freed);
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+
+        if (r == -EBUSY && ++i->n_tries < RECOMPRESS_TRIES_MAX && !c->stop) {
+                struct timespec ts;
+
+                /* Still being offlined, look at it again first thing after a bit */
+                LIST_PREPEND(queue, c->queue, i);
+                if (!c->queue_tail)
+                        c->queue_tail = i;
+                c->n_queue++;
+
+                timespec_store(&ts, now(CLOCK_MONOTONIC) + RECOMPRESS_RETRY_USEC);
+                (void) pthread_cond_timedwait(&c->cond, &c->mutex, &ts);
+                return;
+        }
+
+        if (r > 0) {
+                c->n_files++;
+                c->n_freed += freed;
+
+                if (!c->done) {
+                        uint64_t one = 1;
+
+                        /* The event loop empties the eventfd only along with the list */
+                        (void) write(c->notify_fd, &one, sizeof(one));
+                }
+
+                LIST_PREPEND(queue, c->done, i);
+        }
+
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        if (r > 0)
+                log_debug("Recompressed archived journal %s (%s freed).", i->path, FORMAT_BYTES(freed));
+        else {
+                if (r < 0 && r != -ECANCELED)
+                        log_full_errno(r == -ENOENT ? LOG_DEBUG : LOG_WARNING, r,
+                                       "Failed to recompress %s, ignoring: %m", i->path);
+
+                recompress_item_free(i);
+        }
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+}
+
+static void* recompress_thread(void *p) {
+        JournalRecompressor *c = p;
+
+        /* On Linux both only apply to the calling thread */
+        if (ioprio_set(IOPRIO_WHO_PROCESS, 0, ioprio_prio_value(IOPRIO_CLASS_IDLE, 0)) < 0)
+                log_debug_errno(errno, "Failed to set I/O priority of recompress thread, ignoring: %m");
+        if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+                log_debug_errno(errno, "Failed to set CPU priority of recompress thread, ignoring: %m");
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+
+        for (;;) {
+                RecompressItem *i;
+
+                while (!c->stop && !c->queue)
+                        assert_se(pthread_cond_wait(&c->cond, &c->mutex) == 0);
+                if (c->stop)
+                        break;
+
+                i = c->queue;
+                LIST_REMOVE(queue, c->queue, i);
+                if (c->queue_tail == i)
+                        c->queue_tail = NULL;
+                c->n_queue--;
+
+                assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+                /* Returns with the mutex locked */
+                recompress_one(c, i);
+        }
+
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+        return NULL;
+}
+
+static void recompress_dispatch_done(JournalRecompressor *c) {
+        RecompressItem *done;
+
+        assert(c);
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        done = TAKE_PTR(c->done);
+        (void) flush_fd(c->notify_fd);
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        while (done) {
+                RecompressItem *i = done;
+
+                LIST_REMOVE(queue, done, i);
+
+                /* The file was replaced by a smaller one */
+                server_update_vacuum_index(c->server, i->path);
+                recompress_item_free(i);
+        }
+}
+
+static int dispatch_recompressed(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        JournalRecompressor *c = userdata;
+
+        assert(c);
+
+        recompress_dispatch_done(c);
+        return 0;
+}
+
+static JournalRecompressor* recompressor_free(JournalRecompressor *c) {
+        if (!c)
+                return NULL;
+
+        if (c->thread_started) {
+                assert_se(pthread_mutex_lock(&c->mutex) == 0);
+                c->stop = true;
+                assert_se(pthread_cond_broadcast(&c->cond) == 0);
+                assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+                (void) pthread_join(c->thread, NULL);
+        }
+
+        /* What's left stays as it is, "journalctl --recompress" can take care of it */
+        while (c->queue) {
+                RecompressItem *i = c->queue;
+
+                LIST_REMOVE(queue, c->queue, i);
+                recompress_item_free(i);
+        }
+
+        /* What's done is taken into account still */
+        recompress_dispatch_done(c);
+
+        sd_event_source_disable_unref(c->event_source);
+        safe_close(c->notify_fd);
+
+        assert_se(pthread_cond_destroy(&c->cond) == 0);
+        assert_se(pthread_mutex_destroy(&c->mutex) == 0);
+
+        return mfree(c);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalRecompressor*, recompressor_free);
+
+int server_start_recompress(Server *s) {
+        _cleanup_(recompressor_freep) JournalRecompressor *c = NULL;
+        pthread_condattr_t attr;
+        sigset_t ss, saved_ss;
+        int k;
+
+        assert(s);
+        assert(!s->recompressor);
+
+        if (!s->recompress)
+                return 0;
+
+#if !HAVE_ZSTD
+        log_debug("zstd support is not available, not recompressing archived journal files.");
+        return 0;
+#endif
+
+        c = new(JournalRecompressor, 1);
+        if (!c)
+                return log_oom();
+
+        *c = (JournalRecompressor) {
+                .server = s,
+                .notify_fd = -1,
+        };
+
+        assert_se(pthread_mutex_init(&c->mutex, NULL) == 0);
+        assert_se(pthread_condattr_init(&attr) == 0);
+        assert_se(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+        assert_se(pthread_cond_init(&c->cond, &attr) == 0);
+        assert_se(pthread_condattr_destroy(&attr) == 0);
+
+        c->notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (c->notify_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd for recompress thread: %m");
+
+        k = sd_event_add_io(s->event, &c->event_source, c->notify_fd, EPOLLIN, dispatch_recompressed, c);
+        if (k < 0)
+                return log_error_errno(k, "Failed to add recompress thread to event loop: %m");
+
+        /* Nothing urgent, the vacuum index is only looked at when vacuuming */
+        k = sd_event_source_set_priority(c->event_source, SD_EVENT_PRIORITY_IDLE);
+        if (k < 0)
+                return log_error_errno(k, "Failed to adjust recompress thread event source priority: %m");
+
+        assert_se(sigfillset(&ss) >= 0);
+        k = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (k > 0)
+                return log_error_errno(k, "Failed to block signals for recompress thread: %m");
+
+        k = pthread_create(&c->thread, NULL, recompress_thread, c);
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        if (k > 0) {
+                /* Not worth failing for, archived files just stay as they are */
+                log_warning_errno(k, "Failed to start recompress thread, not recompressing archived journal files: %m");
+                return 0;
+        }
+
+        c->thread_started = true;
+        s->recompressor = TAKE_PTR(c);
+        return 0;
+}
+
+void server_stop_recompress(Server *s) {
+        assert(s);
+
+        s->recompressor = recompressor_free(s->recompressor);
+}
+
+void server_recompress(Server *s, const char *path) {
+        JournalRecompressor *c;
+        RecompressItem *i;
+
+        assert(s);
+
+        c = s->recompressor;
+        if (!c || !path)
+                return;
+
+        i = new0(RecompressItem, 1);
+        if (!i) {
+                log_oom();
+                return;
+        }
+
+        i->path = strdup(path);
+        if (!i->path) {
+                recompress_item_free(i);
+                log_oom();
+                return;
+        }
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        LIST_INSERT_AFTER(queue, c->queue, c->queue_tail, i);
+        c->queue_tail = i;
+        c->n_queue++;
+        assert_se(pthread_cond_signal(&c->cond) == 0);
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+}
+
+void server_recompress_statistics(Server *s, uint64_t *ret_files, uint64_t *ret_freed, uint64_t *ret_queued) {
+        JournalRecompressor *c;
+
+        assert(s);
+        assert(ret_files);
+        assert(ret_freed);
+        assert(ret_queued);
+
+        c = s->recompressor;
+        if (!c) {
+                *ret_files = *ret_freed = *ret_queued = 0;
+                return;
+        }
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        *ret_files = c->n_files;
+        *ret_freed = c->n_freed;
+        *ret_queued = c->n_queue;
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "journald-server.h"
+
+int server_start_recompress(Server *s);
+void server_stop_recompress(Server *s);
+
+void server_recompress(Server *s, const char *path);
+void server_recompress_statistics(Server *s, uint64_t *ret_files, uint64_t *ret_freed, uint64_t *ret_queued);
@@ -37,6 +37,8 @@
 #include "journald-kmsg.h"
 #include "journald-native.h"
 #include "journald-rate-limit.h"
+#include "journald-reader.h"
+#include "journald-recompress.h"
 #include "journald-server.h"
 #include "journald-stream.h"
 #include "journald-syslog.h"
@@ -80,50 +82,83 @@
 
 #define IDLE_TIMEOUT_USEC (30*USEC_PER_SEC)
 
+/* Maximum number of entries collected before they are written out in one batch */
+#define WRITE_QUEUE_MAX 256U
+
+static void server_set_file_usage(JournalStorage *storage, JournalFile *f) {
+        const char *fn;
+
+        assert(storage);
+
+        if (!f)
+                return;
+
+        fn = path_startswith(f->path, storage->path);
+        if (fn)
+                journal_vacuum_index_set_usage(storage->vacuum_index, fn, (uint64_t) f->last_stat.st_blocks * 512UL);
+}
+
 static int determine_path_usage(
                 Server *s,
-                const char *path,
+                JournalStorage *storage,
                 uint64_t *ret_used,
                 uint64_t *ret_free) {
 
-        _cleanup_closedir_ DIR *d = NULL;
-        struct dirent *de;
         struct statvfs ss;
+        JournalFile *f;
+        int r;
 
         assert(s);
-        assert(path);
+        assert(storage);
         assert(ret_used);
         assert(ret_free);
 
-        d = opendir(path);
-        if (!d)
-                return log_full_errno(errno == ENOENT ? LOG_DEBUG : LOG_ERR,
-                                      errno, "Failed to open %s: %m", path);
+        r = journal_vacuum_index_refresh(storage->vacuum_index);
+        if (r < 0)
+                return log_full_errno(r == -ENOENT ? LOG_DEBUG : LOG_ERR,
+                                      r, "Failed to read %s: %m", storage->path);
+
+        if (statvfs(storage->path, &ss) < 0)
+                return log_error_errno(errno, "Failed to statvfs(%s): %m", storage->path);
 
-        if (fstatvfs(dirfd(d), &ss) < 0)
-                return log_error_errno(errno, "Failed to fstatvfs(%s): %m", path);
+        /* The files we write to keep growing, take their current size from what we know about them
+         * anyway, instead of stat()ing them */
+        if (storage == &s->runtime_storage)
+                server_set_file_usage(storage, s->runtime_journal);
+        else {
+                server_set_file_usage(storage, s->system_journal);
+                ORDERED_HASHMAP_FOREACH(f, s->user_journals)
+                        server_set_file_usage(storage, f);
+        }
 
         *ret_free = ss.f_bsize * ss.f_bavail;
-        *ret_used = 0;
-        FOREACH_DIRENT_ALL(de, d, break) {
-                struct stat st;
+        *ret_used = journal_vacuum_index_usage(storage->vacuum_index);
 
-                if (!endswith(de->d_name, ".journal") &&
-                    !endswith(de->d_name, ".journal~"))
-                        continue;
+        return 0;
+}
 
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
-                        log_debug_errno(errno, "Failed to stat %s/%s, ignoring: %m", path, de->d_name);
-                        continue;
-                }
+void server_update_vacuum_index(Server *s, const char *path) {
+        JournalStorage *storage;
+        int r;
+
+        assert(s);
+
+        /* Tells the vacuum index of the storage the file is in that we created, archived or removed it */
+
+        if (!path)
+                return;
 
-                if (!S_ISREG(st.st_mode))
+        FOREACH_POINTER(storage, &s->system_storage, &s->runtime_storage) {
+                const char *fn;
+
+                fn = path_startswith(path, storage->path);
+                if (isempty(fn))
                         continue;
 
-                *ret_used += (uint64_t) st.st_blocks * 512UL;
+                r = journal_vacuum_index_update(storage->vacuum_index, fn);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to update vacuum index of %s, ignoring: %m", storage->path);
         }
-
-        return 0;
 }
 
 static void cache_space_invalidate(JournalStorageSpace *space) {
@@ -147,7 +182,7 @@ static int cache_space_refresh(Server *s, JournalStorage *storage) {
         if (space->timestamp != 0 && usec_add(space->timestamp, RECHECK_SPACE_USEC) > ts)
                 return 0;
 
-        r = determine_path_usage(s, storage->path, &vfs_used, &vfs_avail);
+        r = determine_path_usage(s, storage, &vfs_used, &vfs_avail);
         if (r < 0)
                 return r;
 
@@ -285,6 +320,21 @@ static int open_journal(
         if (r < 0)
                 return r;
 
+        /* The file might have just been created */
+        server_update_vacuum_index(s, f->path);
+
+        if (s->message_index) {
+                r = journal_file_enable_index(f);
+                if (r < 0)
+                        return r;
+        }
+
+        if (s->compress_dictionary) {
+                r = journal_file_enable_dictionary(f);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to enable compression dictionary for %s, ignoring: %m", fname);
+        }
+
         *ret = TAKE_PTR(f);
         return r;
 }
@@ -454,13 +504,19 @@ static int do_rotate(
                 bool seal,
                 uint32_t uid) {
 
+        _cleanup_free_ char *archived = NULL;
         int r;
         assert(s);
 
         if (!*f)
                 return -EINVAL;
 
+        (void) journal_file_archived_path(*f, &archived);
+
         r = journal_file_rotate(f, s->compress.enabled, s->compress.threshold_bytes, seal, s->deferred_closes);
+        server_update_vacuum_index(s, archived);
+        if (*f)
+                server_update_vacuum_index(s, (*f)->path);
         if (r < 0) {
                 if (*f)
                         return log_error_errno(r, "Failed to rotate %s: %m", (*f)->path);
@@ -469,6 +525,7 @@ static int do_rotate(
         }
 
         server_add_acls(*f, uid);
+        server_recompress(s, archived);
         return r;
 }
 
@@ -519,7 +576,7 @@ static int vacuum_offline_user_journals(Server *s) {
         }
 
         for (;;) {
-                _cleanup_free_ char *u = NULL, *full = NULL;
+                _cleanup_free_ char *u = NULL, *full = NULL, *archived = NULL;
                 _cleanup_close_ int fd = -1;
                 const char *a, *b;
                 struct dirent *de;
@@ -597,10 +654,16 @@ static int vacuum_offline_user_journals(Server *s) {
 
                 TAKE_FD(fd); /* Donated to journal_file_open() */
 
+                (void) journal_file_archived_path(f, &archived);
+
                 r = journal_file_archive(f);
                 if (r < 0)
                         log_debug_errno(r, "Failed to archive journal file '%s', ignoring: %m", full);
 
+                server_update_vacuum_index(s, archived);
+                server_update_vacuum_index(s, full);
+                server_recompress(s, archived);
+
                 f = journal_initiate_close(f, s->deferred_closes);
         }
 
@@ -614,6 +677,9 @@ void server_rotate(Server *s) {
 
         log_debug("Rotating...");
 
+        /* Make sure everything queued so far ends up in the files we are about to archive */
+        server_flush_write_queue(s);
+
         /* First, rotate the system journal (either in its runtime flavour or in its runtime flavour) */
         (void) do_rotate(s, &s->runtime_journal, "runtime", false, 0);
         (void) do_rotate(s, &s->system_journal, "system", s->seal, 0);
@@ -640,6 +706,8 @@ void server_sync(Server *s) {
         JournalFile *f;
         int r;
 
+        server_flush_write_queue(s);
+
         if (s->system_journal) {
                 r = journal_file_set_offline(s->system_journal, false);
                 if (r < 0)
@@ -673,9 +741,9 @@ static void do_vacuum(Server *s, JournalStorage *storage, bool verbose) {
         if (verbose)
                 server_space_usage_message(s, storage);
 
-        r = journal_directory_vacuum(storage->path, storage->space.limit,
-                                     storage->metrics.n_max_files, s->max_retention_usec,
-                                     &s->oldest_file_usec, verbose);
+        r = journal_vacuum_index_vacuum(storage->vacuum_index, storage->space.limit,
+                                        storage->metrics.n_max_files, s->max_retention_usec,
+                                        &s->oldest_file_usec, verbose);
         if (r < 0 && r != -ENOENT)
                 log_warning_errno(r, "Failed to vacuum %s, ignoring: %m", storage->path);
 
@@ -789,23 +857,17 @@ static bool shall_try_append_again(JournalFile *f, int r) {
         }
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n, int priority) {
-        bool vacuumed = false, rotate = false;
-        struct dual_timestamp ts;
+static void write_to_journal(Server *s, uid_t uid, const JournalAppendEntry *entries, size_t n_entries, int priority) {
+        bool vacuumed = false, rotate = false, written = false;
         JournalFile *f;
+        size_t k = 0;
         int r;
 
         assert(s);
-        assert(iovec);
-        assert(n > 0);
-
-        /* Get the closest, linearized time we have for this log event from the event loop. (Note that we do not use
-         * the source time, and not even the time the event was originally seen, but instead simply the time we started
-         * processing it, as we want strictly linear ordering in what we write out.) */
-        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &ts.realtime) >= 0);
-        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts.monotonic) >= 0);
+        assert(entries);
+        assert(n_entries > 0);
 
-        if (ts.realtime < s->last_realtime_clock) {
+        if (entries[0].ts.realtime < s->last_realtime_clock) {
                 /* When the time jumps backwards, let's immediately rotate. Of course, this should not happen during
                  * regular operation. However, when it does happen, then we should make sure that we start fresh files
                  * to ensure that the entries in the journal files are strictly ordered by time, in order to ensure
@@ -835,34 +897,195 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n
                         return;
         }
 
-        s->last_realtime_clock = ts.realtime;
+        s->last_realtime_clock = entries[n_entries - 1].ts.realtime;
 
-        r = journal_file_append_entry(f, &ts, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r >= 0) {
+        while (k < n_entries) {
+                const JournalAppendEntry *e;
+                size_t n_appended = 0;
+
+                r = journal_file_append_entries(f, NULL, entries + k, n_entries - k, &s->seqnum, &n_appended);
+                if (n_appended > 0) {
+                        k += n_appended;
+                        written = true;
+                        vacuumed = false;
+                }
+                if (r >= 0)
+                        break;
+
+                /* Entry k failed, everything before it has been written. */
+                e = entries + k;
+
+                if (vacuumed || !shall_try_append_again(f, r)) {
+                        log_error_errno(r, "Failed to write entry (%u items, %zu bytes)%s, ignoring: %m",
+                                        e->n_iovec, IOVEC_TOTAL_SIZE(e->iovec, e->n_iovec),
+                                        vacuumed ? " despite vacuuming" : "");
+                        k++;
+                        vacuumed = false;
+                        continue;
+                }
+
+                log_info_errno(r, "Failed to write entry (%u items, %zu bytes), rotating before retrying: %m",
+                               e->n_iovec, IOVEC_TOTAL_SIZE(e->iovec, e->n_iovec));
+
+                server_rotate(s);
+                server_vacuum(s, false);
+                vacuumed = true;
+
+                f = find_journal(s, uid);
+                if (!f)
+                        return;
+
+                log_debug("Retrying write.");
+        }
+
+        if (written)
                 server_schedule_sync(s, priority);
+}
+
+static void write_queue_clear(Server *s) {
+        assert(s);
+
+        for (size_t i = 0; i < s->n_write_queue; i++)
+                free((struct iovec*) s->write_queue[i].iovec);
+
+        s->n_write_queue = 0;
+}
+
+void server_flush_write_queue(Server *s) {
+        JournalAppendEntry *entries;
+        size_t n_entries;
+
+        assert(s);
+
+        if (s->n_write_queue == 0)
                 return;
+
+        /* Detach the queue before writing it out: writing might rotate the journal files, which flushes
+         * the queue again, and might generate log messages of its own, which are queued up anew. */
+        entries = TAKE_PTR(s->write_queue);
+        n_entries = s->n_write_queue;
+        s->n_write_queue = 0;
+
+        write_to_journal(s, s->write_queue_uid, entries, n_entries, s->write_queue_priority);
+
+        for (size_t i = 0; i < n_entries; i++)
+                free((struct iovec*) entries[i].iovec);
+
+        /* Keep the allocation around for the next iteration, unless a new queue was started meanwhile */
+        if (!s->write_queue)
+                s->write_queue = entries;
+        else
+                free(entries);
+}
+
+static int dispatch_write_queue(sd_event_source *es, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        server_flush_write_queue(s);
+        return 0;
+}
+
+static struct iovec* iovec_copy_flat(const struct iovec *iovec, size_t n) {
+        struct iovec *copy;
+        uint8_t *p;
+
+        /* Copies the iovec array and all the data it references into a single allocation */
+
+        copy = malloc(n * sizeof(struct iovec) + IOVEC_TOTAL_SIZE(iovec, n));
+        if (!copy)
+                return NULL;
+
+        p = (uint8_t*) (copy + n);
+        for (size_t i = 0; i < n; i++) {
+                copy[i] = IOVEC_MAKE(p, iovec[i].iov_len);
+                memcpy_safe(p, iovec[i].iov_base, iovec[i].iov_len);
+                p += iovec[i].iov_len;
         }
 
-        if (vacuumed || !shall_try_append_again(f, r)) {
-                log_error_errno(r, "Failed to write entry (%zu items, %zu bytes), ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-                return;
+        return copy;
+}
+
+static void queue_for_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n, int priority) {
+        struct dual_timestamp ts;
+        struct iovec *copy;
+        int r;
+
+        assert(s);
+        assert(iovec);
+        assert(n > 0);
+
+        /* Get the closest, linearized time we have for this log event from the event loop. (Note that we do not use
+         * the source time, and not even the time the event was originally seen, but instead simply the time we started
+         * processing it, as we want strictly linear ordering in what we write out.) */
+        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &ts.realtime) >= 0);
+        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts.monotonic) >= 0);
+
+        /* Once the event loop is done (i.e. while shutting down) nobody would dispatch the queue anymore */
+        if (sd_event_get_state(s->event) == SD_EVENT_FINISHED)
+                goto direct;
+
+        /* Entries are not written out immediately, but collected until all input sources that are ready in
+         * this event loop iteration have been processed, and then appended in one batch. A batch only ever
+         * covers a single journal file, and never spans a jump of the clock. */
+        if (s->n_write_queue > 0 &&
+            (s->write_queue_uid != uid || ts.realtime < s->write_queue[s->n_write_queue - 1].ts.realtime))
+                server_flush_write_queue(s);
+
+        if (!s->write_queue_event_source) {
+                r = sd_event_add_defer(s->event, &s->write_queue_event_source, dispatch_write_queue, s);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to allocate write queue event source, writing entry directly: %m");
+                        goto direct;
+                }
+
+                /* Lower priority than all input sources, so that we drain them first */
+                r = sd_event_source_set_priority(s->write_queue_event_source, SD_EVENT_PRIORITY_NORMAL+10);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to set write queue event source priority, writing entry directly: %m");
+                        s->write_queue_event_source = sd_event_source_disable_unref(s->write_queue_event_source);
+                        goto direct;
+                }
         }
 
-        log_info_errno(r, "Failed to write entry (%zu items, %zu bytes), rotating before retrying: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
+        if (!GREEDY_REALLOC(s->write_queue, s->n_write_queue + 1)) {
+                log_oom_debug();
+                goto direct;
+        }
 
-        server_rotate(s);
-        server_vacuum(s, false);
+        copy = iovec_copy_flat(iovec, n);
+        if (!copy) {
+                log_oom_debug();
+                goto direct;
+        }
 
-        f = find_journal(s, uid);
-        if (!f)
-                return;
+        if (s->n_write_queue == 0) {
+                s->write_queue_uid = uid;
+                s->write_queue_priority = priority;
+        } else
+                s->write_queue_priority = MIN(s->write_queue_priority, priority);
+
+        s->write_queue[s->n_write_queue++] = (JournalAppendEntry) {
+                .ts = ts,
+                .iovec = copy,
+                .n_iovec = n,
+        };
 
-        log_debug("Retrying write.");
-        r = journal_file_append_entry(f, &ts, NULL, iovec, n, &s->seqnum, NULL, NULL);
+        r = sd_event_source_set_enabled(s->write_queue_event_source, SD_EVENT_ONESHOT);
         if (r < 0)
-                log_error_errno(r, "Failed to write entry (%zu items, %zu bytes) despite vacuuming, ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-        else
-                server_schedule_sync(s, priority);
+                log_debug_errno(r, "Failed to enable write queue event source, flushing immediately: %m");
+
+        /* Write out right away if the queue is full, or if this is of priority CRIT, ALERT, EMERG, since
+         * these are synced to disk immediately too. */
+        if (r < 0 || s->n_write_queue >= WRITE_QUEUE_MAX || priority <= LOG_CRIT)
+                server_flush_write_queue(s);
+
+        return;
+
+direct:
+        server_flush_write_queue(s);
+        write_to_journal(s, uid, &(const JournalAppendEntry) { .ts = ts, .iovec = iovec, .n_iovec = n }, 1, priority);
 }
 
 #define IOVEC_ADD_NUMERIC_FIELD(iovec, n, value, type, isset, format, field)  \
@@ -945,9 +1168,9 @@ static void dispatch_message_real(
 
                 IOVEC_ADD_ID128_FIELD(iovec, n, c->invocation_id, "_SYSTEMD_INVOCATION_ID");
 
-                if (c->extra_fields_n_iovec > 0) {
-                        memcpy(iovec + n, c->extra_fields_iovec, c->extra_fields_n_iovec * sizeof(struct iovec));
-                        n += c->extra_fields_n_iovec;
+                if (client_context_extra_fields_n_iovec(c) > 0) {
+                        memcpy(iovec + n, c->unit_context->extra_fields_iovec, c->unit_context->extra_fields_n_iovec * sizeof(struct iovec));
+                        n += c->unit_context->extra_fields_n_iovec;
                 }
         }
 
@@ -1018,7 +1241,7 @@ static void dispatch_message_real(
         else
                 journal_uid = 0;
 
-        write_to_journal(s, journal_uid, iovec, n, priority);
+        queue_for_journal(s, journal_uid, iovec, n, priority);
 }
 
 void server_driver_message(Server *s, pid_t object_pid, const char *message_id, const char *format, ...) {
@@ -1096,9 +1319,22 @@ void server_dispatch_message(
                 return;
 
         if (c && c->unit) {
+                usec_t interval = s->ratelimit_interval, ts;
+                unsigned burst = s->ratelimit_burst;
+                uint64_t hash;
+
+                if (c->unit_context) {
+                        interval = c->unit_context->log_ratelimit_interval;
+                        burst = c->unit_context->log_ratelimit_burst;
+                        hash = c->unit_context->ratelimit_hash;
+                } else
+                        hash = journal_ratelimit_hash(s->ratelimit, c->unit);
+
                 (void) determine_space(s, &available, NULL);
 
-                rl = journal_ratelimit_test(s->ratelimit, c->unit, c->log_ratelimit_interval, c->log_ratelimit_burst, priority & LOG_PRIMASK, available);
+                assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts) >= 0);
+
+                rl = journal_ratelimit_test(s->ratelimit, c->unit, hash, ts, interval, burst, priority & LOG_PRIMASK, available);
                 if (rl == 0)
                         return;
 
@@ -1135,6 +1371,9 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
         if (require_flag_file && !flushed_flag_is_set(s))
                 return 0;
 
+        /* Queued entries still belong into the runtime journal */
+        server_flush_write_queue(s);
+
         (void) system_journal_open(s, true, false);
 
         if (!s->system_journal)
@@ -1165,7 +1404,7 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
                         goto finish;
                 }
 
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset);
+                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL);
                 if (r >= 0)
                         continue;
 
@@ -1186,7 +1425,7 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
                 }
 
                 log_debug("Retrying write.");
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset);
+                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL);
                 if (r < 0) {
                         log_error_errno(r, "Can't write entry: %m");
                         goto finish;
@@ -1237,6 +1476,8 @@ static int server_relinquish_var(Server *s) {
 
         log_debug("Relinquishing %s...", s->system_storage.path);
 
+        server_flush_write_queue(s);
+
         (void) system_journal_open(s, false, true);
 
         s->system_journal = journal_file_close(s->system_journal);
@@ -1277,7 +1518,7 @@ int server_process_datagram(
          * __convert_scm_timestamps(), which assumes the buffer is initialized. See #20741. */
         CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(struct ucred)) +
                          CMSG_SPACE_TIMEVAL +
-                         CMSG_SPACE(sizeof(int)) + /* fd */
+                         CMSG_SPACE(sizeof(int) * 2) + /* fds */
                          CMSG_SPACE(NAME_MAX) /* selinux label */) control = {};
 
         union sockaddr_union sa = {};
@@ -1292,7 +1533,7 @@ int server_process_datagram(
         };
 
         assert(s);
-        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
+        assert(fd == s->native_fd || fd == s->syslog_fd);
 
         if (revents != EPOLLIN)
                 return log_error_errno(SYNTHETIC_ERRNO(EIO),
@@ -1355,21 +1596,17 @@ int server_process_datagram(
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via syslog socket. Ignoring.");
 
-        } else if (fd == s->native_fd) {
+        } else {
+                assert(fd == s->native_fd);
+
                 if (n > 0 && n_fds == 0)
                         server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
                 else if (n == 0 && n_fds == 1)
                         server_process_native_file(s, fds[0], ucred, tv, label, label_len);
+                else if (n == 0 && n_fds == 2)
+                        server_process_native_ring(s, fds, ucred, label, label_len);
                 else if (n_fds > 0)
                         log_warning("Got too many file descriptors via native socket. Ignoring.");
-
-        } else {
-                assert(fd == s->audit_fd);
-
-                if (n > 0 && n_fds == 0)
-                        server_process_audit_message(s, s->buffer, n, ucred, &sa, msghdr.msg_namelen);
-                else if (n_fds > 0)
-                        log_warning("Got file descriptors via audit socket. Ignoring.");
         }
 
         close_many(fds, n_fds);
@@ -2006,6 +2243,51 @@ static int vl_method_relinquish_var(Varlink *link, JsonVariant *parameters, Varl
         return varlink_reply(link, NULL);
 }
 
+static int vl_method_get_statistics(Varlink *link, JsonVariant *parameters, VarlinkMethodFlags flags, void *userdata) {
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL, *ratelimit = NULL;
+        uint64_t recompressed, recompress_freed, recompress_queued;
+        Server *s = userdata;
+        int r;
+
+        assert(link);
+        assert(s);
+
+        if (json_variant_elements(parameters) > 0)
+                return varlink_error_invalid_parameter(link, parameters);
+
+        r = journal_ratelimit_build_json(s->ratelimit, &ratelimit);
+        if (r < 0)
+                return r;
+
+        server_recompress_statistics(s, &recompressed, &recompress_freed, &recompress_queued);
+
+        r = json_build(&v, JSON_BUILD_OBJECT(
+                        JSON_BUILD_PAIR("ClientContexts", JSON_BUILD_OBJECT(
+                                JSON_BUILD_PAIR("Entries", JSON_BUILD_UNSIGNED(hashmap_size(s->client_contexts))),
+                                JSON_BUILD_PAIR("Units", JSON_BUILD_UNSIGNED(hashmap_size(s->unit_contexts))),
+                                JSON_BUILD_PAIR("ProcessEvents", JSON_BUILD_BOOLEAN(s->proc_events_active)),
+                                JSON_BUILD_PAIR("Hits", JSON_BUILD_UNSIGNED(s->n_client_context_hits)),
+                                JSON_BUILD_PAIR("Misses", JSON_BUILD_UNSIGNED(s->n_client_context_misses)),
+                                JSON_BUILD_PAIR("Refreshes", JSON_BUILD_UNSIGNED(s->n_client_context_refreshes)),
+                                JSON_BUILD_PAIR("Invalidations", JSON_BUILD_UNSIGNED(s->n_client_context_invalidations)))),
+                        JSON_BUILD_PAIR("Kernel", JSON_BUILD_OBJECT(
+                                JSON_BUILD_PAIR("Records", JSON_BUILD_UNSIGNED(s->n_kmsg_records)),
+                                JSON_BUILD_PAIR("Lost", JSON_BUILD_UNSIGNED(s->n_kmsg_lost)),
+                                JSON_BUILD_PAIR("Overruns", JSON_BUILD_UNSIGNED(s->n_kmsg_overruns)))),
+                        JSON_BUILD_PAIR("Audit", JSON_BUILD_OBJECT(
+                                JSON_BUILD_PAIR("Records", JSON_BUILD_UNSIGNED(s->n_audit_records)),
+                                JSON_BUILD_PAIR("Overruns", JSON_BUILD_UNSIGNED(s->n_audit_overruns)))),
+                        JSON_BUILD_PAIR("Recompress", JSON_BUILD_OBJECT(
+                                JSON_BUILD_PAIR("Files", JSON_BUILD_UNSIGNED(recompressed)),
+                                JSON_BUILD_PAIR("Freed", JSON_BUILD_UNSIGNED(recompress_freed)),
+                                JSON_BUILD_PAIR("Queued", JSON_BUILD_UNSIGNED(recompress_queued)))),
+                        JSON_BUILD_PAIR("RateLimit", JSON_BUILD_VARIANT(ratelimit))));
+        if (r < 0)
+                return r;
+
+        return varlink_reply(link, v);
+}
+
 static int vl_connect(VarlinkServer *server, Varlink *link, void *userdata) {
         Server *s = userdata;
 
@@ -2044,7 +2326,8 @@ static int server_open_varlink(Server *s, const char *socket, int fd) {
                         "io.systemd.Journal.Synchronize",   vl_method_synchronize,
                         "io.systemd.Journal.Rotate",        vl_method_rotate,
                         "io.systemd.Journal.FlushToVar",    vl_method_flush_to_var,
-                        "io.systemd.Journal.RelinquishVar", vl_method_relinquish_var);
+                        "io.systemd.Journal.RelinquishVar", vl_method_relinquish_var,
+                        "io.systemd.Journal.GetStatistics", vl_method_get_statistics);
         if (r < 0)
                 return r;
 
@@ -2090,6 +2373,10 @@ static bool server_is_idle(Server *s) {
         if (s->n_stdout_streams > 0)
                 return false;
 
+        /* Same for clients that log through a ring buffer */
+        if (s->n_native_rings > 0)
+                return false;
+
         return true;
 }
 
@@ -2186,6 +2473,7 @@ int server_init(Server *s, const char *namespace) {
 
                 .compress.enabled = true,
                 .compress.threshold_bytes = UINT64_MAX,
+                .recompress = true,
                 .seal = true,
 
                 .set_audit = true,
@@ -2332,6 +2620,15 @@ int server_init(Server *s, const char *namespace) {
                 }
         }
 
+        /* Before any socket or stream is watched, so that they are read on the threads */
+        r = server_start_readers(s);
+        if (r < 0)
+                return r;
+
+        r = server_start_recompress(s);
+        if (r < 0)
+                return r;
+
         /* Try to restore streams, but don't bother if this fails */
         (void) server_restore_streams(s, fds);
 
@@ -2395,6 +2692,14 @@ int server_init(Server *s, const char *namespace) {
         if (r < 0)
                 return log_error_errno(r, "Failed to acquire cgroup root path: %m");
 
+        /* The proc connector reports the processes of the whole system, namespace instances only see a
+         * fraction of them as clients, hence leave that to the main instance */
+        if (!s->namespace) {
+                r = server_open_proc_connector(s);
+                if (r < 0)
+                        return r;
+        }
+
         server_cache_hostname(s);
         server_cache_boot_id(s);
         server_cache_machine_id(s);
@@ -2416,6 +2721,14 @@ int server_init(Server *s, const char *namespace) {
         if (!s->system_storage.path)
                 return log_oom();
 
+        r = journal_vacuum_index_new(s->runtime_storage.path, &s->runtime_storage.vacuum_index);
+        if (r < 0)
+                return log_oom();
+
+        r = journal_vacuum_index_new(s->system_storage.path, &s->system_storage.vacuum_index);
+        if (r < 0)
+                return log_oom();
+
         (void) server_connect_notify(s);
 
         (void) client_context_acquire_default(s);
@@ -2446,14 +2759,23 @@ void server_maybe_append_tags(Server *s) {
 void server_done(Server *s) {
         assert(s);
 
-        free(s->namespace);
-        free(s->namespace_field);
-
-        set_free_with_destructor(s->deferred_closes, journal_file_close);
+        /* This still processes what the threads read, hence first */
+        server_stop_readers(s);
+        server_stop_recompress(s);
 
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
+        while (s->native_rings)
+                native_ring_free(s->native_rings);
+
+        /* Appending might still open journal files, hence do it while everything is in place */
+        server_flush_write_queue(s);
+        write_queue_clear(s);
+        free(s->write_queue);
+
+        set_free_with_destructor(s->deferred_closes, journal_file_close);
+
         client_context_flush_all(s);
 
         (void) journal_file_close(s->system_journal);
@@ -2478,6 +2800,10 @@ void server_done(Server *s) {
         sd_event_source_unref(s->notify_event_source);
         sd_event_source_unref(s->watchdog_event_source);
         sd_event_source_unref(s->idle_event_source);
+        sd_event_source_unref(s->write_queue_event_source);
+        sd_event_source_unref(s->native_ring_event_source);
+        sd_event_source_unref(s->proc_event_source);
+        sd_event_source_unref(s->units_event_source);
         sd_event_unref(s->event);
 
         safe_close(s->syslog_fd);
@@ -2494,12 +2820,17 @@ void server_done(Server *s) {
         if (s->kernel_seqnum)
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
+        free(s->namespace);
+        free(s->namespace_field);
         free(s->buffer);
+        free(s->audit_buffer);
         free(s->tty_path);
         free(s->cgroup_root);
         free(s->hostname_field);
         free(s->runtime_storage.path);
         free(s->system_storage.path);
+        journal_vacuum_index_free(s->runtime_storage.vacuum_index);
+        journal_vacuum_index_free(s->system_storage.vacuum_index);
         free(s->runtime_directory);
 
         mmap_cache_unref(s->mmap);
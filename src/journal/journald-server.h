@@ -7,10 +7,14 @@
 #include "sd-event.h"
 
 typedef struct Server Server;
+typedef struct NativeRing NativeRing;
+typedef struct JournalReader JournalReader;
+typedef struct JournalRecompressor JournalRecompressor;
 
 #include "conf-parser.h"
 #include "hashmap.h"
 #include "journal-file.h"
+#include "journal-vacuum.h"
 #include "journald-context.h"
 #include "journald-rate-limit.h"
 #include "journald-stream.h"
@@ -57,6 +61,9 @@ typedef struct JournalStorage {
 
         JournalMetrics metrics;
         JournalStorageSpace space;
+
+        /* The journal files in 'path', so that we don't have to read the directory all the time */
+        JournalVacuumIndex *vacuum_index;
 } JournalStorage;
 
 struct Server {
@@ -87,6 +94,8 @@ struct Server {
         sd_event_source *notify_event_source;
         sd_event_source *watchdog_event_source;
         sd_event_source *idle_event_source;
+        sd_event_source *write_queue_event_source;
+        sd_event_source *native_ring_event_source;
 
         JournalFile *runtime_journal;
         JournalFile *system_journal;
@@ -94,6 +103,12 @@ struct Server {
 
         uint64_t seqnum;
 
+        /* Entries collected during the current event loop iteration, appended to the journal in one batch */
+        JournalAppendEntry *write_queue;
+        size_t n_write_queue;
+        uid_t write_queue_uid;
+        int write_queue_priority;
+
         char *buffer;
 
         JournalRateLimit *ratelimit;
@@ -105,7 +120,10 @@ struct Server {
         JournalStorage system_storage;
 
         JournalCompressOptions compress;
+        bool compress_dictionary;
+        bool recompress;
         bool seal;
+        bool message_index;
         bool read_kmsg;
         int set_audit;
 
@@ -125,6 +143,18 @@ struct Server {
         LIST_HEAD(StdoutStream, stdout_streams_notify_queue);
         unsigned n_stdout_streams;
 
+        LIST_HEAD(NativeRing, native_rings);
+        unsigned n_native_rings;
+
+        /* Threads that read and parse what comes in on the native and syslog sockets and on stdout streams,
+         * if enabled, see journald-reader.c */
+        unsigned reader_threads;
+        JournalReader *readers;
+        unsigned n_readers;
+
+        /* Thread that recompresses archived files, see journald-recompress.c */
+        JournalRecompressor *recompressor;
+
         char *tty_path;
 
         int max_level_store;
@@ -165,8 +195,31 @@ struct Server {
         /* Caching of client metadata */
         Hashmap *client_contexts;
         Prioq *client_contexts_lru;
+        Hashmap *unit_contexts;
 
         usec_t last_cache_pid_flush;
+        usec_t last_units_watch;
+
+        /* Changes that invalidate cached metadata: process events from the kernel, and the files PID 1 keeps in
+         * /run/systemd/units/ */
+        sd_event_source *proc_event_source;
+        uint32_t proc_connector_cookie;
+        bool proc_events_active;
+        sd_event_source *units_event_source;
+
+        uint64_t n_client_context_hits;
+        uint64_t n_client_context_misses;
+        uint64_t n_client_context_refreshes;
+        uint64_t n_client_context_invalidations;
+
+        /* Kernel log and audit records read, records the kernel dropped before we got to read them, and how
+         * often that happened */
+        uint64_t n_kmsg_records;
+        uint64_t n_kmsg_lost;
+        uint64_t n_kmsg_overruns;
+        uint64_t n_audit_records;
+        uint64_t n_audit_overruns;
+        void *audit_buffer;
 
         ClientContext *my_context; /* the context of journald itself */
         ClientContext *pid1_context; /* the context of PID 1 */
@@ -193,6 +246,7 @@ struct Server {
 
 void server_dispatch_message(Server *s, struct iovec *iovec, size_t n, size_t m, ClientContext *c, const struct timeval *tv, int priority, pid_t object_pid);
 void server_driver_message(Server *s, pid_t object_pid, const char *message_id, const char *format, ...) _sentinel_ _printf_(4,0);
+void server_flush_write_queue(Server *s);
 
 /* gperf lookup function */
 const struct ConfigPerfItem* journald_gperf_lookup(const char *key, GPERF_LEN_TYPE length);
@@ -219,6 +273,7 @@ int server_flush_to_var(Server *s, bool require_flag_file);
 void server_maybe_append_tags(Server *s);
 int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata);
 void server_space_usage_message(Server *s, JournalStorage *storage);
+void server_update_vacuum_index(Server *s, const char *path);
 
 int server_start_or_stop_idle_timer(Server *s);
 int server_refresh_idle_timer(Server *s);
@@ -22,6 +22,7 @@
 #include "journald-console.h"
 #include "journald-context.h"
 #include "journald-kmsg.h"
+#include "journald-reader.h"
 #include "journald-server.h"
 #include "journald-stream.h"
 #include "journald-syslog.h"
@@ -94,6 +95,13 @@ struct StdoutStream {
 
         sd_event_source *event_source;
 
+        /* Set if the stream is read on a reader thread, see journald-reader.c. The buffer and the two fields
+         * below then belong to that thread, until it hands the stream back with its last record. */
+        JournalReader *reader;
+        struct ucred reader_ucred;
+        unsigned reader_setup_lines; /* protocol lines still to come before the stream is running */
+        bool terminated:1;
+
         char *state_file;
 
         ClientContext *context;
@@ -139,6 +147,16 @@ void stdout_stream_destroy(StdoutStream *s) {
         if (!s)
                 return;
 
+        if (s->reader) {
+                /* A reader thread still reads from the stream. Make it run into EOF, it then hands the stream
+                 * back with its last record, and only then we get rid of it. */
+                if (!s->terminated) {
+                        s->terminated = true;
+                        (void) shutdown(s->fd, SHUT_RD);
+                }
+                return;
+        }
+
         if (s->state_file)
                 (void) unlink(s->state_file);
 
@@ -448,11 +466,14 @@ static int stdout_stream_line(StdoutStream *s, char *p, LineBreak line_break) {
         assert_not_reached();
 }
 
+typedef int (*stdout_stream_found_t)(StdoutStream *s, char *p, size_t l, LineBreak line_break, void *userdata);
+
 static int stdout_stream_found(
                 StdoutStream *s,
                 char *p,
                 size_t l,
-                LineBreak line_break) {
+                LineBreak line_break,
+                void *userdata) {
 
         char saved;
         int r;
@@ -473,8 +494,9 @@ static size_t stdout_stream_line_max(StdoutStream *s) {
         assert(s);
 
         /* During the "setup" phase of our protocol, let's ensure we use a line length where a full unit name
-         * can fit in */
-        if (s->state != STDOUT_STREAM_RUNNING)
+         * can fit in. A reader thread can't look at the state, the main thread changes that only later when it
+         * gets to the lines, hence it counts the lines of the setup phase itself. */
+        if (s->reader ? s->reader_setup_lines > 0 : s->state != STDOUT_STREAM_RUNNING)
                 return STDOUT_STREAM_SETUP_PROTOCOL_LINE_MAX;
 
         /* After the protocol's "setup" phase is complete, let's use whatever the user configured */
@@ -486,20 +508,22 @@ static int stdout_stream_scan(
                 char *p,
                 size_t remaining,
                 LineBreak force_flush,
+                stdout_stream_found_t found_func,
+                void *userdata,
                 size_t *ret_consumed) {
 
-        size_t consumed = 0, line_max;
+        size_t consumed = 0;
         int r;
 
         assert(s);
         assert(p);
-
-        line_max = stdout_stream_line_max(s);
+        assert(found_func);
 
         for (;;) {
                 LineBreak line_break;
                 size_t skip, found;
                 char *end1, *end2;
+                size_t line_max = stdout_stream_line_max(s);
                 size_t tmp_remaining = MIN(remaining, line_max);
 
                 end1 = memchr(p, '\n', tmp_remaining);
@@ -522,7 +546,7 @@ static int stdout_stream_scan(
                 } else
                         break;
 
-                r = stdout_stream_found(s, p, found, line_break);
+                r = found_func(s, p, found, line_break, userdata);
                 if (r < 0)
                         return r;
 
@@ -532,7 +556,7 @@ static int stdout_stream_scan(
         }
 
         if (force_flush >= 0 && remaining > 0) {
-                r = stdout_stream_found(s, p, remaining, force_flush);
+                r = found_func(s, p, remaining, force_flush, userdata);
                 if (r < 0)
                         return r;
 
@@ -545,10 +569,14 @@ static int stdout_stream_scan(
         return 0;
 }
 
-static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+static int stdout_stream_receive(
+                StdoutStream *s,
+                struct ucred *ucred_current,
+                stdout_stream_found_t found_func,
+                void *userdata) {
+
         CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(struct ucred))) control;
         size_t limit, consumed, allocated;
-        StdoutStream *s = userdata;
         struct ucred *ucred;
         struct iovec iovec;
         ssize_t l;
@@ -563,19 +591,16 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
         };
 
         assert(s);
+        assert(ucred_current);
 
-        if ((revents|EPOLLIN|EPOLLHUP) != (EPOLLIN|EPOLLHUP)) {
-                log_error("Got invalid event from epoll for stdout stream: %"PRIx32, revents);
-                goto terminate;
-        }
+        /* Reads from the stream once and passes on the complete lines. Returns 1 if something was read, 0 if
+         * there was nothing to read, -EPIPE on EOF and another negative errno if the stream is broken. */
 
         /* If the buffer is almost full, add room for another 1K */
         allocated = MALLOC_ELEMENTSOF(s->buffer);
         if (s->length + 512 >= allocated) {
-                if (!GREEDY_REALLOC(s->buffer, s->length + 1 + 1024)) {
-                        log_oom();
-                        goto terminate;
-                }
+                if (!GREEDY_REALLOC(s->buffer, s->length + 1 + 1024))
+                        return log_oom();
 
                 allocated = MALLOC_ELEMENTSOF(s->buffer);
         }
@@ -591,28 +616,30 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
                 if (IN_SET(errno, EINTR, EAGAIN))
                         return 0;
 
-                log_warning_errno(errno, "Failed to read from stream: %m");
-                goto terminate;
+                return log_warning_errno(errno, "Failed to read from stream: %m");
         }
         cmsg_close_all(&msghdr);
 
         if (l == 0) {
-                (void) stdout_stream_scan(s, s->buffer, s->length, /* force_flush = */ LINE_BREAK_EOF, NULL);
-                goto terminate;
+                (void) stdout_stream_scan(s, s->buffer, s->length, /* force_flush = */ LINE_BREAK_EOF, found_func, userdata, NULL);
+                return -EPIPE;
         }
 
         /* Invalidate the context if the PID of the sender changed. This happens when a forked process
          * inherits stdout/stderr from a parent. In this case getpeercred() returns the ucred of the parent,
          * which can be invalid if the parent has exited in the meantime. */
         ucred = CMSG_FIND_DATA(&msghdr, SOL_SOCKET, SCM_CREDENTIALS, struct ucred);
-        if (ucred && ucred->pid != s->ucred.pid) {
+        if (ucred && ucred->pid != ucred_current->pid) {
                 /* Force out any previously half-written lines from a different process, before we switch to
                  * the new ucred structure for everything we just added */
-                r = stdout_stream_scan(s, s->buffer, s->length, /* force_flush = */ LINE_BREAK_PID_CHANGE, NULL);
+                r = stdout_stream_scan(s, s->buffer, s->length, /* force_flush = */ LINE_BREAK_PID_CHANGE, found_func, userdata, NULL);
                 if (r < 0)
-                        goto terminate;
+                        return r;
 
-                s->context = client_context_release(s->server, s->context);
+                /* Lines read on a reader thread carry their credentials, the main thread invalidates the
+                 * context when it gets to them */
+                if (!s->reader)
+                        s->context = client_context_release(s->server, s->context);
 
                 p = s->buffer + s->length;
         } else {
@@ -622,11 +649,11 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
 
         /* Always copy in the new credentials */
         if (ucred)
-                s->ucred = *ucred;
+                *ucred_current = *ucred;
 
-        r = stdout_stream_scan(s, p, l, _LINE_BREAK_INVALID, &consumed);
+        r = stdout_stream_scan(s, p, l, _LINE_BREAK_INVALID, found_func, userdata, &consumed);
         if (r < 0)
-                goto terminate;
+                return r;
 
         /* Move what wasn't consumed to the front of the buffer */
         assert(consumed <= (size_t) l);
@@ -634,13 +661,131 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
         memmove(s->buffer, p + consumed, s->length);
 
         return 1;
+}
+
+static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        StdoutStream *s = userdata;
+        int r;
+
+        assert(s);
+
+        if ((revents|EPOLLIN|EPOLLHUP) != (EPOLLIN|EPOLLHUP)) {
+                log_error("Got invalid event from epoll for stdout stream: %"PRIx32, revents);
+                goto terminate;
+        }
+
+        r = stdout_stream_receive(s, &s->ucred, stdout_stream_found, NULL);
+        if (r < 0)
+                goto terminate;
+
+        return r;
 
 terminate:
         stdout_stream_destroy(s);
         return 0;
 }
 
-int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
+typedef struct StdoutStreamReadData {
+        stdout_stream_line_t line_func;
+        void *userdata;
+} StdoutStreamReadData;
+
+static int stdout_stream_found_reader(
+                StdoutStream *s,
+                char *p,
+                size_t l,
+                LineBreak line_break,
+                void *userdata) {
+
+        StdoutStreamReadData *d = userdata;
+
+        assert(s);
+        assert(d);
+
+        if (s->reader_setup_lines > 0)
+                s->reader_setup_lines--;
+
+        return d->line_func(s, &s->reader_ucred, p, l, line_break, d->userdata);
+}
+
+int stdout_stream_read(StdoutStream *s, stdout_stream_line_t line_func, void *userdata) {
+        StdoutStreamReadData d = {
+                .line_func = line_func,
+                .userdata = userdata,
+        };
+
+        assert(s);
+        assert(s->reader);
+        assert(line_func);
+
+        /* Called on the reader thread, the lines are processed later on the main thread with
+         * stdout_stream_process_line() */
+
+        return stdout_stream_receive(s, &s->reader_ucred, stdout_stream_found_reader, &d);
+}
+
+void stdout_stream_process_line(StdoutStream *s, const struct ucred *ucred, char *p, int line_break) {
+        assert(s);
+        assert(s->reader);
+        assert(ucred);
+        assert(p);
+        assert(line_break >= 0 && line_break < _LINE_BREAK_MAX);
+
+        /* Once we gave up on the stream, the reader thread may still pass on what it read in the meantime */
+        if (s->terminated)
+                return;
+
+        if (ucred->pid != s->ucred.pid)
+                s->context = client_context_release(s->server, s->context);
+
+        s->ucred = *ucred;
+
+        if (stdout_stream_line(s, p, line_break) < 0)
+                stdout_stream_destroy(s);
+}
+
+int stdout_stream_get_fd(StdoutStream *s) {
+        assert(s);
+
+        return s->fd;
+}
+
+void stdout_stream_release(StdoutStream *s) {
+        assert(s);
+        assert(s->reader);
+
+        /* The reader thread ran into EOF or an error, and won't touch the stream anymore */
+        s->reader = NULL;
+        stdout_stream_destroy(s);
+}
+
+static int stdout_stream_watch(StdoutStream *stream) {
+        Server *s;
+        int r;
+
+        assert(stream);
+
+        s = stream->server;
+
+        if (s->n_readers > 0) {
+                stream->reader_ucred = stream->ucred;
+                stream->reader_setup_lines = STDOUT_STREAM_RUNNING - stream->state;
+
+                return server_reader_add_stream(s, stream, stream->fd, &stream->reader);
+        }
+
+        r = sd_event_add_io(s->event, &stream->event_source, stream->fd, EPOLLIN, stdout_stream_process, stream);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add stream to event loop: %m");
+
+        r = sd_event_source_set_priority(stream->event_source, SD_EVENT_PRIORITY_NORMAL+5);
+        if (r < 0)
+                return log_error_errno(r, "Failed to adjust stdout event source priority: %m");
+
+        return 0;
+}
+
+static int stdout_stream_add(Server *s, int fd, StdoutStream **ret) {
         _cleanup_(stdout_stream_freep) StdoutStream *stream = NULL;
         sd_id128_t id;
         int r;
@@ -680,14 +825,6 @@ int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
 
         (void) shutdown(fd, SHUT_WR);
 
-        r = sd_event_add_io(s->event, &stream->event_source, fd, EPOLLIN, stdout_stream_process, stream);
-        if (r < 0)
-                return log_error_errno(r, "Failed to add stream to event loop: %m");
-
-        r = sd_event_source_set_priority(stream->event_source, SD_EVENT_PRIORITY_NORMAL+5);
-        if (r < 0)
-                return log_error_errno(r, "Failed to adjust stdout event source priority: %m");
-
         stream->fd = fd;
 
         stream->server = s;
@@ -696,10 +833,31 @@ int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
 
         (void) server_start_or_stop_idle_timer(s); /* Maybe no longer idle? */
 
+        *ret = TAKE_PTR(stream);
+        return 0;
+}
+
+int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
+        StdoutStream *stream;
+        int r;
+
+        assert(s);
+        assert(fd >= 0);
+
+        r = stdout_stream_add(s, fd, &stream);
+        if (r < 0)
+                return r;
+
+        r = stdout_stream_watch(stream);
+        if (r < 0) {
+                stream->fd = -1; /* On failure the caller keeps the fd */
+                stdout_stream_free(stream);
+                return r;
+        }
+
         if (ret)
                 *ret = stream;
 
-        TAKE_PTR(stream);
         return 0;
 }
 
@@ -833,7 +991,7 @@ static int stdout_stream_restore(Server *s, const char *fname, int fd) {
                 return -ENOBUFS;
         }
 
-        r = stdout_stream_install(s, fd, &stream);
+        r = stdout_stream_add(s, fd, &stream);
         if (r < 0)
                 return r;
 
@@ -843,6 +1001,14 @@ static int stdout_stream_restore(Server *s, const char *fname, int fd) {
         /* Ignore all parsing errors */
         (void) stdout_stream_load(stream, fname);
 
+        /* Only start reading once we know the state, a reader thread needs it */
+        r = stdout_stream_watch(stream);
+        if (r < 0) {
+                stream->fd = -1;
+                stdout_stream_free(stream);
+                return r;
+        }
+
         return 0;
 }
 
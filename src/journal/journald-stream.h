@@ -13,3 +13,11 @@ StdoutStream* stdout_stream_free(StdoutStream *s);
 int stdout_stream_install(Server *s, int fd, StdoutStream **ret);
 void stdout_stream_destroy(StdoutStream *s);
 void stdout_stream_send_notify(StdoutStream *s);
+
+/* Reading streams on a reader thread, see journald-reader.c */
+typedef int (*stdout_stream_line_t)(StdoutStream *s, const struct ucred *ucred, const char *p, size_t l, int line_break, void *userdata);
+
+int stdout_stream_get_fd(StdoutStream *s);
+int stdout_stream_read(StdoutStream *s, stdout_stream_line_t line_func, void *userdata);
+void stdout_stream_process_line(StdoutStream *s, const struct ucred *ucred, char *p, int line_break);
+void stdout_stream_release(StdoutStream *s);
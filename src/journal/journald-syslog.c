@@ -12,6 +12,7 @@
 #include "io-util.h"
 #include "journald-console.h"
 #include "journald-kmsg.h"
+#include "journald-reader.h"
 #include "journald-server.h"
 #include "journald-syslog.h"
 #include "journald-wall.h"
@@ -493,6 +494,9 @@ int server_open_syslog_socket(Server *s, const char *syslog_socket) {
         if (r < 0)
                 return log_error_errno(r, "SO_TIMESTAMP failed: %m");
 
+        if (s->n_readers > 0)
+                return server_reader_add_socket(s, &s->syslog_fd);
+
         r = sd_event_add_io(s->event, &s->syslog_event_source, s->syslog_fd, EPOLLIN, server_process_datagram, s);
         if (r < 0)
                 return log_error_errno(r, "Failed to add syslog server fd to event loop: %m");
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sd-id128.h"
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "socket-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+
+/* Puts load on all transports of a running journald at once: a few clients each send messages over the native
+ * socket, over the syslog socket and as stdout streams. Then it waits until everything was stored, checks that
+ * the messages of each client are in order, and reports how long it took. Pass a namespace to run this against
+ * the journald instance of that namespace, e.g. to compare different ReaderThreads= settings. Make sure that
+ * instance doesn't rate limit us. */
+
+#define N_CLIENTS 4U
+
+typedef enum Transport {
+        TRANSPORT_NATIVE,
+        TRANSPORT_SYSLOG,
+        TRANSPORT_STREAM,
+        _TRANSPORT_MAX,
+} Transport;
+
+static const char* const transport_name[_TRANSPORT_MAX] = {
+        [TRANSPORT_NATIVE] = "native",
+        [TRANSPORT_SYSLOG] = "syslog",
+        [TRANSPORT_STREAM] = "stream",
+};
+
+static const char* const transport_socket[_TRANSPORT_MAX] = {
+        [TRANSPORT_NATIVE] = "socket",
+        [TRANSPORT_SYSLOG] = "dev-log",
+        [TRANSPORT_STREAM] = "stdout",
+};
+
+static unsigned arg_n_messages;
+static const char *arg_namespace;
+static char *runtime_directory;
+static char identifier[STRLEN("test-journald-load-") + SD_ID128_STRING_MAX];
+
+static int client_connect(Transport t) {
+        _cleanup_free_ char *path = NULL;
+        union sockaddr_union sa;
+        int fd, r;
+
+        assert_se(path = path_join(runtime_directory, transport_socket[t]));
+
+        r = sockaddr_un_set_path(&sa.un, path);
+        assert_se(r >= 0);
+
+        fd = socket(AF_UNIX, (t == TRANSPORT_STREAM ? SOCK_STREAM : SOCK_DGRAM)|SOCK_CLOEXEC, 0);
+        assert_se(fd >= 0);
+
+        if (connect(fd, &sa.sa, r) < 0) {
+                r = -errno;
+                safe_close(fd);
+                return r;
+        }
+
+        return fd;
+}
+
+static void* client(void *p) {
+        unsigned t = PTR_TO_UINT(p) / N_CLIENTS, id = PTR_TO_UINT(p) % N_CLIENTS;
+        _cleanup_close_ int fd = -1;
+
+        fd = client_connect(t);
+        assert_se(fd >= 0);
+
+        if (t == TRANSPORT_STREAM) {
+                _cleanup_free_ char *header = NULL;
+
+                /* identifier, unit, priority, level prefix, forward to syslog, kmsg and console */
+                assert_se(header = strjoin(identifier, "\n\n6\n0\n0\n0\n0\n"));
+                assert_se(loop_write(fd, header, strlen(header), false) >= 0);
+        }
+
+        for (unsigned i = 0; i < arg_n_messages; i++) {
+                char buf[STRLEN("MESSAGE=\nSYSLOG_IDENTIFIER=\n") + sizeof(identifier) + 16 + 2 * DECIMAL_STR_MAX(unsigned)];
+
+                switch (t) {
+
+                case TRANSPORT_NATIVE:
+                        xsprintf(buf, "MESSAGE=native %u %u\nSYSLOG_IDENTIFIER=%s\n", id, i, identifier);
+                        assert_se(send(fd, buf, strlen(buf), 0) >= 0);
+                        break;
+
+                case TRANSPORT_SYSLOG:
+                        xsprintf(buf, "<14>%s: syslog %u %u", identifier, id, i);
+                        assert_se(send(fd, buf, strlen(buf), 0) >= 0);
+                        break;
+
+                case TRANSPORT_STREAM:
+                        xsprintf(buf, "stream %u %u\n", id, i);
+                        assert_se(loop_write(fd, buf, strlen(buf), false) >= 0);
+                        break;
+
+                default:
+                        assert_not_reached();
+                }
+        }
+
+        return NULL;
+}
+
+static unsigned read_journal(sd_journal *j, unsigned next[static _TRANSPORT_MAX * N_CLIENTS]) {
+        unsigned n = 0;
+        int r;
+
+        while ((r = sd_journal_next(j)) > 0) {
+                const void *data;
+                unsigned t, id, i;
+                size_t l;
+                char *m;
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &data, &l) >= 0);
+                assert_se(m = strndupa(data, l));
+
+                for (t = 0; t < _TRANSPORT_MAX; t++)
+                        if (startswith(m + STRLEN("MESSAGE="), transport_name[t]))
+                                break;
+                assert_se(t < _TRANSPORT_MAX);
+
+                assert_se(sscanf(m + STRLEN("MESSAGE=") + strlen(transport_name[t]), " %u %u", &id, &i) == 2);
+                assert_se(id < N_CLIENTS);
+
+                /* Whatever comes from one client has to stay in order */
+                assert_se(i == next[t * N_CLIENTS + id]);
+                next[t * N_CLIENTS + id]++;
+                n++;
+        }
+        assert_se(r >= 0);
+
+        return n;
+}
+
+static void test_load(void) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        unsigned next[_TRANSPORT_MAX * N_CLIENTS] = {}, n_stored = 0, n_total;
+        pthread_t threads[_TRANSPORT_MAX * N_CLIENTS];
+        usec_t start, t_sent, t_stored, last_progress;
+        const char *match;
+        sd_id128_t id;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        xsprintf(identifier, "test-journald-load-" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(id));
+
+        assert_se(sd_journal_open_namespace(&j, arg_namespace, SD_JOURNAL_LOCAL_ONLY) >= 0);
+        match = strjoina("SYSLOG_IDENTIFIER=", identifier);
+        assert_se(sd_journal_add_match(j, match, 0) >= 0);
+
+        n_total = _TRANSPORT_MAX * N_CLIENTS * arg_n_messages;
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (unsigned i = 0; i < ELEMENTSOF(threads); i++)
+                assert_se(pthread_create(threads + i, NULL, client, UINT_TO_PTR(i)) == 0);
+
+        for (unsigned i = 0; i < ELEMENTSOF(threads); i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
+
+        t_sent = now(CLOCK_MONOTONIC) - start;
+
+        /* Give up if nothing new shows up for a while */
+        last_progress = now(CLOCK_MONOTONIC);
+        while (n_stored < n_total) {
+                unsigned n;
+
+                n = read_journal(j, next);
+                if (n > 0)
+                        last_progress = now(CLOCK_MONOTONIC);
+                n_stored += n;
+
+                if (n_stored >= n_total)
+                        break;
+
+                assert_se(now(CLOCK_MONOTONIC) - last_progress < 30 * USEC_PER_SEC);
+                assert_se(sd_journal_wait(j, 100 * USEC_PER_MSEC) >= 0);
+        }
+
+        t_stored = now(CLOCK_MONOTONIC) - start;
+
+        assert_se(n_stored == n_total);
+
+        log_info("%u messages from %u clients over %u transports: sent after %s, stored after %s (%.0f messages/s)",
+                 n_total, N_CLIENTS * _TRANSPORT_MAX, _TRANSPORT_MAX,
+                 FORMAT_TIMESPAN(t_sent, USEC_PER_MSEC), FORMAT_TIMESPAN(t_stored, USEC_PER_MSEC),
+                 n_total / ((double) t_stored / USEC_PER_SEC));
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ char *runtime = NULL;
+        int fd;
+
+        test_setup_logging(LOG_INFO);
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_messages) >= 0 && arg_n_messages > 0);
+        else
+                arg_n_messages = slow_tests_enabled() ? 100000 : 10000;
+
+        if (argc >= 3)
+                arg_namespace = argv[2];
+
+        if (arg_namespace)
+                assert_se(runtime = strjoin("/run/systemd/journal.", arg_namespace));
+        else
+                assert_se(runtime = strdup("/run/systemd/journal"));
+        runtime_directory = runtime;
+
+        fd = client_connect(TRANSPORT_NATIVE);
+        if (fd < 0)
+                return log_tests_skipped_errno(fd, "journald is not running");
+        safe_close(fd);
+
+        test_load();
+
+        return 0;
+}
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <syslog.h>
+
+#include "journald-rate-limit.h"
+#include "json.h"
+#include "stdio-util.h"
+#include "tests.h"
+#include "time-util.h"
+
+#define INTERVAL (10 * USEC_PER_SEC)
+#define BURST 100U
+
+static int test(JournalRateLimit *r, const char *id, usec_t ts, int priority) {
+        return journal_ratelimit_test(r, id, journal_ratelimit_hash(r, id), ts, INTERVAL, BURST, priority, 0);
+}
+
+static void test_burst(void) {
+        JournalRateLimit *r;
+        usec_t ts = USEC_PER_SEC;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(r = journal_ratelimit_new());
+
+        /* A full bucket lets a burst through, and then nothing */
+        for (unsigned i = 0; i < BURST; i++)
+                assert_se(test(r, "foo.service", ts, LOG_INFO) == 1);
+        for (unsigned i = 0; i < 10; i++)
+                assert_se(test(r, "foo.service", ts, LOG_INFO) == 0);
+
+        /* Other units and other priorities have their own buckets */
+        assert_se(test(r, "bar.service", ts, LOG_INFO) == 1);
+        assert_se(test(r, "foo.service", ts, LOG_ERR) == 1);
+
+        /* After a tenth of the interval a tenth of the burst got through again. The dropped messages are only
+         * reported once the interval passed. */
+        ts += INTERVAL / 10;
+        for (unsigned i = 0; i < BURST / 10; i++)
+                assert_se(test(r, "foo.service", ts, LOG_INFO) == 1);
+        assert_se(test(r, "foo.service", ts, LOG_INFO) == 0);
+
+        ts += INTERVAL;
+        assert_se(test(r, "foo.service", ts, LOG_INFO) == 1 + 11);
+        assert_se(test(r, "foo.service", ts, LOG_INFO) == 1);
+
+        /* Disabled rate limiting lets everything through */
+        for (unsigned i = 0; i < 2 * BURST; i++)
+                assert_se(journal_ratelimit_test(r, "baz.service", journal_ratelimit_hash(r, "baz.service"), ts, 0, BURST, LOG_INFO, 0) == 1);
+
+        journal_ratelimit_free(r);
+}
+
+static void test_many_groups(void) {
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
+        JournalRateLimit *r;
+        usec_t ts = USEC_PER_SEC;
+        JsonVariant *units;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(r = journal_ratelimit_new());
+
+        /* More groups than are kept around, all of them busy. The oldest ones are evicted, and the rest keeps
+         * its state. */
+        for (unsigned i = 0; i < 20000; i++) {
+                char id[STRLEN("unit-.service") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(id, "unit-%u.service", i);
+
+                for (unsigned j = 0; j < BURST; j++)
+                        assert_se(test(r, id, ts + i, LOG_INFO) == 1);
+                assert_se(test(r, id, ts + i, LOG_INFO) == 0);
+        }
+
+        assert_se(test(r, "unit-19999.service", ts + 20000, LOG_INFO) == 0);
+
+        assert_se(journal_ratelimit_build_json(r, &v) >= 0);
+
+        assert_se(json_variant_unsigned(json_variant_by_key(v, "Groups")) <= 16384);
+        assert_se(json_variant_unsigned(json_variant_by_key(v, "Evicted")) > 0);
+        assert_se(json_variant_unsigned(json_variant_by_key(v, "Dropped")) == 20001);
+        assert_se(units = json_variant_by_key(v, "Units"));
+        assert_se(json_variant_elements(units) == json_variant_unsigned(json_variant_by_key(v, "Groups")));
+
+        /* Evicted groups start over */
+        ts += 2 * INTERVAL;
+        assert_se(test(r, "unit-0.service", ts, LOG_INFO) == 1);
+
+        journal_ratelimit_free(r);
+}
+
+static void test_vacuum(void) {
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
+        JournalRateLimit *r;
+        usec_t ts = USEC_PER_SEC;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(r = journal_ratelimit_new());
+
+        /* A full table where a single group expired. Vacuuming still has to make room for more than one
+         * new group, i.e. evict the least recently used eighth of the table minus the expired group. */
+        assert_se(test(r, "unit-0.service", ts, LOG_INFO) == 1);
+
+        ts += INTERVAL;
+        for (unsigned i = 1; i <= 16384; i++) {
+                char id[STRLEN("unit-.service") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(id, "unit-%u.service", i);
+                assert_se(test(r, id, ts, LOG_INFO) == 1);
+        }
+
+        assert_se(journal_ratelimit_build_json(r, &v) >= 0);
+        assert_se(json_variant_unsigned(json_variant_by_key(v, "Groups")) == 16384 - 16384 / 8 + 1);
+        assert_se(json_variant_unsigned(json_variant_by_key(v, "Evicted")) == 16384 / 8 - 1);
+
+        journal_ratelimit_free(r);
+}
+
+static void test_benchmark(void) {
+        JournalRateLimit *r;
+        unsigned n_units = slow_tests_enabled() ? 10000 : 1000, n = 1000000;
+        uint64_t *hashes;
+        char **ids;
+        usec_t start, t;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(r = journal_ratelimit_new());
+        assert_se(ids = new(char*, n_units));
+        assert_se(hashes = new(uint64_t, n_units));
+
+        for (unsigned i = 0; i < n_units; i++) {
+                assert_se(asprintf(ids + i, "unit-%u.service", i) >= 0);
+                hashes[i] = journal_ratelimit_hash(r, ids[i]);
+        }
+
+        start = now(CLOCK_MONOTONIC);
+        for (unsigned i = 0; i < n; i++)
+                assert_se(journal_ratelimit_test(r, ids[i % n_units], hashes[i % n_units], USEC_PER_SEC + i,
+                                                 INTERVAL, BURST, LOG_INFO, 0) >= 0);
+        t = now(CLOCK_MONOTONIC) - start;
+
+        log_info("%u messages from %u units: %s, %.0f ns per message",
+                 n, n_units, FORMAT_TIMESPAN(t, 1), (double) t * NSEC_PER_USEC / n);
+
+        for (unsigned i = 0; i < n_units; i++)
+                free(ids[i]);
+        free(ids);
+        free(hashes);
+        journal_ratelimit_free(r);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        test_burst();
+        test_many_groups();
+        test_vacuum();
+        test_benchmark();
+
+        return 0;
+}
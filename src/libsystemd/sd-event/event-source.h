@@ -1,6 +1,7 @@
 #pragma once
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include <pthread.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
@@ -12,6 +13,7 @@
 #include "list.h"
 #include "prioq.h"
 #include "ratelimit.h"
+#include "work-pool.h"
 
 typedef enum EventSourceType {
         SOURCE_IO,
@@ -27,6 +29,8 @@ typedef enum EventSourceType {
         SOURCE_EXIT,
         SOURCE_WATCHDOG,
         SOURCE_INOTIFY,
+        SOURCE_COMPLETION,
+        SOURCE_WORK,
         _SOURCE_EVENT_SOURCE_TYPE_MAX,
         _SOURCE_EVENT_SOURCE_TYPE_INVALID = -EINVAL,
 } EventSourceType;
@@ -35,14 +39,24 @@ typedef enum EventSourceType {
  * we know how to dispatch it */
 typedef enum WakeupType {
         WAKEUP_NONE,
-        WAKEUP_EVENT_SOURCE, /* either I/O or pidfd wakeup */
+        WAKEUP_EVENT_SOURCE, /* either I/O, pidfd or completion wakeup */
         WAKEUP_CLOCK_DATA,
         WAKEUP_SIGNAL_DATA,
         WAKEUP_INOTIFY_DATA,
+        WAKEUP_WORK_DATA,
         _WAKEUP_TYPE_MAX,
         _WAKEUP_TYPE_INVALID = -EINVAL,
 } WakeupType;
 
+/* The operations completion event sources carry out */
+typedef enum CompletionType {
+        COMPLETION_READ,
+        COMPLETION_WRITE,
+        COMPLETION_ACCEPT,
+        _COMPLETION_TYPE_MAX,
+        _COMPLETION_TYPE_INVALID = -EINVAL,
+} CompletionType;
+
 struct inode_data;
 
 struct sd_event_source {
@@ -93,6 +107,13 @@ struct sd_event_source {
                 struct {
                         sd_event_time_handler_t callback;
                         usec_t next, accuracy;
+                        /* Timers with a coarse accuracy on a clock that never jumps backwards are kept in the
+                         * clock's timer wheel instead of its prioqs. While enabled and not pending they are
+                         * linked into the wheel slot of the tick they are due at. */
+                        struct timer_wheel_slot *wheel_slot;
+                        uint64_t wheel_tick;
+                        LIST_FIELDS(sd_event_source, wheel);
+                        bool in_wheel:1;
                 } time;
                 struct {
                         sd_event_signal_handler_t callback;
@@ -127,9 +148,54 @@ struct sd_event_source {
                         struct inode_data *inode_data;
                         LIST_FIELDS(sd_event_source, by_inode_data);
                 } inotify;
+                struct {
+                        sd_event_completion_handler_t callback;
+                        CompletionType type;
+                        int fd;
+                        void *buffer;
+                        size_t size;
+                        uint64_t offset; /* UINT64_MAX for the current file position */
+                        int flags;       /* accept4() flags */
+                        int result;
+                        bool armed:1;      /* the operation is waited for in the epoll */
+                        bool registered:1; /* whether the fd is registered in the epoll */
+                } completion;
+                struct {
+                        sd_event_completion_handler_t callback;
+                        sd_event_work_handler_t work;
+                        WorkItem item;
+                        int result;
+                        /* On the list of done work. Set by the thread that did the work, hence not a bit
+                         * field, and protected by the mutex of the work data, like the list. */
+                        bool done;
+                        LIST_FIELDS(sd_event_source, done);
+                        bool submitted; /* handed to the pool, and not reported back yet */
+                } work;
         };
 };
 
+#define TIMER_WHEEL_LEVELS 6U
+#define TIMER_WHEEL_SLOT_BITS 6U
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_SLOT_BITS)
+
+struct timer_wheel_slot {
+        LIST_HEAD(sd_event_source, sources);
+        uint64_t first; /* No source in the slot is due before this tick */
+};
+
+struct timer_wheel {
+        /* A hierarchical timer wheel. Slot i of level l covers the ticks which are the same as 'now' above
+         * bit (l+1)*TIMER_WHEEL_SLOT_BITS, and i in the bits below, down to bit l*TIMER_WHEEL_SLOT_BITS.
+         * Each source goes into the lowest level its tick fits in, hence everything in level l is due
+         * before anything in level l+1. Whenever 'now' reaches the range of a slot above level 0, the
+         * slot's sources move down to the levels below. What's too far out for all levels waits in the
+         * overflow slot. */
+        uint64_t now; /* Everything due before this tick has been dispatched */
+        uint64_t occupied[TIMER_WHEEL_LEVELS]; /* Bitmaps of the non-empty slots of each level */
+        struct timer_wheel_slot slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+        struct timer_wheel_slot overflow;
+};
+
 struct clock_data {
         WakeupType wakeup;
         int fd;
@@ -143,6 +209,10 @@ struct clock_data {
 
         Prioq *earliest;
         Prioq *latest;
+
+        /* Coarse timers instead go into a timer wheel, where arming and disarming them is O(1) */
+        struct timer_wheel *wheel;
+
         usec_t next;
 
         bool needs_rearm:1;
@@ -161,6 +231,18 @@ struct signal_data {
         sd_event_source *current;
 };
 
+/* The thread pool work event sources run their work on, set up when the first of them is added. The threads
+ * put what they are done with on a list, and signal the eventfd, which is watched by the epoll. */
+struct work_data {
+        WakeupType wakeup;
+
+        int fd;
+        WorkPool *pool;
+
+        pthread_mutex_t mutex;
+        LIST_HEAD(sd_event_source, done);
+};
+
 /* A structure listing all event sources currently watching a specific inode */
 struct inode_data {
         /* The identifier for the inode, the combination of the .st_dev + .st_ino fields of the file */
@@ -11,3 +11,10 @@ int event_reset_time(sd_event *e, sd_event_source **s,
                      int64_t priority, const char *description, bool force_reset);
 int event_source_disable(sd_event_source *s);
 int event_source_is_enabled(sd_event_source *s);
+
+/* Event sources that carry out a read(), write() or accept4() themselves once it would not block
+ * anymore, and report its result to the handler. The fd is watched with epoll, hence it may not be used
+ * by more than one of these event sources at a time, nor by an event source added with sd_event_add_io(). */
+int event_add_read(sd_event *e, sd_event_source **s, int fd, void *buffer, size_t size, uint64_t offset, sd_event_completion_handler_t callback, void *userdata);
+int event_add_write(sd_event *e, sd_event_source **s, int fd, const void *buffer, size_t size, uint64_t offset, sd_event_completion_handler_t callback, void *userdata);
+int event_add_accept(sd_event *e, sd_event_source **s, int fd, int flags, sd_event_completion_handler_t callback, void *userdata);
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
 
@@ -11,6 +13,7 @@
 #include "alloc-util.h"
 #include "env-util.h"
 #include "event-source.h"
+#include "event-util.h"
 #include "fd-util.h"
 #include "fs-util.h"
 #include "hashmap.h"
@@ -29,6 +32,19 @@
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* Timers that may be dispatched at least this late go into the timer wheel of their clock, which has a
+ * resolution of TIMER_WHEEL_TICK_USEC. Timers that need to be more accurate stay in the prioqs. */
+#define TIMER_WHEEL_ACCURACY_MIN_USEC (10 * USEC_PER_MSEC)
+#define TIMER_WHEEL_TICK_USEC USEC_PER_MSEC
+
+/* The wheel's idea of the current tick must never go backwards, hence it is only used for clocks which
+ * don't jump */
+#define EVENT_SOURCE_TIME_CAN_USE_WHEEL(t)      \
+        IN_SET((t),                             \
+               SOURCE_TIME_BOOTTIME,            \
+               SOURCE_TIME_MONOTONIC,           \
+               SOURCE_TIME_BOOTTIME_ALARM)
+
 static bool EVENT_SOURCE_WATCH_PIDFD(sd_event_source *s) {
         /* Returns true if this is a PID event source and can be implemented by watching EPOLLIN */
         return s &&
@@ -61,6 +77,8 @@ static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX]
         [SOURCE_EXIT] = "exit",
         [SOURCE_WATCHDOG] = "watchdog",
         [SOURCE_INOTIFY] = "inotify",
+        [SOURCE_COMPLETION] = "completion",
+        [SOURCE_WORK] = "work",
 };
 
 DEFINE_PRIVATE_STRING_TABLE_LOOKUP_TO_STRING(event_source_type, int);
@@ -128,6 +146,9 @@ struct sd_event {
         /* A list of inotify objects that already have events buffered which aren't processed yet */
         LIST_HEAD(struct inotify_data, inotify_data_buffered);
 
+        /* Set up when the first work event source is added */
+        struct work_data work;
+
         pid_t original_pid;
 
         uint64_t iteration;
@@ -159,7 +180,9 @@ struct sd_event {
 static thread_local sd_event *default_event = NULL;
 
 static void source_disconnect(sd_event_source *s);
+static int source_set_pending(sd_event_source *s, bool b);
 static void event_gc_inode_data(sd_event *e, struct inode_data *d);
+static usec_t sleep_between(sd_event *e, usec_t a, usec_t b);
 
 static sd_event *event_resolve(sd_event *e) {
         return e == SD_EVENT_DEFAULT ? default_event : e;
@@ -315,6 +338,21 @@ static void free_clock_data(struct clock_data *d) {
         safe_close(d->fd);
         prioq_free(d->earliest);
         prioq_free(d->latest);
+        free(d->wheel);
+}
+
+static void free_work_data(struct work_data *d) {
+        assert(d);
+        assert(d->wakeup == WAKEUP_WORK_DATA);
+
+        if (!d->pool)
+                return;
+
+        assert(!d->done);
+
+        d->pool = work_pool_free(d->pool);
+        assert_se(pthread_mutex_destroy(&d->mutex) == 0);
+        d->fd = safe_close(d->fd);
 }
 
 static sd_event *event_free(sd_event *e) {
@@ -342,6 +380,8 @@ static sd_event *event_free(sd_event *e) {
         free_clock_data(&e->realtime_alarm);
         free_clock_data(&e->boottime_alarm);
 
+        free_work_data(&e->work);
+
         prioq_free(e->pending);
         prioq_free(e->prepare);
         prioq_free(e->exit);
@@ -388,6 +428,8 @@ _public_ int sd_event_new(sd_event** ret) {
                 .boottime_alarm.wakeup = WAKEUP_CLOCK_DATA,
                 .boottime_alarm.fd = -1,
                 .boottime_alarm.next = USEC_INFINITY,
+                .work.wakeup = WAKEUP_WORK_DATA,
+                .work.fd = -1,
                 .perturb = USEC_INFINITY,
                 .original_pid = getpid_cached(),
         };
@@ -514,6 +556,230 @@ static int source_child_pidfd_register(sd_event_source *s, int enabled) {
         return 0;
 }
 
+static void source_completion_unregister(sd_event_source *s) {
+        assert(s);
+        assert(s->type == SOURCE_COMPLETION);
+
+        if (event_pid_changed(s->event))
+                return;
+
+        if (!s->completion.registered)
+                return;
+
+        if (epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->completion.fd, NULL) < 0)
+                log_debug_errno(errno, "Failed to remove source %s (type %s) from epoll, ignoring: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+
+        s->completion.registered = false;
+}
+
+static int source_completion_register(sd_event_source *s) {
+        assert(s);
+        assert(s->type == SOURCE_COMPLETION);
+
+        /* The operation is carried out once epoll says the fd is ready for it. Always oneshot, as the
+         * event source needs to be armed again for another operation anyway. */
+
+        struct epoll_event ev = {
+                .events = (s->completion.type == COMPLETION_WRITE ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT,
+                .data.ptr = s,
+        };
+
+        if (epoll_ctl(s->event->epoll_fd,
+                      s->completion.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                      s->completion.fd, &ev) < 0)
+                return -errno;
+
+        s->completion.registered = true;
+
+        return 0;
+}
+
+static int source_completion_perform(sd_event_source *s) {
+        ssize_t n;
+
+        assert(s);
+        assert(s->type == SOURCE_COMPLETION);
+
+        switch (s->completion.type) {
+
+        case COMPLETION_READ:
+                if (s->completion.offset == UINT64_MAX)
+                        n = read(s->completion.fd, s->completion.buffer, s->completion.size);
+                else
+                        n = pread(s->completion.fd, s->completion.buffer, s->completion.size, (off_t) s->completion.offset);
+                break;
+
+        case COMPLETION_WRITE:
+                if (s->completion.offset == UINT64_MAX)
+                        n = write(s->completion.fd, s->completion.buffer, s->completion.size);
+                else
+                        n = pwrite(s->completion.fd, s->completion.buffer, s->completion.size, (off_t) s->completion.offset);
+                break;
+
+        case COMPLETION_ACCEPT:
+                n = accept4(s->completion.fd, NULL, NULL, s->completion.flags);
+                break;
+
+        default:
+                assert_not_reached();
+        }
+        if (n < 0)
+                return -errno;
+
+        return (int) n;
+}
+
+static int source_completion_arm(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_COMPLETION);
+        assert(!s->completion.armed);
+
+        r = source_completion_register(s);
+        if (r == -EPERM) {
+                /* Regular files can't be watched by epoll, but are always ready anyway */
+                s->completion.result = source_completion_perform(s);
+                return source_set_pending(s, true);
+        }
+        if (r < 0)
+                return r;
+
+        s->completion.armed = true;
+        return 0;
+}
+
+static void source_completion_disarm(sd_event_source *s) {
+        assert(s);
+        assert(s->type == SOURCE_COMPLETION);
+
+        if (event_pid_changed(s->event))
+                return;
+
+        if (!s->completion.armed)
+                return;
+
+        source_completion_unregister(s);
+        s->completion.armed = false;
+}
+
+static int event_setup_work_data(sd_event *e) {
+        struct work_data *d = &e->work;
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(e);
+
+        if (d->pool)
+                return 0;
+
+        fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (fd < 0)
+                return -errno;
+
+        fd = fd_move_above_stdio(fd);
+
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+                .data.ptr = d,
+        };
+
+        if (epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                return -errno;
+
+        r = work_pool_new(WORK_POOL_THREADS_MAX, &d->pool);
+        if (r < 0) {
+                (void) epoll_ctl(e->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                return r;
+        }
+
+        assert_se(pthread_mutex_init(&d->mutex, NULL) == 0);
+        d->fd = TAKE_FD(fd);
+
+        return 0;
+}
+
+static int source_work_run(void *userdata) {
+        sd_event_source *s = userdata;
+
+        return s->work.work(s->userdata);
+}
+
+static void source_work_done(WorkItem *w, int result, void *userdata) {
+        sd_event_source *s = userdata;
+        struct work_data *d = &s->event->work;
+
+        /* Runs on the thread that did the work. The event loop picks the result up once woken up. */
+
+        s->work.result = result;
+
+        assert_se(pthread_mutex_lock(&d->mutex) == 0);
+        LIST_PREPEND(work.done, d->done, s);
+        s->work.done = true;
+        assert_se(pthread_mutex_unlock(&d->mutex) == 0);
+
+        (void) eventfd_write(d->fd, 1);
+}
+
+static int source_work_submit(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_WORK);
+        assert(!s->work.submitted);
+
+        s->work.item = (WorkItem) {
+                .func = source_work_run,
+                .done = source_work_done,
+                .userdata = s,
+        };
+
+        r = work_pool_submit(s->event->work.pool, &s->work.item);
+        if (r < 0)
+                return r;
+
+        s->work.submitted = true;
+        return 0;
+}
+
+static void source_work_cancel(sd_event_source *s, bool wait) {
+        struct work_data *d;
+
+        assert(s);
+        assert(s->type == SOURCE_WORK);
+
+        if (event_pid_changed(s->event))
+                return;
+
+        if (!s->work.submitted)
+                return;
+
+        d = &s->event->work;
+
+        if (work_pool_cancel(d->pool, &s->work.item)) {
+                s->work.submitted = false;
+                return;
+        }
+
+        /* The work is underway already. Unless the event source goes away, its result is reported once it
+         * is enabled again. Otherwise the work might still refer to the event source, and its userdata,
+         * hence wait until it is done, and forget about its result. */
+        if (!wait)
+                return;
+
+        work_pool_wait(d->pool, &s->work.item);
+
+        assert_se(pthread_mutex_lock(&d->mutex) == 0);
+        if (s->work.done) {
+                LIST_REMOVE(work.done, d->done, s);
+                s->work.done = false;
+        }
+        assert_se(pthread_mutex_unlock(&d->mutex) == 0);
+
+        s->work.submitted = false;
+}
+
 static clockid_t event_source_type_to_clock(EventSourceType t) {
 
         switch (t) {
@@ -770,6 +1036,190 @@ static void event_source_pp_prioq_reshuffle(sd_event_source *s) {
                 prioq_reshuffle(s->event->prepare, s, &s->prepare_index);
 }
 
+static bool event_source_time_wants_wheel(EventSourceType t, usec_t accuracy) {
+        return EVENT_SOURCE_TIME_CAN_USE_WHEEL(t) && accuracy >= TIMER_WHEEL_ACCURACY_MIN_USEC;
+}
+
+static int timer_wheel_new(clockid_t clock, struct timer_wheel **ret) {
+        struct timer_wheel *w;
+
+        assert(ret);
+
+        w = new0(struct timer_wheel, 1);
+        if (!w)
+                return -ENOMEM;
+
+        /* The alarm clock is only different when it comes to waking up the system */
+        w->now = now(clock == CLOCK_BOOTTIME_ALARM ? CLOCK_BOOTTIME : clock) / TIMER_WHEEL_TICK_USEC;
+
+        *ret = w;
+        return 0;
+}
+
+static void timer_wheel_link(struct timer_wheel *w, sd_event_source *s, uint64_t tick) {
+        struct timer_wheel_slot *slot;
+        unsigned level;
+
+        assert(w);
+        assert(s);
+        assert(!s->time.wheel_slot);
+
+        /* What is due already is dispatched with the next tick */
+        tick = MAX(tick, w->now);
+
+        /* The lowest level in whose range of the current tick the tick is */
+        level = u64log2(tick ^ w->now) / TIMER_WHEEL_SLOT_BITS;
+        if (level >= TIMER_WHEEL_LEVELS)
+                slot = &w->overflow;
+        else {
+                unsigned i;
+
+                i = (tick >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+                slot = &w->slots[level][i];
+                w->occupied[level] |= UINT64_C(1) << i;
+        }
+
+        if (!slot->sources || tick < slot->first)
+                slot->first = tick;
+
+        LIST_PREPEND(time.wheel, slot->sources, s);
+        s->time.wheel_slot = slot;
+        s->time.wheel_tick = tick;
+}
+
+static void timer_wheel_slot_emptied(struct timer_wheel *w, struct timer_wheel_slot *slot) {
+        size_t k;
+
+        assert(w);
+        assert(slot);
+        assert(!slot->sources);
+
+        if (slot == &w->overflow)
+                return;
+
+        k = slot - &w->slots[0][0];
+        w->occupied[k / TIMER_WHEEL_SLOTS] &= ~(UINT64_C(1) << (k % TIMER_WHEEL_SLOTS));
+}
+
+static void timer_wheel_unlink(struct timer_wheel *w, sd_event_source *s) {
+        struct timer_wheel_slot *slot;
+
+        assert(w);
+        assert(s);
+
+        slot = s->time.wheel_slot;
+        if (!slot)
+                return;
+
+        LIST_REMOVE(time.wheel, slot->sources, s);
+        s->time.wheel_slot = NULL;
+
+        if (!slot->sources)
+                timer_wheel_slot_emptied(w, slot);
+}
+
+static uint64_t timer_wheel_next(const struct timer_wheel *w) {
+        assert(w);
+
+        /* Returns the first tick anything might be due at, UINT64_MAX if there is nothing. That's exact if
+         * it is in level 0, otherwise it might be earlier than what's actually due, as the first tick of a
+         * slot isn't updated when sources are unlinked. */
+
+        for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++)
+                if (w->occupied[level] != 0)
+                        return w->slots[level][__builtin_ctzll(w->occupied[level])].first;
+
+        return w->overflow.sources ? w->overflow.first : UINT64_MAX;
+}
+
+static bool timer_wheel_cascade(struct timer_wheel *w, struct timer_wheel_slot *slot) {
+        LIST_HEAD(sd_event_source, l);
+
+        assert(w);
+        assert(slot);
+
+        if (!slot->sources)
+                return false;
+
+        l = TAKE_PTR(slot->sources);
+        timer_wheel_slot_emptied(w, slot);
+
+        while (l) {
+                sd_event_source *s = l;
+
+                LIST_REMOVE(time.wheel, l, s);
+                s->time.wheel_slot = NULL;
+                timer_wheel_link(w, s, s->time.wheel_tick);
+        }
+
+        return true;
+}
+
+static bool timer_wheel_set_now(struct timer_wheel *w, uint64_t tick) {
+        bool moved = false;
+        uint64_t old;
+
+        assert(w);
+
+        /* Must only be called when nothing is due before 'tick', i.e. it's at most timer_wheel_next().
+         * Returns true if sources moved down, in which case timer_wheel_next() might be later now. */
+
+        old = w->now;
+        if (tick <= old)
+                return false;
+
+        w->now = tick;
+
+        /* Everything in the range of the new tick moves down, starting at the top, so that what moves down
+         * more than one level moves down to the bottom right away */
+        if ((old ^ tick) >> (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS) != 0)
+                moved = timer_wheel_cascade(w, &w->overflow);
+
+        for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+                unsigned shift = level * TIMER_WHEEL_SLOT_BITS;
+
+                if ((old >> shift) == (tick >> shift))
+                        continue;
+
+                if (timer_wheel_cascade(w, &w->slots[level][(tick >> shift) & (TIMER_WHEEL_SLOTS - 1)]))
+                        moved = true;
+        }
+
+        return moved;
+}
+
+static int clock_data_ensure_wheel(struct clock_data *d, EventSourceType t) {
+        assert(d);
+
+        if (d->wheel)
+                return 0;
+
+        return timer_wheel_new(event_source_type_to_clock(t), &d->wheel);
+}
+
+static void event_source_time_wheel_update(sd_event_source *s, struct clock_data *d) {
+        usec_t latest, t;
+
+        assert(s);
+        assert(s->time.in_wheel);
+        assert(d);
+        assert(d->wheel);
+
+        timer_wheel_unlink(d->wheel, s);
+        d->needs_rearm = true;
+
+        if (s->enabled == SD_EVENT_OFF || s->pending || s->ratelimited || s->time.next == USEC_INFINITY)
+                return;
+
+        /* Pick the same spot in the window the prioqs would pick if this was the only timer, so that
+         * wakeups are coalesced just the same. The tick is the first one at or after that spot, unless that
+         * is past the window, which always contains a tick, as the accuracy is more than a tick. */
+        latest = usec_add(s->time.next, s->time.accuracy);
+        t = sleep_between(s->event, s->time.next, latest);
+
+        timer_wheel_link(d->wheel, s, MIN(DIV_ROUND_UP(t, TIMER_WHEEL_TICK_USEC), latest / TIMER_WHEEL_TICK_USEC));
+}
+
 static void event_source_time_prioq_reshuffle(sd_event_source *s) {
         struct clock_data *d;
 
@@ -777,13 +1227,18 @@ static void event_source_time_prioq_reshuffle(sd_event_source *s) {
 
         /* Called whenever the event source's timer ordering properties changed, i.e. time, accuracy,
          * pending, enable state, and ratelimiting state. Makes sure the two prioq's are ordered
-         * properly again. */
+         * properly again, or the timer is in the right slot of the timer wheel. */
 
         if (s->ratelimited)
                 d = &s->event->monotonic;
-        else if (EVENT_SOURCE_IS_TIME(s->type))
+        else if (EVENT_SOURCE_IS_TIME(s->type)) {
                 assert_se(d = event_get_clock_data(s->event, s->type));
-        else
+
+                if (s->time.in_wheel) {
+                        event_source_time_wheel_update(s, d);
+                        return;
+                }
+        } else
                 return; /* no-op for an event source which is neither a timer nor ratelimited. */
 
         prioq_reshuffle(d->earliest, s, &s->earliest_index);
@@ -804,6 +1259,23 @@ static void event_source_time_prioq_remove(
         d->needs_rearm = true;
 }
 
+static void event_source_time_clock_remove(
+                sd_event_source *s,
+                struct clock_data *d) {
+
+        assert(s);
+        assert(EVENT_SOURCE_IS_TIME(s->type));
+        assert(d);
+
+        if (s->time.in_wheel) {
+                timer_wheel_unlink(d->wheel, s);
+                d->needs_rearm = true;
+                return;
+        }
+
+        event_source_time_prioq_remove(s, d);
+}
+
 static void source_disconnect(sd_event_source *s) {
         sd_event *event;
 
@@ -834,7 +1306,7 @@ static void source_disconnect(sd_event_source *s) {
                 if (!s->ratelimited) {
                         struct clock_data *d;
                         assert_se(d = event_get_clock_data(s->event, s->type));
-                        event_source_time_prioq_remove(s, d);
+                        event_source_time_clock_remove(s, d);
                 }
 
                 break;
@@ -914,6 +1386,15 @@ static void source_disconnect(sd_event_source *s) {
                 break;
         }
 
+        case SOURCE_COMPLETION:
+                source_completion_disarm(s);
+                source_completion_unregister(s);
+                break;
+
+        case SOURCE_WORK:
+                source_work_cancel(s, /* wait= */ true);
+                break;
+
         default:
                 assert_not_reached();
         }
@@ -1220,6 +1701,65 @@ static int event_source_time_prioq_put(
         return 0;
 }
 
+static int event_source_time_clock_put(
+                sd_event_source *s,
+                struct clock_data *d) {
+
+        assert(s);
+        assert(EVENT_SOURCE_IS_TIME(s->type));
+        assert(d);
+
+        /* Adds a timer event source to its own clock, as opposed to the CLOCK_MONOTONIC prioqs when it is
+         * ratelimited */
+
+        if (s->time.in_wheel) {
+                event_source_time_wheel_update(s, d);
+                return 0;
+        }
+
+        return event_source_time_prioq_put(s, d);
+}
+
+static int event_source_time_set_in_wheel(sd_event_source *s, bool b) {
+        struct clock_data *d;
+        int r;
+
+        assert(s);
+        assert(EVENT_SOURCE_IS_TIME(s->type));
+
+        if (s->time.in_wheel == b)
+                return 0;
+
+        assert_se(d = event_get_clock_data(s->event, s->type));
+
+        if (b) {
+                r = clock_data_ensure_wheel(d, s->type);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Ratelimited timers are in the CLOCK_MONOTONIC prioqs, and go back to their own clock later */
+        if (s->ratelimited) {
+                s->time.in_wheel = b;
+                return 0;
+        }
+
+        if (b) {
+                event_source_time_prioq_remove(s, d);
+                s->time.in_wheel = true;
+                event_source_time_wheel_update(s, d);
+        } else {
+                r = event_source_time_prioq_put(s, d);
+                if (r < 0)
+                        return r;
+
+                timer_wheel_unlink(d->wheel, s);
+                s->time.in_wheel = false;
+        }
+
+        return 0;
+}
+
 _public_ int sd_event_add_time(
                 sd_event *e,
                 sd_event_source **ret,
@@ -1263,11 +1803,18 @@ _public_ int sd_event_add_time(
         s->time.next = usec;
         s->time.accuracy = accuracy == 0 ? DEFAULT_ACCURACY_USEC : accuracy;
         s->time.callback = callback;
+        s->time.in_wheel = event_source_time_wants_wheel(type, s->time.accuracy);
         s->earliest_index = s->latest_index = PRIOQ_IDX_NULL;
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
-        r = event_source_time_prioq_put(s, d);
+        if (s->time.in_wheel) {
+                r = clock_data_ensure_wheel(d, type);
+                if (r < 0)
+                        return r;
+        }
+
+        r = event_source_time_clock_put(s, d);
         if (r < 0)
                 return r;
 
@@ -1673,6 +2220,155 @@ _public_ int sd_event_add_exit(
         return 0;
 }
 
+static int event_add_completion(
+                sd_event *e,
+                sd_event_source **ret,
+                CompletionType type,
+                int fd,
+                void *buffer,
+                size_t size,
+                uint64_t offset,
+                int flags,
+                sd_event_completion_handler_t callback,
+                void *userdata) {
+
+        _cleanup_(source_freep) sd_event_source *s = NULL;
+        int r;
+
+        assert(e);
+
+        s = source_new(e, !ret, SOURCE_COMPLETION);
+        if (!s)
+                return -ENOMEM;
+
+        s->wakeup = WAKEUP_EVENT_SOURCE;
+        s->completion.callback = callback;
+        s->completion.type = type;
+        s->completion.fd = fd;
+        s->completion.buffer = buffer;
+        s->completion.size = size;
+        s->completion.offset = offset;
+        s->completion.flags = flags;
+        s->userdata = userdata;
+        s->enabled = SD_EVENT_ONESHOT;
+
+        r = source_completion_arm(s);
+        if (r < 0)
+                return r;
+
+        if (ret)
+                *ret = s;
+        TAKE_PTR(s);
+
+        return 0;
+}
+
+int event_add_read(
+                sd_event *e,
+                sd_event_source **ret,
+                int fd,
+                void *buffer,
+                size_t size,
+                uint64_t offset,
+                sd_event_completion_handler_t callback,
+                void *userdata) {
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(fd >= 0, -EBADF);
+        assert_return(buffer || size == 0, -EINVAL);
+        assert_return(size <= INT_MAX, -EINVAL);
+        assert_return(offset == UINT64_MAX || offset <= INT64_MAX, -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return event_add_completion(e, ret, COMPLETION_READ, fd, buffer, size, offset, 0, callback, userdata);
+}
+
+int event_add_write(
+                sd_event *e,
+                sd_event_source **ret,
+                int fd,
+                const void *buffer,
+                size_t size,
+                uint64_t offset,
+                sd_event_completion_handler_t callback,
+                void *userdata) {
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(fd >= 0, -EBADF);
+        assert_return(buffer || size == 0, -EINVAL);
+        assert_return(size <= INT_MAX, -EINVAL);
+        assert_return(offset == UINT64_MAX || offset <= INT64_MAX, -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return event_add_completion(e, ret, COMPLETION_WRITE, fd, (void*) buffer, size, offset, 0, callback, userdata);
+}
+
+int event_add_accept(
+                sd_event *e,
+                sd_event_source **ret,
+                int fd,
+                int flags,
+                sd_event_completion_handler_t callback,
+                void *userdata) {
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(fd >= 0, -EBADF);
+        assert_return(!(flags & ~(SOCK_NONBLOCK|SOCK_CLOEXEC)), -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return event_add_completion(e, ret, COMPLETION_ACCEPT, fd, NULL, 0, UINT64_MAX, flags, callback, userdata);
+}
+
+_public_ int sd_event_add_work(
+                sd_event *e,
+                sd_event_source **ret,
+                sd_event_work_handler_t work,
+                sd_event_completion_handler_t callback,
+                void *userdata) {
+
+        _cleanup_(source_freep) sd_event_source *s = NULL;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(work, -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        r = event_setup_work_data(e);
+        if (r < 0)
+                return r;
+
+        s = source_new(e, !ret, SOURCE_WORK);
+        if (!s)
+                return -ENOMEM;
+
+        s->work.work = work;
+        s->work.callback = callback;
+        s->userdata = userdata;
+        s->enabled = SD_EVENT_ONESHOT;
+
+        r = source_work_submit(s);
+        if (r < 0)
+                return r;
+
+        if (ret)
+                *ret = s;
+        TAKE_PTR(s);
+
+        return 0;
+}
+
 static void event_free_inotify_data(sd_event *e, struct inotify_data *d) {
         assert(e);
 
@@ -2424,10 +3120,11 @@ static int event_source_offline(
         assert(s);
         assert(enabled == SD_EVENT_OFF || ratelimited);
 
-        /* Unset the pending flag when this event source is disabled */
+        /* Unset the pending flag when this event source is disabled. Completion and work event sources keep
+         * it, as their operation was carried out already, they report it once enabled again. */
         if (s->enabled != SD_EVENT_OFF &&
             enabled == SD_EVENT_OFF &&
-            !IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
+            !IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT, SOURCE_COMPLETION, SOURCE_WORK)) {
                 r = source_set_pending(s, false);
                 if (r < 0)
                         return r;
@@ -2463,6 +3160,14 @@ static int event_source_offline(
                 prioq_reshuffle(s->event->exit, s, &s->exit.prioq_index);
                 break;
 
+        case SOURCE_COMPLETION:
+                source_completion_disarm(s);
+                break;
+
+        case SOURCE_WORK:
+                source_work_cancel(s, /* wait= */ false);
+                break;
+
         case SOURCE_TIME_REALTIME:
         case SOURCE_TIME_BOOTTIME:
         case SOURCE_TIME_MONOTONIC:
@@ -2497,7 +3202,7 @@ static int event_source_online(
         /* Unset the pending flag when this event source is enabled */
         if (s->enabled == SD_EVENT_OFF &&
             enabled != SD_EVENT_OFF &&
-            !IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
+            !IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT, SOURCE_COMPLETION, SOURCE_WORK)) {
                 r = source_set_pending(s, false);
                 if (r < 0)
                         return r;
@@ -2550,6 +3255,24 @@ static int event_source_online(
                         s->event->n_online_child_sources++;
                 break;
 
+        case SOURCE_COMPLETION:
+                /* If the last operation completed while disabled, it is reported first */
+                if (!s->pending && !s->completion.armed) {
+                        r = source_completion_arm(s);
+                        if (r < 0)
+                                return r;
+                }
+                break;
+
+        case SOURCE_WORK:
+                /* Same for work */
+                if (!s->pending && !s->work.submitted) {
+                        r = source_work_submit(s);
+                        if (r < 0)
+                                return r;
+                }
+                break;
+
         case SOURCE_TIME_REALTIME:
         case SOURCE_TIME_BOOTTIME:
         case SOURCE_TIME_MONOTONIC:
@@ -2668,6 +3391,7 @@ _public_ int sd_event_source_get_time_accuracy(sd_event_source *s, uint64_t *use
 }
 
 _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec) {
+        usec_t old;
         int r;
 
         assert_return(s, -EINVAL);
@@ -2683,8 +3407,15 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         if (usec == 0)
                 usec = DEFAULT_ACCURACY_USEC;
 
+        old = s->time.accuracy;
         s->time.accuracy = usec;
 
+        r = event_source_time_set_in_wheel(s, event_source_time_wants_wheel(s->type, usec));
+        if (r < 0) {
+                s->time.accuracy = old;
+                return r;
+        }
+
         event_source_time_prioq_reshuffle(s);
         return 0;
 }
@@ -2878,9 +3609,10 @@ static int event_source_enter_ratelimited(sd_event_source *s) {
 
         /* Timer event sources are already using the earliest/latest queues for the timer scheduling. Let's
          * first remove them from the prioq appropriate for their own clock, so that we can use the prioq
-         * fields of the event source then for adding it to the CLOCK_MONOTONIC prioq instead. */
+         * fields of the event source then for adding it to the CLOCK_MONOTONIC prioq instead. Coarse timers
+         * are taken out of the timer wheel of their clock instead. */
         if (EVENT_SOURCE_IS_TIME(s->type))
-                event_source_time_prioq_remove(s, event_get_clock_data(s->event, s->type));
+                event_source_time_clock_remove(s, event_get_clock_data(s->event, s->type));
 
         /* Now, let's add the event source to the monotonic clock instead */
         r = event_source_time_prioq_put(s, &s->event->monotonic);
@@ -2903,7 +3635,7 @@ fail:
         /* Reinstall time event sources in the priority queue as before. This shouldn't fail, since the queue
          * space for it should already be allocated. */
         if (EVENT_SOURCE_IS_TIME(s->type))
-                assert_se(event_source_time_prioq_put(s, event_get_clock_data(s->event, s->type)) >= 0);
+                assert_se(event_source_time_clock_put(s, event_get_clock_data(s->event, s->type)) >= 0);
 
         return r;
 }
@@ -2921,7 +3653,7 @@ static int event_source_leave_ratelimit(sd_event_source *s) {
 
         /* Let's then add the event source to its native clock prioq again — if this is a timer event source */
         if (EVENT_SOURCE_IS_TIME(s->type)) {
-                r = event_source_time_prioq_put(s, event_get_clock_data(s->event, s->type));
+                r = event_source_time_clock_put(s, event_get_clock_data(s->event, s->type));
                 if (r < 0)
                         goto fail;
         }
@@ -2931,7 +3663,7 @@ static int event_source_leave_ratelimit(sd_event_source *s) {
         if (r < 0) {
                 /* Do something roughly sensible when this failed: undo the two prioq ops above */
                 if (EVENT_SOURCE_IS_TIME(s->type))
-                        event_source_time_prioq_remove(s, event_get_clock_data(s->event, s->type));
+                        event_source_time_clock_remove(s, event_get_clock_data(s->event, s->type));
 
                 goto fail;
         }
@@ -3036,7 +3768,7 @@ static int event_arm_timer(
 
         struct itimerspec its = {};
         sd_event_source *a, *b;
-        usec_t t;
+        usec_t t = USEC_INFINITY;
 
         assert(e);
         assert(d);
@@ -3048,7 +3780,24 @@ static int event_arm_timer(
 
         a = prioq_peek(d->earliest);
         assert(!a || EVENT_SOURCE_USES_TIME_PRIOQ(a->type));
-        if (!a || a->enabled == SD_EVENT_OFF || time_event_source_next(a) == USEC_INFINITY) {
+        if (a && a->enabled != SD_EVENT_OFF && time_event_source_next(a) != USEC_INFINITY) {
+                b = prioq_peek(d->latest);
+                assert(!b || EVENT_SOURCE_USES_TIME_PRIOQ(b->type));
+                assert(b && b->enabled != SD_EVENT_OFF);
+
+                t = sleep_between(e, time_event_source_next(a), time_event_source_latest(b));
+        }
+
+        /* The timers in the wheel already picked their spot in their windows */
+        if (d->wheel) {
+                uint64_t tick;
+
+                tick = timer_wheel_next(d->wheel);
+                if (tick != UINT64_MAX)
+                        t = MIN(t, tick * TIMER_WHEEL_TICK_USEC);
+        }
+
+        if (t == USEC_INFINITY) {
 
                 if (d->fd < 0)
                         return 0;
@@ -3064,11 +3813,6 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
-        assert(!b || EVENT_SOURCE_USES_TIME_PRIOQ(b->type));
-        assert(b && b->enabled != SD_EVENT_OFF);
-
-        t = sleep_between(e, time_event_source_next(a), time_event_source_latest(b));
         if (d->next == t)
                 return 0;
 
@@ -3107,6 +3851,80 @@ static int process_io(sd_event *e, sd_event_source *s, uint32_t revents) {
         return source_set_pending(s, true);
 }
 
+static int process_completion(sd_event *e, sd_event_source *s, uint32_t revents) {
+        int r;
+
+        assert(e);
+        assert(s);
+        assert(s->type == SOURCE_COMPLETION);
+
+        /* The fd is ready, carry out the operation, and report the result */
+
+        if (!s->completion.armed)
+                return 0;
+
+        r = source_completion_perform(s);
+        if (IN_SET(r, -EAGAIN, -EINTR))
+                /* Somebody else got there first, wait for the next time */
+                return source_completion_register(s);
+
+        s->completion.armed = false;
+        s->completion.result = r;
+
+        return source_set_pending(s, true);
+}
+
+static int process_work(sd_event *e, uint32_t revents, int64_t *min_priority) {
+        struct work_data *d = &e->work;
+        LIST_HEAD(sd_event_source, l);
+        sd_event_source *s;
+        uint64_t x;
+        int r;
+
+        assert(e);
+        assert(min_priority);
+
+        assert_return(revents == EPOLLIN, -EIO);
+
+        if (read(d->fd, &x, sizeof(x)) < 0 && !IN_SET(errno, EAGAIN, EINTR))
+                return -errno;
+
+        assert_se(pthread_mutex_lock(&d->mutex) == 0);
+        l = TAKE_PTR(d->done);
+        LIST_FOREACH(work.done, s, l)
+                s->work.done = false;
+        assert_se(pthread_mutex_unlock(&d->mutex) == 0);
+
+        if (!l)
+                return 0;
+
+        while ((s = l)) {
+                LIST_REMOVE(work.done, l, s);
+
+                s->work.submitted = false;
+
+                r = source_set_pending(s, true);
+                if (r < 0) {
+                        /* Try again next time */
+                        s->work.submitted = true;
+                        LIST_PREPEND(work.done, l, s);
+
+                        assert_se(pthread_mutex_lock(&d->mutex) == 0);
+                        LIST_FOREACH(work.done, s, l)
+                                s->work.done = true;
+                        LIST_JOIN(work.done, d->done, l);
+                        assert_se(pthread_mutex_unlock(&d->mutex) == 0);
+
+                        (void) eventfd_write(d->fd, 1);
+                        return r;
+                }
+
+                *min_priority = MIN(*min_priority, s->priority);
+        }
+
+        return 1;
+}
+
 static int flush_timer(sd_event *e, int fd, uint32_t events, usec_t *next) {
         uint64_t x;
         ssize_t ss;
@@ -3133,6 +3951,50 @@ static int flush_timer(sd_event *e, int fd, uint32_t events, usec_t *next) {
         return 0;
 }
 
+static int process_timer_wheel(
+                sd_event *e,
+                usec_t n,
+                struct clock_data *d) {
+
+        struct timer_wheel *w;
+        uint64_t now_tick;
+        int r;
+
+        assert(e);
+        assert(d);
+
+        w = d->wheel;
+        if (!w)
+                return 0;
+
+        now_tick = n / TIMER_WHEEL_TICK_USEC;
+
+        for (;;) {
+                struct timer_wheel_slot *slot;
+                uint64_t tick;
+
+                tick = timer_wheel_next(w);
+                if (tick > now_tick) {
+                        if (timer_wheel_set_now(w, now_tick + 1))
+                                d->needs_rearm = true;
+                        return 0;
+                }
+
+                /* Moves down what might be due at that tick, if it isn't in level 0 yet. If we woke up
+                 * for that but nothing is due after all, the timer needs to be armed for what is. */
+                if (timer_wheel_set_now(w, tick))
+                        d->needs_rearm = true;
+
+                slot = &w->slots[0][w->now & (TIMER_WHEEL_SLOTS - 1)];
+                while (slot->sources) {
+                        /* Takes the source out of the wheel */
+                        r = source_set_pending(slot->sources, true);
+                        if (r < 0)
+                                return r;
+                }
+        }
+}
+
 static int process_timer(
                 sd_event *e,
                 usec_t n,
@@ -3144,6 +4006,10 @@ static int process_timer(
         assert(e);
         assert(d);
 
+        r = process_timer_wheel(e, n, d);
+        if (r < 0)
+                return r;
+
         for (;;) {
                 s = prioq_peek(d->earliest);
                 assert(!s || EVENT_SOURCE_USES_TIME_PRIOQ(s->type));
@@ -3643,6 +4509,14 @@ static int source_dispatch(sd_event_source *s) {
                 break;
         }
 
+        case SOURCE_COMPLETION:
+                r = s->completion.callback(s, s->completion.result, s->userdata);
+                break;
+
+        case SOURCE_WORK:
+                r = s->work.callback(s, s->work.result, s->userdata);
+                break;
+
         case SOURCE_WATCHDOG:
         case _SOURCE_EVENT_SOURCE_TYPE_MAX:
         case _SOURCE_EVENT_SOURCE_TYPE_INVALID:
@@ -3665,6 +4539,32 @@ static int source_dispatch(sd_event_source *s) {
                 source_free(s);
         else if (r < 0)
                 sd_event_source_set_enabled(s, SD_EVENT_OFF);
+        else if (saved_type == SOURCE_COMPLETION &&
+                 s->enabled == SD_EVENT_ON &&
+                 !s->pending &&
+                 !s->completion.armed) {
+                /* Permanently enabled completion event sources carry out their operation again once the
+                 * callback is done with the buffer */
+                r = source_completion_arm(s);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to rearm event source %s (type %s), disabling: %m",
+                                        strna(s->description),
+                                        event_source_type_to_string(saved_type));
+                        sd_event_source_set_enabled(s, SD_EVENT_OFF);
+                }
+        } else if (saved_type == SOURCE_WORK &&
+                   s->enabled == SD_EVENT_ON &&
+                   !s->pending &&
+                   !s->work.submitted) {
+                /* Similarly, permanently enabled work event sources do their work again */
+                r = source_work_submit(s);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to resubmit work of event source %s (type %s), disabling: %m",
+                                        strna(s->description),
+                                        event_source_type_to_string(saved_type));
+                        sd_event_source_set_enabled(s, SD_EVENT_OFF);
+                }
+        }
 
         return 1;
 }
@@ -3990,7 +4890,9 @@ static int process_epoll(sd_event *e, usec_t timeout, int64_t threshold, int64_t
 
                                 assert(s);
 
-                                if (s->priority > threshold)
+                                /* Completion event sources are watched oneshot, hence the operation is
+                                 * carried out now, whatever the priority. */
+                                if (s->priority > threshold && s->type != SOURCE_COMPLETION)
                                         continue;
 
                                 min_priority = MIN(min_priority, s->priority);
@@ -4005,6 +4907,10 @@ static int process_epoll(sd_event *e, usec_t timeout, int64_t threshold, int64_t
                                         r = process_pidfd(e, s, e->event_queue[i].events);
                                         break;
 
+                                case SOURCE_COMPLETION:
+                                        r = process_completion(e, s, e->event_queue[i].events);
+                                        break;
+
                                 default:
                                         assert_not_reached();
                                 }
@@ -4029,6 +4935,10 @@ static int process_epoll(sd_event *e, usec_t timeout, int64_t threshold, int64_t
                                 r = event_inotify_data_read(e, e->event_queue[i].data.ptr, e->event_queue[i].events, threshold);
                                 break;
 
+                        case WAKEUP_WORK_DATA:
+                                r = process_work(e, e->event_queue[i].events, &min_priority);
+                                break;
+
                         default:
                                 assert_not_reached();
                         }
@@ -5,9 +5,11 @@
 #include "sd-event.h"
 
 #include "alloc-util.h"
+#include "event-util.h"
 #include "exec-util.h"
 #include "fd-util.h"
 #include "fs-util.h"
+#include "io-util.h"
 #include "log.h"
 #include "macro.h"
 #include "missing_syscall.h"
@@ -17,11 +19,13 @@
 #include "random-util.h"
 #include "rm-rf.h"
 #include "signal-util.h"
+#include "socket-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
 #include "tests.h"
 #include "tmpfile-util.h"
 #include "util.h"
+#include "work-pool.h"
 
 static int prepare_handler(sd_event_source *s, void *userdata) {
         log_info("preparing %c", PTR_TO_INT(userdata));
@@ -692,6 +696,27 @@ static void test_ratelimit(void) {
 
         log_info("ratelimit_time_handler: called 10 more times, event source got ratelimited");
         assert_se(count == 20);
+
+        /* Once more with a coarse timer, which goes into the timer wheel while ratelimited */
+        assert_se(sd_event_source_set_time_accuracy(s, 20 * USEC_PER_MSEC) >= 0);
+        assert_se(sd_event_source_set_ratelimit(s, 0, 0) >= 0);
+        assert_se(!sd_event_source_is_ratelimited(s));
+
+        assert_se(sd_event_source_set_ratelimit(s, 1 * USEC_PER_SEC, 10) >= 0);
+
+        do {
+                assert_se(sd_event_run(e, UINT64_MAX) >= 0);
+        } while (!sd_event_source_is_ratelimited(s));
+
+        log_info("ratelimit_time_handler: called 10 more times, event source got ratelimited");
+        assert_se(count == 30);
+
+        /* And leaves the ratelimited state again through the wheel, dispatching what was pending */
+        do {
+                assert_se(sd_event_run(e, UINT64_MAX) >= 0);
+        } while (sd_event_source_is_ratelimited(s));
+
+        assert_se(count == 31);
 }
 
 static void test_simple_timeout(void) {
@@ -747,6 +772,466 @@ static void test_inotify_self_destroy(void) {
         assert_se(sd_event_loop(e) >= 0);
 }
 
+struct completion_context {
+        char buffer[16];
+        int read_result, write_result, accept_result;
+        unsigned n_reads;
+};
+
+static int completion_read_handler(sd_event_source *s, int result, void *userdata) {
+        struct completion_context *c = userdata;
+
+        c->read_result = result;
+        c->n_reads++;
+        return 0;
+}
+
+static int completion_write_handler(sd_event_source *s, int result, void *userdata) {
+        struct completion_context *c = userdata;
+
+        c->write_result = result;
+        return 0;
+}
+
+static int completion_accept_handler(sd_event_source *s, int result, void *userdata) {
+        struct completion_context *c = userdata;
+
+        c->accept_result = result;
+        return 0;
+}
+
+static void test_completion(void) {
+        _cleanup_close_ int fd = -1, listen_fd = -1, connect_fd = -1;
+        _cleanup_close_pair_ int p[2] = {-1, -1};
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_(sd_event_source_unrefp) sd_event_source *r = NULL, *w = NULL, *a = NULL;
+        struct completion_context c = {};
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+        };
+        socklen_t salen = sizeof(sa_family_t);
+        char path[] = "/tmp/test-event-completion-XXXXXX";
+        char buf[4];
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(pipe2(p, O_CLOEXEC|O_NONBLOCK) >= 0);
+
+        /* A read that has to wait for the write */
+        assert_se(event_add_read(e, &r, p[0], c.buffer, sizeof(c.buffer), UINT64_MAX, completion_read_handler, &c) >= 0);
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(c.n_reads == 0);
+
+        assert_se(event_add_write(e, &w, p[1], "hello", 5, UINT64_MAX, completion_write_handler, &c) >= 0);
+        while (c.n_reads == 0 || c.write_result == 0)
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.write_result == 5);
+        assert_se(c.read_result == 5);
+        assert_se(memcmp(c.buffer, "hello", 5) == 0);
+
+        /* Oneshot by default, nothing happens until enabled again */
+        assert_se(write(p[1], "x", 1) == 1);
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(c.n_reads == 1);
+        assert_se(sd_event_source_set_enabled(r, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.n_reads == 2 && c.read_result == 1 && c.buffer[0] == 'x');
+
+        /* A disabled read doesn't take anything */
+        assert_se(sd_event_source_set_enabled(r, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(sd_event_source_set_enabled(r, SD_EVENT_OFF) >= 0);
+        assert_se(write(p[1], "y", 1) == 1);
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(c.n_reads == 2);
+        assert_se(read(p[0], buf, sizeof(buf)) == 1 && buf[0] == 'y');
+
+        /* Permanently enabled, every write is picked up */
+        assert_se(sd_event_source_set_enabled(r, SD_EVENT_ON) >= 0);
+        for (unsigned i = 0; i < 10; i++) {
+                assert_se(write(p[1], "z", 1) == 1);
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+                assert_se(c.n_reads == 3 + i && c.read_result == 1 && c.buffer[0] == 'z');
+        }
+
+        /* End of file */
+        w = sd_event_source_unref(w);
+        p[1] = safe_close(p[1]);
+        assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.n_reads == 13 && c.read_result == 0);
+        r = sd_event_source_unref(r);
+
+        /* Regular files at an offset */
+        fd = mkostemp_safe(path);
+        assert_se(fd >= 0);
+        assert_se(unlink(path) >= 0);
+        assert_se(write(fd, "0123456789", 10) == 10);
+        assert_se(event_add_read(e, &r, fd, c.buffer, 4, 3, completion_read_handler, &c) >= 0);
+        assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.n_reads == 14 && c.read_result == 4);
+        assert_se(memcmp(c.buffer, "3456", 4) == 0);
+
+        /* Accepting connections */
+        listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        assert_se(listen_fd >= 0);
+        assert_se(bind(listen_fd, &sa.sa, salen) >= 0); /* autobind */
+        salen = sizeof(sa);
+        assert_se(getsockname(listen_fd, &sa.sa, &salen) >= 0);
+        assert_se(listen(listen_fd, 1) >= 0);
+
+        assert_se(event_add_accept(e, &a, listen_fd, SOCK_CLOEXEC, completion_accept_handler, &c) >= 0);
+        assert_se(sd_event_run(e, 0) == 0);
+
+        connect_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        assert_se(connect_fd >= 0);
+        assert_se(connect(connect_fd, &sa.sa, salen) >= 0);
+        assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.accept_result >= 0);
+        assert_se(safe_close(c.accept_result) < 0);
+
+        /* Freed while the operation is underway */
+        assert_se(sd_event_source_set_enabled(a, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 0) == 0);
+        a = sd_event_source_unref(a);
+}
+
+struct work_context {
+        int fd;
+        unsigned n_runs;
+        unsigned n_done;
+        int result;
+};
+
+static int work_sleep(void *userdata) {
+        struct work_context *c = userdata;
+
+        (void) usleep(10 * USEC_PER_MSEC);
+        __atomic_add_fetch(&c->n_runs, 1, __ATOMIC_SEQ_CST);
+        return 42;
+}
+
+static int work_read(void *userdata) {
+        struct work_context *c = userdata;
+        char x;
+
+        __atomic_add_fetch(&c->n_runs, 1, __ATOMIC_SEQ_CST);
+        assert_se(fd_wait_for_event(c->fd, POLLIN, USEC_INFINITY) > 0);
+        return read(c->fd, &x, 1) == 1 ? x : -errno;
+}
+
+static int work_done_handler(sd_event_source *s, int result, void *userdata) {
+        struct work_context *c = userdata;
+
+        c->n_done++;
+        c->result = result;
+        return 0;
+}
+
+static int work_repeat_handler(sd_event_source *s, int result, void *userdata) {
+        struct work_context *c = userdata;
+
+        assert_se(result == 42);
+
+        if (++c->n_done >= 5)
+                assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+        return 0;
+}
+
+static void test_work(void) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_(sd_event_source_unrefp) sd_event_source *s = NULL;
+        _cleanup_close_pair_ int p[2] = {-1, -1};
+        struct work_context c = {}, many = {};
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(pipe2(p, O_CLOEXEC|O_NONBLOCK) >= 0);
+
+        /* More work than threads, floating event sources */
+        for (unsigned i = 0; i < 3 * WORK_POOL_THREADS_MAX; i++)
+                assert_se(sd_event_add_work(e, NULL, work_sleep, work_done_handler, &many) >= 0);
+        while (many.n_done < 3 * WORK_POOL_THREADS_MAX)
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(many.n_runs == 3 * WORK_POOL_THREADS_MAX);
+        assert_se(many.result == 42);
+
+        /* Permanently enabled, the work is done again and again */
+        assert_se(sd_event_add_work(e, &s, work_sleep, work_repeat_handler, &c) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+        while (c.n_done < 5)
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.n_runs == 5);
+        s = sd_event_source_unref(s);
+
+        /* Disabled while running, the result is reported once enabled again */
+        c = (struct work_context) { .fd = p[0] };
+        assert_se(sd_event_add_work(e, &s, work_read, work_done_handler, &c) >= 0);
+        while (__atomic_load_n(&c.n_runs, __ATOMIC_SEQ_CST) == 0)
+                (void) usleep(USEC_PER_MSEC);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+        assert_se(write(p[1], "x", 1) == 1);
+        assert_se(sd_event_run(e, 100 * USEC_PER_MSEC) == 0);
+        assert_se(c.n_done == 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(c.n_done == 1 && c.result == 'x');
+        assert_se(c.n_runs == 1);
+
+        /* Disabled before it started, it never runs */
+        c = (struct work_context) {};
+        for (unsigned i = 0; i < WORK_POOL_THREADS_MAX; i++)
+                assert_se(sd_event_add_work(e, NULL, work_sleep, work_done_handler, &many) >= 0);
+        s = sd_event_source_unref(s);
+        assert_se(sd_event_add_work(e, &s, work_sleep, work_done_handler, &c) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+        while (many.n_done < 4 * WORK_POOL_THREADS_MAX)
+                assert_se(sd_event_run(e, UINT64_MAX) > 0);
+        assert_se(c.n_runs <= 1);
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(c.n_done == 0);
+
+        /* Freed while running, the result is dropped */
+        s = sd_event_source_unref(s);
+        c = (struct work_context) {};
+        assert_se(sd_event_add_work(e, &s, work_sleep, work_done_handler, &c) >= 0);
+        s = sd_event_source_unref(s);
+        assert_se(sd_event_run(e, 50 * USEC_PER_MSEC) == 0);
+        assert_se(c.n_done == 0);
+}
+
+#define WAKEUP_PAIRS 64U
+
+static unsigned arg_n_wakeups;
+
+struct wakeup_context {
+        sd_event_source *source;
+        int fd[2];
+        int peer_fd;
+        char buffer;
+        unsigned *n;
+};
+
+static int wakeup_io_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        struct wakeup_context *c = userdata;
+        char x;
+
+        assert_se(read(fd, &x, 1) == 1);
+        assert_se(write(c->peer_fd, &x, 1) == 1);
+
+        if (++(*c->n) >= arg_n_wakeups)
+                return sd_event_exit(sd_event_source_get_event(s), 0);
+
+        return 0;
+}
+
+static int wakeup_completion_handler(sd_event_source *s, int result, void *userdata) {
+        struct wakeup_context *c = userdata;
+
+        assert_se(result == 1);
+        assert_se(write(c->peer_fd, &c->buffer, 1) == 1);
+
+        if (++(*c->n) >= arg_n_wakeups)
+                return sd_event_exit(sd_event_source_get_event(s), 0);
+
+        return 0;
+}
+
+static void test_wakeups(bool completion) {
+        struct wakeup_context c[2 * WAKEUP_PAIRS] = {};
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        unsigned n = 0;
+        usec_t t;
+
+        log_info("/* %s(completion=%s) */", __func__, yes_no(completion));
+
+        /* Pairs of event sources playing ping pong over pipes, every wakeup is one read and one write. With
+         * many of them going at once, each loop iteration has plenty to do. */
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        for (unsigned i = 0; i < ELEMENTSOF(c); i++) {
+                c[i].n = &n;
+                assert_se(pipe2(c[i].fd, O_CLOEXEC|O_NONBLOCK) >= 0);
+        }
+
+        for (unsigned i = 0; i < ELEMENTSOF(c); i++) {
+                c[i].peer_fd = c[i ^ 1].fd[1];
+
+                if (completion) {
+                        assert_se(event_add_read(e, &c[i].source, c[i].fd[0], &c[i].buffer, 1, UINT64_MAX,
+                                                    wakeup_completion_handler, c + i) >= 0);
+                        assert_se(sd_event_source_set_enabled(c[i].source, SD_EVENT_ON) >= 0);
+                } else
+                        assert_se(sd_event_add_io(e, &c[i].source, c[i].fd[0], EPOLLIN, wakeup_io_handler, c + i) >= 0);
+        }
+
+        for (unsigned i = 0; i < ELEMENTSOF(c); i += 2)
+                assert_se(write(c[i].fd[1], "x", 1) == 1);
+
+        t = now(CLOCK_MONOTONIC);
+        assert_se(sd_event_loop(e) >= 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_info("%u wakeups in %s, %.0f wakeups/s",
+                 n, FORMAT_TIMESPAN(t, USEC_PER_MSEC), (double) n * USEC_PER_SEC / MAX(t, 1u));
+
+        for (unsigned i = 0; i < ELEMENTSOF(c); i++)
+                sd_event_source_unref(c[i].source);
+        for (unsigned i = 0; i < ELEMENTSOF(c); i++)
+                safe_close_pair(c[i].fd);
+}
+
+#define WHEEL_TIMERS 256U
+
+struct wheel_timer {
+        sd_event_source *source;
+        usec_t usec;
+        bool expected;
+        bool fired;
+};
+
+static int wheel_timer_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        struct wheel_timer *t = userdata;
+        usec_t n;
+
+        assert_se(sd_event_now(sd_event_source_get_event(s), CLOCK_MONOTONIC, &n) >= 0);
+
+        /* Never early, and only once */
+        assert_se(t->expected);
+        assert_se(!t->fired);
+        assert_se(usec == t->usec);
+        assert_se(n >= t->usec);
+
+        t->fired = true;
+        return 0;
+}
+
+static void test_timer_wheel(void) {
+        struct wheel_timer t[WHEEL_TIMERS] = {};
+        _cleanup_(sd_event_source_unrefp) sd_event_source *x = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        usec_t base, end, accuracy;
+        unsigned n = 0;
+
+        log_info("/* %s */", __func__);
+
+        /* Timers with a coarse accuracy go into a timer wheel, make sure they are dispatched just like the
+         * others: not before their time, and not if disabled in the meantime */
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_now(e, CLOCK_MONOTONIC, &base) >= 0);
+
+        end = base;
+        for (unsigned i = 0; i < ELEMENTSOF(t); i++) {
+                /* Some far enough out to start in the upper levels of the wheel */
+                t[i].usec = base + random_u64_range(i % 16 == 0 && slow_tests_enabled() ? 5 * USEC_PER_SEC : 300 * USEC_PER_MSEC);
+                t[i].expected = true;
+
+                assert_se(sd_event_add_time(e, &t[i].source, CLOCK_MONOTONIC, t[i].usec, 20 * USEC_PER_MSEC,
+                                            wheel_timer_handler, t + i) >= 0);
+        }
+
+        for (unsigned i = 0; i < ELEMENTSOF(t); i++)
+                switch (i % 8) {
+
+                case 1: /* Disabled */
+                        assert_se(sd_event_source_set_enabled(t[i].source, SD_EVENT_OFF) >= 0);
+                        t[i].expected = false;
+                        break;
+
+                case 2: /* Rearmed, somewhere else */
+                        t[i].usec = base + random_u64_range(300 * USEC_PER_MSEC);
+                        assert_se(sd_event_source_set_time(t[i].source, t[i].usec) >= 0);
+                        break;
+
+                case 3: /* Moved out of the wheel and back */
+                        assert_se(sd_event_source_set_time_accuracy(t[i].source, 1) >= 0);
+                        assert_se(sd_event_source_get_time_accuracy(t[i].source, &accuracy) >= 0);
+                        assert_se(accuracy == 1);
+
+                        if (i % 16 == 3)
+                                assert_se(sd_event_source_set_time_accuracy(t[i].source, USEC_PER_SEC) >= 0);
+                        break;
+
+                case 4: /* Disabled and enabled again */
+                        assert_se(sd_event_source_set_enabled(t[i].source, SD_EVENT_OFF) >= 0);
+                        assert_se(sd_event_source_set_enabled(t[i].source, SD_EVENT_ONESHOT) >= 0);
+                        break;
+
+                case 5: /* Gone */
+                        t[i].source = sd_event_source_unref(t[i].source);
+                        t[i].expected = false;
+                        break;
+                }
+
+        for (unsigned i = 0; i < ELEMENTSOF(t); i++)
+                if (t[i].expected) {
+                        end = MAX(end, t[i].usec + USEC_PER_SEC);
+                        n++;
+                }
+
+        assert_se(sd_event_add_time(e, &x, CLOCK_MONOTONIC, end, 0, NULL, INT_TO_PTR(0)) >= 0);
+        assert_se(sd_event_loop(e) == 0);
+
+        for (unsigned i = 0; i < ELEMENTSOF(t); i++) {
+                assert_se(t[i].fired == t[i].expected);
+                sd_event_source_unref(t[i].source);
+        }
+
+        log_info("%u of %u timers fired", n, WHEEL_TIMERS);
+}
+
+static unsigned arg_n_timers;
+
+static int rearm_timer_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        assert_not_reached();
+}
+
+static void test_timer_rearm(usec_t accuracy) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_free_ sd_event_source **s = NULL;
+        unsigned n = 0;
+        usec_t base, t;
+
+        log_info("/* %s(accuracy=%s) */", __func__, FORMAT_TIMESPAN(accuracy, 1));
+
+        /* Lots of timeouts, which are pushed back all the time, and hardly ever elapse. Like the idle and
+         * watchdog timeouts of a busy server's connections. */
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_now(e, CLOCK_MONOTONIC, &base) >= 0);
+        assert_se(s = new(sd_event_source*, arg_n_timers));
+
+        for (unsigned i = 0; i < arg_n_timers; i++)
+                assert_se(sd_event_add_time(e, s + i, CLOCK_MONOTONIC,
+                                            base + 30 * USEC_PER_SEC + random_u64_range(30 * USEC_PER_SEC),
+                                            accuracy, rearm_timer_handler, NULL) >= 0);
+
+        /* Rearm every timer for about a second, with the event loop running every now and then */
+        t = now(CLOCK_MONOTONIC);
+        do {
+                for (unsigned i = 0; i < arg_n_timers; i++) {
+                        unsigned k = random_u64_range(arg_n_timers);
+
+                        assert_se(sd_event_source_set_time(s[k], base + 30 * USEC_PER_SEC + random_u64_range(30 * USEC_PER_SEC)) >= 0);
+
+                        if (i % 1000 == 0)
+                                assert_se(sd_event_run(e, 0) >= 0);
+                }
+
+                n += arg_n_timers;
+        } while (now(CLOCK_MONOTONIC) < t + USEC_PER_SEC);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_info("%u timers rearmed %u times in %s, %.0f rearms/s",
+                 arg_n_timers, n, FORMAT_TIMESPAN(t, USEC_PER_MSEC), (double) n * USEC_PER_SEC / MAX(t, 1u));
+
+        for (unsigned i = 0; i < arg_n_timers; i++)
+                sd_event_source_unref(s[i]);
+}
+
 int main(int argc, char *argv[]) {
         test_setup_logging(LOG_DEBUG);
 
@@ -767,5 +1252,19 @@ int main(int argc, char *argv[]) {
 
         test_inotify_self_destroy();
 
+        test_completion();
+
+        test_work();
+
+        arg_n_wakeups = slow_tests_enabled() ? 1000000 : 20000;
+        test_wakeups(false);
+        test_wakeups(true);
+
+        test_timer_wheel();
+
+        arg_n_timers = slow_tests_enabled() ? 1000000 : 100000;
+        test_timer_rearm(1);                       /* in the prioqs */
+        test_timer_rearm(250 * USEC_PER_MSEC);     /* in the timer wheel */
+
         return 0;
 }
@@ -18,6 +18,7 @@
 #endif
 
 #if HAVE_ZSTD
+#include <zdict.h>
 #include <zstd.h>
 #include <zstd_errors.h>
 #endif
@@ -43,6 +44,12 @@ DEFINE_TRIVIAL_CLEANUP_FUNC_FULL(LZ4F_decompressionContext_t, LZ4F_freeDecompres
 DEFINE_TRIVIAL_CLEANUP_FUNC_FULL(ZSTD_CCtx*, ZSTD_freeCCtx, NULL);
 DEFINE_TRIVIAL_CLEANUP_FUNC_FULL(ZSTD_DCtx*, ZSTD_freeDCtx, NULL);
 
+struct ZstdDictionary {
+        ZSTD_CDict *cdict;
+        ZSTD_DDict *ddict;
+        ZSTD_CCtx *cctx;
+};
+
 static int zstd_ret_to_errno(size_t ret) {
         switch (ZSTD_getErrorCode(ret)) {
         case ZSTD_error_dstSize_tooSmall:
@@ -138,6 +145,14 @@ int compress_blob_lz4(const void *src, uint64_t src_size,
 int compress_blob_zstd(
                 const void *src, uint64_t src_size,
                 void *dst, size_t dst_alloc_size, size_t *dst_size) {
+
+        return compress_blob_zstd_level(src, src_size, dst, dst_alloc_size, dst_size, 0);
+}
+
+int compress_blob_zstd_level(
+                const void *src, uint64_t src_size,
+                void *dst, size_t dst_alloc_size, size_t *dst_size,
+                int level) {
 #if HAVE_ZSTD
         size_t k;
 
@@ -147,7 +162,127 @@ int compress_blob_zstd(
         assert(dst_alloc_size > 0);
         assert(dst_size);
 
-        k = ZSTD_compress(dst, dst_alloc_size, src, src_size, 0);
+        k = ZSTD_compress(dst, dst_alloc_size, src, src_size, level);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int zstd_dictionary_train(
+                const void *samples, const size_t *sample_sizes, size_t n_samples,
+                size_t max_size, void **ret, size_t *ret_size) {
+#if HAVE_ZSTD
+        _cleanup_free_ void *dict = NULL;
+        size_t k;
+
+        assert(samples);
+        assert(sample_sizes);
+        assert(max_size > 0);
+        assert(ret);
+        assert(ret_size);
+
+        if (n_samples > UINT_MAX)
+                return -E2BIG;
+
+        dict = malloc(max_size);
+        if (!dict)
+                return -ENOMEM;
+
+        k = ZDICT_trainFromBuffer(dict, max_size, samples, sample_sizes, n_samples);
+        if (ZDICT_isError(k)) {
+                /* Usually this means the samples were too few or too uniform to learn anything from */
+                log_debug("ZSTD dictionary training failed: %s", ZDICT_getErrorName(k));
+                return -ENODATA;
+        }
+
+        *ret = TAKE_PTR(dict);
+        *ret_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int zstd_dictionary_new(const void *dict, size_t dict_size, int level, ZstdDictionary **ret) {
+#if HAVE_ZSTD
+        _cleanup_(zstd_dictionary_freep) ZstdDictionary *d = NULL;
+
+        assert(dict);
+        assert(ret);
+
+        if (ZSTD_getDictID_fromDict(dict, dict_size) == 0)
+                return -EBADMSG;
+
+        d = new0(ZstdDictionary, 1);
+        if (!d)
+                return -ENOMEM;
+
+        /* Both copy the dictionary, hence it may live in a memory map that goes away later */
+        d->cdict = ZSTD_createCDict(dict, dict_size, level != 0 ? level : ZSTD_CLEVEL_DEFAULT);
+        d->ddict = ZSTD_createDDict(dict, dict_size);
+        if (!d->cdict || !d->ddict)
+                return -ENOMEM;
+
+        *ret = TAKE_PTR(d);
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+ZstdDictionary* zstd_dictionary_free(ZstdDictionary *d) {
+#if HAVE_ZSTD
+        if (!d)
+                return NULL;
+
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeDDict(d->ddict);
+        ZSTD_freeCCtx(d->cctx);
+
+        return mfree(d);
+#else
+        assert(!d);
+        return NULL;
+#endif
+}
+
+bool zstd_frame_needs_dictionary(const void *src, uint64_t src_size) {
+#if HAVE_ZSTD
+        assert(src);
+
+        /* Frames compressed without a dictionary don't carry a dictionary ID */
+        return ZSTD_getDictID_fromFrame(src, src_size) != 0;
+#else
+        return false;
+#endif
+}
+
+int compress_blob_zstd_dict(
+                ZstdDictionary *d,
+                const void *src, uint64_t src_size,
+                void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#if HAVE_ZSTD
+        size_t k;
+
+        assert(d);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        if (!d->cctx) {
+                d->cctx = ZSTD_createCCtx();
+                if (!d->cctx)
+                        return -ENOMEM;
+        }
+
+        k = ZSTD_compress_usingCDict(d->cctx, dst, dst_alloc_size, src, src_size, d->cdict);
         if (ZSTD_isError(k))
                 return zstd_ret_to_errno(k);
 
@@ -257,15 +392,17 @@ int decompress_blob_lz4(
 #endif
 }
 
-int decompress_blob_zstd(
+#if HAVE_ZSTD
+static int zstd_decompress_blob(
+                const ZSTD_DDict *ddict,
                 const void *src,
                 uint64_t src_size,
                 void **dst,
                 size_t *dst_size,
                 size_t dst_max) {
 
-#if HAVE_ZSTD
         uint64_t size;
+        size_t k;
 
         assert(src);
         assert(src_size > 0);
@@ -288,6 +425,12 @@ int decompress_blob_zstd(
         if (!dctx)
                 return -ENOMEM;
 
+        if (ddict) {
+                k = ZSTD_DCtx_refDDict(dctx, ddict);
+                if (ZSTD_isError(k))
+                        return zstd_ret_to_errno(k);
+        }
+
         ZSTD_inBuffer input = {
                 .src = src,
                 .size = src_size,
@@ -297,7 +440,7 @@ int decompress_blob_zstd(
                 .size = MALLOC_SIZEOF_SAFE(*dst),
         };
 
-        size_t k = ZSTD_decompressStream(dctx, &output, &input);
+        k = ZSTD_decompressStream(dctx, &output, &input);
         if (ZSTD_isError(k)) {
                 log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
                 return zstd_ret_to_errno(k);
@@ -306,6 +449,35 @@ int decompress_blob_zstd(
 
         *dst_size = size;
         return 0;
+}
+#endif
+
+int decompress_blob_zstd(
+                const void *src,
+                uint64_t src_size,
+                void **dst,
+                size_t *dst_size,
+                size_t dst_max) {
+
+#if HAVE_ZSTD
+        return zstd_decompress_blob(NULL, src, src_size, dst, dst_size, dst_max);
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_blob_zstd_dict(
+                const ZstdDictionary *d,
+                const void *src,
+                uint64_t src_size,
+                void **dst,
+                size_t *dst_size,
+                size_t dst_max) {
+
+#if HAVE_ZSTD
+        assert(d);
+
+        return zstd_decompress_blob(d->ddict, src, src_size, dst, dst_size, dst_max);
 #else
         return -EPROTONOSUPPORT;
 #endif
@@ -467,14 +639,18 @@ int decompress_startswith_lz4(
 #endif
 }
 
-int decompress_startswith_zstd(
+#if HAVE_ZSTD
+static int zstd_decompress_startswith(
+                const ZSTD_DDict *ddict,
                 const void *src,
                 uint64_t src_size,
                 void **buffer,
                 const void *prefix,
                 size_t prefix_len,
                 uint8_t extra) {
-#if HAVE_ZSTD
+
+        size_t k;
+
         assert(src);
         assert(src_size > 0);
         assert(buffer);
@@ -491,6 +667,12 @@ int decompress_startswith_zstd(
         if (!dctx)
                 return -ENOMEM;
 
+        if (ddict) {
+                k = ZSTD_DCtx_refDDict(dctx, ddict);
+                if (ZSTD_isError(k))
+                        return zstd_ret_to_errno(k);
+        }
+
         if (!(greedy_realloc(buffer, MAX(ZSTD_DStreamOutSize(), prefix_len + 1), 1)))
                 return -ENOMEM;
 
@@ -502,7 +684,6 @@ int decompress_startswith_zstd(
                 .dst = *buffer,
                 .size = MALLOC_SIZEOF_SAFE(*buffer),
         };
-        size_t k;
 
         k = ZSTD_decompressStream(dctx, &output, &input);
         if (ZSTD_isError(k)) {
@@ -513,6 +694,35 @@ int decompress_startswith_zstd(
 
         return memcmp(*buffer, prefix, prefix_len) == 0 &&
                 ((const uint8_t*) *buffer)[prefix_len] == extra;
+}
+#endif
+
+int decompress_startswith_zstd(
+                const void *src,
+                uint64_t src_size,
+                void **buffer,
+                const void *prefix,
+                size_t prefix_len,
+                uint8_t extra) {
+#if HAVE_ZSTD
+        return zstd_decompress_startswith(NULL, src, src_size, buffer, prefix, prefix_len, extra);
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_startswith_zstd_dict(
+                const ZstdDictionary *d,
+                const void *src,
+                uint64_t src_size,
+                void **buffer,
+                const void *prefix,
+                size_t prefix_len,
+                uint8_t extra) {
+#if HAVE_ZSTD
+        assert(d);
+
+        return zstd_decompress_startswith(d->ddict, src, src_size, buffer, prefix, prefix_len, extra);
 #else
         return -EPROTONOSUPPORT;
 #endif
@@ -14,6 +14,9 @@ int compress_blob_lz4(const void *src, uint64_t src_size,
                       void *dst, size_t dst_alloc_size, size_t *dst_size);
 int compress_blob_zstd(const void *src, uint64_t src_size,
                        void *dst, size_t dst_alloc_size, size_t *dst_size);
+/* level 0 selects the zstd default */
+int compress_blob_zstd_level(const void *src, uint64_t src_size,
+                             void *dst, size_t dst_alloc_size, size_t *dst_size, int level);
 
 static inline int compress_blob(const void *src, uint64_t src_size,
                                 void *dst, size_t dst_alloc_size, size_t *dst_size) {
@@ -36,6 +39,27 @@ static inline int compress_blob(const void *src, uint64_t src_size,
         return r;
 }
 
+/* zstd dictionaries are trained per journal file from a sample of its first DATA payloads, which makes
+ * compressing the short payloads typical for log messages worthwhile. */
+typedef struct ZstdDictionary ZstdDictionary;
+
+int zstd_dictionary_train(const void *samples, const size_t *sample_sizes, size_t n_samples,
+                          size_t max_size, void **ret, size_t *ret_size);
+int zstd_dictionary_new(const void *dict, size_t dict_size, int level, ZstdDictionary **ret);
+ZstdDictionary* zstd_dictionary_free(ZstdDictionary *d);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZstdDictionary*, zstd_dictionary_free);
+
+bool zstd_frame_needs_dictionary(const void *src, uint64_t src_size);
+
+int compress_blob_zstd_dict(ZstdDictionary *d, const void *src, uint64_t src_size,
+                            void *dst, size_t dst_alloc_size, size_t *dst_size);
+int decompress_blob_zstd_dict(const ZstdDictionary *d, const void *src, uint64_t src_size,
+                              void **dst, size_t *dst_size, size_t dst_max);
+int decompress_startswith_zstd_dict(const ZstdDictionary *d, const void *src, uint64_t src_size,
+                                    void **buffer,
+                                    const void *prefix, size_t prefix_len,
+                                    uint8_t extra);
+
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t* dst_size, size_t dst_max);
 int decompress_blob_lz4(const void *src, uint64_t src_size,
@@ -273,6 +273,16 @@ int journal_file_hmac_put_object(JournalFile *f, ObjectType type, Object *o, uin
                 gcry_md_write(f->hmac, &o->tag.seqnum, sizeof(o->tag.seqnum));
                 gcry_md_write(f->hmac, &o->tag.epoch, sizeof(o->tag.epoch));
                 break;
+
+        case OBJECT_DICTIONARY:
+                /* All */
+                gcry_md_write(f->hmac, o->dictionary.payload, le64toh(o->object.size) - offsetof(DictionaryObject, payload));
+                break;
+
+        case OBJECT_BLOOM:
+                /* All */
+                gcry_md_write(f->hmac, &o->bloom.n_items, le64toh(o->object.size) - offsetof(BloomObject, n_items));
+                break;
         default:
                 return -EINVAL;
         }
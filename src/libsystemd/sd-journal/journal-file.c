@@ -4,7 +4,6 @@
 #include <fcntl.h>
 #include <linux/fs.h>
 #include <linux/magic.h>
-#include <pthread.h>
 #include <stddef.h>
 #include <sys/mman.h>
 #include <sys/statvfs.h>
@@ -25,6 +24,7 @@
 #include "journal-file.h"
 #include "lookup3.h"
 #include "memory-util.h"
+#include "nulstr-util.h"
 #include "path-util.h"
 #include "random-util.h"
 #include "set.h"
@@ -41,6 +41,38 @@
 #define DEFAULT_COMPRESS_THRESHOLD (512ULL)
 #define MIN_COMPRESS_THRESHOLD (8ULL)
 
+/* Against a dictionary even the payloads of short fields become smaller */
+#define DICTIONARY_COMPRESS_THRESHOLD (64ULL)
+
+/* zstd recommends to train dictionaries on roughly a hundred times their size worth of samples. Larger
+ * payloads are rare and would only crowd out the short ones the dictionary is meant for. */
+#define DICTIONARY_SIZE_MAX (16U * 1024U)
+#define DICTIONARY_SAMPLES_SIZE (100U * DICTIONARY_SIZE_MAX)
+#define DICTIONARY_SAMPLE_SIZE_MAX (4U * 1024U)
+
+/* The fields whose values go into the bloom filter of archived files: what journalctl's --unit=,
+ * --user-unit=, --identifier= and --boot match on, and a few more that are commonly matched on and don't
+ * take too many different values. With 10 bits per value and 7 hash functions about 1% of the lookups of
+ * absent values are false positives. */
+#define BLOOM_FIELDS                            \
+        "_SYSTEMD_UNIT\0"                       \
+        "_SYSTEMD_USER_UNIT\0"                  \
+        "_SYSTEMD_SLICE\0"                      \
+        "UNIT\0"                                \
+        "USER_UNIT\0"                           \
+        "OBJECT_SYSTEMD_UNIT\0"                 \
+        "OBJECT_SYSTEMD_USER_UNIT\0"            \
+        "COREDUMP_UNIT\0"                       \
+        "COREDUMP_USER_UNIT\0"                  \
+        "SYSLOG_IDENTIFIER\0"                   \
+        "MESSAGE_ID\0"                          \
+        "_COMM\0"                               \
+        "_EXE\0"                                \
+        "_BOOT_ID\0"
+#define BLOOM_BITS_PER_ITEM 10U
+#define BLOOM_N_HASHES 7U
+#define BLOOM_ITEMS_MAX (1024U * 1024U)
+
 /* This is the minimum journal file size */
 #define JOURNAL_FILE_SIZE_MIN (512 * 1024ULL)             /* 512 KiB */
 
@@ -139,17 +171,16 @@ static void journal_file_set_offline_internal(JournalFile *f) {
         }
 }
 
-static void * journal_file_set_offline_thread(void *arg) {
-        JournalFile *f = arg;
-
-        (void) pthread_setname_np(pthread_self(), "journal-offline");
+static int journal_file_set_offline_work(void *userdata) {
+        JournalFile *f = userdata;
 
         journal_file_set_offline_internal(f);
 
-        return NULL;
+        return 0;
 }
 
 static int journal_file_set_offline_thread_join(JournalFile *f) {
+        WorkPool *pool;
         int r;
 
         assert(f);
@@ -157,9 +188,12 @@ static int journal_file_set_offline_thread_join(JournalFile *f) {
         if (f->offline_state == OFFLINE_JOINED)
                 return 0;
 
-        r = pthread_join(f->offline_thread, NULL);
-        if (r)
-                return -r;
+        /* The offlining was handed to the pool by us, hence it exists already */
+        r = work_pool_get_default(&pool);
+        if (r < 0)
+                return r;
+
+        work_pool_wait(pool, &f->offline_work);
 
         f->offline_state = OFFLINE_JOINED;
 
@@ -247,27 +281,23 @@ int journal_file_set_offline(JournalFile *f, bool wait) {
         if (wait) /* Without using a thread if waiting. */
                 journal_file_set_offline_internal(f);
         else {
-                sigset_t ss, saved_ss;
-                int k;
-
-                assert_se(sigfillset(&ss) >= 0);
-                /* Don't block SIGBUS since the offlining thread accesses a memory mapped file.
-                 * Asynchronous SIGBUS signals can safely be handled by either thread. */
-                assert_se(sigdelset(&ss, SIGBUS) >= 0);
-
-                r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
-                if (r > 0)
-                        return -r;
-
-                r = pthread_create(&f->offline_thread, NULL, journal_file_set_offline_thread, f);
-
-                k = pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
-                if (r > 0) {
+                WorkPool *pool;
+
+                /* On one of a bounded number of threads shared with other files, which don't block SIGBUS,
+                 * since the offlining accesses a memory mapped file. */
+                r = work_pool_get_default(&pool);
+                if (r >= 0) {
+                        f->offline_work = (WorkItem) {
+                                .func = journal_file_set_offline_work,
+                                .userdata = f,
+                        };
+
+                        r = work_pool_submit(pool, &f->offline_work);
+                }
+                if (r < 0) {
                         f->offline_state = OFFLINE_JOINED;
-                        return -r;
+                        return r;
                 }
-                if (k > 0)
-                        return -k;
         }
 
         return 0;
@@ -394,6 +424,8 @@ JournalFile* journal_file_close(JournalFile *f) {
                 safe_close(f->fd);
         free(f->path);
 
+        journal_index_free(f->index);
+
         mmap_cache_unref(f->mmap);
 
         ordered_hashmap_free_free(f->chain_cache);
@@ -402,6 +434,12 @@ JournalFile* journal_file_close(JournalFile *f) {
         free(f->compress_buffer);
 #endif
 
+#if HAVE_ZSTD
+        zstd_dictionary_free(f->dictionary);
+        free(f->dictionary_samples);
+        free(f->dictionary_sample_sizes);
+#endif
+
 #if HAVE_GCRYPT
         if (f->fss_file)
                 munmap(f->fss_file, PAGE_ALIGN(f->fss_file_size));
@@ -496,7 +534,7 @@ static bool warn_wrong_flags(const JournalFile *f, bool compatible) {
                                   f->path, type, flags & ~any);
                 flags = (flags & any) & ~supported;
                 if (flags) {
-                        const char* strv[5];
+                        const char* strv[6];
                         unsigned n = 0;
                         _cleanup_free_ char *t = NULL;
 
@@ -510,6 +548,8 @@ static bool warn_wrong_flags(const JournalFile *f, bool compatible) {
                                         strv[n++] = "lz4-compressed";
                                 if (flags & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD)
                                         strv[n++] = "zstd-compressed";
+                                if (flags & HEADER_INCOMPATIBLE_ZSTD_DICTIONARY)
+                                        strv[n++] = "zstd-dictionary";
                                 if (flags & HEADER_INCOMPATIBLE_KEYED_HASH)
                                         strv[n++] = "keyed-hash";
                         }
@@ -767,6 +807,8 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_DICTIONARY] = sizeof(DictionaryObject),
+                [OBJECT_BLOOM] = sizeof(BloomObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -918,6 +960,39 @@ static int journal_file_check_object(JournalFile *f, uint64_t offset, Object *o)
                                                le64toh(o->tag.epoch), offset);
 
                 break;
+
+        case OBJECT_DICTIONARY:
+                if (le64toh(o->object.size) <= offsetof(DictionaryObject, payload))
+                        return log_debug_errno(SYNTHETIC_ERRNO(EBADMSG),
+                                               "Invalid object dictionary size: %" PRIu64 ": %" PRIu64,
+                                               le64toh(o->object.size),
+                                               offset);
+
+                break;
+
+        case OBJECT_BLOOM: {
+                uint64_t sz, fields_size;
+
+                sz = le64toh(o->object.size);
+                fields_size = le64toh(o->bloom.fields_size);
+
+                if (sz < offsetof(BloomObject, payload) ||
+                    fields_size == 0 ||
+                    fields_size >= sz - offsetof(BloomObject, payload) ||
+                    o->bloom.payload[fields_size - 1] != 0)
+                        return log_debug_errno(SYNTHETIC_ERRNO(EBADMSG),
+                                               "Invalid object bloom size: %" PRIu64 ": %" PRIu64,
+                                               sz,
+                                               offset);
+
+                if (o->bloom.n_hashes == 0)
+                        return log_debug_errno(SYNTHETIC_ERRNO(EBADMSG),
+                                               "Invalid object bloom hash function count: %u: %" PRIu64,
+                                               o->bloom.n_hashes,
+                                               offset);
+
+                break;
+        }
         }
 
         return 0;
@@ -1493,8 +1568,8 @@ int journal_file_find_data_object_with_hash(
 
                         l -= offsetof(Object, data.payload);
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
-                                            o->data.payload, l, &f->compress_buffer, &rsize, 0);
+                        r = journal_file_decompress_blob(f, o->object.flags & OBJECT_COMPRESSION_MASK,
+                                                         o->data.payload, l, &f->compress_buffer, &rsize, 0);
                         if (r < 0)
                                 return r;
 
@@ -1654,12 +1729,388 @@ static int journal_file_append_field(
         return 0;
 }
 
-static int journal_file_append_data(
+#if HAVE_ZSTD
+static int journal_file_load_dictionary(JournalFile *f) {
+        uint64_t p, l;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        if (f->dictionary)
+                return 1;
+
+        if (!JOURNAL_HEADER_ZSTD_DICTIONARY(f->header))
+                return 0;
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset))
+                return -EBADMSG;
+
+        p = le64toh(READ_NOW(f->header->dictionary_offset));
+        if (!VALID64(p) || p == 0)
+                return -EBADMSG;
+
+        r = journal_file_move_to_object(f, OBJECT_DICTIONARY, p, &o);
+        if (r < 0)
+                return r;
+
+        l = le64toh(READ_NOW(o->object.size)) - offsetof(Object, dictionary.payload);
+
+        r = zstd_dictionary_new(o->dictionary.payload, l, f->compress_level, &f->dictionary);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+#endif
+
+int journal_file_decompress_blob(
+                JournalFile *f,
+                int compression,
+                const void *src, uint64_t src_size,
+                void **dst, size_t *dst_size, size_t dst_max) {
+
+        assert(f);
+
+#if HAVE_ZSTD
+        if (compression == OBJECT_COMPRESSED_ZSTD && zstd_frame_needs_dictionary(src, src_size)) {
+                int r;
+
+                r = journal_file_load_dictionary(f);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EBADMSG;
+
+                return decompress_blob_zstd_dict(f->dictionary, src, src_size, dst, dst_size, dst_max);
+        }
+#endif
+
+        return decompress_blob(compression, src, src_size, dst, dst_size, dst_max);
+}
+
+int journal_file_decompress_startswith(
+                JournalFile *f,
+                int compression,
+                const void *src, uint64_t src_size,
+                void **buffer,
+                const void *prefix, size_t prefix_len,
+                uint8_t extra) {
+
+        assert(f);
+
+#if HAVE_ZSTD
+        if (compression == OBJECT_COMPRESSED_ZSTD && zstd_frame_needs_dictionary(src, src_size)) {
+                int r;
+
+                r = journal_file_load_dictionary(f);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EBADMSG;
+
+                return decompress_startswith_zstd_dict(f->dictionary, src, src_size, buffer, prefix, prefix_len, extra);
+        }
+#endif
+
+        return decompress_startswith(compression, src, src_size, buffer, prefix, prefix_len, extra);
+}
+
+int journal_file_enable_dictionary(JournalFile *f) {
+        assert(f);
+        assert_return(f->writable, -EPERM);
+
+#if HAVE_ZSTD
+        f->compress_dictionary = true;
+        return 0;
+#else
+        return -EOPNOTSUPP;
+#endif
+}
+
+#if HAVE_ZSTD
+static int journal_file_train_dictionary(JournalFile *f) {
+        _cleanup_free_ void *dict = NULL;
+        size_t dict_size;
+        uint64_t p;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        r = zstd_dictionary_train(f->dictionary_samples, f->dictionary_sample_sizes, f->n_dictionary_samples,
+                                  DICTIONARY_SIZE_MAX, &dict, &dict_size);
+        if (r < 0)
+                return r;
+
+        r = zstd_dictionary_new(dict, dict_size, f->compress_level, &f->dictionary);
+        if (r < 0)
+                return r;
+
+        r = journal_file_append_object(f, OBJECT_DICTIONARY, offsetof(Object, dictionary.payload) + dict_size, &o, &p);
+        if (r < 0) {
+                f->dictionary = zstd_dictionary_free(f->dictionary);
+                return r;
+        }
+
+        memcpy(o->dictionary.payload, dict, dict_size);
+
+        /* Only announce the dictionary once it is complete, readers look at the flag first */
+        f->header->dictionary_offset = htole64(p);
+        f->header->incompatible_flags |= htole32(HEADER_INCOMPATIBLE_ZSTD_DICTIONARY);
+
+#if HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_DICTIONARY, o, p);
+        if (r < 0)
+                return r;
+#endif
+
+        log_debug("Trained %zu byte compression dictionary for %s from %zu samples.",
+                  dict_size, f->path, f->n_dictionary_samples);
+
+        return 0;
+}
+#endif
+
+static void journal_file_sample_for_dictionary(JournalFile *f, const void *data, uint64_t size) {
+#if HAVE_ZSTD
+        int r;
+
+        assert(f);
+
+        if (!f->compress_dictionary || !f->compress_zstd || f->dictionary ||
+            JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset))
+                return;
+
+        if (size < MIN_COMPRESS_THRESHOLD || size > DICTIONARY_SAMPLE_SIZE_MAX)
+                return;
+
+        if (!GREEDY_REALLOC(f->dictionary_samples, f->dictionary_samples_size + size) ||
+            !GREEDY_REALLOC(f->dictionary_sample_sizes, f->n_dictionary_samples + 1)) {
+                log_debug("Failed to collect compression dictionary samples for %s, not using a dictionary.", f->path);
+                f->compress_dictionary = false;
+                goto finish;
+        }
+
+        memcpy(f->dictionary_samples + f->dictionary_samples_size, data, size);
+        f->dictionary_samples_size += size;
+        f->dictionary_sample_sizes[f->n_dictionary_samples++] = size;
+
+        if (f->dictionary_samples_size < DICTIONARY_SAMPLES_SIZE)
+                return;
+
+        /* If training fails, try again with the next batch of samples */
+        r = journal_file_train_dictionary(f);
+        if (r < 0)
+                log_debug_errno(r, "Failed to train compression dictionary for %s, ignoring: %m", f->path);
+
+finish:
+        f->dictionary_samples = mfree(f->dictionary_samples);
+        f->dictionary_sample_sizes = mfree(f->dictionary_sample_sizes);
+        f->dictionary_samples_size = f->n_dictionary_samples = 0;
+#endif
+}
+
+static uint64_t bloom_bit(uint64_t hash, unsigned i, uint64_t n_bits) {
+        /* Derives the hash functions from the hash of the DATA object, see Kirsch and Mitzenmacher, "Less
+         * Hashing, Same Performance: Building a Better Bloom Filter" */
+        return ((hash & UINT32_MAX) + i * ((hash >> 32) | 1)) % n_bits;
+}
+
+int journal_file_append_bloom(JournalFile *f) {
+        _cleanup_free_ uint64_t *hashes = NULL;
+        uint64_t n_bits, p;
+        const char *field;
+        size_t n = 0;
+        uint8_t *bits;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert_return(f->writable, -EPERM);
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_offset))
+                return -EOPNOTSUPP;
+
+        if (f->header->bloom_offset != 0)
+                return 0;
+
+        /* The DATA objects of a field are linked from its FIELD object, and carry their hash, hence there's
+         * no need to look at the values themselves. */
+        NULSTR_FOREACH(field, BLOOM_FIELDS) {
+                uint64_t q;
+
+                r = journal_file_find_field_object(f, field, strlen(field), &o, NULL);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        continue;
+
+                for (q = le64toh(o->field.head_data_offset); q != 0; q = le64toh(o->data.next_field_offset)) {
+                        if (n >= BLOOM_ITEMS_MAX)
+                                return -E2BIG;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, q, &o);
+                        if (r < 0)
+                                return r;
+
+                        if (!GREEDY_REALLOC(hashes, n + 1))
+                                return -ENOMEM;
+
+                        hashes[n++] = le64toh(o->data.hash);
+                }
+        }
+
+        n_bits = ALIGN_TO(MAX(n, (size_t) 1) * BLOOM_BITS_PER_ITEM, 64U);
+
+        r = journal_file_append_object(f, OBJECT_BLOOM,
+                                       offsetof(Object, bloom.payload) + sizeof(BLOOM_FIELDS) - 1 + n_bits / 8,
+                                       &o, &p);
+        if (r < 0)
+                return r;
+
+        o->bloom.n_items = htole64(n);
+        o->bloom.fields_size = htole64(sizeof(BLOOM_FIELDS) - 1);
+        o->bloom.n_hashes = BLOOM_N_HASHES;
+        memcpy(o->bloom.payload, BLOOM_FIELDS, sizeof(BLOOM_FIELDS) - 1);
+
+        bits = o->bloom.payload + sizeof(BLOOM_FIELDS) - 1;
+        memzero(bits, n_bits / 8);
+
+        for (size_t i = 0; i < n; i++)
+                for (unsigned k = 0; k < BLOOM_N_HASHES; k++) {
+                        uint64_t b = bloom_bit(hashes[i], k, n_bits);
+
+                        bits[b / 8] |= 1U << (b % 8);
+                }
+
+        /* Only announce the filter once it is complete */
+        f->header->bloom_offset = htole64(p);
+
+#if HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_BLOOM, o, p);
+        if (r < 0)
+                return r;
+#endif
+
+        log_debug("Added %" PRIu64 " byte bloom filter of %zu values to %s.", n_bits / 8, n, f->path);
+
+        return 1;
+}
+
+bool journal_file_bloom_excludes(JournalFile *f, const void *data, uint64_t size, uint64_t hash) {
+        uint64_t p, fields_size, n_bits;
+        const uint8_t *bits;
+        const char *field;
+        size_t field_length;
+        bool covered = false;
+        const void *eq;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(data || size == 0);
+
+        /* Returns true if the file certainly contains no DATA object with the specified payload */
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_offset))
+                return false;
+
+        p = le64toh(READ_NOW(f->header->bloom_offset));
+        if (p == 0)
+                return false;
+
+        eq = memchr(data, '=', size);
+        if (!eq)
+                return false;
+        field_length = (const uint8_t*) eq - (const uint8_t*) data;
+
+        r = journal_file_move_to_object(f, OBJECT_BLOOM, p, &o);
+        if (r < 0)
+                return false;
+
+        fields_size = le64toh(READ_NOW(o->bloom.fields_size));
+
+        /* Only the values of the listed fields are in the filter. The list is followed by the filter bits
+         * rather than an empty string, hence not a proper nulstr. */
+        for (field = (const char*) o->bloom.payload;
+             field < (const char*) o->bloom.payload + fields_size;
+             field += strlen(field) + 1)
+                if (strlen(field) == field_length && memcmp(field, data, field_length) == 0) {
+                        covered = true;
+                        break;
+                }
+        if (!covered)
+                return false;
+
+        bits = o->bloom.payload + fields_size;
+        n_bits = (le64toh(READ_NOW(o->object.size)) - offsetof(Object, bloom.payload) - fields_size) * 8;
+
+        for (unsigned k = 0; k < o->bloom.n_hashes; k++) {
+                uint64_t b = bloom_bit(hash, k, n_bits);
+
+                if (!(bits[b / 8] & (1U << (b % 8))))
+                        return true;
+        }
+
+        return false;
+}
+
+#if HAVE_COMPRESSION
+static int journal_file_compress_data(
                 JournalFile *f,
                 const void *data, uint64_t size,
+                void *dst, size_t dst_alloc_size, size_t *dst_size) {
+
+        assert(f);
+
+#if HAVE_ZSTD
+        if (f->compress_zstd && journal_file_load_dictionary(f) > 0) {
+                int r;
+
+                r = compress_blob_zstd_dict(f->dictionary, data, size, dst, dst_alloc_size, dst_size);
+                if (r < 0)
+                        return r;
+
+                return OBJECT_COMPRESSED_ZSTD;
+        }
+
+        if (f->compress_zstd && f->compress_level != 0) {
+                int r;
+
+                r = compress_blob_zstd_level(data, size, dst, dst_alloc_size, dst_size, f->compress_level);
+                if (r < 0)
+                        return r;
+
+                return OBJECT_COMPRESSED_ZSTD;
+        }
+#endif
+
+        return compress_blob(data, size, dst, dst_alloc_size, dst_size);
+}
+
+static uint64_t journal_file_compress_threshold(JournalFile *f) {
+        assert(f);
+
+#if HAVE_ZSTD
+        /* Unless a threshold was configured explicitly, compress shorter payloads too once there's a
+         * dictionary to compress them against */
+        if (f->compress_threshold_default && f->compress_zstd && journal_file_load_dictionary(f) > 0)
+                return MIN(f->compress_threshold_bytes, DICTIONARY_COMPRESS_THRESHOLD);
+#endif
+
+        return f->compress_threshold_bytes;
+}
+#endif
+
+static int journal_file_append_data_with_hash(
+                JournalFile *f,
+                const void *data, uint64_t size,
+                uint64_t hash,
                 Object **ret, uint64_t *ret_offset) {
 
-        uint64_t hash, p;
+        uint64_t p;
         uint64_t osize;
         Object *o;
         int r, compression = 0;
@@ -1668,8 +2119,6 @@ static int journal_file_append_data(
         assert(f);
         assert(data || size == 0);
 
-        hash = journal_file_hash_data(f, data, size);
-
         r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
                 return r;
@@ -1684,6 +2133,9 @@ static int journal_file_append_data(
                 return 0;
         }
 
+        /* This might append the dictionary object, hence do it before we allocate our own */
+        journal_file_sample_for_dictionary(f, data, size);
+
         osize = offsetof(Object, data.payload) + size;
         r = journal_file_append_object(f, OBJECT_DATA, osize, &o, &p);
         if (r < 0)
@@ -1692,10 +2144,10 @@ static int journal_file_append_data(
         o->data.hash = htole64(hash);
 
 #if HAVE_COMPRESSION
-        if (JOURNAL_FILE_COMPRESS(f) && size >= f->compress_threshold_bytes) {
+        if (JOURNAL_FILE_COMPRESS(f) && size >= journal_file_compress_threshold(f)) {
                 size_t rsize = 0;
 
-                compression = compress_blob(data, size, o->data.payload, size - 1, &rsize);
+                compression = journal_file_compress_data(f, data, size, o->data.payload, size - 1, &rsize);
 
                 if (compression >= 0) {
                         o->object.size = htole64(offsetof(Object, data.payload) + rsize);
@@ -1755,6 +2207,17 @@ static int journal_file_append_data(
         return 0;
 }
 
+static int journal_file_append_data(
+                JournalFile *f,
+                const void *data, uint64_t size,
+                Object **ret, uint64_t *ret_offset) {
+
+        assert(f);
+        assert(data || size == 0);
+
+        return journal_file_append_data_with_hash(f, data, size, journal_file_hash_data(f, data, size), ret, ret_offset);
+}
+
 uint64_t journal_file_entry_n_items(Object *o) {
         uint64_t sz;
         assert(o);
@@ -2105,15 +2568,125 @@ int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t)
         return r;
 }
 
+int journal_file_enable_index(JournalFile *f) {
+        assert(f);
+        assert_return(f->writable, -EPERM);
+
+        if (f->index)
+                return 0;
+
+        f->index = journal_index_new();
+        if (!f->index)
+                return -ENOMEM;
+
+        return 0;
+}
+
+static void journal_file_index_entry(JournalFile *f, const struct iovec iovec[], unsigned n_iovec) {
+        uint64_t seqnum;
+        int r;
+
+        assert(f);
+
+        if (!f->index)
+                return;
+
+        seqnum = le64toh(f->header->tail_entry_seqnum);
+
+        for (unsigned i = 0; i < n_iovec; i++) {
+                const char *m;
+
+                m = memory_startswith(iovec[i].iov_base, iovec[i].iov_len, "MESSAGE=");
+                if (!m)
+                        continue;
+
+                r = journal_index_add(f->index, seqnum, m, iovec[i].iov_len - STRLEN("MESSAGE="));
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to index entry in %s, disabling index: %m", f->path);
+                        f->index = journal_index_free(f->index);
+                }
+
+                return;
+        }
+
+        /* Entries without a message never match a substring search on the message, hence they can stay
+         * covered by the current block. But make sure a block exists that covers them at all. */
+        r = journal_index_add(f->index, seqnum, NULL, 0);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to index entry in %s, disabling index: %m", f->path);
+                f->index = journal_index_free(f->index);
+        }
+}
+
 static int entry_item_cmp(const EntryItem *a, const EntryItem *b) {
         return CMP(le64toh(a->object_offset), le64toh(b->object_offset));
 }
 
-int journal_file_append_entry(
+/* Data objects appended during a batch of entries. Log messages from the same client share most of their
+ * fields (_PID=, _COMM=, _SYSTEMD_UNIT=, _HOSTNAME=, …), hence remembering the offsets of the objects we
+ * just looked up lets us skip the hash table walk through the mmap cache for all but the first entry. */
+#define DATA_CACHE_SIZE 64U
+
+typedef struct DataCacheItem {
+        const void *data;
+        uint64_t size;
+        uint64_t hash;
+        uint64_t offset;
+} DataCacheItem;
+
+static int journal_file_append_data_cached(
+                JournalFile *f,
+                DataCacheItem *cache,
+                const void *data, uint64_t size,
+                uint64_t *ret_hash, uint64_t *ret_offset) {
+
+        DataCacheItem *ci = NULL;
+        uint64_t hash, p;
+        int r;
+
+        assert(f);
+        assert(data || size == 0);
+        assert(ret_hash);
+        assert(ret_offset);
+
+        hash = journal_file_hash_data(f, data, size);
+
+        if (cache) {
+                ci = cache + hash % DATA_CACHE_SIZE;
+
+                if (ci->data &&
+                    ci->hash == hash &&
+                    ci->size == size &&
+                    memcmp_safe(ci->data, data, size) == 0) {
+                        *ret_hash = hash;
+                        *ret_offset = ci->offset;
+                        return 0;
+                }
+        }
+
+        r = journal_file_append_data_with_hash(f, data, size, hash, NULL, &p);
+        if (r < 0)
+                return r;
+
+        if (ci)
+                *ci = (DataCacheItem) {
+                        .data = data,
+                        .size = size,
+                        .hash = hash,
+                        .offset = p,
+                };
+
+        *ret_hash = hash;
+        *ret_offset = p;
+        return 0;
+}
+
+static int journal_file_append_entry_full(
                 JournalFile *f,
                 const dual_timestamp *ts,
                 const sd_id128_t *boot_id,
                 const struct iovec iovec[], unsigned n_iovec,
+                DataCacheItem *cache,
                 uint64_t *seqnum,
                 Object **ret, uint64_t *ret_offset) {
 
@@ -2149,10 +2722,9 @@ int journal_file_append_entry(
         items = newa(EntryItem, n_iovec);
 
         for (unsigned i = 0; i < n_iovec; i++) {
-                uint64_t p;
-                Object *o;
+                uint64_t h, p;
 
-                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len, &o, &p);
+                r = journal_file_append_data_cached(f, cache, iovec[i].iov_base, iovec[i].iov_len, &h, &p);
                 if (r < 0)
                         return r;
 
@@ -2168,10 +2740,10 @@ int journal_file_append_entry(
                 if (JOURNAL_HEADER_KEYED_HASH(f->header))
                         xor_hash ^= jenkins_hash64(iovec[i].iov_base, iovec[i].iov_len);
                 else
-                        xor_hash ^= le64toh(o->data.hash);
+                        xor_hash ^= h;
 
                 items[i].object_offset = htole64(p);
-                items[i].hash = o->data.hash;
+                items[i].hash = htole64(h);
         }
 
         /* Order by the position on disk, in order to improve seek
@@ -2179,6 +2751,15 @@ int journal_file_append_entry(
         typesafe_qsort(items, n_iovec, entry_item_cmp);
 
         r = journal_file_append_entry_internal(f, ts, boot_id, xor_hash, items, n_iovec, seqnum, ret, ret_offset);
+        if (r < 0)
+                return r;
+
+        journal_file_index_entry(f, iovec, n_iovec);
+        return r;
+}
+
+static int journal_file_finish_append(JournalFile *f, int r) {
+        assert(f);
 
         /* If the memory mapping triggered a SIGBUS then we return an
          * IO error and ignore the error code passed down to us, since
@@ -2196,6 +2777,55 @@ int journal_file_append_entry(
         return r;
 }
 
+int journal_file_append_entry(
+                JournalFile *f,
+                const dual_timestamp *ts,
+                const sd_id128_t *boot_id,
+                const struct iovec iovec[], unsigned n_iovec,
+                uint64_t *seqnum,
+                Object **ret, uint64_t *ret_offset) {
+
+        int r;
+
+        assert(f);
+
+        r = journal_file_append_entry_full(f, ts, boot_id, iovec, n_iovec, NULL, seqnum, ret, ret_offset);
+        return journal_file_finish_append(f, r);
+}
+
+int journal_file_append_entries(
+                JournalFile *f,
+                const sd_id128_t *boot_id,
+                const JournalAppendEntry entries[], size_t n_entries,
+                uint64_t *seqnum,
+                size_t *ret_n_appended) {
+
+        DataCacheItem cache[DATA_CACHE_SIZE] = {};
+        size_t i;
+        int r = 0;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+
+        /* Appends a series of entries in one go. Identical data objects referenced by multiple entries are
+         * only looked up once, and readers are notified only once at the end. On failure the number of
+         * entries that were successfully written is returned in ret_n_appended, so that the caller may
+         * rotate and retry the remaining ones. */
+
+        for (i = 0; i < n_entries; i++) {
+                r = journal_file_append_entry_full(f, &entries[i].ts, boot_id,
+                                                   entries[i].iovec, entries[i].n_iovec,
+                                                   cache, seqnum, NULL, NULL);
+                if (r < 0)
+                        break;
+        }
+
+        if (ret_n_appended)
+                *ret_n_appended = i;
+
+        return journal_file_finish_append(f, r);
+}
+
 typedef struct ChainCacheItem {
         uint64_t first; /* the array at the beginning of the chain */
         uint64_t array; /* the cached array */
@@ -3247,6 +3877,15 @@ void journal_file_dump(JournalFile *f) {
                                le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_DICTIONARY:
+                        printf("Type: OBJECT_DICTIONARY\n");
+                        break;
+
+                case OBJECT_BLOOM:
+                        printf("Type: OBJECT_BLOOM items=%"PRIu64"\n",
+                               le64toh(o->bloom.n_items));
+                        break;
+
                 default:
                         printf("Type: unknown (%i)\n", o->object.type);
                         break;
@@ -3283,7 +3922,7 @@ void journal_file_print_header(JournalFile *f) {
                "Sequential number ID: %s\n"
                "State: %s\n"
                "Compatible flags:%s%s\n"
-               "Incompatible flags:%s%s%s%s%s\n"
+               "Incompatible flags:%s%s%s%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data hash table size: %"PRIu64"\n"
@@ -3309,6 +3948,7 @@ void journal_file_print_header(JournalFile *f) {
                JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
                JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
                JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) ? " COMPRESSED-ZSTD" : "",
+               JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) ? " ZSTD-DICTIONARY" : "",
                JOURNAL_HEADER_KEYED_HASH(f->header) ? " KEYED-HASH" : "",
                (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
@@ -3351,6 +3991,15 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Deepest data hash chain: %" PRIu64"\n",
                        f->header->data_hash_chain_depth);
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, bloom_offset) && f->header->bloom_offset != 0) {
+                Object *o;
+
+                if (journal_file_move_to_object(f, OBJECT_BLOOM, le64toh(f->header->bloom_offset), &o) >= 0)
+                        printf("Bloom filter: %"PRIu64" values in %"PRIu64" bytes\n",
+                               le64toh(o->bloom.n_items),
+                               le64toh(o->object.size) - offsetof(Object, bloom.payload) - le64toh(o->bloom.fields_size));
+        }
+
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", FORMAT_BYTES((uint64_t) st.st_blocks * 512ULL));
 }
@@ -3439,6 +4088,7 @@ int journal_file_open(
                 .compress_threshold_bytes = compress_threshold_bytes == UINT64_MAX ?
                                             DEFAULT_COMPRESS_THRESHOLD :
                                             MAX(MIN_COMPRESS_THRESHOLD, compress_threshold_bytes),
+                .compress_threshold_default = compress_threshold_bytes == UINT64_MAX,
 #if HAVE_GCRYPT
                 .seal = seal,
 #endif
@@ -3664,13 +4314,13 @@ fail:
         return r;
 }
 
-int journal_file_archive(JournalFile *f) {
-        _cleanup_free_ char *p = NULL;
+int journal_file_archived_path(JournalFile *f, char **ret) {
+        char *p;
 
         assert(f);
+        assert(ret);
 
-        if (!f->writable)
-                return -EINVAL;
+        /* Determines the name the file gets when it is archived, based on its current header */
 
         /* Is this a journal file that was passed to us as fd? If so, we synthesized a path name for it, and we refuse
          * rotation, since we don't know the actual path, and couldn't rename the file hence. */
@@ -3687,11 +4337,49 @@ int journal_file_archive(JournalFile *f) {
                      le64toh(f->header->head_entry_realtime)) < 0)
                 return -ENOMEM;
 
+        *ret = p;
+        return 0;
+}
+
+int journal_file_archive(JournalFile *f) {
+        _cleanup_free_ char *p = NULL;
+        int r;
+
+        assert(f);
+
+        if (!f->writable)
+                return -EINVAL;
+
+        r = journal_file_archived_path(f, &p);
+        if (r < 0)
+                return r;
+
         /* Try to rename the file to the archived version. If the file already was deleted, we'll get ENOENT, let's
          * ignore that case. */
         if (rename(f->path, p) < 0 && errno != ENOENT)
                 return -errno;
 
+        /* Nothing is added to the file from now on, hence a filter of its values stays valid */
+        r = journal_file_append_bloom(f);
+        if (r < 0)
+                log_debug_errno(r, "Failed to add bloom filter to %s, ignoring: %m", p);
+
+        /* Write out the substring index next to the archived file. The file won't change anymore from now
+         * on, so the index stays valid for its whole lifetime. */
+        if (f->index) {
+                _cleanup_free_ char *i = NULL;
+
+                i = strjoin(p, JOURNAL_INDEX_SUFFIX);
+                if (!i)
+                        return -ENOMEM;
+
+                r = journal_index_write(f->index, i, f->header->file_id, f->fd);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to write journal index %s, ignoring: %m", i);
+
+                f->index = journal_index_free(f->index);
+        }
+
         /* Sync the rename to disk */
         (void) fsync_directory_of_file(f->fd);
 
@@ -3739,11 +4427,15 @@ int journal_file_rotate(
                 Set *deferred_closes) {
 
         JournalFile *new_file = NULL;
+        bool indexed, dictionary;
         int r;
 
         assert(f);
         assert(*f);
 
+        indexed = (*f)->index;
+        dictionary = (*f)->compress_dictionary;
+
         r = journal_file_archive(*f);
         if (r < 0)
                 return r;
@@ -3761,6 +4453,15 @@ int journal_file_rotate(
                         deferred_closes,
                         *f,              /* template */
                         &new_file);
+        if (r >= 0 && indexed) {
+                r = journal_file_enable_index(new_file);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to enable index on %s, ignoring: %m", new_file->path);
+                r = 0;
+        }
+        if (r >= 0 && dictionary)
+                /* Every file gets its own dictionary, trained from its own first entries */
+                (void) journal_file_enable_dictionary(new_file);
 
         journal_initiate_close(*f, deferred_closes);
         *f = new_file;
@@ -3852,7 +4553,29 @@ int journal_file_open_reliably(
                                  deferred_closes, template, ret);
 }
 
-int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p) {
+int journal_file_dup(JournalFile *f, JournalFile **ret) {
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        /* Opens the file once more, read-only and with its own mmap cache, so that it can be read from
+         * another thread than the one using 'f'. */
+
+        fd = fcntl(f->fd, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0)
+                return -errno;
+
+        r = journal_file_open(fd, f->path, O_RDONLY, 0, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, ret);
+        if (r < 0)
+                return r;
+
+        TAKE_FD(fd);
+        return 0;
+}
+
+int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum) {
         uint64_t q, n, xor_hash = 0;
         const sd_id128_t *boot_id;
         dual_timestamp ts;
@@ -3906,7 +4629,8 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
 #if HAVE_COMPRESSION
                         size_t rsize = 0;
 
-                        r = decompress_blob(
+                        r = journal_file_decompress_blob(
+                                        from,
                                         o->object.flags & OBJECT_COMPRESSION_MASK,
                                         o->data.payload, l,
                                         &from->compress_buffer, &rsize,
@@ -3940,7 +4664,10 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         }
 
         r = journal_file_append_entry_internal(to, &ts, boot_id, xor_hash, items, n,
-                                               NULL, NULL, NULL);
+                                               seqnum, NULL, NULL);
+
+        /* We don't look into the copied entry, hence the index must not claim to cover it */
+        journal_index_break(to->index);
 
         if (mmap_cache_got_sigbus(to->mmap, to->cache_fd))
                 return -EIO;
@@ -11,11 +11,14 @@
 #include "sd-event.h"
 #include "sd-id128.h"
 
+#include "compress.h"
 #include "hashmap.h"
 #include "journal-def.h"
+#include "journal-index.h"
 #include "mmap-cache.h"
 #include "sparse-endian.h"
 #include "time-util.h"
+#include "work-pool.h"
 
 typedef struct JournalMetrics {
         /* For all these: -1 means "pick automatically", and 0 means "no limit enforced" */
@@ -67,11 +70,14 @@ typedef struct JournalFile {
         bool compress_xz:1;
         bool compress_lz4:1;
         bool compress_zstd:1;
+        bool compress_dictionary:1;
+        bool compress_threshold_default:1;
         bool seal:1;
         bool defrag_on_close:1;
         bool close_fd:1;
         bool archive:1;
         bool keyed_hash:1;
+        bool index_loaded:1;
 
         direction_t last_direction;
         LocationType location_type;
@@ -100,16 +106,32 @@ typedef struct JournalFile {
 
         OrderedHashmap *chain_cache;
 
-        pthread_t offline_thread;
+        WorkItem offline_work;
         volatile OfflineState offline_state;
 
         unsigned last_seen_generation;
+        unsigned location_prioq_idx;
+
+        /* Substring index over the MESSAGE= fields. Built while writing if enabled, and loaded from the
+         * sidecar file when reading archived files. */
+        JournalIndex *index;
 
         uint64_t compress_threshold_bytes;
+        int compress_level; /* zstd level for new DATA objects, 0 for the default */
 #if HAVE_COMPRESSION
         void *compress_buffer;
 #endif
 
+#if HAVE_ZSTD
+        /* The dictionary ZSTD compressed DATA objects may refer to. While it is not trained yet, the
+         * payloads of the first DATA objects are collected here as samples for it. */
+        ZstdDictionary *dictionary;
+        uint8_t *dictionary_samples;
+        size_t dictionary_samples_size;
+        size_t *dictionary_sample_sizes;
+        size_t n_dictionary_samples;
+#endif
+
 #if HAVE_GCRYPT
         gcry_md_hd_t hmac;
         bool hmac_running;
@@ -161,6 +183,8 @@ int journal_file_open_reliably(
                 JournalFile *template,
                 JournalFile **ret);
 
+int journal_file_dup(JournalFile *f, JournalFile **ret);
+
 #define ALIGN64(x) (((x) + 7ULL) & ~7ULL)
 #define VALID64(x) (((x) & 7ULL) == 0ULL)
 
@@ -201,6 +225,9 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_KEYED_HASH(h) \
         FLAGS_SET(le32toh((h)->incompatible_flags), HEADER_INCOMPATIBLE_KEYED_HASH)
 
+#define JOURNAL_HEADER_ZSTD_DICTIONARY(h) \
+        FLAGS_SET(le32toh((h)->incompatible_flags), HEADER_INCOMPATIBLE_ZSTD_DICTIONARY)
+
 int journal_file_move_to_object(JournalFile *f, ObjectType type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o) _pure_;
@@ -217,6 +244,19 @@ int journal_file_append_entry(
                 Object **ret,
                 uint64_t *offset);
 
+typedef struct JournalAppendEntry {
+        dual_timestamp ts;
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalAppendEntry;
+
+int journal_file_append_entries(
+                JournalFile *f,
+                const sd_id128_t *boot_id,
+                const JournalAppendEntry entries[], size_t n_entries,
+                uint64_t *seqno,
+                size_t *ret_n_appended);
+
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
@@ -239,11 +279,12 @@ int journal_file_move_to_entry_by_seqnum_for_data(JournalFile *f, uint64_t data_
 int journal_file_move_to_entry_by_realtime_for_data(JournalFile *f, uint64_t data_offset, uint64_t realtime, direction_t direction, Object **ret, uint64_t *offset);
 int journal_file_move_to_entry_by_monotonic_for_data(JournalFile *f, uint64_t data_offset, sd_id128_t boot_id, uint64_t monotonic, direction_t direction, Object **ret, uint64_t *offset);
 
-int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p);
+int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum);
 
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
+int journal_file_archived_path(JournalFile *f, char **ret);
 int journal_file_archive(JournalFile *f);
 JournalFile* journal_initiate_close(JournalFile *f, Set *deferred_closes);
 int journal_file_rotate(JournalFile **f, bool compress, uint64_t compress_threshold_bytes, bool seal, Set *deferred_closes);
@@ -252,6 +293,24 @@ int journal_file_dispose(int dir_fd, const char *fname);
 
 void journal_file_post_change(JournalFile *f);
 int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t);
+int journal_file_enable_index(JournalFile *f);
+int journal_file_enable_dictionary(JournalFile *f);
+
+int journal_file_append_bloom(JournalFile *f);
+bool journal_file_bloom_excludes(JournalFile *f, const void *data, uint64_t size, uint64_t hash);
+
+int journal_file_decompress_blob(
+                JournalFile *f,
+                int compression,
+                const void *src, uint64_t src_size,
+                void **dst, size_t *dst_size, size_t dst_max);
+int journal_file_decompress_startswith(
+                JournalFile *f,
+                int compression,
+                const void *src, uint64_t src_size,
+                void **buffer,
+                const void *prefix, size_t prefix_len,
+                uint8_t extra);
 
 void journal_reset_metrics(JournalMetrics *m);
 void journal_default_metrics(JournalMetrics *m, int fd);
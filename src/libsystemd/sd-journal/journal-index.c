@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "errno-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "io-util.h"
+#include "journal-index.h"
+#include "sort-util.h"
+#include "string-util.h"
+#include "tmpfile-util.h"
+
+/* Don't bother loading absurdly large index files, something is off with them */
+#define JOURNAL_INDEX_N_BLOCKS_MAX (UINT64_C(64) * 1024U)
+
+JournalIndex* journal_index_new(void) {
+        return new0(JournalIndex, 1);
+}
+
+JournalIndex* journal_index_free(JournalIndex *i) {
+        if (!i)
+                return NULL;
+
+        free(i->blocks);
+        return mfree(i);
+}
+
+static uint32_t trigram_make(const uint8_t *p) {
+        /* Only ASCII is folded, so that a caseless search for an ASCII literal finds all its spellings */
+        return (uint32_t) ascii_tolower(p[0]) |
+               (uint32_t) ascii_tolower(p[1]) << 8 |
+               (uint32_t) ascii_tolower(p[2]) << 16;
+}
+
+static void trigram_bits(uint32_t t, unsigned *ret_a, unsigned *ret_b) {
+        uint64_t h;
+
+        assert_cc(JOURNAL_INDEX_BLOOM_SIZE * 8 == UINT32_C(1) << 16);
+
+        /* Two bit positions per trigram, taken from a multiplicative hash. This needs to be stable, since the
+         * filters are stored on disk. */
+        h = (uint64_t) t * UINT64_C(0x9e3779b97f4a7c15);
+
+        *ret_a = (unsigned) (h >> 48);
+        *ret_b = (unsigned) (h >> 32) & 0xffffU;
+}
+
+static int trigram_compare(const uint32_t *a, const uint32_t *b) {
+        return CMP(*a, *b);
+}
+
+static bool bloom_set(uint8_t *bloom, uint32_t t) {
+        unsigned a, b;
+        bool changed;
+
+        /* Returns true if the trigram wasn't in the filter yet */
+
+        trigram_bits(t, &a, &b);
+        changed = !(bloom[a / 8] & (1U << (a % 8))) ||
+                  !(bloom[b / 8] & (1U << (b % 8)));
+
+        bloom[a / 8] |= 1U << (a % 8);
+        bloom[b / 8] |= 1U << (b % 8);
+
+        return changed;
+}
+
+static bool bloom_test(const uint8_t *bloom, uint32_t t) {
+        unsigned a, b;
+
+        trigram_bits(t, &a, &b);
+        return (bloom[a / 8] & (1U << (a % 8))) &&
+               (bloom[b / 8] & (1U << (b % 8)));
+}
+
+int journal_index_add(JournalIndex *i, uint64_t seqnum, const void *message, size_t size) {
+        JournalIndexBlock *b;
+        const uint8_t *p = message;
+
+        assert(i);
+        assert(message || size == 0);
+
+        if (i->n_open > 0 && le64toh(i->blocks[i->n_blocks - 1].last_seqnum) >= seqnum)
+                /* Sequence numbers went backwards? Don't let the block cover entries it doesn't know. */
+                i->n_open = 0;
+
+        if (i->n_open == 0) {
+                if (!GREEDY_REALLOC(i->blocks, i->n_blocks + 1))
+                        return -ENOMEM;
+
+                b = i->blocks + i->n_blocks++;
+                b->first_seqnum = htole64(seqnum);
+                memzero(b->bloom, sizeof(b->bloom));
+                i->n_trigrams = 0;
+        } else
+                b = i->blocks + i->n_blocks - 1;
+
+        for (size_t k = 0; k + 3 <= size; k++)
+                if (bloom_set(b->bloom, trigram_make(p + k)))
+                        i->n_trigrams++;
+
+        b->last_seqnum = htole64(seqnum);
+        i->n_open++;
+
+        /* How many entries fit into a block depends on how varied their messages are, what matters is how
+         * full the filter got. A single huge message may still overfill it, the block is closed right after
+         * it then. */
+        if (i->n_trigrams >= JOURNAL_INDEX_BLOCK_TRIGRAMS_MAX)
+                i->n_open = 0;
+
+        return 0;
+}
+
+void journal_index_break(JournalIndex *i) {
+        /* Called whenever an entry is added to the journal file that is not passed to the index. The
+         * current block must not cover it, hence close it. */
+        if (i)
+                i->n_open = 0;
+}
+
+int journal_index_write(JournalIndex *i, const char *path, sd_id128_t file_id, int template_fd) {
+        _cleanup_(unlink_and_freep) char *t = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        JournalIndexHeader h;
+        struct stat st;
+        int r;
+
+        assert(i);
+        assert(path);
+
+        if (i->n_blocks == 0)
+                return 0;
+
+        r = fopen_temporary(path, &f, &t);
+        if (r < 0)
+                return r;
+
+        /* The index reveals which strings are logged, hence give it the same access rights as the journal
+         * file itself. */
+        if (template_fd >= 0 && fstat(template_fd, &st) >= 0) {
+                (void) fchmod(fileno(f), st.st_mode & 0666);
+                (void) fchown(fileno(f), st.st_uid, st.st_gid);
+        }
+
+        h = (JournalIndexHeader) {
+                .header_size = htole64(sizeof(JournalIndexHeader)),
+                .file_id = file_id,
+                .bloom_size = htole64(JOURNAL_INDEX_BLOOM_SIZE),
+                .n_blocks = htole64(i->n_blocks),
+        };
+        memcpy(h.signature, JOURNAL_INDEX_SIGNATURE, sizeof(h.signature));
+
+        if (fwrite(&h, 1, sizeof(h), f) != sizeof(h) ||
+            fwrite(i->blocks, sizeof(JournalIndexBlock), i->n_blocks, f) != i->n_blocks)
+                return errno_or_else(EIO);
+
+        r = fflush_sync_and_check(f);
+        if (r < 0)
+                return r;
+
+        if (rename(t, path) < 0)
+                return -errno;
+
+        t = mfree(t);
+        return 0;
+}
+
+int journal_index_load(const char *path, sd_id128_t file_id, JournalIndex **ret) {
+        _cleanup_(journal_index_freep) JournalIndex *i = NULL;
+        _cleanup_close_ int fd = -1;
+        JournalIndexHeader h;
+        uint64_t n;
+        struct stat st;
+        int r;
+
+        assert(path);
+        assert(ret);
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        r = loop_read_exact(fd, &h, sizeof(h), false);
+        if (r < 0)
+                return r;
+
+        if (memcmp(h.signature, JOURNAL_INDEX_SIGNATURE, sizeof(h.signature)) != 0 ||
+            le64toh(h.header_size) != sizeof(h) ||
+            le64toh(h.bloom_size) != JOURNAL_INDEX_BLOOM_SIZE)
+                return -EBADMSG;
+
+        if (!sd_id128_equal(h.file_id, file_id))
+                return -ESTALE;
+
+        n = le64toh(h.n_blocks);
+        if (n == 0 || n > JOURNAL_INDEX_N_BLOCKS_MAX ||
+            (uint64_t) st.st_size != sizeof(h) + n * sizeof(JournalIndexBlock))
+                return -EBADMSG;
+
+        i = journal_index_new();
+        if (!i)
+                return -ENOMEM;
+
+        i->blocks = new(JournalIndexBlock, n);
+        if (!i->blocks)
+                return -ENOMEM;
+
+        r = loop_read_exact(fd, i->blocks, n * sizeof(JournalIndexBlock), false);
+        if (r < 0)
+                return r;
+
+        i->n_blocks = n;
+
+        /* The blocks must be ordered and must not overlap, or the lookup below won't work */
+        for (size_t k = 0; k < n; k++)
+                if (le64toh(i->blocks[k].first_seqnum) > le64toh(i->blocks[k].last_seqnum) ||
+                    (k > 0 && le64toh(i->blocks[k-1].last_seqnum) >= le64toh(i->blocks[k].first_seqnum)))
+                        return -EBADMSG;
+
+        *ret = TAKE_PTR(i);
+        return 0;
+}
+
+const JournalIndexBlock* journal_index_find_block(JournalIndex *i, uint64_t seqnum) {
+        size_t left = 0, right;
+
+        if (!i)
+                return NULL;
+
+        right = i->n_blocks;
+        while (left < right) {
+                size_t m = left + (right - left) / 2;
+                const JournalIndexBlock *b = i->blocks + m;
+
+                if (seqnum < le64toh(b->first_seqnum))
+                        right = m;
+                else if (seqnum > le64toh(b->last_seqnum))
+                        left = m + 1;
+                else
+                        return b;
+        }
+
+        return NULL;
+}
+
+int journal_index_trigrams(const char *s, uint32_t **ret, size_t *ret_n) {
+        _cleanup_free_ uint32_t *t = NULL;
+        size_t l, n = 0;
+
+        assert(s);
+        assert(ret);
+        assert(ret_n);
+
+        l = strlen(s);
+        if (l < 3) {
+                *ret = NULL;
+                *ret_n = 0;
+                return 0;
+        }
+
+        t = new(uint32_t, l - 2);
+        if (!t)
+                return -ENOMEM;
+
+        for (size_t k = 0; k + 3 <= l; k++)
+                t[n++] = trigram_make((const uint8_t*) s + k);
+
+        typesafe_qsort(t, n, trigram_compare);
+
+        /* Drop duplicates */
+        l = n;
+        n = 0;
+        for (size_t k = 0; k < l; k++)
+                if (n == 0 || t[n-1] != t[k])
+                        t[n++] = t[k];
+
+        *ret = TAKE_PTR(t);
+        *ret_n = n;
+        return (int) n;
+}
+
+bool journal_index_block_may_contain(const JournalIndexBlock *b, const uint32_t *trigrams, size_t n_trigrams) {
+        assert(b);
+        assert(trigrams || n_trigrams == 0);
+
+        for (size_t k = 0; k < n_trigrams; k++)
+                if (!bloom_test(b->bloom, trigrams[k]))
+                        return false;
+
+        return true;
+}
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "sd-id128.h"
+
+#include "macro.h"
+#include "sparse-endian.h"
+
+/* A journal index is a sidecar file "<file>.journal.idx" written next to an archived journal file. It
+ * splits the entries of the journal file into blocks of consecutive sequence numbers and stores a bloom
+ * filter of all (ASCII case-folded) byte trigrams found in the MESSAGE= fields of each block. Readers
+ * looking for a literal substring may skip every block whose filter lacks one of the trigrams of the
+ * literal, without touching the entries of that block at all. */
+
+#define JOURNAL_INDEX_SUFFIX ".idx"
+#define JOURNAL_INDEX_SIGNATURE ((const char[]) { 'L', 'P', 'K', 'S', 'I', 'D', 'X', '1' })
+
+#define JOURNAL_INDEX_BLOOM_SIZE 8192U
+
+/* Each trigram sets two of the 64Ki bits of a filter, hence after n distinct trigrams about 1 - e^(-2n/64Ki)
+ * of them are set. A block is closed once this many trigrams went into it, i.e. at a fill of about 40%, which
+ * leaves some room for the entry that crosses the limit. Beyond 50% filters stop being useful quickly, as a
+ * block can only be skipped if one of the trigrams of a literal is missing from it. */
+#define JOURNAL_INDEX_BLOCK_TRIGRAMS_MAX 16384U
+
+typedef struct JournalIndexHeader {
+        uint8_t signature[8];
+        le64_t header_size;
+        sd_id128_t file_id;
+        le64_t bloom_size;
+        le64_t n_blocks;
+} _packed_ JournalIndexHeader;
+
+assert_cc(sizeof(JournalIndexHeader) == 48);
+
+/* The in-memory representation is identical to the on-disk one */
+typedef struct JournalIndexBlock {
+        le64_t first_seqnum;
+        le64_t last_seqnum;
+        uint8_t bloom[JOURNAL_INDEX_BLOOM_SIZE];
+} _packed_ JournalIndexBlock;
+
+typedef struct JournalIndex {
+        JournalIndexBlock *blocks;
+        size_t n_blocks;
+
+        /* Number of entries and distinct trigrams in the last block, if it is still open for additions */
+        unsigned n_open;
+        unsigned n_trigrams;
+} JournalIndex;
+
+JournalIndex* journal_index_new(void);
+JournalIndex* journal_index_free(JournalIndex *i);
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalIndex*, journal_index_free);
+
+int journal_index_add(JournalIndex *i, uint64_t seqnum, const void *message, size_t size);
+void journal_index_break(JournalIndex *i);
+
+int journal_index_write(JournalIndex *i, const char *path, sd_id128_t file_id, int template_fd);
+int journal_index_load(const char *path, sd_id128_t file_id, JournalIndex **ret);
+
+const JournalIndexBlock* journal_index_find_block(JournalIndex *i, uint64_t seqnum);
+
+int journal_index_trigrams(const char *s, uint32_t **ret, size_t *ret_n);
+bool journal_index_block_may_contain(const JournalIndexBlock *b, const uint32_t *trigrams, size_t n_trigrams);
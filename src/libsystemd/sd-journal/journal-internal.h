@@ -11,7 +11,9 @@
 #include "hashmap.h"
 #include "journal-def.h"
 #include "journal-file.h"
+#include "journal-prefetch.h"
 #include "list.h"
+#include "prioq.h"
 #include "set.h"
 
 typedef struct Match Match;
@@ -73,6 +75,13 @@ struct sd_journal {
 
         OrderedHashmap *files;
         IteratedCache *files_cache;
+
+        /* Files that have an entry beyond the current location, ordered by that entry in the direction we
+         * are iterating in, and files that might still be written to, hence need to be checked for new
+         * entries even after we reached their end. */
+        Prioq *files_prioq;
+        direction_t files_prioq_direction;
+        Set *live_files;
         MMapCache *mmap;
 
         Location current_location;
@@ -119,9 +128,17 @@ struct sd_journal {
         Hashmap *directories_by_wd;
 
         Hashmap *errors;
+
+        /* Only if opened with SD_JOURNAL_PARALLEL */
+        JournalPrefetch *prefetch;
+
+        /* Trigrams of the literal passed to journal_set_message_hint() */
+        uint32_t *index_trigrams;
+        size_t n_index_trigrams;
 };
 
 char *journal_make_match_string(sd_journal *j);
+int journal_set_message_hint(sd_journal *j, const char *literal);
 void journal_print_header(sd_journal *j);
 
 #define JOURNAL_FOREACH_DATA_RETVAL(j, data, l, retval)                     \
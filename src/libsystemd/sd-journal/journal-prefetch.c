@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "journal-prefetch.h"
+#include "log.h"
+#include "sort-util.h"
+
+#define PREFETCH_THREADS_MAX 8U
+#define PREFETCH_CHUNK_SIZE (8U * 1024U * 1024U)
+
+/* How many files beyond the ones the reader already got to are read ahead. More would only push out of
+ * the page cache what the reader is going to need first. */
+#define PREFETCH_FILES_AHEAD 16U
+
+typedef struct PrefetchItem {
+        int fd;
+        uint64_t size;
+
+        /* Where the reader gets to the file: its first entry when reading forward, its last one when
+         * reading backwards */
+        uint64_t head_realtime, tail_realtime;
+} PrefetchItem;
+
+struct JournalPrefetch {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        /* Items before 'next' have been taken by a worker already. Items before 'reached' have been
+         * reached by the reader, and workers only take items before 'limit', which is a few beyond. */
+        PrefetchItem *items;
+        size_t n_items, next, reached, limit;
+        direction_t direction;
+
+        pthread_t threads[PREFETCH_THREADS_MAX];
+        size_t n_threads;
+
+        bool started;
+
+        /* Written under the mutex, but also polled without it by workers in the middle of a file, hence
+         * always accessed atomically */
+        bool stop;
+};
+
+int journal_prefetch_new(JournalPrefetch **ret) {
+        JournalPrefetch *p;
+
+        assert(ret);
+
+        p = new0(JournalPrefetch, 1);
+        if (!p)
+                return -ENOMEM;
+
+        assert_se(pthread_mutex_init(&p->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&p->cond, NULL) == 0);
+
+        *ret = p;
+        return 0;
+}
+
+JournalPrefetch* journal_prefetch_free(JournalPrefetch *p) {
+        if (!p)
+                return NULL;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        __atomic_store_n(&p->stop, true, __ATOMIC_RELAXED);
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        for (size_t i = 0; i < p->n_threads; i++)
+                (void) pthread_join(p->threads[i], NULL);
+
+        for (size_t i = p->next; i < p->n_items; i++)
+                safe_close(p->items[i].fd);
+        free(p->items);
+
+        assert_se(pthread_cond_destroy(&p->cond) == 0);
+        assert_se(pthread_mutex_destroy(&p->mutex) == 0);
+
+        return mfree(p);
+}
+
+static void prefetch_file(JournalPrefetch *p, const PrefetchItem *i) {
+        assert(p);
+        assert(i);
+
+        for (uint64_t offset = 0; offset < i->size; offset += PREFETCH_CHUNK_SIZE) {
+                if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED))
+                        break;
+
+                /* readahead() only returns once the data has been read, which is what keeps the workers
+                 * busy in parallel. If the file system doesn't support it, let the kernel do it in the
+                 * background and move on. */
+                if (readahead(i->fd, offset, MIN(i->size - offset, (uint64_t) PREFETCH_CHUNK_SIZE)) < 0) {
+                        (void) posix_fadvise(i->fd, offset, 0, POSIX_FADV_WILLNEED);
+                        break;
+                }
+        }
+}
+
+static void* prefetch_thread(void *userdata) {
+        JournalPrefetch *p = userdata;
+
+        assert(p);
+
+        for (;;) {
+                PrefetchItem i;
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                while (!__atomic_load_n(&p->stop, __ATOMIC_RELAXED) && p->next >= MIN(p->n_items, p->limit))
+                        assert_se(pthread_cond_wait(&p->cond, &p->mutex) == 0);
+
+                if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED)) {
+                        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+                        return NULL;
+                }
+
+                i = p->items[p->next++];
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                prefetch_file(p, &i);
+                safe_close(i.fd);
+        }
+}
+
+int journal_prefetch_add(JournalPrefetch *p, JournalFile *f) {
+        _cleanup_close_ int fd = -1;
+        int r = 0;
+
+        assert(p);
+        assert(f);
+
+        /* The reader might close the file any time, hence the workers use their own fd */
+        fd = fcntl(f->fd, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0)
+                return -errno;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        if (!GREEDY_REALLOC(p->items, p->n_items + 1))
+                r = -ENOMEM;
+        else {
+                p->items[p->n_items++] = (PrefetchItem) {
+                        .fd = TAKE_FD(fd),
+                        .size = f->last_stat.st_size,
+                        .head_realtime = le64toh(f->header->head_entry_realtime),
+                        .tail_realtime = le64toh(f->header->tail_entry_realtime),
+                };
+
+                assert_se(pthread_cond_signal(&p->cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return r;
+}
+
+static int prefetch_item_compare(const PrefetchItem *a, const PrefetchItem *b) {
+        return CMP(a->head_realtime, b->head_realtime);
+}
+
+static int prefetch_item_compare_reverse(const PrefetchItem *a, const PrefetchItem *b) {
+        return CMP(b->tail_realtime, a->tail_realtime);
+}
+
+int journal_prefetch_start(JournalPrefetch *p, direction_t direction) {
+        PrefetchItem *pending;
+        sigset_t ss, saved_ss;
+        size_t n;
+        long k;
+        int r;
+
+        assert(p);
+
+        /* Only ever called from the reading thread, hence no need to lock for this check */
+        if (p->started)
+                return 0;
+
+        p->started = true;
+
+        /* Now that we know in which direction the journal is read, prefetch the files in the order in
+         * which the reader will need them, beginning with the first few. */
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        pending = p->items + p->next;
+        if (direction == DIRECTION_DOWN)
+                typesafe_qsort(pending, p->n_items - p->next, prefetch_item_compare);
+        else
+                typesafe_qsort(pending, p->n_items - p->next, prefetch_item_compare_reverse);
+        p->direction = direction;
+        p->limit = p->next + PREFETCH_FILES_AHEAD;
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        k = sysconf(_SC_NPROCESSORS_ONLN);
+        n = k > 0 ? MIN((size_t) k, PREFETCH_THREADS_MAX) : 1;
+
+        assert_se(sigfillset(&ss) >= 0);
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0)
+                return -r;
+
+        for (; p->n_threads < n; p->n_threads++) {
+                r = pthread_create(p->threads + p->n_threads, NULL, prefetch_thread, p);
+                if (r > 0)
+                        break;
+        }
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        if (r > 0)
+                return log_debug_errno(r, "Failed to start prefetch thread, continuing with %zu threads: %m",
+                                       p->n_threads);
+
+        return 0;
+}
+
+void journal_prefetch_advance(JournalPrefetch *p, uint64_t realtime) {
+        size_t reached;
+
+        assert(p);
+
+        /* Called by the reader for each entry it moves to. Only the reader thread adds and sorts items,
+         * hence it may look at them without taking the lock, as long as it doesn't change anything. */
+
+        if (!p->started)
+                return;
+
+        for (reached = p->reached; reached < p->n_items; reached++) {
+                const PrefetchItem *i = p->items + reached;
+
+                if (p->direction == DIRECTION_DOWN ? i->head_realtime > realtime : i->tail_realtime < realtime)
+                        break;
+        }
+
+        if (reached == p->reached)
+                return;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        p->reached = reached;
+        p->limit = reached + PREFETCH_FILES_AHEAD;
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+}
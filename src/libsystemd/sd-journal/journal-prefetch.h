@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <inttypes.h>
+
+#include "journal-file.h"
+#include "macro.h"
+
+/* A small pool of worker threads that read journal files into the page cache ahead of the (single
+ * threaded) reader, so that walking through a directory of many archived files is not bound by waiting
+ * for one file after the other to be faulted in. Only a few files beyond the one the reader is on are read
+ * ahead at any time. */
+
+typedef struct JournalPrefetch JournalPrefetch;
+
+int journal_prefetch_new(JournalPrefetch **ret);
+JournalPrefetch* journal_prefetch_free(JournalPrefetch *p);
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalPrefetch*, journal_prefetch_free);
+
+int journal_prefetch_add(JournalPrefetch *p, JournalFile *f);
+int journal_prefetch_start(JournalPrefetch *p, direction_t direction);
+void journal_prefetch_advance(JournalPrefetch *p, uint64_t realtime);
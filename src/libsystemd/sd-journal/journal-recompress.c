@@ -0,0 +1,299 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "dirent-util.h"
+#include "errno-util.h"
+#include "fd-util.h"
+#include "format-util.h"
+#include "fs-util.h"
+#include "journal-def.h"
+#include "journal-file.h"
+#include "journal-recompress.h"
+#include "memory-util.h"
+#include "missing_fs.h"
+#include "missing_syscall.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "sync-util.h"
+#include "tmpfile-util.h"
+#include "xattr-util.h"
+
+#if HAVE_ZSTD
+static int recompressed_level(int fd) {
+        _cleanup_free_ char *v = NULL;
+        int level;
+
+        if (fgetxattr_malloc(fd, JOURNAL_RECOMPRESS_XATTR, &v) < 0)
+                return 0;
+
+        if (safe_atoi(v, &level) < 0)
+                return 0;
+
+        return level;
+}
+
+static void mark_recompressed(int fd, int level) {
+        char v[DECIMAL_STR_MAX(int)];
+
+        xsprintf(v, "%i", level);
+
+        if (fsetxattr(fd, JOURNAL_RECOMPRESS_XATTR, v, strlen(v), 0) < 0)
+                log_debug_errno(errno, "Failed to mark journal file as recompressed, ignoring: %m");
+}
+
+static void copy_access(int fdf, int fdt, const struct stat *st) {
+        _cleanup_free_ char *acl = NULL;
+        int r;
+
+        assert(st);
+
+        /* Readers of user journals are given access via ACLs, keep them */
+        (void) fchown(fdt, st->st_uid, st->st_gid);
+        (void) fchmod(fdt, st->st_mode & 07777);
+
+        r = fgetxattr_malloc(fdf, "system.posix_acl_access", &acl);
+        if (r > 0 && fsetxattr(fdt, "system.posix_acl_access", acl, r, 0) < 0)
+                log_debug_errno(errno, "Failed to copy ACL of journal file, ignoring: %m");
+}
+
+static int copy_entries(JournalFile *from, JournalFile *to, const volatile bool *cancel) {
+        uint64_t p = 0;
+        int r;
+
+        for (;;) {
+                uint64_t seqnum;
+                Object *o;
+
+                if (cancel && *cancel)
+                        return -ECANCELED;
+
+                r = journal_file_next_entry(from, p, DIRECTION_DOWN, &o, &p);
+                if (r <= 0)
+                        return r;
+
+                /* The entry keeps its sequence number, as cursors and the message index refer to it */
+                seqnum = le64toh(o->entry.seqnum) - 1;
+
+                r = journal_file_copy_entry(from, to, o, p, &seqnum);
+                if (r < 0)
+                        return r;
+        }
+}
+
+static int truncate_tail(JournalFile *f) {
+        uint64_t p, end;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Files are grown in large steps, drop what wasn't used of the last one */
+
+        p = le64toh(f->header->tail_object_offset);
+        if (p == 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_UNUSED, p, &o);
+        if (r < 0)
+                return r;
+
+        end = PAGE_ALIGN(p + ALIGN64(le64toh(READ_NOW(o->object.size))));
+
+        r = journal_file_fstat(f);
+        if (r < 0)
+                return r;
+
+        if (end >= (uint64_t) f->last_stat.st_size)
+                return 0;
+
+        if (ftruncate(f->fd, end) < 0)
+                return -errno;
+
+        f->header->arena_size = htole64(end - le64toh(f->header->header_size));
+
+        return journal_file_fstat(f);
+}
+#endif
+
+int journal_file_recompress(const char *path, int level, const volatile bool *cancel, uint64_t *ret_freed) {
+#if HAVE_ZSTD
+        _cleanup_(journal_file_closep) JournalFile *from = NULL;
+        _cleanup_(unlink_and_freep) char *tmp = NULL;
+        _cleanup_(journal_file_closep) JournalFile *to = NULL;
+        JournalMetrics metrics;
+        struct stat st, new_st;
+        int fd, r;
+
+        assert(path);
+        assert(level != 0);
+
+        /* Returns 1 if the file was replaced by a recompressed copy, 0 if it was left alone, and -EBUSY if
+         * it is not archived yet. */
+
+        r = journal_file_open(-1, path, O_RDONLY, 0, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &from);
+        if (r < 0)
+                return r;
+
+        if (from->header->state != STATE_ARCHIVED)
+                return -EBUSY;
+
+        /* Rewriting would break the seal */
+        if (JOURNAL_HEADER_SEALED(from->header))
+                return 0;
+
+        if (recompressed_level(from->fd) >= level)
+                return 0;
+
+        st = from->last_stat;
+
+        /* Not O_TMPFILE, journal files without a name are considered deleted. The name doesn't end in
+         * ".journal", hence readers don't pick the file up. */
+        r = tempfn_random(path, NULL, &tmp);
+        if (r < 0)
+                return r;
+
+        fd = open(tmp, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0600);
+        if (fd < 0) {
+                tmp = mfree(tmp);
+                return -errno;
+        }
+
+        copy_access(from->fd, fd, &st);
+
+        /* The data hash table is sized from the maximum file size. Nothing is added to the copy after it is
+         * complete, hence size it for the data objects it will contain, like journald would a file that
+         * just fits them. */
+        journal_reset_metrics(&metrics);
+        if (JOURNAL_HEADER_CONTAINS(from->header, n_data))
+                metrics.max_size = le64toh(from->header->n_data) * 768U;
+
+        r = journal_file_open(fd, path, O_RDWR, st.st_mode & 07777, true, UINT64_MAX, false, &metrics,
+                              NULL, NULL, NULL, &to);
+        if (r < 0) {
+                safe_close(fd);
+                return r;
+        }
+
+        /* The copy is only worth anything if it ends up smaller, hence give up as soon as it doesn't */
+        to->metrics.max_size = st.st_size;
+
+        to->compress_level = level;
+        if (JOURNAL_HEADER_ZSTD_DICTIONARY(from->header))
+                (void) journal_file_enable_dictionary(to);
+
+        /* Keyed hashes of the copy are computed with the file ID, hence it must be set before anything
+         * is added */
+        to->header->file_id = from->header->file_id;
+        to->header->machine_id = from->header->machine_id;
+        to->header->seqnum_id = from->header->seqnum_id;
+
+        r = copy_entries(from, to, cancel);
+        if (r >= 0) {
+                /* Files archived before bloom filters were a thing get one now, too */
+                (void) journal_file_append_bloom(to);
+
+                r = truncate_tail(to);
+        }
+        if (r == -E2BIG) {
+                log_debug("Recompressed copy of %s would not be smaller, leaving it as is.", path);
+                mark_recompressed(from->fd, level);
+                return 0;
+        }
+        if (r < 0)
+                return r;
+
+        if (fstat(to->fd, &new_st) < 0)
+                return -errno;
+
+        if (new_st.st_blocks >= st.st_blocks) {
+                log_debug("Recompressed copy of %s is not smaller, leaving it as is.", path);
+                mark_recompressed(from->fd, level);
+                return 0;
+        }
+
+        mark_recompressed(to->fd, level);
+
+        to->archive = true;
+        to = journal_file_close(to);
+
+        /* If the original was vacuumed in the meantime, the copy must not bring it back */
+        if (renameat2(AT_FDCWD, tmp, AT_FDCWD, path, RENAME_EXCHANGE) < 0) {
+                if (errno == ENOENT)
+                        return 0;
+                if (!ERRNO_IS_NOT_SUPPORTED(errno) && errno != EINVAL)
+                        return -errno;
+
+                if (rename(tmp, path) < 0)
+                        return -errno;
+
+                tmp = mfree(tmp);
+        }
+
+        /* The temporary name now refers to the original file, which goes away with it */
+        (void) fsync_directory_of_file(from->fd);
+
+        if (ret_freed)
+                *ret_freed = (uint64_t) (st.st_blocks - new_st.st_blocks) * 512U;
+
+        return 1;
+#else
+        return -EOPNOTSUPP;
+#endif
+}
+
+int journal_directory_recompress(const char *directory, int level, bool verbose) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        uint64_t sum = 0;
+        unsigned n = 0;
+
+        assert(directory);
+
+        d = opendir(directory);
+        if (!d)
+                return -errno;
+
+        FOREACH_DIRENT(de, d, return -errno) {
+                _cleanup_free_ char *p = NULL;
+                uint64_t freed = 0;
+                int r;
+
+                if (!dirent_is_file_with_suffix(de, ".journal"))
+                        continue;
+
+                p = path_join(directory, de->d_name);
+                if (!p)
+                        return -ENOMEM;
+
+                r = journal_file_recompress(p, level, NULL, &freed);
+                if (r == -EOPNOTSUPP)
+                        return r;
+                if (r == -EBUSY) /* Active file */
+                        continue;
+                if (r < 0) {
+                        log_full_errno(verbose ? LOG_WARNING : LOG_DEBUG, r,
+                                       "Failed to recompress %s, ignoring: %m", p);
+                        continue;
+                }
+                if (r == 0)
+                        continue;
+
+                log_full(verbose ? LOG_INFO : LOG_DEBUG, "Recompressed archived journal %s (%s freed).",
+                         p, FORMAT_BYTES(freed));
+
+                sum += freed;
+                n++;
+        }
+
+        log_full(verbose ? LOG_INFO : LOG_DEBUG, "Recompressing done, freed %s in %u archived journals from %s.",
+                 FORMAT_BYTES(sum), n, directory);
+
+        return 0;
+}
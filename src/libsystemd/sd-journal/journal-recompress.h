@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/* Archived journal files are written with the fast compression settings that suit the active file, and are
+ * never modified afterwards. Recompressing rewrites such a file with all its data compressed at a high zstd
+ * level, keeping file ID, sequence numbers and everything else cursors and indexes refer to, and atomically
+ * replaces the original with the result if that is smaller. */
+
+#define JOURNAL_RECOMPRESS_LEVEL 19
+
+/* Stores the level a file was recompressed with, so that it isn't tried again */
+#define JOURNAL_RECOMPRESS_XATTR "user.journal_recompress_level"
+
+int journal_file_recompress(const char *path, int level, const volatile bool *cancel, uint64_t *ret_freed);
+int journal_directory_recompress(const char *directory, int level, bool verbose);
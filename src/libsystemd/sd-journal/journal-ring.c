@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "journal-ring.h"
+#include "memfd-util.h"
+#include "memory-util.h"
+#include "missing_fcntl.h"
+#include "process-util.h"
+
+/* The ring consists of the header, followed by a data area that is a power of two in size, in which
+ * records are placed back to back. 'head' and 'tail' only ever grow, their position in the data area is
+ * taken modulo its size.
+ *
+ * Clients (any thread of the registering process) reserve space for a record by moving 'head' forward
+ * with a compare-and-swap, then copy the message in and finally mark the record as committed. A record
+ * never wraps around the end of the data area, if it doesn't fit anymore the rest of the area is
+ * reserved as padding and the record is placed at the beginning. If there's not enough space the client
+ * sends the message over the socket instead.
+ *
+ * journald reads committed records in order starting at 'tail', copies them out, clears them and moves
+ * 'tail' forward. As all of the space is cleared before it is handed back, a record whose space was
+ * reserved but whose header was not written yet reads as free, rather than as whatever an earlier record
+ * left there. It stops at the first record that is not committed yet. Before going to
+ * sleep it sets 'waiting', and the client that commits the next record clears it and wakes journald up
+ * through the socket that was passed along with the ring.
+ *
+ * journald can't trust anything in the ring, the client may change it any time. Hence it keeps its own
+ * copy of the tail and the size, checks that records stay within the data area, and copies each record
+ * out before parsing it. */
+
+static const uint8_t signature[] = { 'J', 'R', 'N', 'L', 'R', 'I', 'N', 'G' };
+
+enum {
+        RECORD_FREE,
+        RECORD_COMMITTED,
+        RECORD_PADDING,
+};
+
+typedef struct JournalRingRecord {
+        uint32_t size;  /* Size of the payload */
+        uint32_t state;
+        uint8_t payload[];
+} JournalRingRecord;
+
+#define RECORD_ALIGN(l) ALIGN_TO((l), sizeof(uint64_t))
+
+int journal_ring_new(int *ret_fd, JournalRing **ret) {
+        _cleanup_(journal_ring_freep) JournalRing *ring = NULL;
+        _cleanup_close_ int fd = -1;
+        void *p;
+        int r;
+
+        assert(ret_fd);
+        assert(ret);
+
+        fd = memfd_new("journal-ring");
+        if (fd < 0)
+                return fd;
+
+        r = memfd_set_size(fd, JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_DATA_SIZE);
+        if (r < 0)
+                return r;
+
+        /* journald maps the ring too, make sure we can't make it go SIGBUS by truncating the file */
+        if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+                return -errno;
+
+        p = mmap(NULL, JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_DATA_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+                return -errno;
+
+        /* Child processes must not write to the ring, journald attributes everything in it to us */
+        if (madvise(p, JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_DATA_SIZE, MADV_DONTFORK) < 0) {
+                r = -errno;
+                (void) munmap(p, JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_DATA_SIZE);
+                return r;
+        }
+
+        ring = new(JournalRing, 1);
+        if (!ring) {
+                (void) munmap(p, JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_DATA_SIZE);
+                return -ENOMEM;
+        }
+
+        *ring = (JournalRing) {
+                .header = p,
+                .data = (uint8_t*) p + JOURNAL_RING_HEADER_SIZE,
+                .data_size = JOURNAL_RING_DATA_SIZE,
+                .wakeup_fd = -1,
+                .pid = getpid_cached(),
+        };
+
+        memcpy(ring->header->signature, signature, sizeof(signature));
+        ring->header->data_size = JOURNAL_RING_DATA_SIZE;
+
+        *ret_fd = TAKE_FD(fd);
+        *ret = TAKE_PTR(ring);
+        return 0;
+}
+
+int journal_ring_map(int fd, JournalRing **ret) {
+        JournalRingHeader header;
+        struct stat st;
+        JournalRing *r;
+        int seals;
+        void *p;
+
+        assert(fd >= 0);
+        assert(ret);
+
+        /* Only memfds that can't shrink anymore, otherwise the client could make us SIGBUS */
+        seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0)
+                return -errno;
+        if ((seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) != (F_SEAL_SHRINK | F_SEAL_SEAL))
+                return -EPERM;
+        if (seals & F_SEAL_WRITE)
+                return -EBADF;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+        if (!S_ISREG(st.st_mode))
+                return -EBADFD;
+
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+                return -EBADMSG;
+
+        if (memcmp(header.signature, signature, sizeof(signature)) != 0)
+                return -EBADMSG;
+
+        if (header.data_size < JOURNAL_RING_DATA_SIZE_MIN ||
+            header.data_size > JOURNAL_RING_DATA_SIZE_MAX ||
+            (header.data_size & (header.data_size - 1)) != 0 ||
+            (uint64_t) st.st_size < JOURNAL_RING_HEADER_SIZE + header.data_size)
+                return -EBADMSG;
+
+        p = mmap(NULL, JOURNAL_RING_HEADER_SIZE + header.data_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+                return -errno;
+
+        r = new(JournalRing, 1);
+        if (!r) {
+                (void) munmap(p, JOURNAL_RING_HEADER_SIZE + header.data_size);
+                return -ENOMEM;
+        }
+
+        *r = (JournalRing) {
+                .header = p,
+                .data = (uint8_t*) p + JOURNAL_RING_HEADER_SIZE,
+                .data_size = header.data_size,
+                .tail = __atomic_load_n(&((JournalRingHeader*) p)->tail, __ATOMIC_ACQUIRE),
+                .wakeup_fd = -1,
+        };
+
+        *ret = r;
+        return 0;
+}
+
+JournalRing* journal_ring_free(JournalRing *r) {
+        if (!r)
+                return NULL;
+
+        if (r->header)
+                (void) munmap(r->header, JOURNAL_RING_HEADER_SIZE + r->data_size);
+
+        safe_close(r->wakeup_fd);
+
+        return mfree(r);
+}
+
+JournalRingState journal_ring_get_state(JournalRing *r) {
+        assert(r);
+
+        return __atomic_load_n(&r->header->state, __ATOMIC_ACQUIRE);
+}
+
+void journal_ring_set_state(JournalRing *r, JournalRingState state) {
+        assert(r);
+
+        __atomic_store_n(&r->header->state, state, __ATOMIC_RELEASE);
+}
+
+int journal_ring_write(JournalRing *r, const struct iovec *iovec, size_t n_iovec) {
+        JournalRingHeader *h;
+        JournalRingRecord *record;
+        uint64_t head, tail, pos, skip, need;
+        size_t size = 0;
+        uint8_t *q;
+
+        assert(r);
+        assert(iovec || n_iovec == 0);
+
+        /* Returns > 0 if journald needs to be woken up, 0 if not, -E2BIG if the message is too large for
+         * the ring and -ENOBUFS if there's currently no space for it. */
+
+        h = r->header;
+
+        for (size_t i = 0; i < n_iovec; i++)
+                size += iovec[i].iov_len;
+
+        /* Don't let a single message take up a good part of the ring */
+        if (size > r->data_size / 8)
+                return -E2BIG;
+
+        need = RECORD_ALIGN(sizeof(JournalRingRecord) + size);
+
+        head = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+        do {
+                tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+
+                pos = head & (r->data_size - 1);
+                skip = pos + need > r->data_size ? r->data_size - pos : 0;
+
+                if (head + skip + need - tail > r->data_size)
+                        return -ENOBUFS;
+
+        } while (!__atomic_compare_exchange_n(&h->head, &head, head + skip + need, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+        if (skip > 0) {
+                record = (JournalRingRecord*) (r->data + pos);
+                record->size = skip - sizeof(JournalRingRecord);
+                __atomic_store_n(&record->state, RECORD_PADDING, __ATOMIC_RELEASE);
+
+                pos = 0;
+        }
+
+        record = (JournalRingRecord*) (r->data + pos);
+        record->size = size;
+
+        q = record->payload;
+        for (size_t i = 0; i < n_iovec; i++)
+                q = mempcpy(q, iovec[i].iov_base, iovec[i].iov_len);
+
+        /* This pairs with journald setting 'waiting' and then checking for committed records in
+         * journal_ring_wait(): either it sees this record, or we see that it's waiting. */
+        __atomic_store_n(&record->state, RECORD_COMMITTED, __ATOMIC_SEQ_CST);
+
+        return __atomic_load_n(&h->waiting, __ATOMIC_SEQ_CST) &&
+                __atomic_exchange_n(&h->waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+static JournalRingRecord* ring_next_record(JournalRing *r, uint64_t *ret_head) {
+        uint64_t head;
+
+        assert(r);
+        assert(ret_head);
+
+        /* Sequentially consistent, so that journal_ring_wait() can't see an old head after setting
+         * 'waiting' */
+        head = __atomic_load_n(&r->header->head, __ATOMIC_SEQ_CST);
+        *ret_head = head;
+
+        if (head == r->tail || head - r->tail > r->data_size)
+                return NULL;
+
+        return (JournalRingRecord*) (r->data + (r->tail & (r->data_size - 1)));
+}
+
+int journal_ring_read(JournalRing *r, char **buffer, size_t *ret_size) {
+        assert(r);
+        assert(buffer);
+        assert(ret_size);
+
+        /* Copies the next record into the buffer, followed by a NUL byte. Returns > 0 if there was one,
+         * 0 if there's nothing to read right now, and -EBADMSG if the ring doesn't make sense. */
+
+        for (;;) {
+                JournalRingRecord *record;
+                uint64_t head, pos, need;
+                uint32_t state, size;
+
+                record = ring_next_record(r, &head);
+                if (!record)
+                        return head == r->tail ? 0 : -EBADMSG;
+
+                state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+                if (state == RECORD_FREE)
+                        return 0;
+
+                size = __atomic_load_n(&record->size, __ATOMIC_RELAXED);
+                pos = r->tail & (r->data_size - 1);
+
+                if (state == RECORD_PADDING) {
+                        /* Padding always fills up the rest of the data area */
+                        need = (uint64_t) sizeof(JournalRingRecord) + size;
+                        if (pos + need != r->data_size)
+                                return -EBADMSG;
+                } else if (state == RECORD_COMMITTED) {
+                        need = RECORD_ALIGN((uint64_t) sizeof(JournalRingRecord) + size);
+                        if (pos + need > r->data_size)
+                                return -EBADMSG;
+                } else
+                        return -EBADMSG;
+
+                if (head - r->tail < need)
+                        return -EBADMSG;
+
+                if (state == RECORD_COMMITTED) {
+                        if (!GREEDY_REALLOC(*buffer, (size_t) size + 1))
+                                return -ENOMEM;
+
+                        memcpy(*buffer, record->payload, size);
+                        (*buffer)[size] = 0;
+                }
+
+                /* Hand the space back to the clients */
+                memzero(record, need);
+                r->tail += need;
+                __atomic_store_n(&r->header->tail, r->tail, __ATOMIC_RELEASE);
+
+                if (state == RECORD_COMMITTED) {
+                        *ret_size = size;
+                        return 1;
+                }
+        }
+}
+
+bool journal_ring_wait(JournalRing *r) {
+        JournalRingRecord *record;
+        uint64_t head;
+
+        assert(r);
+
+        /* Asks clients to wake us up for the next record. Returns false if a record came in in the
+         * meantime, and we should rather go on reading. */
+
+        __atomic_store_n(&r->header->waiting, 1, __ATOMIC_SEQ_CST);
+
+        record = ring_next_record(r, &head);
+        if (!record || __atomic_load_n(&record->state, __ATOMIC_SEQ_CST) == RECORD_FREE)
+                return true;
+
+        __atomic_store_n(&r->header->waiting, 0, __ATOMIC_RELAXED);
+        return false;
+}
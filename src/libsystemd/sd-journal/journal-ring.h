@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "macro.h"
+
+/* A ring buffer in a memfd shared between a client and journald, through which the client passes native
+ * protocol messages without a syscall per message. See journal-ring.c for how it works. */
+
+#define JOURNAL_RING_HEADER_SIZE 4096U
+#define JOURNAL_RING_DATA_SIZE (1024U * 1024U)
+#define JOURNAL_RING_DATA_SIZE_MIN (64U * 1024U)
+#define JOURNAL_RING_DATA_SIZE_MAX (16U * 1024U * 1024U)
+
+typedef enum JournalRingState {
+        JOURNAL_RING_NEW,    /* Registered by the client, but not picked up by journald yet */
+        JOURNAL_RING_ACTIVE, /* Being read by journald */
+        JOURNAL_RING_CLOSED, /* Not read anymore, journald went away or refused the ring */
+} JournalRingState;
+
+typedef struct JournalRingHeader {
+        uint8_t signature[8];
+        uint64_t data_size;
+        uint32_t state;
+        uint8_t reserved0[44];
+
+        /* Written by the clients: up to where space has been reserved for records */
+        uint64_t head;
+        uint8_t reserved1[56];
+
+        /* Written by journald: up to where records have been read, and whether it needs to be woken up
+         * for new records */
+        uint64_t tail;
+        uint32_t waiting;
+        uint8_t reserved2[52];
+} JournalRingHeader;
+
+assert_cc(sizeof(JournalRingHeader) == 192);
+assert_cc(sizeof(JournalRingHeader) <= JOURNAL_RING_HEADER_SIZE);
+
+typedef struct JournalRing {
+        JournalRingHeader *header;
+        uint8_t *data;
+        uint64_t data_size;
+
+        /* journald's own idea of the tail, the one in the header can be changed by the client */
+        uint64_t tail;
+
+        /* The socket through which journald is woken up, owned by the ring */
+        int wakeup_fd;
+
+        /* Client side: the process that registered the ring */
+        pid_t pid;
+} JournalRing;
+
+int journal_ring_new(int *ret_fd, JournalRing **ret);
+int journal_ring_map(int fd, JournalRing **ret);
+JournalRing* journal_ring_free(JournalRing *r);
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalRing*, journal_ring_free);
+
+JournalRingState journal_ring_get_state(JournalRing *r);
+void journal_ring_set_state(JournalRing *r, JournalRingState state);
+
+int journal_ring_write(JournalRing *r, const struct iovec *iovec, size_t n_iovec);
+int journal_ring_read(JournalRing *r, char **buffer, size_t *ret_size);
+bool journal_ring_wait(JournalRing *r);
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <printf.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -12,11 +13,14 @@
 #include "sd-journal.h"
 
 #include "alloc-util.h"
+#include "env-util.h"
 #include "errno-util.h"
 #include "fd-util.h"
 #include "io-util.h"
 #include "fileio.h"
+#include "journal-ring.h"
 #include "memfd-util.h"
+#include "process-util.h"
 #include "socket-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
@@ -62,6 +66,135 @@ retry:
         return fd;
 }
 
+/* With $SYSTEMD_JOURNAL_RING=1 the first message registers a ring buffer with journald, and once journald
+ * picked it up messages are passed through it rather than the socket. Like the socket, the ring is shared
+ * by all threads. It's never unregistered, journald notices when we are gone. Child processes don't
+ * inherit it, they register their own. */
+
+static JournalRing *journal_ring = NULL;
+static bool journal_ring_registered = false;
+
+static void journal_ring_forget(void) {
+        JournalRing *ring;
+
+        /* Invoked in the child after fork(). The mapping is not inherited (MADV_DONTFORK), hence don't
+         * touch it, but close our copy of the wakeup socket, so that journald notices when the parent
+         * is gone. */
+
+        ring = TAKE_PTR(journal_ring);
+        if (!ring)
+                return;
+
+        ring->header = NULL;
+        ring->data = NULL;
+        journal_ring_free(ring);
+
+        journal_ring_registered = false;
+}
+
+static int journal_ring_register(int fd, const struct msghdr *mh) {
+        static bool atfork_installed = false;
+        _cleanup_(journal_ring_freep) JournalRing *ring = NULL;
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        _cleanup_close_ int memfd = -1;
+        CMSG_BUFFER_TYPE(CMSG_SPACE(sizeof(int) * 2)) control = {};
+        struct msghdr registration = {
+                .msg_name = mh->msg_name,
+                .msg_namelen = mh->msg_namelen,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+        int r;
+
+        /* The handler is inherited by child processes, install it only once */
+        if (!atfork_installed) {
+                r = pthread_atfork(NULL, NULL, journal_ring_forget);
+                if (r != 0)
+                        return -r;
+
+                atfork_installed = true;
+        }
+
+        r = journal_ring_new(&memfd, &ring);
+        if (r < 0)
+                return r;
+
+        /* journald is woken up through this socket, and notices that we exited when it is closed */
+        if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0, pair) < 0)
+                return -errno;
+
+        cmsg = CMSG_FIRSTHDR(&registration);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 2);
+        memcpy(CMSG_DATA(cmsg), (const int[]) { memfd, pair[1] }, sizeof(int) * 2);
+
+        /* An empty datagram with two fds is a ring registration */
+        if (sendmsg(fd, &registration, MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        ring->wakeup_fd = TAKE_FD(pair[0]);
+        __atomic_store_n(&journal_ring, TAKE_PTR(ring), __ATOMIC_RELEASE);
+
+        return 0;
+}
+
+static JournalRing* journal_ring_get(int fd, const struct msghdr *mh) {
+        static int enabled = -1;
+        JournalRing *ring;
+
+        ring = __atomic_load_n(&journal_ring, __ATOMIC_ACQUIRE);
+        if (ring) {
+                /* If we got here through a raw clone() the fork handler didn't run, and the ring isn't
+                 * mapped in this process */
+                if (ring->pid != getpid_cached())
+                        return NULL;
+
+                /* Until journald picked up the ring, or after it went away, use the socket */
+                if (journal_ring_get_state(ring) != JOURNAL_RING_ACTIVE)
+                        return NULL;
+
+                return ring;
+        }
+
+        if (enabled < 0)
+                enabled = getenv_bool_secure("SYSTEMD_JOURNAL_RING") > 0;
+        if (!enabled)
+                return NULL;
+
+        /* Only try once, whoever gets here first */
+        if (!__sync_bool_compare_and_swap(&journal_ring_registered, false, true))
+                return NULL;
+
+        (void) journal_ring_register(fd, mh);
+
+        return NULL;
+}
+
+static int journal_ring_send(int fd, const struct msghdr *mh) {
+        JournalRing *ring;
+        int r;
+
+        ring = journal_ring_get(fd, mh);
+        if (!ring)
+                return -ENOTCONN;
+
+        r = journal_ring_write(ring, mh->msg_iov, mh->msg_iovlen);
+        if (r <= 0)
+                return r;
+
+        /* journald went to sleep, wake it up. If the socket is full, it's going to look anyway. */
+        if (send(ring->wakeup_fd, "", 1, MSG_DONTWAIT|MSG_NOSIGNAL) < 0 && errno != EAGAIN) {
+                /* journald is gone without closing the ring properly, nobody is going to read the
+                 * message. Stop using the ring, and let the caller send it over the socket again. */
+                journal_ring_set_state(ring, JOURNAL_RING_CLOSED);
+                return -errno;
+        }
+
+        return 0;
+}
+
 _public_ int sd_journal_print(int priority, const char *format, ...) {
         int r;
         va_list ap;
@@ -288,6 +421,9 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         mh.msg_iov = w;
         mh.msg_iovlen = j;
 
+        if (journal_ring_send(fd, &mh) >= 0)
+                return 0;
+
         k = sendmsg(fd, &mh, MSG_NOSIGNAL);
         if (k >= 0)
                 return 0;
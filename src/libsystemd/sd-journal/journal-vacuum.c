@@ -7,30 +7,86 @@
 #include "sd-id128.h"
 
 #include "alloc-util.h"
+#include "hashmap.h"
 #include "dirent-util.h"
 #include "fd-util.h"
 #include "format-util.h"
 #include "fs-util.h"
 #include "journal-def.h"
 #include "journal-file.h"
+#include "journal-index.h"
 #include "journal-vacuum.h"
-#include "sort-util.h"
+#include "prioq.h"
+#include "stat-util.h"
 #include "string-util.h"
 #include "time-util.h"
 #include "xattr-util.h"
 
-struct vacuum_info {
-        uint64_t usage;
+/* How often the directory is read again even if it looks unchanged, so that changes that raced with our own
+ * are picked up eventually */
+#define VACUUM_INDEX_RESCAN_USEC (1 * USEC_PER_HOUR)
+
+typedef struct JournalVacuumFile {
         char *filename;
+        uint64_t usage;
+        bool archived;
 
+        /* Only set for archived and disposed files */
         uint64_t realtime;
-
         sd_id128_t seqnum_id;
         uint64_t seqnum;
         bool have_seqnum;
+        unsigned prioq_idx;
+} JournalVacuumFile;
+
+struct JournalVacuumIndex {
+        char *directory;
+
+        /* All journal files in the directory by name, the archived ones also ordered by age */
+        Hashmap *files;
+        Prioq *archived;
+
+        uint64_t archived_usage;
+        uint64_t active_usage;
+        uint64_t n_active;
+
+        /* The directory as we saw it after the last change we know about */
+        struct stat dir_stat;
+        usec_t scan_usec;
 };
 
-static int vacuum_compare(const struct vacuum_info *a, const struct vacuum_info *b) {
+static JournalVacuumFile* vacuum_file_free(JournalVacuumFile *f) {
+        if (!f)
+                return NULL;
+
+        free(f->filename);
+        return mfree(f);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalVacuumFile*, vacuum_file_free);
+
+DEFINE_PRIVATE_HASH_OPS_WITH_VALUE_DESTRUCTOR(vacuum_file_hash_ops, char, string_hash_func, string_compare_func,
+                                              JournalVacuumFile, vacuum_file_free);
+
+typedef enum VacuumFileType {
+        VACUUM_FILE_ACTIVE,
+        VACUUM_FILE_ARCHIVED,
+        VACUUM_FILE_DISPOSED,
+        VACUUM_FILE_INDEX,
+        VACUUM_FILE_OTHER,
+} VacuumFileType;
+
+static void unlink_index(int dfd, const char *fn) {
+        const char *i;
+
+        /* Remove the substring index that might have been written next to an archived journal file */
+        i = strjoina(fn, JOURNAL_INDEX_SUFFIX);
+        if (unlinkat(dfd, i, 0) < 0 && errno != ENOENT)
+                log_debug_errno(errno, "Failed to remove journal index %s, ignoring: %m", i);
+}
+
+static int vacuum_compare(const void *_a, const void *_b) {
+        const JournalVacuumFile *a = _a, *b = _b;
         int r;
 
         if (a->have_seqnum && b->have_seqnum &&
@@ -51,7 +107,7 @@ static void patch_realtime(
                 int fd,
                 const char *fn,
                 const struct stat *st,
-                unsigned long long *realtime) {
+                uint64_t *realtime) {
 
         usec_t x;
 
@@ -114,207 +170,490 @@ static int journal_file_empty(int dir_fd, const char *name) {
         return le64toh(n_entries) <= 0;
 }
 
-int journal_directory_vacuum(
-                const char *directory,
-                uint64_t max_use,
-                uint64_t n_max_files,
-                usec_t max_retention_usec,
-                usec_t *oldest_usec,
-                bool verbose) {
 
-        uint64_t sum = 0, freed = 0, n_active_files = 0;
-        size_t n_list = 0, i;
-        _cleanup_closedir_ DIR *d = NULL;
-        struct vacuum_info *list = NULL;
-        usec_t retention_limit = 0;
-        struct dirent *de;
-        int r;
+static VacuumFileType vacuum_file_type(
+                const char *name,
+                uint64_t *ret_realtime,
+                sd_id128_t *ret_seqnum_id,
+                uint64_t *ret_seqnum) {
 
-        assert(directory);
+        unsigned long long seqnum, realtime, tmp;
+        char id[SD_ID128_STRING_MAX];
+        size_t q;
 
-        if (max_use <= 0 && max_retention_usec <= 0 && n_max_files <= 0)
-                return 0;
+        assert(name);
+        assert(ret_realtime);
+        assert(ret_seqnum_id);
+        assert(ret_seqnum);
 
-        if (max_retention_usec > 0)
-                retention_limit = usec_sub_unsigned(now(CLOCK_REALTIME), max_retention_usec);
+        q = strlen(name);
 
-        d = opendir(directory);
-        if (!d)
-                return -errno;
+        if (endswith(name, ".journal")) {
 
-        FOREACH_DIRENT_ALL(de, d, r = -errno; goto finish) {
-                unsigned long long seqnum = 0, realtime;
-                _cleanup_free_ char *p = NULL;
-                sd_id128_t seqnum_id;
-                bool have_seqnum;
-                uint64_t size;
-                struct stat st;
-                size_t q;
-
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
-                        log_debug_errno(errno, "Failed to stat file %s while vacuuming, ignoring: %m", de->d_name);
-                        continue;
-                }
+                /* Archived files are named <prefix>@<seqnum_id>-<seqnum>-<realtime>.journal, everything else
+                 * is an active file, which is left around */
 
-                if (!S_ISREG(st.st_mode))
-                        continue;
+                if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
+                        return VACUUM_FILE_ACTIVE;
 
-                q = strlen(de->d_name);
+                if (name[q-8-16-1] != '-' ||
+                    name[q-8-16-1-16-1] != '-' ||
+                    name[q-8-16-1-16-1-32-1] != '@')
+                        return VACUUM_FILE_ACTIVE;
 
-                if (endswith(de->d_name, ".journal")) {
+                memcpy(id, name + q-8-16-1-16-1-32, 32);
+                id[32] = 0;
+                if (sd_id128_from_string(id, ret_seqnum_id) < 0)
+                        return VACUUM_FILE_ACTIVE;
 
-                        /* Vacuum archived files. Active files are
-                         * left around */
+                if (sscanf(name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2)
+                        return VACUUM_FILE_ACTIVE;
 
-                        if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8) {
-                                n_active_files++;
-                                continue;
-                        }
+                *ret_seqnum = seqnum;
+                *ret_realtime = realtime;
+                return VACUUM_FILE_ARCHIVED;
+        }
 
-                        if (de->d_name[q-8-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1-32-1] != '@') {
-                                n_active_files++;
-                                continue;
-                        }
+        if (endswith(name, ".journal~")) {
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                /* Corrupted files, named <prefix>@<realtime>-<random>.journal~ */
 
-                        de->d_name[q-8-16-1-16-1] = 0;
-                        if (sd_id128_from_string(de->d_name + q-8-16-1-16-1-32, &seqnum_id) < 0) {
-                                n_active_files++;
-                                continue;
-                        }
+                if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                        return VACUUM_FILE_ACTIVE;
 
-                        if (sscanf(de->d_name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2) {
-                                n_active_files++;
-                                continue;
-                        }
+                if (name[q-1-8-16-1] != '-' ||
+                    name[q-1-8-16-1-16-1] != '@')
+                        return VACUUM_FILE_ACTIVE;
 
-                        have_seqnum = true;
+                if (sscanf(name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2)
+                        return VACUUM_FILE_ACTIVE;
 
-                } else if (endswith(de->d_name, ".journal~")) {
-                        unsigned long long tmp;
+                *ret_seqnum_id = SD_ID128_NULL;
+                *ret_seqnum = 0;
+                *ret_realtime = realtime;
+                return VACUUM_FILE_DISPOSED;
+        }
 
-                        /* seqnum_id won't be initialised before use below, so set to 0 */
-                        seqnum_id = SD_ID128_NULL;
+        if (endswith(name, ".journal" JOURNAL_INDEX_SUFFIX))
+                return VACUUM_FILE_INDEX;
 
-                        /* Vacuum corrupted files */
+        return VACUUM_FILE_OTHER;
+}
 
-                        if (q < 1 + 16 + 1 + 16 + 8 + 1) {
-                                n_active_files++;
-                                continue;
-                        }
+static void vacuum_index_drop(JournalVacuumIndex *idx, JournalVacuumFile *f) {
+        assert(idx);
 
-                        if (de->d_name[q-1-8-16-1] != '-' ||
-                            de->d_name[q-1-8-16-1-16-1] != '@') {
-                                n_active_files++;
-                                continue;
-                        }
+        if (!f)
+                return;
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        assert_se(hashmap_remove(idx->files, f->filename) == f);
 
-                        if (sscanf(de->d_name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2) {
-                                n_active_files++;
-                                continue;
-                        }
+        if (f->archived) {
+                assert_se(prioq_remove(idx->archived, f, &f->prioq_idx) > 0);
+                idx->archived_usage = LESS_BY(idx->archived_usage, f->usage);
+        } else {
+                idx->active_usage = LESS_BY(idx->active_usage, f->usage);
+                idx->n_active--;
+        }
 
-                        have_seqnum = false;
-                } else {
-                        /* We do not vacuum unknown files! */
-                        log_debug("Not vacuuming unknown file %s.", de->d_name);
-                        continue;
+        vacuum_file_free(f);
+}
+
+static void vacuum_index_clear(JournalVacuumIndex *idx) {
+        assert(idx);
+
+        idx->archived = prioq_free(idx->archived);
+        idx->files = hashmap_free(idx->files);
+
+        idx->archived_usage = idx->active_usage = idx->n_active = 0;
+        idx->scan_usec = 0;
+}
+
+static int vacuum_index_put(
+                JournalVacuumIndex *idx,
+                int dir_fd,
+                const char *name,
+                bool verbose,
+                uint64_t *freed) {
+
+        _cleanup_(vacuum_file_freep) JournalVacuumFile *f = NULL;
+        sd_id128_t seqnum_id = SD_ID128_NULL;
+        uint64_t seqnum = 0, realtime = 0, size;
+        VacuumFileType type;
+        struct stat st;
+        int r;
+
+        assert(idx);
+        assert(dir_fd >= 0);
+        assert(name);
+        assert(freed);
+
+        /* Forget what we knew about the file, it might have changed or be gone */
+        vacuum_index_drop(idx, hashmap_get(idx->files, name));
+
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                if (errno != ENOENT)
+                        log_debug_errno(errno, "Failed to stat file %s while vacuuming, ignoring: %m", name);
+                return 0;
+        }
+
+        if (!S_ISREG(st.st_mode))
+                return 0;
+
+        size = 512UL * (uint64_t) st.st_blocks;
+
+        type = vacuum_file_type(name, &realtime, &seqnum_id, &seqnum);
+        switch (type) {
+
+        case VACUUM_FILE_INDEX:
+                /* Remove indexes whose journal file is gone, they are useless. */
+                if (faccessat(dir_fd, strndupa(name, strlen(name) - STRLEN(JOURNAL_INDEX_SUFFIX)), F_OK, AT_SYMLINK_NOFOLLOW) < 0 &&
+                    errno == ENOENT &&
+                    unlinkat(dir_fd, name, 0) >= 0) {
+                        log_full(verbose ? LOG_INFO : LOG_DEBUG,
+                                 "Deleted orphaned journal index %s/%s (%s).", idx->directory, name, FORMAT_BYTES(size));
+                        *freed += size;
                 }
 
-                size = 512UL * (uint64_t) st.st_blocks;
+                return 0;
+
+        case VACUUM_FILE_OTHER:
+                /* We do not vacuum unknown files! */
+                log_debug("Not vacuuming unknown file %s.", name);
+                return 0;
 
-                r = journal_file_empty(dirfd(d), p);
+        case VACUUM_FILE_ARCHIVED:
+        case VACUUM_FILE_DISPOSED:
+                r = journal_file_empty(dir_fd, name);
                 if (r < 0) {
-                        log_debug_errno(r, "Failed check if %s is empty, ignoring: %m", p);
-                        continue;
+                        log_debug_errno(r, "Failed check if %s is empty, ignoring: %m", name);
+                        return 0;
                 }
                 if (r > 0) {
                         /* Always vacuum empty non-online files. */
 
-                        r = unlinkat_deallocate(dirfd(d), p, 0);
+                        r = unlinkat_deallocate(dir_fd, name, 0);
                         if (r >= 0) {
+                                unlink_index(dir_fd, name);
 
                                 log_full(verbose ? LOG_INFO : LOG_DEBUG,
-                                         "Deleted empty archived journal %s/%s (%s).", directory, p, FORMAT_BYTES(size));
+                                         "Deleted empty archived journal %s/%s (%s).", idx->directory, name, FORMAT_BYTES(size));
 
-                                freed += size;
+                                *freed += size;
                         } else if (r != -ENOENT)
-                                log_warning_errno(r, "Failed to delete empty archived journal %s/%s: %m", directory, p);
+                                log_warning_errno(r, "Failed to delete empty archived journal %s/%s: %m", idx->directory, name);
 
-                        continue;
+                        return 0;
                 }
 
-                patch_realtime(dirfd(d), p, &st, &realtime);
+                patch_realtime(dir_fd, name, &st, &realtime);
+                break;
+
+        default:
+                break;
+        }
 
-                if (!GREEDY_REALLOC(list, n_list + 1)) {
-                        r = -ENOMEM;
-                        goto finish;
+        f = new(JournalVacuumFile, 1);
+        if (!f)
+                return -ENOMEM;
+
+        *f = (JournalVacuumFile) {
+                .filename = strdup(name),
+                .usage = size,
+                .archived = type != VACUUM_FILE_ACTIVE,
+                .realtime = realtime,
+                .seqnum_id = seqnum_id,
+                .seqnum = seqnum,
+                .have_seqnum = type == VACUUM_FILE_ARCHIVED,
+                .prioq_idx = PRIOQ_IDX_NULL,
+        };
+        if (!f->filename)
+                return -ENOMEM;
+
+        r = hashmap_ensure_put(&idx->files, &vacuum_file_hash_ops, f->filename, f);
+        if (r < 0)
+                return r;
+
+        if (f->archived) {
+                r = prioq_ensure_put(&idx->archived, vacuum_compare, f, &f->prioq_idx);
+                if (r < 0) {
+                        (void) hashmap_remove(idx->files, f->filename);
+                        return r;
                 }
 
-                list[n_list++] = (struct vacuum_info) {
-                        .filename = TAKE_PTR(p),
-                        .usage = size,
-                        .seqnum = seqnum,
-                        .realtime = realtime,
-                        .seqnum_id = seqnum_id,
-                        .have_seqnum = have_seqnum,
-                };
+                idx->archived_usage += size;
+        } else {
+                idx->active_usage += size;
+                idx->n_active++;
+        }
+
+        TAKE_PTR(f);
+        return 1;
+}
+
+static int vacuum_index_scan(JournalVacuumIndex *idx, bool verbose, uint64_t *freed) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r;
+
+        assert(idx);
+        assert(freed);
+
+        vacuum_index_clear(idx);
+
+        d = opendir(idx->directory);
+        if (!d)
+                return -errno;
+
+        FOREACH_DIRENT_ALL(de, d, return -errno) {
+                r = vacuum_index_put(idx, dirfd(d), de->d_name, verbose, freed);
+                if (r < 0)
+                        return r;
+        }
+
+        if (fstat(dirfd(d), &idx->dir_stat) < 0)
+                return -errno;
+
+        idx->scan_usec = now(CLOCK_MONOTONIC);
+
+        log_debug("Read %u archived and %" PRIu64 " active journal files from %s.",
+                  prioq_size(idx->archived), idx->n_active, idx->directory);
+
+        return 1;
+}
+
+static int vacuum_index_refresh(JournalVacuumIndex *idx, bool verbose, uint64_t *freed) {
+        struct stat st;
+
+        assert(idx);
+
+        /* Only read the whole directory if somebody else changed it since we last looked */
+
+        if (stat(idx->directory, &st) < 0) {
+                vacuum_index_clear(idx);
+                return -errno;
+        }
+
+        if (idx->scan_usec > 0 &&
+            stat_inode_unmodified(&st, &idx->dir_stat) &&
+            usec_add(idx->scan_usec, VACUUM_INDEX_RESCAN_USEC) > now(CLOCK_MONOTONIC))
+                return 0;
+
+        return vacuum_index_scan(idx, verbose, freed);
+}
+
+static void vacuum_index_restamp(JournalVacuumIndex *idx, int dir_fd) {
+        assert(idx);
+        assert(dir_fd >= 0);
+
+        /* We changed the directory ourselves and know about the change, hence remember what it looks like
+         * now. If that fails, read it once more next time. */
+
+        if (fstat(dir_fd, &idx->dir_stat) < 0)
+                idx->scan_usec = 0;
+}
+
+int journal_vacuum_index_new(const char *directory, JournalVacuumIndex **ret) {
+        _cleanup_(journal_vacuum_index_freep) JournalVacuumIndex *idx = NULL;
+
+        assert(directory);
+        assert(ret);
+
+        idx = new0(JournalVacuumIndex, 1);
+        if (!idx)
+                return -ENOMEM;
+
+        idx->directory = strdup(directory);
+        if (!idx->directory)
+                return -ENOMEM;
+
+        *ret = TAKE_PTR(idx);
+        return 0;
+}
+
+JournalVacuumIndex* journal_vacuum_index_free(JournalVacuumIndex *idx) {
+        if (!idx)
+                return NULL;
+
+        vacuum_index_clear(idx);
+        free(idx->directory);
+
+        return mfree(idx);
+}
+
+int journal_vacuum_index_refresh(JournalVacuumIndex *idx) {
+        uint64_t freed = 0;
+
+        assert(idx);
+
+        return vacuum_index_refresh(idx, false, &freed);
+}
+
+int journal_vacuum_index_update(JournalVacuumIndex *idx, const char *filename) {
+        _cleanup_close_ int fd = -1;
+        uint64_t freed = 0;
+        int r;
+
+        assert(idx);
+        assert(filename);
+
+        /* Picks up a file in the directory that we just created, archived or removed, without reading
+         * the whole directory again. */
+
+        if (idx->scan_usec == 0)
+                return 0;
+
+        fd = open(idx->directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0) {
+                vacuum_index_clear(idx);
+                return -errno;
+        }
 
-                sum += size;
+        r = vacuum_index_put(idx, fd, filename, false, &freed);
+        if (r < 0) {
+                idx->scan_usec = 0;
+                return r;
         }
 
-        typesafe_qsort(list, n_list, vacuum_compare);
+        vacuum_index_restamp(idx, fd);
+        return r;
+}
+
+void journal_vacuum_index_set_usage(JournalVacuumIndex *idx, const char *filename, uint64_t usage) {
+        JournalVacuumFile *f;
+
+        assert(idx);
+        assert(filename);
+
+        /* Active files grow all the time. The caller tells us the current size of those it has open, so
+         * that they don't need to be stat()ed. Files we don't know yet are found when the directory is
+         * read again. */
+
+        f = hashmap_get(idx->files, filename);
+        if (!f || f->archived)
+                return;
+
+        idx->active_usage = LESS_BY(idx->active_usage, f->usage) + usage;
+        f->usage = usage;
+}
+
+uint64_t journal_vacuum_index_usage(JournalVacuumIndex *idx) {
+        assert(idx);
 
-        for (i = 0; i < n_list; i++) {
+        return idx->archived_usage + idx->active_usage;
+}
+
+int journal_vacuum_index_vacuum(
+                JournalVacuumIndex *idx,
+                uint64_t max_use,
+                uint64_t n_max_files,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec,
+                bool verbose) {
+
+        _cleanup_free_ JournalVacuumFile **failed = NULL;
+        _cleanup_close_ int fd = -1;
+        usec_t retention_limit = 0;
+        uint64_t freed = 0;
+        size_t n_failed = 0;
+        JournalVacuumFile *f;
+        int r;
+
+        assert(idx);
+
+        if (max_use <= 0 && max_retention_usec <= 0 && n_max_files <= 0)
+                return 0;
+
+        if (max_retention_usec > 0)
+                retention_limit = usec_sub_unsigned(now(CLOCK_REALTIME), max_retention_usec);
+
+        r = vacuum_index_refresh(idx, verbose, &freed);
+        if (r < 0)
+                goto finish;
+
+        /* Delete the oldest archived files until we are within the limits. Files that can't be deleted are
+         * set aside until we are done, so that we go on with the next ones. */
+
+        while ((f = prioq_peek(idx->archived))) {
                 uint64_t left;
 
-                left = n_active_files + n_list - i;
+                left = idx->n_active + prioq_size(idx->archived) + n_failed;
 
-                if ((max_retention_usec <= 0 || list[i].realtime >= retention_limit) &&
-                    (max_use <= 0 || sum <= max_use) &&
+                if ((max_retention_usec <= 0 || f->realtime >= retention_limit) &&
+                    (max_use <= 0 || idx->archived_usage <= max_use) &&
                     (n_max_files <= 0 || left <= n_max_files))
                         break;
 
-                r = unlinkat_deallocate(dirfd(d), list[i].filename, 0);
+                if (fd < 0) {
+                        fd = open(idx->directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                        if (fd < 0) {
+                                r = -errno;
+                                goto finish;
+                        }
+                }
+
+                r = unlinkat_deallocate(fd, f->filename, 0);
                 if (r >= 0) {
+                        unlink_index(fd, f->filename);
                         log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted archived journal %s/%s (%s).",
-                                 directory, list[i].filename, FORMAT_BYTES(list[i].usage));
-                        freed += list[i].usage;
+                                 idx->directory, f->filename, FORMAT_BYTES(f->usage));
+                        freed += f->usage;
 
-                        if (list[i].usage < sum)
-                                sum -= list[i].usage;
-                        else
-                                sum = 0;
+                } else if (r != -ENOENT) {
+                        log_warning_errno(r, "Failed to delete archived journal %s/%s: %m", idx->directory, f->filename);
 
-                } else if (r != -ENOENT)
-                        log_warning_errno(r, "Failed to delete archived journal %s/%s: %m", directory, list[i].filename);
+                        if (!GREEDY_REALLOC(failed, n_failed + 1)) {
+                                r = -ENOMEM;
+                                goto finish;
+                        }
+
+                        assert_se(prioq_pop(idx->archived) == f);
+                        f->prioq_idx = PRIOQ_IDX_NULL;
+                        failed[n_failed++] = f;
+                        continue;
+                }
+
+                vacuum_index_drop(idx, f);
         }
 
-        if (oldest_usec && i < n_list && (*oldest_usec == 0 || list[i].realtime < *oldest_usec))
-                *oldest_usec = list[i].realtime;
+        if (oldest_usec && (f = prioq_peek(idx->archived)) && (*oldest_usec == 0 || f->realtime < *oldest_usec))
+                *oldest_usec = f->realtime;
 
         r = 0;
 
 finish:
-        for (i = 0; i < n_list; i++)
-                free(list[i].filename);
-        free(list);
+        for (size_t i = 0; i < n_failed; i++)
+                if (prioq_put(idx->archived, failed[i], &failed[i]->prioq_idx) < 0) {
+                        /* Can't keep track of it, read the directory again next time */
+                        vacuum_index_clear(idx);
+                        break;
+                }
+
+        if (fd >= 0 && idx->scan_usec > 0)
+                vacuum_index_restamp(idx, fd);
 
         log_full(verbose ? LOG_INFO : LOG_DEBUG, "Vacuuming done, freed %s of archived journals from %s.",
-                 FORMAT_BYTES(freed), directory);
+                 FORMAT_BYTES(freed), idx->directory);
 
         return r;
 }
+
+int journal_directory_vacuum(
+                const char *directory,
+                uint64_t max_use,
+                uint64_t n_max_files,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec,
+                bool verbose) {
+
+        _cleanup_(journal_vacuum_index_freep) JournalVacuumIndex *idx = NULL;
+        int r;
+
+        assert(directory);
+
+        r = journal_vacuum_index_new(directory, &idx);
+        if (r < 0)
+                return r;
+
+        return journal_vacuum_index_vacuum(idx, max_use, n_max_files, max_retention_usec, oldest_usec, verbose);
+}
@@ -4,6 +4,22 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+#include "macro.h"
 #include "time-util.h"
 
+/* Keeps track of the journal files in a directory, so that vacuuming and determining the disk usage doesn't
+ * require reading the whole directory and stat()ing every file each time. The directory is only read
+ * again if somebody else changed it. */
+typedef struct JournalVacuumIndex JournalVacuumIndex;
+
+int journal_vacuum_index_new(const char *directory, JournalVacuumIndex **ret);
+JournalVacuumIndex* journal_vacuum_index_free(JournalVacuumIndex *idx);
+DEFINE_TRIVIAL_CLEANUP_FUNC(JournalVacuumIndex*, journal_vacuum_index_free);
+
+int journal_vacuum_index_refresh(JournalVacuumIndex *idx);
+int journal_vacuum_index_update(JournalVacuumIndex *idx, const char *filename);
+void journal_vacuum_index_set_usage(JournalVacuumIndex *idx, const char *filename, uint64_t usage);
+uint64_t journal_vacuum_index_usage(JournalVacuumIndex *idx);
+int journal_vacuum_index_vacuum(JournalVacuumIndex *idx, uint64_t max_use, uint64_t n_max_files, usec_t max_retention_usec, usec_t *oldest_usec, bool verbose);
+
 int journal_directory_vacuum(const char *directory, uint64_t max_use, uint64_t n_max_files, usec_t max_retention_usec, usec_t *oldest_usec, bool verbose);
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -9,6 +11,7 @@
 #include "compress.h"
 #include "fd-util.h"
 #include "fileio.h"
+#include "format-util.h"
 #include "fs-util.h"
 #include "journal-authenticate.h"
 #include "journal-def.h"
@@ -122,7 +125,7 @@ static int hash_payload(JournalFile *f, Object *o, uint64_t offset, const uint8_
                 _cleanup_free_ void *b = NULL;
                 size_t b_size;
 
-                r = decompress_blob(compression, src, size, &b, &b_size, 0);
+                r = journal_file_decompress_blob(f, compression, src, size, &b, &b_size, 0);
                 if (r < 0) {
                         error_errno(offset, r, "%s decompression failed: %m",
                                     object_compressed_to_string(compression));
@@ -374,6 +377,26 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
                         return -EBADMSG;
                 }
 
+                break;
+
+        case OBJECT_DICTIONARY:
+                if (le64toh(o->object.size) <= offsetof(DictionaryObject, payload)) {
+                        error(offset,
+                              "Invalid object dictionary size: %"PRIu64,
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                break;
+
+        case OBJECT_BLOOM:
+                if (le64toh(o->bloom.n_items) > le64toh(f->header->n_data)) {
+                        error(offset,
+                              "Invalid object bloom item count: %"PRIu64,
+                              le64toh(o->bloom.n_items));
+                        return -EBADMSG;
+                }
+
                 break;
         }
 
@@ -593,11 +616,10 @@ static int verify_data(
 
 static int verify_hash_table(
                 JournalFile *f,
+                uint64_t begin, uint64_t end,
                 MMapFileDescriptor *cache_data_fd, uint64_t n_data,
                 MMapFileDescriptor *cache_entry_fd, uint64_t n_entries,
-                MMapFileDescriptor *cache_entry_array_fd, uint64_t n_entry_arrays,
-                usec_t *last_usec,
-                bool show_progress) {
+                MMapFileDescriptor *cache_entry_array_fd, uint64_t n_entry_arrays) {
 
         uint64_t i, n;
         int r;
@@ -606,7 +628,8 @@ static int verify_hash_table(
         assert(cache_data_fd);
         assert(cache_entry_fd);
         assert(cache_entry_array_fd);
-        assert(last_usec);
+
+        /* Checks the hash chains of the buckets [begin, end) of the data hash table */
 
         n = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
         if (n <= 0)
@@ -616,12 +639,9 @@ static int verify_hash_table(
         if (r < 0)
                 return log_error_errno(r, "Failed to map data hash table: %m");
 
-        for (i = 0; i < n; i++) {
+        for (i = begin; i < MIN(end, n); i++) {
                 uint64_t last = 0, p;
 
-                if (show_progress)
-                        draw_progress(0xC000 + scale_progress(0x3FFF, i, n), last_usec);
-
                 p = le64toh(f->data_hash_table[i].head_hash_offset);
                 while (p != 0) {
                         Object *o;
@@ -742,38 +762,489 @@ static int verify_entry(
         return 0;
 }
 
-static int verify_entry_array(
+static int verify_entry_array_items(
                 JournalFile *f,
+                uint64_t a, uint64_t index,
+                uint64_t begin, uint64_t end,
+                uint64_t last,
                 MMapFileDescriptor *cache_data_fd, uint64_t n_data,
-                MMapFileDescriptor *cache_entry_fd, uint64_t n_entries,
-                MMapFileDescriptor *cache_entry_array_fd, uint64_t n_entry_arrays,
-                usec_t *last_usec,
-                bool show_progress) {
+                MMapFileDescriptor *cache_entry_fd, uint64_t n_entries) {
 
-        uint64_t i = 0, a, n, last = 0;
+        uint64_t j, n;
+        Object *o;
         int r;
 
         assert(f);
         assert(cache_data_fd);
         assert(cache_entry_fd);
+
+        /* Checks the entries referenced by the items [begin, end) of the entry array at 'a', whose first
+         * item is the index'th entry of the file. 'last' is the entry preceding item 'begin'. */
+
+        n = le64toh(f->header->n_entries);
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+        if (r < 0)
+                return r;
+
+        for (j = begin; j < end; j++) {
+                uint64_t p, i = index + j;
+
+                p = le64toh(o->entry_array.items[j]);
+                if (p <= last) {
+                        error(a, "Entry array not sorted at %"PRIu64" of %"PRIu64, i, n);
+                        return -EBADMSG;
+                }
+                last = p;
+
+                if (!contains_uint64(f->mmap, cache_entry_fd, n_entries, p)) {
+                        error(a, "Invalid array entry at %"PRIu64" of %"PRIu64, i, n);
+                        return -EBADMSG;
+                }
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+                if (r < 0)
+                        return r;
+
+                r = verify_entry(f, o, p, cache_data_fd, n_data);
+                if (r < 0)
+                        return r;
+
+                /* Pointer might have moved, reposition */
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int verify_objects(JournalFile *f, uint64_t begin, uint64_t end, uint64_t *ret_offset) {
+        uint64_t p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(ret_offset);
+
+        /* Checks the contents of the objects starting in [begin, end). Their headers and order have been
+         * checked already while walking the file. */
+
+        for (p = begin; p < end; p = p + ALIGN64(le64toh(o->object.size))) {
+                r = journal_file_move_to_object(f, OBJECT_UNUSED, p, &o);
+                if (r < 0) {
+                        error(p, "Invalid object");
+                        *ret_offset = p;
+                        return r;
+                }
+
+                r = journal_file_object_verify(f, p, o);
+                if (r < 0) {
+                        error_errno(p, r, "Invalid object contents: %m");
+                        *ret_offset = p;
+                        return r;
+                }
+        }
+
+        return 0;
+}
+
+/* Most of the time is spent following the references between objects, and hashing and decompressing
+ * payloads, all of which can be done for different parts of the file independently. Hence, the work is
+ * split into sections, which are handed to worker threads. Each worker uses its own JournalFile object
+ * for the file, since neither the mmap cache nor the decompression buffers may be shared between
+ * threads. The walk through all objects in order, and with it the verification of the tags, stays on
+ * the calling thread, which picks up sections too once it has nothing else to do. */
+
+#define VERIFY_THREADS_MAX 8U
+
+/* Files smaller than this are verified on the calling thread alone */
+#define VERIFY_PARALLEL_SIZE_MIN (16U * 1024U * 1024U)
+
+/* How much work is handed out at once */
+#define VERIFY_SECTION_BYTES (4U * 1024U * 1024U)
+#define VERIFY_SECTION_ITEMS 4096U
+
+typedef enum VerifySectionType {
+        VERIFY_SECTION_OBJECTS,           /* Contents of the objects starting in [begin, end) */
+        VERIFY_SECTION_ENTRY_ARRAY_ITEMS, /* Entries referenced by items [begin, end) of an entry array */
+        VERIFY_SECTION_HASH_TABLE,        /* Buckets [begin, end) of the data hash table */
+} VerifySectionType;
+
+typedef struct VerifySection {
+        VerifySectionType type;
+        uint64_t begin, end;
+
+        /* Only for VERIFY_SECTION_ENTRY_ARRAY_ITEMS: the array, the index of its first item among all
+         * entries, and the entry preceding item 'begin' */
+        uint64_t array, index, last;
+} VerifySection;
+
+typedef struct VerifyContext VerifyContext;
+
+typedef struct VerifyWorker {
+        VerifyContext *context;
+        pthread_t thread;
+
+        JournalFile *file;
+        MMapFileDescriptor *cache_data_fd, *cache_entry_fd, *cache_entry_array_fd;
+} VerifyWorker;
+
+struct VerifyContext {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        VerifySection *sections;
+        size_t n_sections, next_section, n_sections_done;
+        bool quit;
+
+        /* The failure of the first section that failed, in the order in which they were added */
+        bool failed;
+        size_t failed_section;
+        uint64_t failed_offset;
+        int r;
+
+        uint64_t n_data, n_entries, n_entry_arrays;
+
+        /* Progress is counted in bytes of objects first, then in entries and hash table buckets */
+        uint64_t progress, progress_total, progress_base;
+        bool show_progress;
+        usec_t last_usec;
+
+        /* The first worker is the calling thread, using the JournalFile object we were passed */
+        VerifyWorker workers[VERIFY_THREADS_MAX];
+        size_t n_workers;
+};
+
+static unsigned verify_pick_n_threads(JournalFile *f, unsigned n_threads) {
+        long k;
+
+        assert(f);
+
+        if (n_threads > 0)
+                return MIN(n_threads, VERIFY_THREADS_MAX);
+
+        if (f->last_stat.st_size < VERIFY_PARALLEL_SIZE_MIN)
+                return 1;
+
+        k = sysconf(_SC_NPROCESSORS_ONLN);
+        if (k <= 0)
+                return 1;
+
+        return MIN((unsigned) k, VERIFY_THREADS_MAX);
+}
+
+static uint64_t verify_section_size(const VerifySection *s) {
+        assert(s);
+
+        return s->end - s->begin;
+}
+
+static void verify_draw_progress(VerifyContext *c, uint64_t extra) {
+        assert(c);
+
+        if (!c->show_progress)
+                return;
+
+        draw_progress(c->progress_base +
+                      scale_progress(0x7FFF, __atomic_load_n(&c->progress, __ATOMIC_RELAXED) + extra, c->progress_total),
+                      &c->last_usec);
+}
+
+static void verify_set_progress(VerifyContext *c, uint64_t base, uint64_t total) {
+        assert(c);
+
+        __atomic_store_n(&c->progress, 0, __ATOMIC_RELAXED);
+        c->progress_base = base;
+        c->progress_total = total;
+}
+
+static int verify_section(VerifyWorker *w, const VerifySection *s, uint64_t *ret_offset) {
+        VerifyContext *c;
+
+        assert(w);
+        assert(s);
+
+        c = w->context;
+
+        switch (s->type) {
+
+        case VERIFY_SECTION_OBJECTS:
+                return verify_objects(w->file, s->begin, s->end, ret_offset);
+
+        case VERIFY_SECTION_ENTRY_ARRAY_ITEMS:
+                return verify_entry_array_items(w->file,
+                                                s->array, s->index,
+                                                s->begin, s->end,
+                                                s->last,
+                                                w->cache_data_fd, c->n_data,
+                                                w->cache_entry_fd, c->n_entries);
+
+        case VERIFY_SECTION_HASH_TABLE:
+                return verify_hash_table(w->file,
+                                         s->begin, s->end,
+                                         w->cache_data_fd, c->n_data,
+                                         w->cache_entry_fd, c->n_entries,
+                                         w->cache_entry_array_fd, c->n_entry_arrays);
+
+        default:
+                assert_not_reached();
+        }
+}
+
+static void verify_process(VerifyWorker *w, bool wait) {
+        VerifyContext *c;
+
+        assert(w);
+
+        c = w->context;
+
+        /* Processes sections until there are no more, or, if 'wait' is true, until told to quit */
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+
+        for (;;) {
+                uint64_t offset = UINT64_MAX;
+                VerifySection s;
+                bool skip;
+                size_t i;
+                int r = 0;
+
+                while (!c->quit && c->next_section >= c->n_sections) {
+                        if (!wait)
+                                goto finish;
+
+                        assert_se(pthread_cond_wait(&c->cond, &c->mutex) == 0);
+                }
+
+                if (c->quit)
+                        break;
+
+                i = c->next_section++;
+                s = c->sections[i];
+
+                /* Once something failed there's no point in going on */
+                skip = c->failed;
+
+                assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+                if (!skip)
+                        r = verify_section(w, &s, &offset);
+
+                __atomic_add_fetch(&c->progress, verify_section_size(&s), __ATOMIC_RELAXED);
+
+                if (w == c->workers)
+                        verify_draw_progress(c, 0);
+
+                assert_se(pthread_mutex_lock(&c->mutex) == 0);
+
+                if (r < 0 && (!c->failed || i < c->failed_section)) {
+                        c->failed = true;
+                        c->failed_section = i;
+                        c->failed_offset = offset;
+                        c->r = r;
+                }
+
+                c->n_sections_done++;
+                assert_se(pthread_cond_broadcast(&c->cond) == 0);
+        }
+
+finish:
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+}
+
+static void* verify_thread(void *userdata) {
+        VerifyWorker *w = userdata;
+
+        assert(w);
+
+        verify_process(w, true);
+        return NULL;
+}
+
+static int verify_add_section(VerifyContext *c, const VerifySection *s) {
+        int r = 0;
+
+        assert(c);
+        assert(s);
+
+        if (s->begin >= s->end)
+                return 0;
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+
+        if (!GREEDY_REALLOC(c->sections, c->n_sections + 1))
+                r = log_oom();
+        else {
+                c->sections[c->n_sections++] = *s;
+                assert_se(pthread_cond_signal(&c->cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        return r;
+}
+
+static bool verify_failed(VerifyContext *c) {
+        bool failed;
+
+        assert(c);
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        failed = c->failed;
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        return failed;
+}
+
+static int verify_run(VerifyContext *c, uint64_t *ret_offset) {
+        int r = 0;
+
+        assert(c);
+        assert(ret_offset);
+
+        /* Help out with the sections added so far, then wait for the workers to finish theirs. If a
+         * section failed, returns its error, and the offset of the object at fault, if it's known. */
+
+        verify_process(c->workers, false);
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+
+        while (c->n_sections_done < c->n_sections)
+                assert_se(pthread_cond_wait(&c->cond, &c->mutex) == 0);
+
+        if (c->failed) {
+                r = c->r;
+                if (c->failed_offset != UINT64_MAX)
+                        *ret_offset = c->failed_offset;
+        }
+
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        return r;
+}
+
+static void verify_start(VerifyContext *c, JournalFile *f, FILE *data_fp, FILE *entry_fp, FILE *entry_array_fp, unsigned n_threads) {
+        sigset_t ss, saved_ss;
+        int r;
+
+        assert(c);
+        assert(f);
+
+        /* Starts n_threads-1 workers. If that doesn't work out, we make do with fewer. */
+
+        if (n_threads <= 1)
+                return;
+
+        if (sigfillset(&ss) < 0)
+                return;
+
+        /* Block all signals in the workers, so that they are delivered to the caller's thread */
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r != 0) {
+                log_debug_errno(r, "Failed to block signals, not starting verification threads: %m");
+                return;
+        }
+
+        while (c->n_workers < n_threads) {
+                VerifyWorker *w = c->workers + c->n_workers;
+
+                *w = (VerifyWorker) {
+                        .context = c,
+                };
+
+                r = journal_file_dup(f, &w->file);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to open %s once more, not starting any more verification threads: %m", f->path);
+                        break;
+                }
+
+                w->cache_data_fd = mmap_cache_add_fd(w->file->mmap, fileno(data_fp), PROT_READ);
+                w->cache_entry_fd = mmap_cache_add_fd(w->file->mmap, fileno(entry_fp), PROT_READ);
+                w->cache_entry_array_fd = mmap_cache_add_fd(w->file->mmap, fileno(entry_array_fp), PROT_READ);
+                if (!w->cache_data_fd || !w->cache_entry_fd || !w->cache_entry_array_fd) {
+                        log_oom_debug();
+                        break;
+                }
+
+                r = pthread_create(&w->thread, NULL, verify_thread, w);
+                if (r != 0) {
+                        log_debug_errno(r, "Failed to start verification thread, not starting any more: %m");
+                        break;
+                }
+
+                c->n_workers++;
+        }
+
+        /* Clean up after the worker that failed to start, if any */
+        if (c->n_workers < n_threads && c->workers[c->n_workers].file) {
+                VerifyWorker *w = c->workers + c->n_workers;
+
+                if (w->cache_data_fd)
+                        mmap_cache_free_fd(w->file->mmap, w->cache_data_fd);
+                if (w->cache_entry_fd)
+                        mmap_cache_free_fd(w->file->mmap, w->cache_entry_fd);
+                if (w->cache_entry_array_fd)
+                        mmap_cache_free_fd(w->file->mmap, w->cache_entry_array_fd);
+
+                journal_file_close(w->file);
+                *w = (VerifyWorker) {};
+        }
+
+        (void) pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+
+        log_debug("Verifying %s using %zu threads.", f->path, c->n_workers);
+}
+
+static void verify_done(VerifyContext *c) {
+        assert(c);
+
+        assert_se(pthread_mutex_lock(&c->mutex) == 0);
+        c->quit = true;
+        assert_se(pthread_cond_broadcast(&c->cond) == 0);
+        assert_se(pthread_mutex_unlock(&c->mutex) == 0);
+
+        /* The first worker is the calling thread, its file and caches belong to the caller */
+        for (size_t i = 1; i < c->n_workers; i++) {
+                VerifyWorker *w = c->workers + i;
+
+                (void) pthread_join(w->thread, NULL);
+
+                mmap_cache_free_fd(w->file->mmap, w->cache_data_fd);
+                mmap_cache_free_fd(w->file->mmap, w->cache_entry_fd);
+                mmap_cache_free_fd(w->file->mmap, w->cache_entry_array_fd);
+                journal_file_close(w->file);
+        }
+
+        c->n_workers = 0;
+        c->sections = mfree(c->sections);
+
+        assert_se(pthread_cond_destroy(&c->cond) == 0);
+        assert_se(pthread_mutex_destroy(&c->mutex) == 0);
+}
+
+static int verify_add_entry_array(VerifyContext *c, JournalFile *f, MMapFileDescriptor *cache_entry_array_fd) {
+        uint64_t i = 0, a, n, last = 0;
+        int r;
+
+        assert(c);
+        assert(f);
         assert(cache_entry_array_fd);
-        assert(last_usec);
+
+        /* Follows the chain of entry arrays, and splits up checking the entries they reference */
 
         n = le64toh(f->header->n_entries);
         a = le64toh(f->header->entry_array_offset);
         while (i < n) {
-                uint64_t next, m, j;
+                uint64_t next, m;
                 Object *o;
 
-                if (show_progress)
-                        draw_progress(0x8000 + scale_progress(0x3FFF, i, n), last_usec);
-
                 if (a == 0) {
                         error(a, "Array chain too short at %"PRIu64" of %"PRIu64, i, n);
                         return -EBADMSG;
                 }
 
-                if (!contains_uint64(f->mmap, cache_entry_array_fd, n_entry_arrays, a)) {
+                if (!contains_uint64(f->mmap, cache_entry_array_fd, c->n_entry_arrays, a)) {
                         error(a, "Invalid array %"PRIu64" of %"PRIu64, i, n);
                         return -EBADMSG;
                 }
@@ -788,37 +1259,46 @@ static int verify_entry_array(
                         return -EBADMSG;
                 }
 
-                m = journal_file_entry_array_n_items(o);
-                for (j = 0; i < n && j < m; i++, j++) {
-                        uint64_t p;
+                m = MIN(journal_file_entry_array_n_items(o), n - i);
+                for (uint64_t j = 0; j < m; j += VERIFY_SECTION_ITEMS) {
+                        r = verify_add_section(c, &(VerifySection) {
+                                        .type = VERIFY_SECTION_ENTRY_ARRAY_ITEMS,
+                                        .begin = j,
+                                        .end = MIN(j + VERIFY_SECTION_ITEMS, m),
+                                        .array = a,
+                                        .index = i,
+                                        .last = j == 0 ? last : le64toh(o->entry_array.items[j - 1]),
+                                });
+                        if (r < 0)
+                                return r;
+                }
 
-                        p = le64toh(o->entry_array.items[j]);
-                        if (p <= last) {
-                                error(a, "Entry array not sorted at %"PRIu64" of %"PRIu64, i, n);
-                                return -EBADMSG;
-                        }
-                        last = p;
+                if (m > 0)
+                        last = le64toh(o->entry_array.items[m - 1]);
 
-                        if (!contains_uint64(f->mmap, cache_entry_fd, n_entries, p)) {
-                                error(a, "Invalid array entry at %"PRIu64" of %"PRIu64, i, n);
-                                return -EBADMSG;
-                        }
+                i += m;
+                a = next;
+        }
 
-                        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
-                        if (r < 0)
-                                return r;
+        return 0;
+}
 
-                        r = verify_entry(f, o, p, cache_data_fd, n_data);
-                        if (r < 0)
-                                return r;
+static int verify_add_hash_table(VerifyContext *c, JournalFile *f) {
+        uint64_t n;
+        int r;
 
-                        /* Pointer might have moved, reposition */
-                        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
-                        if (r < 0)
-                                return r;
-                }
+        assert(c);
+        assert(f);
 
-                a = next;
+        n = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
+        for (uint64_t i = 0; i < n; i += VERIFY_SECTION_ITEMS) {
+                r = verify_add_section(c, &(VerifySection) {
+                                .type = VERIFY_SECTION_HASH_TABLE,
+                                .begin = i,
+                                .end = MIN(i + VERIFY_SECTION_ITEMS, n),
+                        });
+                if (r < 0)
+                        return r;
         }
 
         return 0;
@@ -828,6 +1308,7 @@ int journal_file_verify(
                 JournalFile *f,
                 const char *key,
                 usec_t *first_contained, usec_t *last_validated, usec_t *last_contained,
+                unsigned n_threads,
                 bool show_progress) {
         int r;
         Object *o;
@@ -836,12 +1317,17 @@ int journal_file_verify(
         uint64_t entry_seqnum = 0, entry_monotonic = 0, entry_realtime = 0;
         sd_id128_t entry_boot_id;
         bool entry_seqnum_set = false, entry_monotonic_set = false, entry_realtime_set = false, found_main_entry_array = false;
-        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
-        usec_t last_usec = 0;
+        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0, n_dictionaries = 0, n_blooms = 0;
+        uint64_t section_begin;
+        usec_t start_usec;
+        VerifyContext c = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .cond = PTHREAD_COND_INITIALIZER,
+                .show_progress = show_progress,
+        };
         _cleanup_close_ int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
         _cleanup_fclose_ FILE *data_fp = NULL, *entry_fp = NULL, *entry_array_fp = NULL;
         MMapFileDescriptor *cache_data_fd = NULL, *cache_entry_fd = NULL, *cache_entry_array_fd = NULL;
-        unsigned i;
         bool found_last = false;
         const char *tmp_dir = NULL;
 
@@ -850,6 +1336,8 @@ int journal_file_verify(
 #endif
         assert(f);
 
+        start_usec = now(CLOCK_MONOTONIC);
+
         if (key) {
 #if HAVE_GCRYPT
                 r = journal_file_parse_verification_key(f, key);
@@ -930,24 +1418,36 @@ int journal_file_verify(
                 goto fail;
         }
 
-        for (i = 0; i < sizeof(f->header->reserved); i++)
+        for (size_t i = 0; i < sizeof(f->header->reserved); i++)
                 if (f->header->reserved[i] != 0) {
                         error(offsetof(Header, reserved[i]), "Reserved field is non-zero");
                         r = -EBADMSG;
                         goto fail;
                 }
 
+        c.workers[c.n_workers++] = (VerifyWorker) {
+                .context = &c,
+                .file = f,
+                .cache_data_fd = cache_data_fd,
+                .cache_entry_fd = cache_entry_fd,
+                .cache_entry_array_fd = cache_entry_array_fd,
+        };
+
+        verify_start(&c, f, data_fp, entry_fp, entry_array_fp, verify_pick_n_threads(f, n_threads));
+
         /* First iteration: we go through all objects, verify the
-         * superficial structure, headers, hashes. */
+         * superficial structure, headers, hashes. We walk through the objects here, and the workers check
+         * their contents in the meantime. Both count towards the progress. */
 
-        p = le64toh(f->header->header_size);
+        verify_set_progress(&c, 0, 2 * le64toh(f->header->tail_object_offset));
+
+        p = section_begin = le64toh(f->header->header_size);
         for (;;) {
                 /* Early exit if there are no objects in the file, at all */
                 if (le64toh(f->header->tail_object_offset) == 0)
                         break;
 
-                if (show_progress)
-                        draw_progress(scale_progress(0x7FFF, p, le64toh(f->header->tail_object_offset)), &last_usec);
+                verify_draw_progress(&c, p);
 
                 r = journal_file_move_to_object(f, OBJECT_UNUSED, p, &o);
                 if (r < 0) {
@@ -961,14 +1461,24 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                n_objects++;
+                if (p - section_begin >= VERIFY_SECTION_BYTES) {
+                        r = verify_add_section(&c, &(VerifySection) {
+                                        .type = VERIFY_SECTION_OBJECTS,
+                                        .begin = section_begin,
+                                        .end = p,
+                                });
+                        if (r < 0)
+                                goto fail;
 
-                r = journal_file_object_verify(f, p, o);
-                if (r < 0) {
-                        error_errno(p, r, "Invalid object contents: %m");
-                        goto fail;
+                        section_begin = p;
+
+                        /* No need to go on if the contents of an earlier object are broken */
+                        if (verify_failed(&c))
+                                break;
                 }
 
+                n_objects++;
+
                 if (!!(o->object.flags & OBJECT_COMPRESSED_XZ) +
                     !!(o->object.flags & OBJECT_COMPRESSED_LZ4) +
                     !!(o->object.flags & OBJECT_COMPRESSED_ZSTD) > 1) {
@@ -1208,6 +1718,40 @@ int journal_file_verify(
                         n_tags++;
                         break;
 
+                case OBJECT_DICTIONARY:
+                        if (n_dictionaries > 0) {
+                                error(p, "More than one dictionary");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (!JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) ||
+                            le64toh(f->header->dictionary_offset) != p) {
+                                error(p, "Header fields for dictionary invalid");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_dictionaries++;
+                        break;
+
+                case OBJECT_BLOOM:
+                        if (n_blooms > 0) {
+                                error(p, "More than one bloom filter");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_offset) ||
+                            le64toh(f->header->bloom_offset) != p) {
+                                error(p, "Header fields for bloom filter invalid");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_blooms++;
+                        break;
+
                 default:
                         n_weird++;
                 }
@@ -1220,6 +1764,33 @@ int journal_file_verify(
                 p = p + ALIGN64(le64toh(o->object.size));
         };
 
+        if (found_last) {
+                r = verify_add_section(&c, &(VerifySection) {
+                                .type = VERIFY_SECTION_OBJECTS,
+                                .begin = section_begin,
+                                .end = p + 1,
+                        });
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = verify_run(&c, &p);
+        if (r < 0)
+                goto fail;
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, bloom_offset) &&
+            le64toh(f->header->bloom_offset) != 0 && n_blooms == 0) {
+                error(offsetof(Header, bloom_offset), "Missing bloom filter");
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        if (JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) && n_dictionaries == 0) {
+                error(offsetof(Header, dictionary_offset), "Missing dictionary");
+                r = -EBADMSG;
+                goto fail;
+        }
+
         if (!found_last && le64toh(f->header->tail_object_offset) != 0) {
                 error(le64toh(f->header->tail_object_offset), "Tail object pointer dead");
                 r = -EBADMSG;
@@ -1316,27 +1887,37 @@ int journal_file_verify(
          * unreferenced objects. We only care that everything that is
          * referenced is consistent. */
 
-        r = verify_entry_array(f,
-                               cache_data_fd, n_data,
-                               cache_entry_fd, n_entries,
-                               cache_entry_array_fd, n_entry_arrays,
-                               &last_usec,
-                               show_progress);
+        c.n_data = n_data;
+        c.n_entries = n_entries;
+        c.n_entry_arrays = n_entry_arrays;
+
+        verify_set_progress(&c, 0x8000,
+                            le64toh(f->header->n_entries) +
+                            le64toh(f->header->data_hash_table_size) / sizeof(HashItem));
+
+        r = verify_add_entry_array(&c, f, cache_entry_array_fd);
+        if (r < 0)
+                goto fail;
+
+        r = verify_add_hash_table(&c, f);
         if (r < 0)
                 goto fail;
 
-        r = verify_hash_table(f,
-                              cache_data_fd, n_data,
-                              cache_entry_fd, n_entries,
-                              cache_entry_array_fd, n_entry_arrays,
-                              &last_usec,
-                              show_progress);
+        r = verify_run(&c, &p);
         if (r < 0)
                 goto fail;
 
         if (show_progress)
                 flush_progress();
 
+        log_debug("Verified %s (%s) in %s using %zu threads.",
+                  f->path,
+                  FORMAT_BYTES(f->last_stat.st_size),
+                  FORMAT_TIMESPAN(now(CLOCK_MONOTONIC) - start_usec, USEC_PER_MSEC),
+                  c.n_workers);
+
+        verify_done(&c);
+
         mmap_cache_free_fd(f->mmap, cache_data_fd);
         mmap_cache_free_fd(f->mmap, cache_entry_fd);
         mmap_cache_free_fd(f->mmap, cache_entry_array_fd);
@@ -1351,6 +1932,9 @@ int journal_file_verify(
         return 0;
 
 fail:
+        /* Stop the workers before we close the files they use */
+        verify_done(&c);
+
         if (show_progress)
                 flush_progress();
 
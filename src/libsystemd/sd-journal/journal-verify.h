@@ -3,4 +3,5 @@
 
 #include "journal-file.h"
 
-int journal_file_verify(JournalFile *f, const char *key, usec_t *first_contained, usec_t *last_validated, usec_t *last_contained, bool show_progress);
+/* If n_threads is 0, it's picked based on the size of the file and the number of CPUs */
+int journal_file_verify(JournalFile *f, const char *key, usec_t *first_contained, usec_t *last_validated, usec_t *last_contained, unsigned n_threads, bool show_progress);
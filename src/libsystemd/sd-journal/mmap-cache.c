@@ -42,6 +42,13 @@ struct Context {
         unsigned id;
         Window *window;
 
+        /* The window the context was last attached to, and how large to make the next one. While the
+         * context moves through a file sequentially, its windows grow. */
+        MMapFileDescriptor *last_fd;
+        uint64_t last_offset;
+        size_t last_size;
+        size_t window_size;
+
         LIST_FIELDS(Context, by_window);
 };
 
@@ -71,8 +78,10 @@ struct MMapCache {
 #if ENABLE_DEBUG_MMAP_CACHE
 /* Tiny windows increase mmap activity and the chance of exposing unsafe use. */
 # define WINDOW_SIZE (page_size())
+# define WINDOW_SIZE_MAX WINDOW_SIZE
 #else
 # define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+# define WINDOW_SIZE_MAX (64ULL*1024ULL*1024ULL)
 #endif
 
 MMapCache* mmap_cache_new(void) {
@@ -233,6 +242,33 @@ static void context_attach_window(Context *c, Window *w) {
 
         c->window = w;
         LIST_PREPEND(by_window, w->contexts, c);
+
+        c->last_fd = w->fd;
+        c->last_offset = w->offset;
+        c->last_size = w->size;
+}
+
+static int context_direction(Context *c, MMapFileDescriptor *f, uint64_t offset, size_t size) {
+        uint64_t last_end;
+
+        assert(c);
+        assert(f);
+
+        /* Returns > 0 if the access continues right after the window the context used last, < 0 if it
+         * continues right before it, and 0 if it is somewhere else entirely. */
+
+        if (c->last_fd != f || c->last_size == 0)
+                return 0;
+
+        last_end = c->last_offset + c->last_size;
+
+        if (offset >= c->last_offset && offset + size > last_end && offset < last_end + c->window_size)
+                return 1;
+
+        if (offset < c->last_offset && offset + size <= last_end && offset + c->window_size >= c->last_offset)
+                return -1;
+
+        return 0;
 }
 
 static Context *context_add(MMapCache *m, unsigned id) {
@@ -250,6 +286,7 @@ static Context *context_add(MMapCache *m, unsigned id) {
 
         c->cache = m;
         c->id = id;
+        c->window_size = WINDOW_SIZE;
 
         assert(!m->contexts[id]);
         m->contexts[id] = c;
@@ -422,7 +459,7 @@ static int add_mmap(
         Context *c;
         Window *w;
         void *d;
-        int r;
+        int r, direction;
 
         assert(m);
         assert(m->n_ref > 0);
@@ -430,21 +467,36 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        c = context_add(m, context);
+        if (!c)
+                return -ENOMEM;
+
+        /* Double the window size each time a context runs off the end of its window in the direction it
+         * has been going, and go back to the default on any other access. */
+        direction = context_direction(c, f, offset, size);
+        c->window_size = direction != 0 ? MIN(c->window_size * 2, WINDOW_SIZE_MAX) : WINDOW_SIZE;
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (wsize < c->window_size) {
                 uint64_t delta;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                /* Sequential access only needs what lies ahead, anything else gets the surroundings */
+                if (direction > 0)
+                        delta = 0;
+                else if (direction < 0)
+                        delta = c->window_size - wsize;
+                else
+                        delta = PAGE_ALIGN((c->window_size - wsize) / 2);
 
                 if (delta > offset)
                         woffset = 0;
                 else
                         woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                wsize = c->window_size;
         }
 
         if (st) {
@@ -463,9 +515,12 @@ static int add_mmap(
         if (r < 0)
                 return r;
 
-        c = context_add(m, context);
-        if (!c)
-                goto outofmem;
+        /* When reading through the file, start reading in the whole window right away. The kernel's own
+         * readahead only looks forward and only a little bit beyond the page we fault in. We don't use
+         * MADV_SEQUENTIAL for this, since it turns off read-around, which makes later accesses in the
+         * other direction really slow. */
+        if (direction != 0)
+                (void) madvise(d, wsize, MADV_WILLNEED);
 
         w = window_add(m, f, keep_always, woffset, wsize, d);
         if (!w)
@@ -641,6 +696,10 @@ void mmap_cache_free_fd(MMapCache *m, MMapFileDescriptor *f) {
         while (f->windows)
                 window_free(f->windows);
 
+        for (unsigned i = 0; i < MMAP_CACHE_MAX_CONTEXTS; i++)
+                if (m->contexts[i] && m->contexts[i]->last_fd == f)
+                        m->contexts[i]->last_fd = NULL;
+
         if (f->cache)
                 assert_se(hashmap_remove(f->cache->fds, FD_TO_PTR(f->fd)));
 
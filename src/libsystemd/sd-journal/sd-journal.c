@@ -30,6 +30,7 @@
 #include "journal-def.h"
 #include "journal-file.h"
 #include "journal-internal.h"
+#include "journal-prefetch.h"
 #include "list.h"
 #include "lookup3.h"
 #include "nulstr-util.h"
@@ -106,6 +107,7 @@ static void detach_location(sd_journal *j) {
 
         j->current_file = NULL;
         j->current_field = 0;
+        j->files_prioq = prioq_free(j->files_prioq);
 
         ORDERED_HASHMAP_FOREACH(f, j->files)
                 journal_file_reset_location(f);
@@ -417,6 +419,61 @@ char *journal_make_match_string(sd_journal *j) {
         return match_make_string(j->level0);
 }
 
+int journal_set_message_hint(sd_journal *j, const char *literal) {
+        _cleanup_free_ uint32_t *t = NULL;
+        size_t n = 0;
+        int r;
+
+        assert(j);
+
+        /* Tells us that the caller is only interested in entries whose MESSAGE= field contains the
+         * specified literal (compared case-insensitively for ASCII). It's only a hint: we use it to skip
+         * over ranges of entries of archived files whose index proves that none of them matches, but the
+         * caller still has to check every entry returned. */
+
+        if (literal) {
+                r = journal_index_trigrams(literal, &t, &n);
+                if (r < 0)
+                        return r;
+        }
+
+        free_and_replace(j->index_trigrams, t);
+        j->n_index_trigrams = n;
+
+        return 0;
+}
+
+static const JournalIndexBlock* journal_file_index_excludes(sd_journal *j, JournalFile *f) {
+        const JournalIndexBlock *b;
+        int r;
+
+        assert(j);
+        assert(f);
+
+        if (j->n_index_trigrams == 0)
+                return NULL;
+
+        if (!f->index_loaded) {
+                f->index_loaded = true;
+
+                /* Only archived files have an index, and they won't change anymore */
+                if (!f->writable && f->header->state == STATE_ARCHIVED) {
+                        const char *fn;
+
+                        fn = strjoina(f->path, JOURNAL_INDEX_SUFFIX);
+                        r = journal_index_load(fn, f->header->file_id, &f->index);
+                        if (r < 0 && r != -ENOENT)
+                                log_debug_errno(r, "Failed to load journal index %s, ignoring: %m", fn);
+                }
+        }
+
+        b = journal_index_find_block(f->index, f->current_seqnum);
+        if (!b || journal_index_block_may_contain(b, j->index_trigrams, j->n_index_trigrams))
+                return NULL;
+
+        return b;
+}
+
 _public_ void sd_journal_flush_matches(sd_journal *j) {
         if (!j)
                 return;
@@ -509,6 +566,11 @@ static int next_for_match(
                 else
                         hash = m->hash;
 
+                /* Archived files might tell right away that the value isn't there, without having to look
+                 * at the hash table */
+                if (journal_file_bloom_excludes(f, m->data, m->size, hash))
+                        return 0;
+
                 r = journal_file_find_data_object_with_hash(f, m->data, m->size, hash, NULL, &dp);
                 if (r <= 0)
                         return r;
@@ -603,6 +665,11 @@ static int find_location_for_match(
                 else
                         hash = m->hash;
 
+                /* Archived files might tell right away that the value isn't there, without having to look
+                 * at the hash table */
+                if (journal_file_bloom_excludes(f, m->data, m->size, hash))
+                        return 0;
+
                 r = journal_file_find_data_object_with_hash(f, m->data, m->size, hash, NULL, &dp);
                 if (r <= 0)
                         return r;
@@ -803,10 +870,24 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
                 } else
                         found = true;
 
-                if (found)
-                        return 1;
-
-                r = next_with_matches(j, f, direction, &c, &cp);
+                if (found) {
+                        const JournalIndexBlock *b;
+
+                        b = journal_file_index_excludes(j, f);
+                        if (!b)
+                                return 1;
+
+                        /* None of the entries in this block can match the hint. Without matches we can jump
+                         * right past the block, otherwise we at least don't bother the caller with them. */
+                        if (!j->level0)
+                                r = journal_file_move_to_entry_by_seqnum(
+                                                f,
+                                                direction == DIRECTION_DOWN ? le64toh(b->last_seqnum) + 1 : le64toh(b->first_seqnum) - 1,
+                                                direction, &c, &cp);
+                        else
+                                r = next_with_matches(j, f, direction, &c, &cp);
+                } else
+                        r = next_with_matches(j, f, direction, &c, &cp);
                 if (r <= 0)
                         return r;
 
@@ -814,57 +895,127 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
+static int journal_file_compare_down(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) a, (JournalFile*) b);
+}
+
+static int journal_file_compare_up(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) b, (JournalFile*) a);
+}
+
+static int file_prioq_update(sd_journal *j, JournalFile *f, direction_t direction) {
+        int r;
+
+        assert(j);
+        assert(f);
+
+        /* Moves the file to its next candidate entry and updates its position in the queue. Returns > 0
+         * if the file still has an entry beyond the current location, 0 otherwise. */
+
+        r = next_beyond_location(j, f, direction);
+        if (r < 0) {
+                log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
+                remove_file_real(j, f);
+                return 0;
+        }
+        if (r == 0) {
+                f->location_type = LOCATION_TAIL;
+                (void) prioq_remove(j->files_prioq, f, &f->location_prioq_idx);
+                return 0;
+        }
+
+        if (prioq_reshuffle(j->files_prioq, f, &f->location_prioq_idx) > 0)
+                return 1;
+
+        r = prioq_put(j->files_prioq, f, &f->location_prioq_idx);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
 static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *new_file = NULL;
-        unsigned i, n_files;
-        const void **files;
+        JournalFile *new_file, *f;
         Object *o;
         int r;
 
         assert_return(j, -EINVAL);
         assert_return(!journal_pid_changed(j), -ECHILD);
 
-        r = iterated_cache_get(j->files_cache, NULL, &files, &n_files);
-        if (r < 0)
-                return r;
+        if (j->prefetch)
+                (void) journal_prefetch_start(j->prefetch, direction);
 
-        for (i = 0; i < n_files; i++) {
-                JournalFile *f = (JournalFile *)files[i];
-                bool found;
+        if (!j->files_prioq || j->files_prioq_direction != direction) {
+                unsigned i, n_files;
+                const void **files;
 
-                r = next_beyond_location(j, f, direction);
-                if (r < 0) {
-                        log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
-                        remove_file_real(j, f);
-                        continue;
-                } else if (r == 0) {
-                        f->location_type = LOCATION_TAIL;
-                        continue;
-                }
+                /* After seeking, changing direction or when files were added, we need to look at every
+                 * file once. From then on only the file we took the previous entry from needs to move on,
+                 * hence each step costs O(log(n_files)) rather than O(n_files). */
 
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
+                j->files_prioq = prioq_free(j->files_prioq);
+                j->files_prioq = prioq_new(direction == DIRECTION_DOWN ? journal_file_compare_down : journal_file_compare_up);
+                if (!j->files_prioq)
+                        return -ENOMEM;
+
+                j->files_prioq_direction = direction;
 
-                        k = journal_file_compare_locations(f, new_file);
+                r = iterated_cache_get(j->files_cache, NULL, &files, &n_files);
+                if (r < 0)
+                        return r;
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
+                for (i = 0; i < n_files; i++) {
+                        r = file_prioq_update(j, (JournalFile*) files[i], direction);
+                        if (r < 0)
+                                return r;
+                }
+        } else {
+                /* The file we took the current entry from was removed from the queue, let it move on */
+                if (j->current_file) {
+                        r = file_prioq_update(j, j->current_file, direction);
+                        if (r < 0)
+                                return r;
                 }
 
-                if (found)
-                        new_file = f;
+                /* Files that are still written to might have new entries, even if we reached their end
+                 * before. */
+                SET_FOREACH(f, j->live_files) {
+                        r = file_prioq_update(j, f, direction);
+                        if (r < 0)
+                                return r;
+                }
         }
 
-        if (!new_file)
-                return 0;
+        /* Now advance the first file in the queue until it is beyond the current location. Note that the
+         * next entry might be the same as the current one, just stored in another file, hence repeat until
+         * the first file does not move anymore. */
+        for (;;) {
+                uint64_t offset;
+
+                new_file = prioq_peek(j->files_prioq);
+                if (!new_file)
+                        return 0;
+
+                offset = new_file->current_offset;
+
+                r = file_prioq_update(j, new_file, direction);
+                if (r < 0)
+                        return r;
+                if (r > 0 && new_file->current_offset == offset)
+                        break;
+        }
 
         r = journal_file_move_to_object(new_file, OBJECT_ENTRY, new_file->current_offset, &o);
         if (r < 0)
                 return r;
 
+        /* The candidate of this file is consumed now, it can't be compared with the others anymore */
+        assert_se(prioq_pop(j->files_prioq) == new_file);
         set_location(j, new_file, o);
 
+        if (j->prefetch)
+                journal_prefetch_advance(j->prefetch, new_file->current_realtime);
+
         return 1;
 }
 
@@ -1352,10 +1503,30 @@ static int add_any_file(
         close_fd = false; /* the fd is now owned by the JournalFile object */
 
         f->last_seen_generation = j->generation;
+        f->location_prioq_idx = PRIOQ_IDX_NULL;
+
+        /* Archived files won't get new entries, all others need to be checked for them while iterating */
+        if (f->header->state != STATE_ARCHIVED) {
+                r = set_ensure_put(&j->live_files, NULL, f);
+                if (r < 0) {
+                        (void) ordered_hashmap_remove(j->files, f->path);
+                        (void) journal_file_close(f);
+                        goto finish;
+                }
+        }
+
+        /* Make sure the new file is taken into account on the next iteration step */
+        j->files_prioq = prioq_free(j->files_prioq);
 
         track_file_disposition(j, f);
         check_network(j, f->fd);
 
+        if (j->prefetch) {
+                k = journal_prefetch_add(j->prefetch, f);
+                if (k < 0)
+                        log_debug_errno(k, "Failed to queue %s for prefetching, ignoring: %m", f->path);
+        }
+
         j->current_invalidate_counter++;
 
         log_debug("File %s added.", f->path);
@@ -1421,6 +1592,8 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
         assert(f);
 
         (void) ordered_hashmap_remove(j->files, f->path);
+        (void) prioq_remove(j->files_prioq, f, &f->location_prioq_idx);
+        (void) set_remove(j->live_files, f);
 
         log_debug("File %s removed.", f->path);
 
@@ -1920,6 +2093,10 @@ static sd_journal *journal_new(int flags, const char *path, const char *namespac
         if (!j->files)
                 return NULL;
 
+        if (FLAGS_SET(flags, SD_JOURNAL_PARALLEL) &&
+            journal_prefetch_new(&j->prefetch) < 0)
+                return NULL;
+
         j->files_cache = ordered_hashmap_iterated_cache_new(j->files);
         j->directories_by_path = hashmap_new(&path_hash_ops);
         j->mmap = mmap_cache_new();
@@ -1935,7 +2112,8 @@ static sd_journal *journal_new(int flags, const char *path, const char *namespac
          SD_JOURNAL_SYSTEM |                            \
          SD_JOURNAL_CURRENT_USER |                      \
          SD_JOURNAL_ALL_NAMESPACES |                    \
-         SD_JOURNAL_INCLUDE_DEFAULT_NAMESPACE)
+         SD_JOURNAL_INCLUDE_DEFAULT_NAMESPACE |         \
+         SD_JOURNAL_PARALLEL)
 
 _public_ int sd_journal_open_namespace(sd_journal **ret, const char *namespace, int flags) {
         _cleanup_(sd_journal_closep) sd_journal *j = NULL;
@@ -1961,7 +2139,7 @@ _public_ int sd_journal_open(sd_journal **ret, int flags) {
 }
 
 #define OPEN_CONTAINER_ALLOWED_FLAGS                    \
-        (SD_JOURNAL_LOCAL_ONLY | SD_JOURNAL_SYSTEM)
+        (SD_JOURNAL_LOCAL_ONLY | SD_JOURNAL_SYSTEM | SD_JOURNAL_PARALLEL)
 
 _public_ int sd_journal_open_container(sd_journal **ret, const char *machine, int flags) {
         _cleanup_free_ char *root = NULL, *class = NULL;
@@ -2005,7 +2183,8 @@ _public_ int sd_journal_open_container(sd_journal **ret, const char *machine, in
 
 #define OPEN_DIRECTORY_ALLOWED_FLAGS                    \
         (SD_JOURNAL_OS_ROOT |                           \
-         SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER )
+         SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER |  \
+         SD_JOURNAL_PARALLEL)
 
 _public_ int sd_journal_open_directory(sd_journal **ret, const char *path, int flags) {
         _cleanup_(sd_journal_closep) sd_journal *j = NULL;
@@ -2056,7 +2235,8 @@ _public_ int sd_journal_open_files(sd_journal **ret, const char **paths, int fla
 
 #define OPEN_DIRECTORY_FD_ALLOWED_FLAGS         \
         (SD_JOURNAL_OS_ROOT |                           \
-         SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER )
+         SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER |  \
+         SD_JOURNAL_PARALLEL)
 
 _public_ int sd_journal_open_directory_fd(sd_journal **ret, int fd, int flags) {
         _cleanup_(sd_journal_closep) sd_journal *j = NULL;
@@ -2149,6 +2329,10 @@ _public_ void sd_journal_close(sd_journal *j) {
 
         sd_journal_flush_matches(j);
 
+        journal_prefetch_free(j->prefetch);
+        prioq_free(j->files_prioq);
+        set_free(j->live_files);
+
         ordered_hashmap_free_with_destructor(j->files, journal_file_close);
         iterated_cache_free(j->files_cache);
 
@@ -2175,6 +2359,7 @@ _public_ void sd_journal_close(sd_journal *j) {
         free(j->namespace);
         free(j->unique_field);
         free(j->fields_buffer);
+        free(j->index_trigrams);
         free(j);
 }
 
@@ -2316,10 +2501,10 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
                 compression = o->object.flags & OBJECT_COMPRESSION_MASK;
                 if (compression) {
 #if HAVE_COMPRESSION
-                        r = decompress_startswith(compression,
-                                                  o->data.payload, l,
-                                                  &f->compress_buffer,
-                                                  field, field_length, '=');
+                        r = journal_file_decompress_startswith(f, compression,
+                                                               o->data.payload, l,
+                                                               &f->compress_buffer,
+                                                               field, field_length, '=');
                         if (r < 0)
                                 log_debug_errno(r, "Cannot decompress %s object of length %"PRIu64" at offset "OFSfmt": %m",
                                                 object_compressed_to_string(compression), l, p);
@@ -2327,10 +2512,10 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                                 size_t rsize;
 
-                                r = decompress_blob(compression,
-                                                    o->data.payload, l,
-                                                    &f->compress_buffer, &rsize,
-                                                    j->data_threshold);
+                                r = journal_file_decompress_blob(f, compression,
+                                                                 o->data.payload, l,
+                                                                 &f->compress_buffer, &rsize,
+                                                                 j->data_threshold);
                                 if (r < 0)
                                         return r;
 
@@ -2395,7 +2580,8 @@ static int return_data(
                 size_t rsize;
                 int r;
 
-                r = decompress_blob(
+                r = journal_file_decompress_blob(
+                                f,
                                 compression,
                                 o->data.payload, l,
                                 &f->compress_buffer, &rsize,
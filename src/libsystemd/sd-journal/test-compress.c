@@ -269,6 +269,61 @@ static void test_lz4_decompress_partial(void) {
 }
 #endif
 
+#if HAVE_ZSTD
+static void test_zstd_dictionary(void) {
+        static const char message[] = "MESSAGE=Started Session 4711 of User lennart.";
+        _cleanup_(zstd_dictionary_freep) ZstdDictionary *d = NULL;
+        _cleanup_free_ size_t *sizes = NULL;
+        _cleanup_free_ char *samples = NULL;
+        _cleanup_free_ void *dict = NULL, *buf = NULL;
+        char compressed[sizeof(message)], plain[2 * sizeof(message)];
+        size_t size = 0, dict_size, compressed_size, plain_size, buf_size;
+
+        log_info("/* %s */", __func__);
+
+        /* Lots of short, similar but not identical messages, like a log would contain */
+        assert_se(sizes = new(size_t, 4096));
+        assert_se(samples = new(char, 4096 * 128));
+        for (unsigned i = 0; i < 4096; i++) {
+                int k;
+
+                k = snprintf(samples + size, 128, "MESSAGE=%s Session %u of User %s.",
+                             i % 2 ? "Started" : "Stopped", random_u32() % 10000,
+                             i % 3 == 0 ? "root" : i % 3 == 1 ? "lennart" : "zbyszek");
+                assert_se(k > 0 && k < 128);
+
+                sizes[i] = k;
+                size += k;
+        }
+
+        assert_se(zstd_dictionary_train(samples, sizes, 4096, 16 * 1024, &dict, &dict_size) == 0);
+        log_info("Trained %zu byte dictionary", dict_size);
+        assert_se(zstd_dictionary_new(dict, dict_size, &d) == 0);
+
+        assert_se(compress_blob_zstd_dict(d, message, sizeof(message), compressed, sizeof(compressed), &compressed_size) == 0);
+        assert_se(zstd_frame_needs_dictionary(compressed, compressed_size));
+
+        /* Short messages only become smaller thanks to the dictionary */
+        assert_se(compress_blob_zstd(message, sizeof(message), plain, sizeof(plain), &plain_size) == 0);
+        assert_se(!zstd_frame_needs_dictionary(plain, plain_size));
+        assert_se(plain_size > compressed_size);
+        log_info("ZSTD %zu → %zu, with dictionary → %zu", sizeof(message), plain_size, compressed_size);
+
+        assert_se(decompress_blob_zstd_dict(d, compressed, compressed_size, &buf, &buf_size, 0) == 0);
+        assert_se(buf_size == sizeof(message));
+        assert_se(memcmp(buf, message, buf_size) == 0);
+
+        assert_se(decompress_startswith_zstd_dict(d, compressed, compressed_size, &buf, "MESSAGE", 7, '=') > 0);
+        assert_se(decompress_startswith_zstd_dict(d, compressed, compressed_size, &buf, "MESSAGE", 7, 'X') == 0);
+
+        /* Without the dictionary the frame can't be decoded, but frames without one decode fine with it */
+        assert_se(decompress_blob_zstd(compressed, compressed_size, &buf, &buf_size, 0) < 0);
+        assert_se(decompress_blob_zstd_dict(d, plain, plain_size, &buf, &buf_size, 0) == 0);
+        assert_se(buf_size == sizeof(message));
+        assert_se(memcmp(buf, message, buf_size) == 0);
+}
+#endif
+
 int main(int argc, char *argv[]) {
 #if HAVE_COMPRESSION
         _unused_ const char text[] =
@@ -363,6 +418,8 @@ int main(int argc, char *argv[]) {
                              compress_stream_zstd, decompress_stream_zstd, srcfile);
 
         test_decompress_startswith_short("ZSTD", compress_blob_zstd, decompress_startswith_zstd);
+
+        test_zstd_dictionary();
 #else
         log_info("/* ZSTD test skipped */");
 #endif
@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "chattr-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "log.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "tmpfile-util.h"
+
+#define N_FIELDS 12
+#define BATCH_SIZE 64
+
+static usec_t arg_duration;
+
+typedef struct FakeEntry {
+        char fields[N_FIELDS][64];
+        struct iovec iovec[N_FIELDS];
+} FakeEntry;
+
+static void make_entry(FakeEntry *e, unsigned i) {
+        unsigned k = 0;
+
+        assert(e);
+
+        /* Roughly what journald generates for a service logging through stdout: the metadata fields repeat
+         * for every line of the same client, only the message itself (and the odd pid) changes. */
+        xsprintf(e->fields[k++], "MESSAGE=Processed request %u in %ums", i, i % 97);
+        xsprintf(e->fields[k++], "PRIORITY=%u", 6 - i % 3);
+        strcpy(e->fields[k++], "SYSLOG_FACILITY=3");
+        xsprintf(e->fields[k++], "SYSLOG_IDENTIFIER=service%u", i % 4);
+        xsprintf(e->fields[k++], "_PID=%u", 1000 + i % 4);
+        strcpy(e->fields[k++], "_UID=0");
+        strcpy(e->fields[k++], "_GID=0");
+        xsprintf(e->fields[k++], "_COMM=service%u", i % 4);
+        strcpy(e->fields[k++], "_TRANSPORT=stdout");
+        xsprintf(e->fields[k++], "_SYSTEMD_UNIT=service%u.service", i % 4);
+        strcpy(e->fields[k++], "_BOOT_ID=3a3d8c5b0a8b4c2f9d4b6a1e2f3c4d5e");
+        strcpy(e->fields[k++], "_HOSTNAME=benchmark");
+        assert_se(k == N_FIELDS);
+
+        for (k = 0; k < N_FIELDS; k++)
+                e->iovec[k] = IOVEC_MAKE_STRING(e->fields[k]);
+}
+
+static JournalFile* open_file(const char *dn, const char *name) {
+        _cleanup_free_ char *fn = NULL;
+        JournalFile *f;
+
+        fn = path_join(dn, name);
+        assert_se(fn);
+
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        return f;
+}
+
+static void report(const char *label, unsigned n, usec_t dt) {
+        log_info("%s: appended %u entries in %s (%.0f entries/s)",
+                 label, n, FORMAT_TIMESPAN(dt, USEC_PER_MSEC), n / ((double) dt / USEC_PER_SEC));
+}
+
+static unsigned test_single(const char *dn) {
+        _cleanup_free_ FakeEntry *e = NULL;
+        JournalFile *f;
+        usec_t start, n = 0;
+        unsigned i;
+
+        e = new(FakeEntry, 1);
+        assert_se(e);
+
+        f = open_file(dn, "single.journal");
+
+        start = now(CLOCK_MONOTONIC);
+        for (i = 0; n < start + arg_duration; i++) {
+                make_entry(e, i);
+                assert_se(journal_file_append_entry(f, NULL, NULL, e->iovec, N_FIELDS, NULL, NULL, NULL) == 0);
+
+                n = now(CLOCK_MONOTONIC);
+        }
+
+        report("single", i, n - start);
+
+        assert_se(le64toh(f->header->n_entries) == i);
+        (void) journal_file_close(f);
+
+        return i;
+}
+
+static void test_batched(const char *dn, unsigned n_single) {
+        _cleanup_free_ FakeEntry *e = NULL;
+        JournalAppendEntry entries[BATCH_SIZE];
+        JournalFile *f, *g;
+        usec_t start, n = 0;
+        unsigned i = 0;
+
+        e = new(FakeEntry, BATCH_SIZE);
+        assert_se(e);
+
+        f = open_file(dn, "batched.journal");
+
+        start = now(CLOCK_MONOTONIC);
+        while (n < start + arg_duration) {
+                size_t n_appended = 0;
+
+                for (unsigned k = 0; k < BATCH_SIZE; k++) {
+                        make_entry(e + k, i + k);
+
+                        entries[k] = (JournalAppendEntry) {
+                                .iovec = e[k].iovec,
+                                .n_iovec = N_FIELDS,
+                        };
+                        dual_timestamp_get(&entries[k].ts);
+                }
+
+                assert_se(journal_file_append_entries(f, NULL, entries, BATCH_SIZE, NULL, &n_appended) == 0);
+                assert_se(n_appended == BATCH_SIZE);
+                i += BATCH_SIZE;
+
+                n = now(CLOCK_MONOTONIC);
+        }
+
+        report("batched", i, n - start);
+
+        assert_se(le64toh(f->header->n_entries) == i);
+
+        /* The same entries appended one by one must result in exactly the same set of objects */
+        g = open_file(dn, "reference.journal");
+        for (unsigned k = 0; k < i; k++) {
+                make_entry(e, k);
+                assert_se(journal_file_append_entry(g, NULL, NULL, e->iovec, N_FIELDS, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(f->header->n_entries == g->header->n_entries);
+        assert_se(f->header->n_data == g->header->n_data);
+        assert_se(f->header->n_fields == g->header->n_fields);
+        assert_se(f->header->n_objects == g->header->n_objects);
+
+        if (n_single > 0)
+                log_info("batched/single: %.2f", (double) i / n_single);
+
+        (void) journal_file_close(g);
+        (void) journal_file_close(f);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *dn = NULL;
+        unsigned n_single;
+
+        test_setup_logging(LOG_INFO);
+
+        if (argc >= 2) {
+                unsigned x;
+
+                assert_se(safe_atou(argv[1], &x) >= 0);
+                arg_duration = x * USEC_PER_SEC;
+        } else
+                arg_duration = slow_tests_enabled() ?
+                        2 * USEC_PER_SEC : USEC_PER_SEC / 50;
+
+        assert_se(mkdtemp_malloc("/var/tmp/journal-append-XXXXXX", &dn) >= 0);
+        (void) chattr_path(dn, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
+
+        n_single = test_single(dn);
+        test_batched(dn, n_single);
+
+        return 0;
+}
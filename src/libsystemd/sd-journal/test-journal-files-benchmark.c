@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "chattr-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "log.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "tmpfile-util.h"
+
+/* Reads through a directory of many journal files with interleaved entries, to see how iteration
+ * scales with the number of files. */
+
+static unsigned arg_n_files;
+static unsigned arg_n_entries;
+
+static void create_files(const char *dn, unsigned n_files, unsigned n_entries) {
+        _cleanup_free_ JournalFile **files = NULL;
+        dual_timestamp ts;
+
+        files = new(JournalFile*, n_files);
+        assert_se(files);
+
+        for (unsigned i = 0; i < n_files; i++) {
+                _cleanup_free_ char *fn = NULL;
+
+                assert_se(asprintf(&fn, "%s/file%u.journal", dn, i) >= 0);
+                assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &files[i]) == 0);
+        }
+
+        dual_timestamp_get(&ts);
+
+        /* Entries are spread round-robin over the files, so that every step needs to pick another file */
+        for (unsigned i = 0; i < n_entries; i++) {
+                char message[LINE_MAX];
+                struct iovec iovec;
+
+                xsprintf(message, "MESSAGE=Entry %u", i);
+                iovec = IOVEC_MAKE_STRING(message);
+
+                ts.realtime++;
+                ts.monotonic++;
+
+                assert_se(journal_file_append_entry(files[i % n_files], &ts, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        /* Like on a system with long retention, almost all files are archived */
+        for (unsigned i = 0; i < n_files; i++) {
+                assert_se(journal_file_archive(files[i]) == 0);
+                (void) journal_file_close(files[i]);
+        }
+}
+
+static void read_files(const char *dn, unsigned n_files, unsigned n_entries, bool down) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        uint64_t previous = 0;
+        usec_t start, end;
+        unsigned n = 0;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+
+        start = now(CLOCK_MONOTONIC);
+
+        if (down)
+                assert_se(sd_journal_seek_head(j) >= 0);
+        else
+                assert_se(sd_journal_seek_tail(j) >= 0);
+
+        while ((r = down ? sd_journal_next(j) : sd_journal_previous(j)) > 0) {
+                uint64_t t;
+
+                assert_se(sd_journal_get_realtime_usec(j, &t) >= 0);
+                assert_se(n == 0 || (down ? t > previous : t < previous));
+
+                previous = t;
+                n++;
+        }
+        assert_se(r == 0);
+
+        end = now(CLOCK_MONOTONIC);
+
+        assert_se(n == n_entries);
+
+        log_info("%u files, %s: read %u entries in %s (%.0f entries/s)",
+                 n_files, down ? "down" : "up", n, FORMAT_TIMESPAN(end - start, USEC_PER_MSEC),
+                 n / ((double) (end - start) / USEC_PER_SEC));
+}
+
+static void test_n_files(unsigned n_files) {
+        _cleanup_(rm_rf_physical_and_freep) char *dn = NULL;
+
+        assert_se(mkdtemp_malloc("/var/tmp/journal-files-XXXXXX", &dn) >= 0);
+        (void) chattr_path(dn, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
+
+        create_files(dn, n_files, arg_n_entries);
+
+        read_files(dn, n_files, arg_n_entries, true);
+        read_files(dn, n_files, arg_n_entries, false);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_files) >= 0 && arg_n_files > 0);
+        else
+                arg_n_files = slow_tests_enabled() ? 512 : 32;
+
+        if (argc >= 3)
+                assert_se(safe_atou(argv[2], &arg_n_entries) >= 0);
+        else
+                arg_n_entries = slow_tests_enabled() ? 256 * 1024 : 16 * 1024;
+
+        for (unsigned n = 1; n < arg_n_files; n *= 4)
+                test_n_files(n);
+        test_n_files(arg_n_files);
+
+        return 0;
+}
@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "chattr-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "journal-index.h"
+#include "journal-internal.h"
+#include "journal-vacuum.h"
+#include "log.h"
+#include "path-util.h"
+#include "random-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "tmpfile-util.h"
+
+#define N_ENTRIES 5000U
+#define NEEDLE_ENTRY 3019U
+#define N_MESSAGES 100000U
+
+static void random_token(char *buf, size_t n) {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        /* Like the base64 encoded keys, fingerprints and cookies found in many log messages */
+        random_bytes(buf, n);
+        for (size_t k = 0; k < n; k++)
+                buf[k] = table[(uint8_t) buf[k] % 64];
+        buf[n] = 0;
+}
+
+static void test_trigrams(void) {
+        _cleanup_free_ uint32_t *t = NULL;
+        size_t n;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_index_trigrams("ab", &t, &n) == 0);
+        assert_se(!t);
+        assert_se(n == 0);
+
+        /* "abc", "bca", "cab", the rest are duplicates, also with different case */
+        assert_se(journal_index_trigrams("abcABCabc", &t, &n) == 3);
+        assert_se(n == 3);
+}
+
+static void test_blocks(void) {
+        _cleanup_(journal_index_freep) JournalIndex *i = NULL;
+        _cleanup_free_ uint32_t *foo = NULL, *bar = NULL;
+        const JournalIndexBlock *b;
+        size_t n_foo, n_bar;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_index_trigrams("Foo", &foo, &n_foo) == 1);
+        assert_se(journal_index_trigrams("bar", &bar, &n_bar) == 1);
+
+        assert_se(i = journal_index_new());
+
+        assert_se(journal_index_add(i, 1, "xxx foo", 7) >= 0);
+        assert_se(journal_index_add(i, 3, NULL, 0) >= 0);
+        journal_index_break(i);
+        assert_se(journal_index_add(i, 5, "BAR", 3) >= 0);
+        assert_se(i->n_blocks == 2);
+
+        assert_se(!journal_index_find_block(i, 0));
+        assert_se(!journal_index_find_block(i, 4));
+        assert_se(!journal_index_find_block(i, 6));
+
+        assert_se(b = journal_index_find_block(i, 3));
+        assert_se(le64toh(b->first_seqnum) == 1);
+        assert_se(le64toh(b->last_seqnum) == 3);
+        assert_se(journal_index_block_may_contain(b, foo, n_foo));
+        assert_se(!journal_index_block_may_contain(b, bar, n_bar));
+
+        assert_se(b = journal_index_find_block(i, 5));
+        assert_se(!journal_index_block_may_contain(b, foo, n_foo));
+        assert_se(journal_index_block_may_contain(b, bar, n_bar));
+}
+
+static void realistic_message(char *buf, size_t size, unsigned i) {
+        static const char *const users[] = { "root", "alice", "bob", "postgres", "www-data", "backup" };
+        static const char *const units[] = { "systemd-tmpfiles-clean", "logrotate", "man-db", "apt-daily",
+                                             "fstrim", "certbot", "user-runtime-dir@1000", "NetworkManager-dispatcher" };
+        const char *user = users[random_u64() % ELEMENTSOF(users)];
+        char token[44];
+        uint8_t a[4];
+
+        random_token(token, sizeof(token) - 1);
+        random_bytes(a, sizeof(a));
+
+        switch (i % 6) {
+
+        case 0:
+                assert_se(snprintf_ok(buf, size, "Started Session %u of User %s.", (unsigned) random_u64() % 100000, user));
+                break;
+
+        case 1:
+                assert_se(snprintf_ok(buf, size, "%s.service: Succeeded.", units[random_u64() % ELEMENTSOF(units)]));
+                break;
+
+        case 2:
+                assert_se(snprintf_ok(buf, size, "pam_unix(sshd:session): session opened for user %s(uid=%u) by (uid=0)",
+                                      user, (unsigned) random_u64() % 65536));
+                break;
+
+        case 3:
+                assert_se(snprintf_ok(buf, size, "Accepted publickey for %s from %u.%u.%u.%u port %u ssh2: RSA SHA256:%s",
+                                      user, a[0], a[1], a[2], a[3], (unsigned) random_u64() % 65536, token));
+                break;
+
+        case 4:
+                assert_se(snprintf_ok(buf, size, "[UFW BLOCK] IN=eth0 OUT= SRC=%u.%u.%u.%u DST=10.0.0.1 LEN=%u PROTO=TCP SPT=%u DPT=22",
+                                      a[0], a[1], a[2], a[3], 40 + (unsigned) random_u64() % 1460, (unsigned) random_u64() % 65536));
+                break;
+
+        case 5:
+                token[22] = 0;
+                assert_se(snprintf_ok(buf, size, "%u.%u.%u.%u - - \"GET /api/v1/session/%s HTTP/1.1\" 200 %u",
+                                      a[0], a[1], a[2], a[3], token, (unsigned) random_u64() % 100000));
+                break;
+        }
+}
+
+static void test_realistic_messages(void) {
+        _cleanup_(journal_index_freep) JournalIndex *i = NULL;
+        _cleanup_free_ uint32_t *absent = NULL, *present = NULL;
+        size_t n_absent, n_present, n_skippable = 0;
+        unsigned fill_max = 0;
+
+        log_info("/* %s */", __func__);
+
+        /* The filters of blocks of typical log messages must not fill up so much that searches for
+         * something that isn't there can't skip them anymore */
+
+        assert_se(journal_index_trigrams("segfault at", &absent, &n_absent) > 0);
+        assert_se(journal_index_trigrams("publickey", &present, &n_present) > 0);
+
+        assert_se(i = journal_index_new());
+
+        for (unsigned k = 0; k < N_MESSAGES; k++) {
+                char message[LINE_MAX];
+
+                realistic_message(message, sizeof(message), k);
+                assert_se(journal_index_add(i, k + 1, message, strlen(message)) >= 0);
+        }
+
+        assert_se(i->n_blocks > 1);
+
+        for (size_t k = 0; k < i->n_blocks; k++) {
+                const JournalIndexBlock *b = i->blocks + k;
+                unsigned bits = 0;
+
+                for (size_t l = 0; l < sizeof(b->bloom); l++)
+                        bits += __builtin_popcount(b->bloom[l]);
+
+                /* The last block is still open, and may hold a few messages only */
+                if (k < i->n_blocks - 1) {
+                        assert_se(bits * 2 <= sizeof(b->bloom) * 8);
+
+                        /* Every block has messages of all kinds */
+                        assert_se(journal_index_block_may_contain(b, present, n_present));
+                }
+                fill_max = MAX(fill_max, bits);
+
+                if (!journal_index_block_may_contain(b, absent, n_absent))
+                        n_skippable++;
+        }
+
+        log_info("%u messages in %zu blocks, maximum fill %u%%, %zu blocks skippable",
+                 N_MESSAGES, i->n_blocks, fill_max * 100 / (JOURNAL_INDEX_BLOOM_SIZE * 8), n_skippable);
+
+        assert_se(n_skippable * 10 >= i->n_blocks * 9);
+}
+
+static void append_entries(JournalFile *f) {
+        for (unsigned i = 0; i < N_ENTRIES; i++) {
+                char message[LINE_MAX], token[25];
+                struct iovec iovec[2];
+                unsigned n = 0;
+
+                /* Varied enough to fill several blocks */
+                random_token(token, sizeof(token) - 1);
+
+                if (i == NEEDLE_ENTRY)
+                        xsprintf(message, "MESSAGE=Found the needle in entry %u", i);
+                else
+                        xsprintf(message, "MESSAGE=Nothing to see in entry %u, request %s", i, token);
+
+                iovec[n++] = IOVEC_MAKE_STRING("PRIORITY=6");
+                if (i % 7 != 0)
+                        iovec[n++] = IOVEC_MAKE_STRING(message);
+
+                assert_se(journal_file_append_entry(f, NULL, NULL, iovec, n, NULL, NULL, NULL) == 0);
+        }
+}
+
+static unsigned count_entries(const char *dn, const char *hint, bool match, direction_t direction, unsigned *ret_found) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        unsigned n = 0, found = 0;
+        int r;
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+        assert_se(journal_set_message_hint(j, hint) >= 0);
+        if (match)
+                assert_se(sd_journal_add_match(j, "PRIORITY=6", 0) >= 0);
+
+        if (direction == DIRECTION_DOWN)
+                assert_se(sd_journal_seek_head(j) >= 0);
+        else
+                assert_se(sd_journal_seek_tail(j) >= 0);
+
+        while ((r = direction == DIRECTION_DOWN ? sd_journal_next(j) : sd_journal_previous(j)) > 0) {
+                const void *d;
+                size_t l;
+
+                n++;
+
+                if (sd_journal_get_data(j, "MESSAGE", &d, &l) >= 0 &&
+                    memmem(d, l, "needle", STRLEN("needle")))
+                        found++;
+        }
+        assert_se(r == 0);
+
+        *ret_found = found;
+        return n;
+}
+
+static void test_archive_and_search(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *dn = NULL;
+        _cleanup_free_ char *fn = NULL;
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        JournalFile *f;
+        unsigned n_idx = 0, n, found;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp_malloc("/var/tmp/journal-index-XXXXXX", &dn) >= 0);
+        (void) chattr_path(dn, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
+
+        assert_se(fn = path_join(dn, "test.journal"));
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_enable_index(f) == 0);
+
+        append_entries(f);
+
+        assert_se(journal_file_rotate(&f, false, UINT64_MAX, false, NULL) >= 0);
+        assert_se(f->index);
+        (void) journal_file_close(f);
+
+        assert_se(d = opendir(dn));
+        FOREACH_DIRENT(de, d, assert_se(false))
+                if (endswith(de->d_name, ".journal" JOURNAL_INDEX_SUFFIX))
+                        n_idx++;
+        assert_se(n_idx == 1);
+
+        /* Without the hint all entries are returned */
+        assert_se(count_entries(dn, NULL, false, DIRECTION_DOWN, &found) == N_ENTRIES);
+        assert_se(found == 1);
+
+        /* With the hint most of them are skipped, but never the one we look for */
+        n = count_entries(dn, "needle", false, DIRECTION_DOWN, &found);
+        log_info("Entries returned with hint: %u of %u", n, N_ENTRIES);
+        assert_se(n < N_ENTRIES);
+        assert_se(found == 1);
+
+        n = count_entries(dn, "NEEDLE", false, DIRECTION_UP, &found);
+        assert_se(n < N_ENTRIES);
+        assert_se(found == 1);
+
+        n = count_entries(dn, "needle", true, DIRECTION_DOWN, &found);
+        assert_se(n < N_ENTRIES);
+        assert_se(found == 1);
+
+        n = count_entries(dn, "needle", true, DIRECTION_UP, &found);
+        assert_se(n < N_ENTRIES);
+        assert_se(found == 1);
+
+        /* Vacuuming removes the index together with the archived file */
+        assert_se(journal_directory_vacuum(dn, 1, 0, 0, NULL, true) >= 0);
+
+        rewinddir(d);
+        FOREACH_DIRENT(de, d, assert_se(false))
+                assert_se(!endswith(de->d_name, JOURNAL_INDEX_SUFFIX));
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        test_trigrams();
+        test_blocks();
+        test_realistic_messages();
+        test_archive_and_search();
+
+        return 0;
+}
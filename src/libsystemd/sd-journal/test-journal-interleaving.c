@@ -140,7 +140,7 @@ static void mkdtemp_chdir_chattr(char *path) {
         (void) chattr_path(path, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
 }
 
-static void test_skip(void (*setup)(void)) {
+static void test_skip(void (*setup)(void), int flags) {
         char t[] = "/var/tmp/journal-skip-XXXXXX";
         sd_journal *j;
         int r;
@@ -151,7 +151,7 @@ static void test_skip(void (*setup)(void)) {
 
         /* Seek to head, iterate down.
          */
-        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_open_directory(&j, t, flags));
         assert_ret(sd_journal_seek_head(j));
         assert_ret(sd_journal_next(j));
         test_check_numbers_down(j, 4);
@@ -159,7 +159,7 @@ static void test_skip(void (*setup)(void)) {
 
         /* Seek to tail, iterate up.
          */
-        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_open_directory(&j, t, flags));
         assert_ret(sd_journal_seek_tail(j));
         assert_ret(sd_journal_previous(j));
         test_check_numbers_up(j, 4);
@@ -167,7 +167,7 @@ static void test_skip(void (*setup)(void)) {
 
         /* Seek to tail, skip to head, iterate down.
          */
-        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_open_directory(&j, t, flags));
         assert_ret(sd_journal_seek_tail(j));
         assert_ret(r = sd_journal_previous_skip(j, 4));
         assert_se(r == 4);
@@ -176,7 +176,7 @@ static void test_skip(void (*setup)(void)) {
 
         /* Seek to head, skip to tail, iterate up.
          */
-        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_open_directory(&j, t, flags));
         assert_ret(sd_journal_seek_head(j));
         assert_ret(r = sd_journal_next_skip(j, 4));
         assert_se(r == 4);
@@ -287,8 +287,11 @@ int main(int argc, char *argv[]) {
 
         arg_keep = argc > 1;
 
-        test_skip(setup_sequential);
-        test_skip(setup_interleaved);
+        test_skip(setup_sequential, 0);
+        test_skip(setup_interleaved, 0);
+
+        test_skip(setup_sequential, SD_JOURNAL_PARALLEL);
+        test_skip(setup_interleaved, SD_JOURNAL_PARALLEL);
 
         test_sequence_numbers();
 
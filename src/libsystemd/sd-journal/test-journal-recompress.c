@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "format-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "journal-index.h"
+#include "journal-recompress.h"
+#include "journal-verify.h"
+#include "log.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "tmpfile-util.h"
+#include "xattr-util.h"
+
+static unsigned arg_n_entries;
+
+static const char* const words[] = {
+        "connection", "established", "from", "client", "request", "handled", "in", "ms",
+        "status", "ok", "failed", "retrying", "worker", "queue", "length", "timeout",
+};
+
+static char* archived_journal(const char *dir) {
+        _cleanup_free_ char *fn = NULL;
+        JournalMetrics metrics;
+        char *archived;
+        JournalFile *f;
+
+        /* Like journald, which sizes the hash tables from the metrics */
+        journal_reset_metrics(&metrics);
+
+        assert_se(fn = path_join(dir, "test.journal"));
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0640, true, UINT64_MAX, false, &metrics, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_enable_index(f) >= 0);
+
+        for (unsigned i = 0; i < arg_n_entries; i++) {
+                char message[STRLEN("MESSAGE=") + 1024], unit[STRLEN("_SYSTEMD_UNIT=.service") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[2];
+                dual_timestamp ts;
+                size_t l;
+
+                /* Log lines made of a small vocabulary, a few of them long enough to be compressed */
+                l = strlen(strcpy(message, "MESSAGE="));
+                for (unsigned k = 0; k < (i % 7 == 0 ? 96 : 12); k++) {
+                        const char *w = words[(i * 7 + k * 3 + k / 5) % ELEMENTSOF(words)];
+
+                        l += strlen(strcpy(message + l, w));
+                        message[l++] = ' ';
+                }
+                l += sprintf(message + l, "%u", i);
+
+                xsprintf(unit, "_SYSTEMD_UNIT=%u.service", i % 13);
+
+                iovec[0] = IOVEC_MAKE(message, l);
+                iovec[1] = IOVEC_MAKE_STRING(unit);
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(journal_file_archived_path(f, &archived) >= 0);
+        assert_se(journal_file_archive(f) >= 0);
+        (void) journal_file_close(f);
+
+        return archived;
+}
+
+static char** read_entries(const char *dir) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        _cleanup_strv_free_ char **l = NULL;
+        size_t n = 0;
+
+        /* Returns the cursor of each entry, followed by its MESSAGE= field */
+
+        assert_se(sd_journal_open_directory(&j, dir, 0) >= 0);
+
+        SD_JOURNAL_FOREACH(j) {
+                const void *d;
+                size_t k;
+
+                assert_se(GREEDY_REALLOC(l, n + 3));
+
+                assert_se(sd_journal_get_cursor(j, l + n) >= 0);
+                assert_se(sd_journal_get_data(j, "MESSAGE", &d, &k) >= 0);
+                assert_se(l[n + 1] = strndup(d, k));
+
+                n += 2;
+                l[n] = NULL;
+        }
+
+        return TAKE_PTR(l);
+}
+
+static void test_recompress(void) {
+        _cleanup_(rm_rf_physical_and_freep) char *dir = NULL;
+        _cleanup_(journal_index_freep) JournalIndex *index = NULL;
+        _cleanup_strv_free_ char **before = NULL, **after = NULL;
+        _cleanup_free_ char *archived = NULL, *active = NULL, *idx = NULL, *level = NULL;
+        JournalFile *f;
+        struct stat st_before, st_after;
+        uint64_t freed = 0;
+        usec_t t;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp_malloc("/tmp/test-journal-recompress-XXXXXX", &dir) >= 0);
+        assert_se(archived = archived_journal(dir));
+        assert_se(idx = strjoin(archived, JOURNAL_INDEX_SUFFIX));
+        assert_se(access(idx, F_OK) >= 0);
+
+        before = read_entries(dir);
+        assert_se(strv_length(before) == 2 * arg_n_entries);
+        assert_se(stat(archived, &st_before) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+        assert_se(journal_file_recompress(archived, JOURNAL_RECOMPRESS_LEVEL, NULL, &freed) == 1);
+        t = now(CLOCK_MONOTONIC) - t;
+        assert_se(freed > 0);
+
+        assert_se(stat(archived, &st_after) >= 0);
+        assert_se(st_after.st_blocks < st_before.st_blocks);
+        log_info("%u entries: %s before, %s after recompressing in %s",
+                 arg_n_entries,
+                 FORMAT_BYTES((uint64_t) st_before.st_blocks * 512U),
+                 FORMAT_BYTES((uint64_t) st_after.st_blocks * 512U),
+                 FORMAT_TIMESPAN(t, USEC_PER_MSEC));
+
+        /* Same entries, same cursors */
+        after = read_entries(dir);
+        assert_se(strv_equal(before, after));
+
+        /* The message index still applies */
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->header->state == STATE_ARCHIVED);
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, 0, false) >= 0);
+        assert_se(journal_index_load(idx, f->header->file_id, &index) >= 0);
+        (void) journal_file_close(f);
+
+        /* Done once is enough, if the file system lets us remember that */
+        if (getxattr_malloc(archived, JOURNAL_RECOMPRESS_XATTR, &level) >= 0) {
+                assert_se(streq(level, STRINGIFY(JOURNAL_RECOMPRESS_LEVEL)));
+                assert_se(journal_file_recompress(archived, JOURNAL_RECOMPRESS_LEVEL, NULL, NULL) == 0);
+        }
+
+        /* Files that are still written to are left alone */
+        assert_se(active = path_join(dir, "active.journal"));
+        assert_se(journal_file_open(-1, active, O_RDWR|O_CREAT, 0640, true, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_recompress(active, JOURNAL_RECOMPRESS_LEVEL, NULL, NULL) == -EBUSY);
+        (void) journal_file_close(f);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+#if !HAVE_ZSTD
+        return log_tests_skipped("zstd support is not available");
+#endif
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_entries) >= 0 && arg_n_entries > 0);
+        else
+                arg_n_entries = slow_tests_enabled() ? 200000 : 20000;
+
+        test_recompress();
+
+        return 0;
+}
@@ -0,0 +1,308 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "journal-ring.h"
+#include "memfd-util.h"
+#include "parse-util.h"
+#include "process-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+
+#define N_THREADS 4U
+
+static unsigned arg_n_messages;
+static JournalRing *producer_ring;
+
+static void test_map(void) {
+        _cleanup_(journal_ring_freep) JournalRing *client = NULL, *server = NULL;
+        _cleanup_close_ int fd = -1, unsealed = -1;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_ring_new(&fd, &client) >= 0);
+        assert_se(journal_ring_get_state(client) == JOURNAL_RING_NEW);
+
+        /* A memfd that can still be truncated is refused */
+        assert_se((unsealed = memfd_new("test-journal-ring")) >= 0);
+        assert_se(memfd_set_size(unsealed, JOURNAL_RING_HEADER_SIZE + JOURNAL_RING_DATA_SIZE) >= 0);
+        assert_se(journal_ring_map(unsealed, &server) == -EPERM);
+
+        assert_se(journal_ring_map(fd, &server) >= 0);
+        assert_se(server->data_size == JOURNAL_RING_DATA_SIZE);
+
+        journal_ring_set_state(server, JOURNAL_RING_ACTIVE);
+        assert_se(journal_ring_get_state(client) == JOURNAL_RING_ACTIVE);
+}
+
+static void test_fork(void) {
+        _cleanup_(journal_ring_freep) JournalRing *client = NULL;
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_ring_new(&fd, &client) >= 0);
+
+        /* Child processes don't get the ring mapped */
+        r = safe_fork("(test-journal-ring)", FORK_DEATHSIG|FORK_LOG|FORK_WAIT, NULL);
+        assert_se(r >= 0);
+        if (r == 0) {
+                unsigned char vec;
+
+                assert_se(mincore(client->header, page_size(), &vec) < 0 && errno == ENOMEM);
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(journal_ring_get_state(client) == JOURNAL_RING_NEW);
+}
+
+static void test_read_write(void) {
+        _cleanup_(journal_ring_freep) JournalRing *client = NULL, *server = NULL;
+        _cleanup_free_ char *buffer = NULL, *large = NULL;
+        _cleanup_close_ int fd = -1;
+        struct iovec iovec[2];
+        unsigned n_written = 0, n_read = 0;
+        size_t size;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_ring_new(&fd, &client) >= 0);
+        assert_se(journal_ring_map(fd, &server) >= 0);
+
+        assert_se(journal_ring_read(server, &buffer, &size) == 0);
+
+        /* Nobody is waiting yet, hence no wakeup */
+        iovec[0] = IOVEC_MAKE_STRING("MESSAGE=");
+        iovec[1] = IOVEC_MAKE_STRING("first");
+        assert_se(journal_ring_write(client, iovec, 2) == 0);
+
+        /* There's a record, so don't go to sleep */
+        assert_se(!journal_ring_wait(server));
+
+        assert_se(journal_ring_read(server, &buffer, &size) > 0);
+        assert_se(size == STRLEN("MESSAGE=first"));
+        assert_se(streq(buffer, "MESSAGE=first"));
+        assert_se(journal_ring_read(server, &buffer, &size) == 0);
+
+        /* Now the first writer has to wake us up, but only that one */
+        assert_se(journal_ring_wait(server));
+        iovec[1] = IOVEC_MAKE_STRING("second");
+        assert_se(journal_ring_write(client, iovec, 2) > 0);
+        iovec[1] = IOVEC_MAKE_STRING("third");
+        assert_se(journal_ring_write(client, iovec, 2) == 0);
+
+        assert_se(journal_ring_read(server, &buffer, &size) > 0);
+        assert_se(streq(buffer, "MESSAGE=second"));
+        assert_se(journal_ring_read(server, &buffer, &size) > 0);
+        assert_se(streq(buffer, "MESSAGE=third"));
+        assert_se(journal_ring_read(server, &buffer, &size) == 0);
+
+        /* Messages that would take up too much of the ring are refused */
+        assert_se(large = malloc(JOURNAL_RING_DATA_SIZE / 8 + 1));
+        memset(large, 'x', JOURNAL_RING_DATA_SIZE / 8 + 1);
+        iovec[0] = IOVEC_MAKE(large, JOURNAL_RING_DATA_SIZE / 8 + 1);
+        assert_se(journal_ring_write(client, iovec, 1) == -E2BIG);
+
+        /* Fill up the ring, read it empty, and do that again so that records wrap around the end */
+        iovec[0] = IOVEC_MAKE(large, 1000);
+        for (unsigned k = 0; k < 3; k++) {
+                unsigned n = 0;
+
+                while ((r = journal_ring_write(client, iovec, 1)) >= 0)
+                        n++;
+                assert_se(r == -ENOBUFS);
+                assert_se(n > 0);
+                n_written += n;
+
+                while ((r = journal_ring_read(server, &buffer, &size)) > 0) {
+                        assert_se(size == 1000);
+                        assert_se(memcmp(buffer, large, 1000) == 0);
+                        n_read++;
+                }
+                assert_se(r == 0);
+                assert_se(n_read == n_written);
+
+                /* Shift things a bit, so that the records end up in different places next time */
+                iovec[1] = IOVEC_MAKE_STRING("x");
+                assert_se(journal_ring_write(client, iovec + 1, 1) == 0);
+                assert_se(journal_ring_read(server, &buffer, &size) > 0);
+        }
+}
+
+static void test_wrap_around(void) {
+        _cleanup_(journal_ring_freep) JournalRing *client = NULL, *server = NULL;
+        _cleanup_free_ char *buffer = NULL, *payload = NULL;
+        _cleanup_close_ int fd = -1;
+        uint64_t written = 0, read = 0;
+        size_t size;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_ring_new(&fd, &client) >= 0);
+        assert_se(journal_ring_map(fd, &server) >= 0);
+
+        /* Payloads consisting of words that look like record states, so that anything read from where a
+         * record used to be looks like a record */
+        assert_se(payload = malloc(JOURNAL_RING_DATA_SIZE / 8));
+        for (size_t i = 0; i < JOURNAL_RING_DATA_SIZE / 8 / sizeof(uint32_t); i++)
+                ((uint32_t*) payload)[i] = 1 + i % 2;
+
+        /* Pass through the ring a couple of times with records of all kinds of sizes, reading some
+         * behind */
+        for (unsigned i = 0; written < 4 * JOURNAL_RING_DATA_SIZE; i++) {
+                size_t l = (i * 7919) % 4096 + (i % 64 == 0 ? JOURNAL_RING_DATA_SIZE / 16 : 0);
+
+                while ((r = journal_ring_write(client, &IOVEC_MAKE(payload, l), 1)) == -ENOBUFS) {
+                        assert_se(journal_ring_read(server, &buffer, &size) > 0);
+                        assert_se(memcmp(buffer, payload, size) == 0);
+                        read += size;
+                }
+                assert_se(r >= 0);
+                written += l;
+        }
+
+        while ((r = journal_ring_read(server, &buffer, &size)) > 0) {
+                assert_se(memcmp(buffer, payload, size) == 0);
+                read += size;
+        }
+        assert_se(r == 0);
+        assert_se(read == written);
+
+        /* A client reserved space, but didn't get to writing the record yet: nothing to read */
+        client->header->head += 4096;
+        assert_se(journal_ring_read(server, &buffer, &size) == 0);
+}
+
+static void test_corrupted(void) {
+        _cleanup_(journal_ring_freep) JournalRing *client = NULL, *server = NULL;
+        _cleanup_free_ char *buffer = NULL;
+        _cleanup_close_ int fd = -1;
+        size_t size;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_ring_new(&fd, &client) >= 0);
+        assert_se(journal_ring_map(fd, &server) >= 0);
+
+        assert_se(journal_ring_write(client, &IOVEC_MAKE_STRING("MESSAGE=foo"), 1) == 0);
+
+        /* A record claiming to be larger than what was reserved */
+        ((uint32_t*) client->data)[0] = JOURNAL_RING_DATA_SIZE / 2;
+        assert_se(journal_ring_read(server, &buffer, &size) == -EBADMSG);
+
+        /* A head far beyond the tail */
+        ((uint32_t*) client->data)[0] = STRLEN("MESSAGE=foo");
+        client->header->head += JOURNAL_RING_DATA_SIZE * 2;
+        assert_se(journal_ring_read(server, &buffer, &size) == -EBADMSG);
+}
+
+static void *producer(void *p) {
+        JournalRing *client = producer_ring;
+        unsigned id = PTR_TO_UINT(p);
+
+        for (unsigned i = 0; i < arg_n_messages; i++) {
+                char buf[STRLEN("MESSAGE=") + 2 * DECIMAL_STR_MAX(unsigned) + 1];
+                int r;
+
+                xsprintf(buf, "MESSAGE=%u %u", id, i);
+
+                while ((r = journal_ring_write(client, &IOVEC_MAKE_STRING(buf), 1)) == -ENOBUFS)
+                        (void) usleep(100);
+                assert_se(r >= 0);
+
+                if (r > 0)
+                        assert_se(loop_write(client->wakeup_fd, "", 1, false) >= 0);
+        }
+
+        return NULL;
+}
+
+static void test_threads(void) {
+        _cleanup_(journal_ring_freep) JournalRing *client = NULL, *server = NULL;
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        _cleanup_free_ char *buffer = NULL;
+        _cleanup_close_ int fd = -1;
+        pthread_t threads[N_THREADS];
+        unsigned n_read = 0, n_wakeups = 0, next[N_THREADS] = {};
+        usec_t start, t;
+        size_t size;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(journal_ring_new(&fd, &client) >= 0);
+        assert_se(journal_ring_map(fd, &server) >= 0);
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+        client->wakeup_fd = pair[0];
+        producer_ring = client;
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (unsigned i = 0; i < N_THREADS; i++)
+                assert_se(pthread_create(threads + i, NULL, producer, UINT_TO_PTR(i)) == 0);
+
+        /* Read like journald does: as long as there are records keep going, otherwise wait to be woken
+         * up. Every message must show up exactly once, in order for each thread. */
+        while (n_read < N_THREADS * arg_n_messages) {
+                r = journal_ring_read(server, &buffer, &size);
+                assert_se(r >= 0);
+                if (r > 0) {
+                        unsigned id, i;
+
+                        assert_se(sscanf(buffer, "MESSAGE=%u %u", &id, &i) == 2);
+                        assert_se(id < N_THREADS);
+                        assert_se(i == next[id]);
+                        next[id]++;
+                        n_read++;
+                        continue;
+                }
+
+                if (!journal_ring_wait(server))
+                        continue;
+
+                assert_se(fd_wait_for_event(pair[1], POLLIN, USEC_INFINITY) >= 0);
+                assert_se(flush_fd(pair[1]) >= 0);
+                n_wakeups++;
+        }
+
+        for (unsigned i = 0; i < N_THREADS; i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
+
+        t = now(CLOCK_MONOTONIC) - start;
+
+        assert_se(journal_ring_read(server, &buffer, &size) == 0);
+
+        client->wakeup_fd = -1;
+
+        log_info("Passed %u messages from %u threads in %s (%.0f messages/s), %u wakeups",
+                 n_read, N_THREADS, FORMAT_TIMESPAN(t, USEC_PER_MSEC),
+                 n_read / ((double) t / USEC_PER_SEC), n_wakeups);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_messages) >= 0 && arg_n_messages > 0);
+        else
+                arg_n_messages = slow_tests_enabled() ? 1000000 : 50000;
+
+        test_map();
+        test_fork();
+        test_read_write();
+        test_wrap_around();
+        test_corrupted();
+        test_threads();
+
+        return 0;
+}
@@ -0,0 +1,212 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "chattr-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fs-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "journal-vacuum.h"
+#include "log.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "tmpfile-util.h"
+
+static unsigned arg_n_files;
+
+static void create_files(const char *dn, unsigned n_files) {
+        _cleanup_close_ int dfd = -1;
+        _cleanup_free_ char *fn = NULL;
+        sd_id128_t seqnum_id;
+        JournalFile *f;
+        Header header = {
+                .n_entries = htole64(1),
+        };
+        usec_t realtime;
+
+        /* The active file is a real one */
+        assert_se(fn = path_join(dn, "system.journal"));
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        (void) journal_file_close(f);
+
+        /* Vacuuming only looks at the names and the number of entries of archived files, hence a header is
+         * enough for those, and we don't need megabytes of disk space for each of them. Their entries are
+         * from the past, so that the file names determine the order and not the file timestamps. */
+        assert_se((dfd = open(dn, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) >= 0);
+        assert_se(sd_id128_randomize(&seqnum_id) >= 0);
+        realtime = now(CLOCK_REALTIME) - USEC_PER_DAY;
+
+        for (unsigned i = 0; i < n_files; i++) {
+                char name[STRLEN("system@.journal") + SD_ID128_STRING_MAX + 2 * 17];
+                _cleanup_close_ int fd = -1;
+
+                xsprintf(name, "system@" SD_ID128_FORMAT_STR "-%016x-%016" PRIx64 ".journal",
+                         SD_ID128_FORMAT_VAL(seqnum_id), i + 1, realtime + i * USEC_PER_SEC);
+
+                assert_se((fd = openat(dfd, name, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644)) >= 0);
+                assert_se(loop_write(fd, &header, sizeof(header), false) >= 0);
+        }
+}
+
+static uint64_t directory_usage(const char *dn, unsigned *ret_n_archived) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        uint64_t usage = 0;
+        unsigned n = 0;
+
+        assert_se(d = opendir(dn));
+
+        FOREACH_DIRENT(de, d, assert_se(false)) {
+                struct stat st;
+
+                if (!endswith(de->d_name, ".journal"))
+                        continue;
+
+                assert_se(fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) >= 0);
+                usage += (uint64_t) st.st_blocks * 512UL;
+
+                if (strchr(de->d_name, '@'))
+                        n++;
+        }
+
+        if (ret_n_archived)
+                *ret_n_archived = n;
+
+        return usage;
+}
+
+static void test_index(void) {
+        _cleanup_(journal_vacuum_index_freep) JournalVacuumIndex *idx = NULL;
+        _cleanup_(rm_rf_physical_and_freep) char *dn = NULL;
+        _cleanup_free_ char *fn = NULL, *archived = NULL, *unknown = NULL;
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        usec_t oldest = 0, first = USEC_INFINITY;
+        unsigned n;
+        JournalFile *f;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp_malloc("/var/tmp/journal-vacuum-XXXXXX", &dn) >= 0);
+        (void) chattr_path(dn, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
+
+        create_files(dn, 20);
+
+        assert_se(journal_vacuum_index_new(dn, &idx) >= 0);
+
+        /* The directory is read once, and then only again when it changed */
+        assert_se(journal_vacuum_index_refresh(idx) > 0);
+        assert_se(journal_vacuum_index_refresh(idx) == 0);
+        assert_se(journal_vacuum_index_usage(idx) == directory_usage(dn, &n));
+        assert_se(n == 20);
+
+        assert_se(unknown = path_join(dn, "unknown"));
+        assert_se(touch(unknown) >= 0);
+        assert_se(journal_vacuum_index_refresh(idx) > 0);
+        assert_se(journal_vacuum_index_usage(idx) == directory_usage(dn, NULL));
+
+        /* Only the oldest files are deleted, and the index knows about it without reading the directory
+         * again */
+        assert_se(d = opendir(dn));
+        FOREACH_DIRENT(de, d, assert_se(false)) {
+                const char *e;
+                unsigned long long realtime;
+
+                e = strrchr(de->d_name, '-');
+                if (e && sscanf(e, "-%16llx.journal", &realtime) == 1)
+                        first = MIN(first, (usec_t) realtime);
+        }
+        assert_se(first != USEC_INFINITY);
+
+        assert_se(journal_vacuum_index_vacuum(idx, 0, 11, 0, &oldest, true) >= 0);
+        assert_se(journal_vacuum_index_refresh(idx) == 0);
+        assert_se(journal_vacuum_index_usage(idx) == directory_usage(dn, &n));
+        assert_se(n == 10);
+        assert_se(oldest == first + 10 * USEC_PER_SEC);
+
+        /* Rotation tells the index about the file it archived and the one it created */
+        assert_se(fn = path_join(dn, "system.journal"));
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_append_entry(f, &(dual_timestamp) { now(CLOCK_REALTIME), now(CLOCK_MONOTONIC) },
+                                            NULL, &IOVEC_MAKE_STRING("MESSAGE=rotated"), 1, NULL, NULL, NULL) == 0);
+        assert_se(journal_file_archived_path(f, &archived) >= 0);
+        assert_se(journal_file_rotate(&f, false, UINT64_MAX, false, NULL) >= 0);
+        (void) journal_file_close(f);
+
+        assert_se(journal_vacuum_index_update(idx, last_path_component(archived)) > 0);
+        assert_se(journal_vacuum_index_update(idx, "system.journal") > 0);
+        assert_se(journal_vacuum_index_refresh(idx) == 0);
+        assert_se(journal_vacuum_index_usage(idx) == directory_usage(dn, &n));
+        assert_se(n == 11);
+
+        /* Files that are removed behind our back are noticed too */
+        assert_se(unlinkat(AT_FDCWD, archived, 0) >= 0);
+        assert_se(journal_vacuum_index_refresh(idx) > 0);
+        assert_se(journal_vacuum_index_usage(idx) == directory_usage(dn, &n));
+        assert_se(n == 10);
+
+        /* Unknown files are never vacuumed */
+        assert_se(journal_vacuum_index_vacuum(idx, 1, 0, 0, NULL, true) >= 0);
+        assert_se(directory_usage(dn, &n) == journal_vacuum_index_usage(idx));
+        assert_se(n == 0);
+        assert_se(access(unknown, F_OK) >= 0);
+}
+
+static void test_benchmark(void) {
+        _cleanup_(journal_vacuum_index_freep) JournalVacuumIndex *idx = NULL;
+        _cleanup_(rm_rf_physical_and_freep) char *dn = NULL;
+        usec_t start, t[2];
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp_malloc("/var/tmp/journal-vacuum-XXXXXX", &dn) >= 0);
+        (void) chattr_path(dn, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
+
+        create_files(dn, arg_n_files);
+
+        /* Nothing is deleted, this is what journald does on every rotation and space check */
+
+        start = now(CLOCK_MONOTONIC);
+        for (unsigned i = 0; i < 10; i++)
+                assert_se(journal_directory_vacuum(dn, UINT64_MAX, 0, 0, NULL, false) >= 0);
+        t[0] = (now(CLOCK_MONOTONIC) - start) / 10;
+
+        assert_se(journal_vacuum_index_new(dn, &idx) >= 0);
+        assert_se(journal_vacuum_index_refresh(idx) > 0);
+
+        start = now(CLOCK_MONOTONIC);
+        for (unsigned i = 0; i < 10; i++)
+                assert_se(journal_vacuum_index_vacuum(idx, UINT64_MAX, 0, 0, NULL, false) >= 0);
+        t[1] = (now(CLOCK_MONOTONIC) - start) / 10;
+
+        log_info("%u files: vacuuming took %s reading the directory, %s with the index",
+                 arg_n_files, FORMAT_TIMESPAN(t[0], 1), FORMAT_TIMESPAN(t[1], 1));
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_files) >= 0 && arg_n_files > 0);
+        else
+                arg_n_files = slow_tests_enabled() ? 5000 : 500;
+
+        test_index();
+        test_benchmark();
+
+        return 0;
+}
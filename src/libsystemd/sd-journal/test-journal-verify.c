@@ -37,7 +37,7 @@ static void bit_toggle(const char *fn, uint64_t p) {
         safe_close(fd);
 }
 
-static int raw_verify(const char *fn, const char *verification_key) {
+static int raw_verify(const char *fn, const char *verification_key, unsigned n_threads) {
         JournalFile *f;
         int r;
 
@@ -45,12 +45,56 @@ static int raw_verify(const char *fn, const char *verification_key) {
         if (r < 0)
                 return r;
 
-        r = journal_file_verify(f, verification_key, NULL, NULL, NULL, false);
+        r = journal_file_verify(f, verification_key, NULL, NULL, NULL, n_threads, false);
         (void) journal_file_close(f);
 
         return r;
 }
 
+static void test_parallel(const char *fn) {
+        unsigned n_failed = 0;
+        JournalFile *f;
+        uint64_t end;
+        int level;
+
+        log_info("Comparing verification with several threads...");
+
+        assert_se(journal_file_open(-1, fn, O_RDONLY, 0666, true, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        end = le64toh(f->header->tail_object_offset);
+        (void) journal_file_close(f);
+
+        assert_se(raw_verify(fn, NULL, 4) >= 0);
+
+        /* Both must agree on whether a damaged file is fine. Errors are expected here, don't spam the
+         * log with them. */
+        level = log_get_max_level();
+        log_set_max_level(LOG_CRIT);
+
+        for (uint64_t k = 0; k < 200; k++) {
+                uint64_t p = (sizeof(Header) + k * (end - sizeof(Header)) / 200) * 8 + k % 8;
+                int a, b;
+
+                bit_toggle(fn, p);
+
+                a = raw_verify(fn, NULL, 1);
+                b = raw_verify(fn, NULL, 4);
+                if ((a >= 0) != (b >= 0))
+                        log_emergency("Bit %"PRIu64": %i with one thread, %i with four.", p, a, b);
+                assert_se((a >= 0) == (b >= 0));
+
+                n_failed += a < 0;
+
+                bit_toggle(fn, p);
+        }
+
+        log_set_max_level(level);
+
+        log_info("%u of 200 damaged files failed verification.", n_failed);
+        assert_se(n_failed > 0);
+
+        assert_se(raw_verify(fn, NULL, 4) >= 0);
+}
+
 int main(int argc, char *argv[]) {
         char t[] = "/var/tmp/journal-XXXXXX";
         unsigned n;
@@ -98,7 +142,7 @@ int main(int argc, char *argv[]) {
         /* journal_file_print_header(f); */
         journal_file_dump(f);
 
-        assert_se(journal_file_verify(f, verification_key, &from, &to, &total, true) >= 0);
+        assert_se(journal_file_verify(f, verification_key, &from, &to, &total, 0, true) >= 0);
 
         if (verification_key && JOURNAL_HEADER_SEALED(f->header))
                 log_info("=> Validated from %s to %s, %s missing",
@@ -108,6 +152,9 @@ int main(int argc, char *argv[]) {
 
         (void) journal_file_close(f);
 
+        if (!verification_key)
+                test_parallel("test.journal");
+
         if (verification_key) {
                 log_info("Toggling bits...");
 
@@ -118,7 +165,7 @@ int main(int argc, char *argv[]) {
 
                         log_info("[ %"PRIu64"+%"PRIu64"]", p / 8, p % 8);
 
-                        if (raw_verify("test.journal", verification_key) >= 0)
+                        if (raw_verify("test.journal", verification_key, 0) >= 0)
                                 log_notice(ANSI_HIGHLIGHT_RED ">>>> %"PRIu64" (bit %"PRIu64") can be toggled without detection." ANSI_NORMAL, p / 8, p % 8);
 
                         bit_toggle("test.journal", p);
@@ -3,13 +3,18 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "sd-journal.h"
+
 #include "chattr-util.h"
 #include "io-util.h"
 #include "journal-authenticate.h"
 #include "journal-file.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
 #include "log.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
 #include "tests.h"
 
 static bool arg_keep = false;
@@ -157,6 +162,96 @@ static void test_empty(void) {
         (void) journal_file_close(f4);
 }
 
+static unsigned count_matching(const char *dir, const char *match) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        unsigned n = 0;
+
+        assert_se(sd_journal_open_directory(&j, dir, 0) >= 0);
+        assert_se(sd_journal_add_match(j, match, 0) >= 0);
+
+        SD_JOURNAL_FOREACH(j)
+                n++;
+
+        return n;
+}
+
+static bool bloom_excludes(JournalFile *f, const char *data) {
+        return journal_file_bloom_excludes(f, data, strlen(data), journal_file_hash_data(f, data, strlen(data)));
+}
+
+static void test_bloom(void) {
+        char t[] = "/var/tmp/journal-bloom-XXXXXX";
+        _cleanup_free_ char *archived = NULL;
+        unsigned false_positives = 0;
+        dual_timestamp ts;
+        JournalFile *f;
+
+        log_info("/* %s */", __func__);
+
+        mkdtemp_chdir_chattr(t);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (unsigned i = 0; i < 1000; i++) {
+                char unit[STRLEN("_SYSTEMD_UNIT=unit-.service") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[2];
+
+                xsprintf(unit, "_SYSTEMD_UNIT=unit-%u.service", i % 100);
+                iovec[0] = IOVEC_MAKE_STRING(unit);
+                iovec[1] = IOVEC_MAKE_STRING("MESSAGE=hello");
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) == 0);
+        }
+
+        /* Only archived files get a filter */
+        assert_se(!bloom_excludes(f, "_SYSTEMD_UNIT=other.service"));
+
+        assert_se(journal_file_archived_path(f, &archived) >= 0);
+        assert_se(journal_file_archive(f) >= 0);
+        assert_se(f->header->bloom_offset != 0);
+        (void) journal_file_close(f);
+
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, 0, false) >= 0);
+
+        /* No false negatives */
+        for (unsigned i = 0; i < 100; i++) {
+                char unit[STRLEN("_SYSTEMD_UNIT=unit-.service") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(unit, "_SYSTEMD_UNIT=unit-%u.service", i);
+                assert_se(!bloom_excludes(f, unit));
+        }
+
+        /* Few false positives */
+        for (unsigned i = 100; i < 10100; i++) {
+                char unit[STRLEN("_SYSTEMD_UNIT=unit-.service") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(unit, "_SYSTEMD_UNIT=unit-%u.service", i);
+                if (!bloom_excludes(f, unit))
+                        false_positives++;
+        }
+        log_info("%u false positives in 10000 lookups", false_positives);
+        assert_se(false_positives < 500);
+
+        /* Fields not in the filter, or without any values at all */
+        assert_se(!bloom_excludes(f, "MESSAGE=bye"));
+        assert_se(!bloom_excludes(f, "UNIT"));
+        assert_se(bloom_excludes(f, "SYSLOG_IDENTIFIER=foo"));
+
+        (void) journal_file_close(f);
+
+        /* Matches still do the right thing */
+        assert_se(count_matching(t, "_SYSTEMD_UNIT=unit-7.service") == 10);
+        assert_se(count_matching(t, "_SYSTEMD_UNIT=unit-100.service") == 0);
+        assert_se(count_matching(t, "MESSAGE=hello") == 1000);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
 #if HAVE_COMPRESSION
 static bool check_compressed(uint64_t compress_threshold, uint64_t data_size) {
         dual_timestamp ts;
@@ -251,6 +346,7 @@ int main(int argc, char *argv[]) {
 
         test_non_empty();
         test_empty();
+        test_bloom();
 #if HAVE_COMPRESSION
         test_min_compress_size();
 #endif
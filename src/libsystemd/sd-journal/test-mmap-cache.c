@@ -5,13 +5,27 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include "alloc-util.h"
 #include "fd-util.h"
+#include "fs-util.h"
+#include "io-util.h"
+#include "log.h"
 #include "macro.h"
 #include "mmap-cache.h"
+#include "parse-util.h"
+#include "tests.h"
+#include "time-util.h"
 #include "tmpfile-util.h"
 #include "util.h"
 
-int main(int argc, char *argv[]) {
+/* Big enough for windows to grow beyond their initial size, small enough for every run */
+#define SEQUENTIAL_SIZE_MIB_DEFAULT 16U
+
+/* The size of the file read sequentially, in MiB. Anything beyond the default makes it a throughput
+ * benchmark, on a cold page cache. */
+static unsigned arg_size_mib;
+
+static void test_basic(void) {
         MMapFileDescriptor *fx;
         int x, y, z, r;
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
@@ -61,6 +75,103 @@ int main(int argc, char *argv[]) {
         safe_close(x);
         safe_close(y);
         safe_close(z);
+}
+
+#define OBJECT_SIZE 64U
+
+static uint64_t read_objects(MMapCache *m, MMapFileDescriptor *f, struct stat *st, bool forward) {
+        uint64_t sum = 0, n = st->st_size / OBJECT_SIZE;
+
+        /* Walk through the file in small steps, like iterating through the objects of a journal file does */
+        for (uint64_t i = 0; i < n; i++) {
+                uint64_t offset = (forward ? i : n - i - 1) * OBJECT_SIZE;
+                void *p;
+
+                assert_se(mmap_cache_get(m, f, 0, false, offset, OBJECT_SIZE, st, &p) > 0);
+                assert_se(*(uint64_t*) p == offset);
+
+                sum += *(uint64_t*) p;
+        }
+
+        return sum;
+}
+
+static void test_sequential(void) {
+        _cleanup_(unlink_tempfilep) char fn[] = "/var/tmp/test-mmap-cache-XXXXXX";
+        _cleanup_free_ uint64_t *buf = NULL;
+        _cleanup_close_ int fd = -1;
+        MMapFileDescriptor *f;
+        uint64_t size, expected = 0;
+        bool benchmark = arg_size_mib > SEQUENTIAL_SIZE_MIB_DEFAULT;
+        struct stat st;
+        MMapCache *m;
+
+        log_info("/* %s */", __func__);
+
+        fd = mkostemp_safe(fn);
+        assert_se(fd >= 0);
+
+        /* Every 64 bit word contains its own offset, so that we can tell whether we read the right thing */
+        size = (uint64_t) arg_size_mib * 1024U * 1024U;
+        assert_se(buf = new(uint64_t, 1024U * 1024U / sizeof(uint64_t)));
+        for (uint64_t offset = 0; offset < size; offset += 1024U * 1024U) {
+                for (size_t i = 0; i < 1024U * 1024U / sizeof(uint64_t); i++)
+                        buf[i] = offset + i * sizeof(uint64_t);
+
+                assert_se(loop_write(fd, buf, 1024U * 1024U, false) >= 0);
+        }
+        assert_se(fstat(fd, &st) >= 0);
+
+        for (uint64_t i = 0; i < size / OBJECT_SIZE; i++)
+                expected += i * OBJECT_SIZE;
+
+        for (unsigned k = 0; k < 2; k++) {
+                bool forward = k == 0;
+                usec_t start, end;
+                void *p, *q;
+
+                /* When benchmarking, start with a cold cache, the interesting case is how quickly data
+                 * comes in from disk */
+                if (benchmark) {
+                        assert_se(fdatasync(fd) >= 0);
+                        assert_se(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+                }
+
+                assert_se(m = mmap_cache_new());
+                assert_se(f = mmap_cache_add_fd(m, fd, PROT_READ));
+
+                start = now(CLOCK_MONOTONIC);
+                assert_se(read_objects(m, f, &st, forward) == expected);
+                end = now(CLOCK_MONOTONIC);
+
+                log_info("Read %u MiB %s in %s (%.1f MiB/s)",
+                         arg_size_mib, forward ? "forward" : "backward",
+                         FORMAT_TIMESPAN(end - start, USEC_PER_MSEC),
+                         arg_size_mib / ((double) (end - start) / USEC_PER_SEC));
+
+                /* Another context finds what was read last in the same window */
+                assert_se(mmap_cache_get(m, f, 0, false, forward ? size - OBJECT_SIZE : 0, OBJECT_SIZE, &st, &p) > 0);
+                assert_se(mmap_cache_get(m, f, 1, false, forward ? size - OBJECT_SIZE : 0, OBJECT_SIZE, &st, &q) > 0);
+                assert_se(p == q);
+                assert_se(*(uint64_t*) q == (forward ? size - OBJECT_SIZE : 0));
+
+                mmap_cache_stats_log_debug(m);
+
+                mmap_cache_free_fd(m, f);
+                mmap_cache_unref(m);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_size_mib) >= 0 && arg_size_mib > 0);
+        else
+                arg_size_mib = slow_tests_enabled() ? 1024 : SEQUENTIAL_SIZE_MIB_DEFAULT;
+
+        test_basic();
+        test_sequential();
 
         return 0;
 }
@@ -210,13 +210,39 @@ static int get_data_newline(JournalImporter *imp) {
         return 1;
 }
 
-static int process_special_field(JournalImporter *imp, char *line) {
+static int process_special_field(JournalImporter *imp, char *line, size_t field_len) {
         const char *value;
         char buf[CELLESCAPE_DEFAULT_LENGTH];
         int r;
 
         assert(line);
 
+        /* Special fields all start with an underscore, don't bother with the others */
+        if (line[0] != '_')
+                return 0;
+
+        if (line[1] != '_') {
+                /* Just a single underline, but it needs special treatment too. */
+                if (field_len != STRLEN("_BOOT_ID") || !(value = startswith(line, "_BOOT_ID=")))
+                        return 0;
+
+                /* It rarely changes, don't parse it over and over again */
+                if (!streq(value, imp->boot_id_string)) {
+                        r = sd_id128_from_string(value, &imp->boot_id);
+                        if (r < 0)
+                                return log_warning_errno(r, "Failed to parse _BOOT_ID '%s': %m",
+                                                         cellescape(buf, sizeof buf, value));
+
+                        if (strlen(value) == SD_ID128_STRING_MAX - 1)
+                                strcpy(imp->boot_id_string, value);
+                        else
+                                imp->boot_id_string[0] = '\0';
+                }
+
+                /* store the field in the usual fashion too */
+                return 0;
+        }
+
         value = startswith(line, "__CURSOR=");
         if (value)
                 /* ignore __CURSOR */
@@ -256,29 +282,12 @@ static int process_special_field(JournalImporter *imp, char *line) {
                 return 1;
         }
 
-        /* Just a single underline, but it needs special treatment too. */
-        value = startswith(line, "_BOOT_ID=");
-        if (value) {
-                r = sd_id128_from_string(value, &imp->boot_id);
-                if (r < 0)
-                        return log_warning_errno(r, "Failed to parse _BOOT_ID '%s': %m",
-                                                 cellescape(buf, sizeof buf, value));
-
-                /* store the field in the usual fashion too */
-                return 0;
-        }
-
-        value = startswith(line, "__");
-        if (value) {
-                log_notice("Unknown dunder line __%s, ignoring.", cellescape(buf, sizeof buf, value));
-                return 1;
-        }
-
-        /* no dunder */
-        return 0;
+        value = line + 2;
+        log_notice("Unknown dunder line __%s, ignoring.", cellescape(buf, sizeof buf, value));
+        return 1;
 }
 
-int journal_importer_process_data(JournalImporter *imp) {
+static int process_data(JournalImporter *imp) {
         int r;
 
         switch(imp->state) {
@@ -307,8 +316,10 @@ int journal_importer_process_data(JournalImporter *imp) {
                    or
                    COREDUMP\n
                    LLLLLLLL0011223344...\n
+
+                   Field names are at most 64 characters, no need to look further for the '='.
                 */
-                sep = memchr(line, '=', n);
+                sep = memchr(line, '=', MIN(n, 65U));
                 if (sep) {
                         /* chomp newline */
                         n--;
@@ -324,7 +335,7 @@ int journal_importer_process_data(JournalImporter *imp) {
                         }
 
                         line[n] = '\0';
-                        r = process_special_field(imp, line);
+                        r = process_special_field(imp, line, sep - line);
                         if (r != 0)
                                 return r < 0 ? r : 0;
 
@@ -421,6 +432,21 @@ int journal_importer_process_data(JournalImporter *imp) {
         }
 }
 
+int journal_importer_process_data(JournalImporter *imp) {
+        int r;
+
+        assert(imp);
+
+        /* Processes fields until the entry is complete, more data is needed, or the end of the data is
+         * reached. Returns 1 for a complete entry, 0 at the end of the data. */
+
+        do
+                r = process_data(imp);
+        while (r == 0 && imp->state != IMPORTER_STATE_EOF);
+
+        return r;
+}
+
 int journal_importer_push_data(JournalImporter *imp, const char *data, size_t size) {
         assert(imp);
         assert(imp->state != IMPORTER_STATE_EOF);
@@ -438,12 +464,57 @@ int journal_importer_push_data(JournalImporter *imp, const char *data, size_t si
         return 0;
 }
 
+#if HAVE_ZSTD
+int journal_importer_push_data_zstd(
+                JournalImporter *imp,
+                ZSTD_DCtx *dctx,
+                const char *data,
+                size_t size,
+                size_t *ret_consumed) {
+
+        ZSTD_inBuffer input = {
+                .src = data,
+                .size = size,
+        };
+        ZSTD_outBuffer output;
+        size_t k;
+
+        assert(imp);
+        assert(imp->state != IMPORTER_STATE_EOF);
+        assert(dctx);
+        assert(ret_consumed);
+
+        /* Decompresses straight into the buffer, but only as much as zstd wants to produce in one go, so
+         * that the caller can process entries in between and the buffer doesn't grow needlessly. Returns
+         * how much of the input was consumed. */
+
+        if (!realloc_buffer(imp, imp->filled + ZSTD_DStreamOutSize()))
+                return log_oom();
+
+        output = (ZSTD_outBuffer) {
+                .dst = imp->buf + imp->filled,
+                .size = MALLOC_SIZEOF_SAFE(imp->buf) - imp->filled,
+        };
+
+        k = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(k))
+                return log_error_errno(SYNTHETIC_ERRNO(EBADMSG),
+                                       "Failed to decompress received data: %s", ZSTD_getErrorName(k));
+
+        imp->filled += output.pos;
+        *ret_consumed = input.pos;
+
+        return 0;
+}
+#endif
+
 void journal_importer_drop_iovw(JournalImporter *imp) {
         size_t remain, target;
 
-        /* This function drops processed data that along with the iovw that points at it */
+        /* This function drops processed data that along with the iovw that points at it. The array of
+         * the iovw is kept for the next entry. */
 
-        iovw_free_contents(&imp->iovw, false);
+        imp->iovw.count = 0;
 
         /* possibly reset buffer position */
         remain = imp->filled - imp->offset;
@@ -6,6 +6,10 @@
 #include <stdbool.h>
 #include <sys/uio.h>
 
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "sd-id128.h"
 
 #include "io-util.h"
@@ -43,6 +47,7 @@ typedef struct JournalImporter {
         int state;
         dual_timestamp ts;
         sd_id128_t boot_id;
+        char boot_id_string[SD_ID128_STRING_MAX]; /* What boot_id was parsed from */
 } JournalImporter;
 
 #define JOURNAL_IMPORTER_INIT(_fd) { .fd = (_fd), .iovw = {} }
@@ -51,6 +56,9 @@ typedef struct JournalImporter {
 void journal_importer_cleanup(JournalImporter *);
 int journal_importer_process_data(JournalImporter *);
 int journal_importer_push_data(JournalImporter *, const char *data, size_t size);
+#if HAVE_ZSTD
+int journal_importer_push_data_zstd(JournalImporter *, ZSTD_DCtx *dctx, const char *data, size_t size, size_t *ret_consumed);
+#endif
 void journal_importer_drop_iovw(JournalImporter *);
 bool journal_importer_eof(const JournalImporter *);
 
@@ -16,13 +16,11 @@
 #include "fd-util.h"
 #include "format-util.h"
 #include "glyph-util.h"
-#include "hashmap.h"
 #include "hostname-util.h"
 #include "id128-util.h"
 #include "io-util.h"
 #include "journal-internal.h"
 #include "journal-util.h"
-#include "json.h"
 #include "locale-util.h"
 #include "log.h"
 #include "logs-show.h"
@@ -32,6 +30,7 @@
 #include "parse-util.h"
 #include "pretty-print.h"
 #include "process-util.h"
+#include "set.h"
 #include "sparse-endian.h"
 #include "stdio-util.h"
 #include "string-table.h"
@@ -887,96 +886,351 @@ void json_escape(
         }
 }
 
-struct json_data {
-        JsonVariant* name;
+/* The JSON output is serialized straight from the data the journal hands us into a buffer that is reused
+ * from entry to entry. Only once the whole entry has been read we know which fields show up more than
+ * once and need to be turned into arrays, and whether the entry is readable at all, hence the entry is
+ * collected first and then written out in one go. */
+
+typedef struct JsonField {
+        size_t name, name_size;   /* The field name in the buffer */
+        size_t value, value_size; /* The formatted value in the buffer, or the raw bytes if 'binary' */
+        bool binary;
+
+        size_t next, last;        /* Further values of the same field */
         size_t n_values;
-        JsonVariant* values[];
-};
+        bool duplicate;           /* Not the first value of this field, written out with the first */
+} JsonField;
+
+typedef struct JsonWriter {
+        char *buffer;
+        size_t size;
+
+        JsonField *fields;
+        size_t n_fields;
+} JsonWriter;
+
+static thread_local JsonWriter json_writer = {};
+
+#if VALGRIND
+_destructor_ static void json_writer_free(void) {
+        free(json_writer.buffer);
+        free(json_writer.fields);
+}
+#endif
+
+static char* json_writer_extend(JsonWriter *w, size_t n) {
+        assert(w);
+
+        /* Makes room for at least n more bytes and returns where to put them */
+        if (n > SIZE_MAX - w->size)
+                return NULL;
+
+        if (!GREEDY_REALLOC(w->buffer, w->size + n))
+                return NULL;
+
+        return w->buffer + w->size;
+}
+
+static size_t json_unescaped_prefix(const char *p, size_t l) {
+        size_t i = 0;
+
+        /* Returns how many bytes at the beginning of p can be copied over as they are. Blocks are checked
+         * without branching on the individual bytes, which the compiler turns into vector instructions. */
+
+        for (; i + 16 <= l; i += 16) {
+                uint8_t needs_escape = 0;
+
+                for (size_t k = 0; k < 16; k++) {
+                        uint8_t c = p[i + k];
+
+                        needs_escape |= (c < ' ') | (c == '"') | (c == '\\');
+                }
+
+                if (needs_escape)
+                        break;
+        }
+
+        for (; i < l; i++)
+                if ((uint8_t) p[i] < ' ' || IN_SET(p[i], '"', '\\'))
+                        break;
+
+        return i;
+}
+
+static int json_writer_put_string(JsonWriter *w, const char *p, size_t l, OutputFlags flags) {
+        const char *color_on = "", *color_off = "";
+        size_t color_on_size, color_off_size;
+        char *q;
+
+        assert(w);
+        assert(p || l == 0);
+
+        if (FLAGS_SET(flags, OUTPUT_COLOR)) {
+                color_on = ansi_green();
+                color_off = ANSI_NORMAL;
+        }
+
+        color_on_size = strlen(color_on);
+        color_off_size = strlen(color_off);
+
+        /* Reserve enough for the worst case of every byte turning into "\u00XX", so that we don't have to
+         * check the size for every single byte */
+        if (l > (SIZE_MAX - color_on_size - color_off_size - 2) / 6)
+                return -ENOMEM;
+
+        q = json_writer_extend(w, color_on_size + l * 6 + color_off_size + 2);
+        if (!q)
+                return -ENOMEM;
+
+        *(q++) = '"';
+        q = mempcpy(q, color_on, color_on_size);
+
+        while (l > 0) {
+                size_t n;
+
+                n = json_unescaped_prefix(p, l);
+                q = mempcpy(q, p, n);
+                p += n;
+                l -= n;
+
+                if (l == 0)
+                        break;
+
+                switch (*p) {
+
+                case '"':
+                case '\\':
+                        *(q++) = '\\';
+                        *(q++) = *p;
+                        break;
+
+                case '\b':
+                        q = stpcpy(q, "\\b");
+                        break;
+
+                case '\f':
+                        q = stpcpy(q, "\\f");
+                        break;
 
-static int update_json_data(
-                Hashmap *h,
+                case '\n':
+                        q = stpcpy(q, "\\n");
+                        break;
+
+                case '\r':
+                        q = stpcpy(q, "\\r");
+                        break;
+
+                case '\t':
+                        q = stpcpy(q, "\\t");
+                        break;
+
+                default:
+                        q += sprintf(q, "\\u%04x", (uint8_t) *p);
+                }
+
+                p++;
+                l--;
+        }
+
+        q = mempcpy(q, color_off, color_off_size);
+        *(q++) = '"';
+
+        w->size = q - w->buffer;
+        return 0;
+}
+
+static int json_writer_put_null(JsonWriter *w, OutputFlags flags) {
+        const char *s;
+        char *q;
+
+        assert(w);
+
+        s = FLAGS_SET(flags, OUTPUT_COLOR) ? ANSI_HIGHLIGHT "null" ANSI_NORMAL : "null";
+
+        q = json_writer_extend(w, strlen(s));
+        if (!q)
+                return -ENOMEM;
+
+        w->size = stpcpy(q, s) - w->buffer;
+        return 0;
+}
+
+static int json_writer_add_field(
+                JsonWriter *w,
                 OutputFlags flags,
                 const char *name,
+                size_t name_size,
                 const void *value,
                 size_t size) {
 
-        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
-        struct json_data *d;
+        JsonField *field;
+        size_t first = SIZE_MAX;
+        char *q;
         int r;
 
-        if (!(flags & OUTPUT_SHOW_ALL) && strlen(name) + 1 + size >= JSON_THRESHOLD)
-                r = json_variant_new_null(&v);
-        else if (utf8_is_printable(value, size))
-                r = json_variant_new_stringn(&v, value, size);
-        else
-                r = json_variant_new_array_bytes(&v, value, size);
-        if (r < 0)
-                return log_error_errno(r, "Failed to allocate JSON data: %m");
+        assert(w);
+        assert(name);
 
-        d = hashmap_get(h, name);
-        if (d) {
-                struct json_data *w;
+        /* Entries have few enough fields that comparing the names is cheaper than hashing them */
+        for (size_t i = 0; i < w->n_fields; i++)
+                if (!w->fields[i].duplicate &&
+                    w->fields[i].name_size == name_size &&
+                    memcmp(w->buffer + w->fields[i].name, name, name_size) == 0) {
+                        first = i;
+                        break;
+                }
 
-                w = realloc(d, offsetof(struct json_data, values) + sizeof(JsonVariant*) * (d->n_values + 1));
-                if (!w)
-                        return log_oom();
+        if (!GREEDY_REALLOC(w->fields, w->n_fields + 1))
+                return log_oom();
 
-                d = w;
-                assert_se(hashmap_update(h, json_variant_string(d->name), d) >= 0);
-        } else {
-                _cleanup_(json_variant_unrefp) JsonVariant *n = NULL;
+        field = w->fields + w->n_fields;
+        *field = (JsonField) {
+                .next = SIZE_MAX,
+                .n_values = 1,
+                .duplicate = first != SIZE_MAX,
+        };
 
-                r = json_variant_new_string(&n, name);
-                if (r < 0)
-                        return log_error_errno(r, "Failed to allocate JSON name variant: %m");
+        q = json_writer_extend(w, name_size);
+        if (!q)
+                return log_oom();
+
+        field->name = w->size;
+        field->name_size = name_size;
+        w->size += name_size;
+        memcpy(q, name, name_size);
 
-                d = malloc0(offsetof(struct json_data, values) + sizeof(JsonVariant*));
-                if (!d)
+        field->value = w->size;
+
+        if (!(flags & OUTPUT_SHOW_ALL) && name_size + 1 + size >= JSON_THRESHOLD)
+                r = json_writer_put_null(w, flags);
+        else if (utf8_is_printable(value, size))
+                r = json_writer_put_string(w, value, size, flags);
+        else {
+                /* Binary data is written out as an array of numbers, which looks different depending
+                 * on how deep it ends up nested, hence keep the bytes until then */
+                field->binary = true;
+
+                q = json_writer_extend(w, size);
+                if (!q)
                         return log_oom();
 
-                r = hashmap_put(h, json_variant_string(n), d);
-                if (r < 0) {
-                        free(d);
-                        return log_error_errno(r, "Failed to insert JSON name into hashmap: %m");
-                }
+                w->size += size;
+                memcpy_safe(q, value, size);
+                r = 0;
+        }
+        if (r < 0)
+                return log_oom();
+
+        field->value_size = w->size - field->value;
+
+        if (first != SIZE_MAX) {
+                JsonField *f = w->fields + first;
 
-                d->name = TAKE_PTR(n);
+                w->fields[f->n_values == 1 ? first : f->last].next = w->n_fields;
+                f->last = w->n_fields;
+                f->n_values++;
         }
 
-        d->values[d->n_values++] = TAKE_PTR(v);
+        w->n_fields++;
         return 0;
 }
 
-static int update_json_data_split(
-                Hashmap *h,
-                OutputFlags flags,
-                const Set *output_fields,
-                const void *data,
-                size_t size) {
+static void json_writer_dump_value(JsonWriter *w, FILE *f, const JsonField *field, OutputFlags flags, bool pretty, const char *prefix) {
+        const uint8_t *p;
 
-        size_t fieldlen;
-        const char *eq;
-        char *name;
+        assert(w);
+        assert(f);
+        assert(field);
 
-        assert(h);
-        assert(data || size == 0);
+        if (!field->binary) {
+                fwrite(w->buffer + field->value, 1, field->value_size, f);
+                return;
+        }
 
-        if (memory_startswith(data, size, "_BOOT_ID="))
-                return 0;
+        p = (const uint8_t*) w->buffer + field->value;
 
-        eq = memchr(data, '=', MIN(size, JSON_THRESHOLD));
-        if (!eq)
-                return 0;
+        fputc('[', f);
+        if (pretty)
+                fputc('\n', f);
 
-        fieldlen = eq - (const char*) data;
-        if (!journal_field_valid(data, fieldlen, true))
-                return log_error_errno(SYNTHETIC_ERRNO(EINVAL), "Invalid field.");
+        for (size_t i = 0; i < field->value_size; i++) {
+                if (i > 0)
+                        fputs(pretty ? ",\n" : ",", f);
+                if (pretty)
+                        fprintf(f, "%s\t", prefix);
 
-        name = strndupa_safe(data, fieldlen);
-        if (output_fields && !set_contains(output_fields, name))
-                return 0;
+                if (FLAGS_SET(flags, OUTPUT_COLOR))
+                        fprintf(f, "%s%u" ANSI_NORMAL, ansi_highlight_blue(), p[i]);
+                else
+                        fprintf(f, "%u", p[i]);
+        }
 
-        return update_json_data(h, flags, name, eq + 1, size - fieldlen - 1);
+        if (pretty)
+                fprintf(f, "\n%s", prefix);
+        fputc(']', f);
+}
+
+static void json_writer_dump(JsonWriter *w, FILE *f, OutputMode mode, OutputFlags flags) {
+        const char *color_on = "", *color_off = "";
+        bool pretty, first = true;
+
+        assert(w);
+        assert(f);
+
+        /* Formats the entry exactly like json_variant_dump() would */
+
+        pretty = mode == OUTPUT_JSON_PRETTY;
+
+        if (FLAGS_SET(flags, OUTPUT_COLOR)) {
+                color_on = ansi_green();
+                color_off = ANSI_NORMAL;
+        }
+
+        if (mode == OUTPUT_JSON_SSE)
+                fputs("data: ", f);
+        if (mode == OUTPUT_JSON_SEQ)
+                fputc('\x1e', f); /* ASCII Record Separator */
+
+        fputs(pretty ? "{\n" : "{", f);
+
+        for (size_t i = 0; i < w->n_fields; i++) {
+                const JsonField *field = w->fields + i;
+
+                if (field->duplicate)
+                        continue;
+
+                if (!first)
+                        fputs(pretty ? ",\n" : ",", f);
+                first = false;
+
+                if (pretty)
+                        fputc('\t', f);
+
+                fprintf(f, "\"%s%.*s%s\"", color_on, (int) field->name_size, w->buffer + field->name, color_off);
+                fputs(pretty ? " : " : ":", f);
+
+                if (field->n_values == 1) {
+                        json_writer_dump_value(w, f, field, flags, pretty, "\t");
+                        continue;
+                }
+
+                fputs(pretty ? "[\n" : "[", f);
+
+                for (size_t k = i; k != SIZE_MAX; k = w->fields[k].next) {
+                        if (k != i)
+                                fputs(pretty ? ",\n" : ",", f);
+                        if (pretty)
+                                fputs("\t\t", f);
+
+                        json_writer_dump_value(w, f, w->fields + k, flags, pretty, "\t\t");
+                }
+
+                fputs(pretty ? "\n\t]" : "]", f);
+        }
+
+        fputs(pretty ? "\n}\n" : "}\n", f);
+        if (mode == OUTPUT_JSON_SSE)
+                fputc('\n', f); /* In case of SSE add a second newline */
 }
 
 static int output_json(
@@ -988,15 +1242,13 @@ static int output_json(
                 const Set *output_fields,
                 const size_t highlight[2]) {
 
-        char sid[SD_ID128_STRING_MAX], usecbuf[DECIMAL_STR_MAX(usec_t)];
-        _cleanup_(json_variant_unrefp) JsonVariant *object = NULL;
+        char usecbuf[DECIMAL_STR_MAX(usec_t)];
         _cleanup_free_ char *cursor = NULL;
+        JsonWriter *w = &json_writer;
         uint64_t realtime, monotonic;
-        JsonVariant **array = NULL;
-        struct json_data *d;
+        const void *data;
         sd_id128_t boot_id;
-        Hashmap *h = NULL;
-        size_t n = 0;
+        size_t size;
         int r;
 
         assert(j);
@@ -1015,107 +1267,62 @@ static int output_json(
         if (r < 0)
                 return log_error_errno(r, "Failed to get cursor: %m");
 
-        h = hashmap_new(&string_hash_ops);
-        if (!h)
-                return log_oom();
+        w->size = w->n_fields = 0;
 
-        r = update_json_data(h, flags, "__CURSOR", cursor, strlen(cursor));
+        r = json_writer_add_field(w, flags, "__CURSOR", STRLEN("__CURSOR"), cursor, strlen(cursor));
         if (r < 0)
-                goto finish;
+                return r;
 
         xsprintf(usecbuf, USEC_FMT, realtime);
-        r = update_json_data(h, flags, "__REALTIME_TIMESTAMP", usecbuf, strlen(usecbuf));
+        r = json_writer_add_field(w, flags, "__REALTIME_TIMESTAMP", STRLEN("__REALTIME_TIMESTAMP"), usecbuf, strlen(usecbuf));
         if (r < 0)
-                goto finish;
+                return r;
 
         xsprintf(usecbuf, USEC_FMT, monotonic);
-        r = update_json_data(h, flags, "__MONOTONIC_TIMESTAMP", usecbuf, strlen(usecbuf));
+        r = json_writer_add_field(w, flags, "__MONOTONIC_TIMESTAMP", STRLEN("__MONOTONIC_TIMESTAMP"), usecbuf, strlen(usecbuf));
         if (r < 0)
-                goto finish;
+                return r;
 
-        sd_id128_to_string(boot_id, sid);
-        r = update_json_data(h, flags, "_BOOT_ID", sid, strlen(sid));
+        r = json_writer_add_field(w, flags, "_BOOT_ID", STRLEN("_BOOT_ID"), SD_ID128_TO_STRING(boot_id), SD_ID128_STRING_MAX - 1);
         if (r < 0)
-                goto finish;
-
-        for (;;) {
-                const void *data;
-                size_t size;
-
-                r = sd_journal_enumerate_data(j, &data, &size);
-                if (r == -EBADMSG) {
-                        log_debug_errno(r, "Skipping message we can't read: %m");
-                        r = 0;
-                        goto finish;
-                }
-                if (r < 0) {
-                        log_error_errno(r, "Failed to read journal: %m");
-                        goto finish;
-                }
-                if (r == 0)
-                        break;
-
-                r = update_json_data_split(h, flags, output_fields, data, size);
-                if (r < 0)
-                        goto finish;
-        }
-
-        array = new(JsonVariant*, hashmap_size(h)*2);
-        if (!array) {
-                r = log_oom();
-                goto finish;
-        }
+                return r;
 
-        HASHMAP_FOREACH(d, h) {
-                assert(d->n_values > 0);
+        JOURNAL_FOREACH_DATA_RETVAL(j, data, size, r) {
+                size_t fieldlen;
+                const char *eq;
 
-                array[n++] = json_variant_ref(d->name);
+                /* We already added the boot id from the data in the header */
+                if (memory_startswith(data, size, "_BOOT_ID="))
+                        continue;
 
-                if (d->n_values == 1)
-                        array[n++] = json_variant_ref(d->values[0]);
-                else {
-                        _cleanup_(json_variant_unrefp) JsonVariant *q = NULL;
+                eq = memchr(data, '=', MIN(size, JSON_THRESHOLD));
+                if (!eq)
+                        continue;
 
-                        r = json_variant_new_array(&q, d->values, d->n_values);
-                        if (r < 0) {
-                                log_error_errno(r, "Failed to create JSON array: %m");
-                                goto finish;
-                        }
+                fieldlen = eq - (const char*) data;
+                if (!journal_field_valid(data, fieldlen, true))
+                        return log_error_errno(SYNTHETIC_ERRNO(EINVAL), "Invalid field.");
 
-                        array[n++] = TAKE_PTR(q);
-                }
-        }
+                r = field_set_test(output_fields, data, fieldlen);
+                if (r < 0)
+                        return r;
+                if (!r)
+                        continue;
 
-        r = json_variant_new_object(&object, array, n);
-        if (r < 0) {
-                log_error_errno(r, "Failed to allocate JSON object: %m");
-                goto finish;
+                r = json_writer_add_field(w, flags, data, fieldlen, eq + 1, size - fieldlen - 1);
+                if (r < 0)
+                        return r;
         }
-
-        json_variant_dump(object,
-                          output_mode_to_json_format_flags(mode) |
-                          (FLAGS_SET(flags, OUTPUT_COLOR) ? JSON_FORMAT_COLOR : 0),
-                          f, NULL);
-
-        r = 0;
-
-finish:
-        while ((d = hashmap_steal_first(h))) {
-                size_t k;
-
-                json_variant_unref(d->name);
-                for (k = 0; k < d->n_values; k++)
-                        json_variant_unref(d->values[k]);
-
-                free(d);
+        if (r == -EBADMSG) {
+                log_debug_errno(r, "Skipping message we can't read: %m");
+                return 0;
         }
+        if (r < 0)
+                return log_error_errno(r, "Failed to read journal: %m");
 
-        hashmap_free(h);
-
-        json_variant_unref_many(array, n);
-        free(array);
+        json_writer_dump(w, f, mode, flags);
 
-        return r;
+        return 0;
 }
 
 static int output_cat_field(
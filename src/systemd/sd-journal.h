@@ -71,6 +71,7 @@ enum {
         SD_JOURNAL_OS_ROOT                   = 1 << 4,
         SD_JOURNAL_ALL_NAMESPACES            = 1 << 5, /* Show all namespaces, not just the default or specified one */
         SD_JOURNAL_INCLUDE_DEFAULT_NAMESPACE = 1 << 6, /* Show default namespace in addition to specified one */
+        SD_JOURNAL_PARALLEL                  = 1 << 7, /* Read files ahead in the background, using multiple threads */
 
         SD_JOURNAL_SYSTEM_ONLY _sd_deprecated_ = SD_JOURNAL_SYSTEM /* old name */
 };
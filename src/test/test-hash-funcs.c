@@ -2,7 +2,9 @@
 
 #include "tests.h"
 #include "hash-funcs.h"
+#include "hashed-string.h"
 #include "set.h"
+#include "strv.h"
 
 static void test_path_hash_set(void) {
         /* The goal is to make sure that non-simplified path are hashed as expected,
@@ -76,8 +78,49 @@ static void test_path_hash_set(void) {
         assert_se(!set_contains(set, "/////../bar/./"));
 }
 
+static void test_hashed_string_set(void) {
+        _cleanup_(hashed_string_freep) char *foo = NULL, *foo2 = NULL, *bar = NULL;
+        _cleanup_(hashed_strv_freep) char **l = NULL;
+        _cleanup_set_free_ Set *set = NULL;
+        char **i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(foo = hashed_strdup("foo.service"));
+        assert_se(foo2 = hashed_strndup("foo.serviceXXX", 11));
+        assert_se(bar = hashed_strdup("bar.service"));
+
+        assert_se(streq(foo, foo2));
+        assert_se(hashed_string_hash(foo) == hashed_string_hash(foo2));
+        assert_se(hashed_string_hash(foo) != hashed_string_hash(bar));
+        assert_se(hashed_string_compare_func(foo, foo2) == 0);
+        assert_se(hashed_string_compare_func(foo, bar) > 0);
+
+        assert_se(set_ensure_put(&set, &hashed_string_hash_ops, foo) == 1);
+        assert_se(set_ensure_put(&set, &hashed_string_hash_ops, foo2) == 0);
+        assert_se(set_ensure_put(&set, &hashed_string_hash_ops, bar) == 1);
+        assert_se(set_get(set, foo2) == foo);
+
+        /* Hashed in one go, the same as one by one */
+        assert_se(hashed_strv_dup(STRV_MAKE("foo.service", "bar.service", "a", "", "b", "baz.socket", "c"), &l) >= 0);
+        assert_se(strv_equal(l, STRV_MAKE("foo.service", "bar.service", "a", "", "b", "baz.socket", "c")));
+        assert_se(hashed_string_hash(l[0]) == hashed_string_hash(foo));
+        assert_se(hashed_string_hash(l[1]) == hashed_string_hash(bar));
+        STRV_FOREACH(i, l) {
+                _cleanup_(hashed_string_freep) char *t = NULL;
+
+                assert_se(t = hashed_strdup(*i));
+                assert_se(hashed_string_hash(*i) == hashed_string_hash(t));
+        }
+
+        assert_se(set_contains(set, l[0]));
+        assert_se(set_contains(set, l[1]));
+        assert_se(!set_contains(set, l[2]));
+}
+
 int main(int argc, char **argv) {
         test_setup_logging(LOG_INFO);
 
         test_path_hash_set();
+        test_hashed_string_set();
 }
@@ -1,7 +1,13 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include "hashed-string.h"
 #include "hashmap.h"
+#include "random-util.h"
+#include "siphash24.h"
 #include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "time-util.h"
 #include "util.h"
 
 unsigned custom_counter = 0;
@@ -161,6 +167,82 @@ static void test_hashmap_put_strdup_null(void) {
         assert_se(s == NULL);
 }
 
+static void test_hashed_string_benchmark(void) {
+        _cleanup_(hashed_strv_freep) char **hashed = NULL;
+        _cleanup_hashmap_free_ Hashmap *plain_map = NULL, *hashed_map = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        _cleanup_free_ const void **in = NULL;
+        _cleanup_free_ size_t *inlen = NULL;
+        _cleanup_free_ uint64_t *out = NULL;
+        bool slow = slow_tests_enabled();
+        unsigned n = slow ? 1U << 20 : 1U << 14, rounds = 10;
+        uint8_t key[16];
+        uint64_t sum = 0;
+        usec_t ts, t;
+
+        log_info("/* %s (%s) */", __func__, slow ? "slow" : "fast");
+
+        /* Names of the length and shape of unit names, as they'd be looked up in PID 1 */
+        assert_se(names = new0(char*, n + 1));
+        for (unsigned i = 0; i < n; i++)
+                assert_se(asprintf(names + i, i % 2 == 0 ? "sys-devices-pci0000:00-0000:00:%02x.%u-block.device" : "unit-%u-%u.service",
+                                   i % 256, i) >= 0);
+
+        assert_se(in = new(const void*, n));
+        assert_se(inlen = new(size_t, n));
+        assert_se(out = new(uint64_t, n));
+        for (unsigned i = 0; i < n; i++) {
+                in[i] = names[i];
+                inlen[i] = strlen(names[i]) + 1;
+        }
+        random_bytes(key, sizeof(key));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (unsigned r = 0; r < rounds; r++)
+                for (unsigned i = 0; i < n; i++)
+                        sum += siphash24(in[i], inlen[i], key);
+        t = now(CLOCK_MONOTONIC) - ts;
+        log_info("siphash24():      %u keys in %s, %.1f ns/key",
+                 n * rounds, FORMAT_TIMESPAN(t, USEC_PER_MSEC), (double) t * 1000 / (n * rounds));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (unsigned r = 0; r < rounds; r++) {
+                siphash24_many(in, inlen, n, key, out);
+                sum -= out[r];
+        }
+        t = now(CLOCK_MONOTONIC) - ts;
+        log_info("siphash24_many(): %u keys in %s, %.1f ns/key",
+                 n * rounds, FORMAT_TIMESPAN(t, USEC_PER_MSEC), (double) t * 1000 / (n * rounds));
+
+        /* Lookups, with and without the cached hash */
+        assert_se(hashed_strv_dup(names, &hashed) >= 0);
+        assert_se(plain_map = hashmap_new(&string_hash_ops));
+        assert_se(hashed_map = hashmap_new(&hashed_string_hash_ops));
+        for (unsigned i = 0; i < n; i++) {
+                assert_se(hashmap_put(plain_map, names[i], UINT_TO_PTR(i + 1)) == 1);
+                assert_se(hashmap_put(hashed_map, hashed[i], UINT_TO_PTR(i + 1)) == 1);
+        }
+
+        ts = now(CLOCK_MONOTONIC);
+        for (unsigned r = 0; r < rounds; r++)
+                for (unsigned i = 0; i < n; i++)
+                        assert_se(PTR_TO_UINT(hashmap_get(plain_map, names[i])) == i + 1);
+        t = now(CLOCK_MONOTONIC) - ts;
+        log_info("string_hash_ops:        %u lookups in %s, %.1f ns/lookup",
+                 n * rounds, FORMAT_TIMESPAN(t, USEC_PER_MSEC), (double) t * 1000 / (n * rounds));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (unsigned r = 0; r < rounds; r++)
+                for (unsigned i = 0; i < n; i++)
+                        assert_se(PTR_TO_UINT(hashmap_get(hashed_map, hashed[i])) == i + 1);
+        t = now(CLOCK_MONOTONIC) - ts;
+        log_info("hashed_string_hash_ops: %u lookups in %s, %.1f ns/lookup",
+                 n * rounds, FORMAT_TIMESPAN(t, USEC_PER_MSEC), (double) t * 1000 / (n * rounds));
+
+        /* Keep the compiler from dropping the hashing */
+        log_debug("%" PRIu64, sum);
+}
+
 int main(int argc, const char *argv[]) {
         /* This file tests in test-hashmap-plain.c, and tests in test-hashmap-ordered.c, which is generated
          * from test-hashmap-plain.c. Hashmap tests should be added to test-hashmap-plain.c, and here only if
@@ -181,6 +263,7 @@ int main(int argc, const char *argv[]) {
         test_iterated_cache();
         test_hashmap_put_strdup();
         test_hashmap_put_strdup_null();
+        test_hashed_string_benchmark();
 
         return 0;
 }
@@ -5,11 +5,15 @@
 #include <fcntl.h>
 
 #include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "format-util.h"
 #include "log.h"
 #include "journal-importer.h"
 #include "path-util.h"
 #include "string-util.h"
 #include "tests.h"
+#include "time-util.h"
 
 static void assert_iovec_entry(const struct iovec *iovec, const char* content) {
         assert_se(strlen(content) == iovec->iov_len);
@@ -68,11 +72,164 @@ static void test_bad_input(void) {
         assert_se(journal_importer_eof(&imp));
 }
 
+static void test_push_data_zstd(void) {
+#if HAVE_ZSTD
+        _cleanup_(journal_importer_cleanup) JournalImporter imp = JOURNAL_IMPORTER_INIT(-1);
+        _cleanup_free_ char *journal_data_path = NULL, *data = NULL;
+        _cleanup_free_ void *compressed = NULL;
+        ZSTD_DCtx *dctx;
+        size_t size, compressed_size, pos = 0;
+        unsigned n_entries = 0;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(get_testdata_dir("journal-data/journal-1.txt", &journal_data_path) >= 0);
+        assert_se(read_full_file(journal_data_path, &data, &size) >= 0);
+
+        assert_se(compressed = malloc(ZSTD_compressBound(size)));
+        compressed_size = ZSTD_compress(compressed, ZSTD_compressBound(size), data, size, 1);
+        assert_se(!ZSTD_isError(compressed_size));
+
+        assert_se(dctx = ZSTD_createDCtx());
+
+        /* Hand the data over in small pieces, like journal-remote does with what it receives */
+        imp.fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        assert_se(imp.fd >= 0);
+        imp.passive_fd = true;
+
+        while (pos < compressed_size) {
+                size_t n;
+
+                assert_se(journal_importer_push_data_zstd(&imp, dctx, (char*) compressed + pos,
+                                                          MIN(compressed_size - pos, 16U), &n) >= 0);
+                pos += n;
+
+                while ((r = journal_importer_process_data(&imp)) != -EAGAIN) {
+                        assert_se(r >= 0);
+                        if (r == 0)
+                                continue;
+
+                        assert_se(imp.iovw.count == 6);
+                        assert_iovec_entry(&imp.iovw.iovec[0], "_BOOT_ID=1531fd22ec84429e85ae888b12fadb91");
+                        assert_iovec_entry(&imp.iovw.iovec[5], "_SOURCE_REALTIME_TIMESTAMP=1478389147837945");
+
+                        journal_importer_drop_iovw(&imp);
+                        n_entries++;
+                }
+        }
+
+        assert_se(n_entries == 1);
+
+        imp.fd = safe_close(imp.fd);
+        ZSTD_freeDCtx(dctx);
+#endif
+}
+
+static char* make_export(unsigned n_entries, size_t *ret_size) {
+        _cleanup_free_ char *buf = NULL;
+        size_t size = 0;
+
+        /* Entries that look like what journal-upload sends, with a binary field in every tenth one */
+        for (unsigned i = 0; i < n_entries; i++) {
+                _cleanup_free_ char *entry = NULL;
+                int k;
+
+                k = asprintf(&entry,
+                             "__CURSOR=s=6863c726210b4560b7048889d8ada5c5;i=%x;b=f446871715504074bf7049ef0718fa93;m=%x;t=4fd05c\n"
+                             "__REALTIME_TIMESTAMP=%u\n"
+                             "__MONOTONIC_TIMESTAMP=%u\n"
+                             "_BOOT_ID=f446871715504074bf7049ef0718fa93\n"
+                             "_TRANSPORT=syslog\n"
+                             "PRIORITY=6\n"
+                             "SYSLOG_FACILITY=3\n"
+                             "SYSLOG_IDENTIFIER=test-journal-importer\n"
+                             "MESSAGE=Message number %u, which is about as long as a typical log message is.\n"
+                             "_UID=0\n"
+                             "_GID=0\n"
+                             "_MACHINE_ID=69121ca41d12c1b69a7960174c27b618\n"
+                             "_HOSTNAME=hostname\n"
+                             "_PID=%u\n"
+                             "_COMM=test-journal-importer\n"
+                             "_CMDLINE=/usr/lib/systemd/tests/test-journal-importer --benchmark\n"
+                             "_SYSTEMD_UNIT=test.service\n"
+                             "_SOURCE_REALTIME_TIMESTAMP=%u\n",
+                             i, i, 1404101101 + i, 1753961 + i, i, 1000 + i % 100, 1404101100 + i);
+                assert_se(k >= 0);
+
+                assert_se(GREEDY_REALLOC(buf, size + k + 64));
+                memcpy(buf + size, entry, k);
+                size += k;
+
+                if (i % 10 == 0) {
+                        static const char binary[] = "BINARY\n" "\x10\0\0\0\0\0\0\0" "0123456789\nabcde" "\n";
+
+                        memcpy(buf + size, binary, sizeof(binary) - 1);
+                        size += sizeof(binary) - 1;
+                }
+
+                buf[size++] = '\n';
+        }
+
+        *ret_size = size;
+        return TAKE_PTR(buf);
+}
+
+static void test_benchmark(void) {
+        _cleanup_(journal_importer_cleanup) JournalImporter imp = JOURNAL_IMPORTER_INIT(-1);
+        _cleanup_free_ char *data = NULL;
+        unsigned n = slow_tests_enabled() ? 200000 : 20000, n_entries = 0;
+        size_t size, pos = 0;
+        usec_t start, t;
+        int r;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(data = make_export(n, &size));
+
+        imp.fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        assert_se(imp.fd >= 0);
+        imp.passive_fd = true;
+
+        /* In the pieces an HTTP server would hand over */
+        start = now(CLOCK_MONOTONIC);
+        while (pos < size) {
+                size_t k = MIN(size - pos, 16U * 1024U);
+
+                assert_se(journal_importer_push_data(&imp, data + pos, k) >= 0);
+                pos += k;
+
+                while ((r = journal_importer_process_data(&imp)) != -EAGAIN) {
+                        assert_se(r >= 0);
+                        if (r == 0)
+                                continue;
+
+                        assert_se(imp.iovw.count == 15 + (n_entries % 10 == 0));
+                        journal_importer_drop_iovw(&imp);
+                        n_entries++;
+                }
+        }
+        t = now(CLOCK_MONOTONIC) - start;
+
+        assert_se(n_entries == n);
+        assert_se(journal_importer_bytes_remaining(&imp) == 0);
+
+        log_info("Parsed %u entries, %s in %s: %.1f MB/s",
+                 n, FORMAT_BYTES(size), FORMAT_TIMESPAN(t, 1),
+                 (double) size / t);
+
+        imp.fd = safe_close(imp.fd);
+}
+
 int main(int argc, char **argv) {
         test_setup_logging(LOG_DEBUG);
 
         test_basic_parsing();
         test_bad_input();
+        test_push_data_zstd();
+
+        log_set_max_level(LOG_INFO);
+        test_benchmark();
 
         return 0;
 }
@@ -21,6 +21,7 @@
 #include "memory-util.h"
 #include "rm-rf.h"
 #include "specifier.h"
+#include "string-intern.h"
 #include "string-util.h"
 #include "strv.h"
 #include "tests.h"
@@ -867,7 +868,7 @@ static void test_unit_is_recursive_template_dependency(void) {
 
         assert_se(u = unit_new(m, sizeof(Service)));
         assert_se(unit_add_name(u, "foobar@1.service") == 0);
-        u->fragment_path = strdup("/foobar@.service");
+        assert_se(string_intern_replace(&u->fragment_path, "/foobar@.service") > 0);
 
         assert_se(hashmap_put_strdup(&m->unit_id_map, "foobar@foobar@123.service", "/foobar@.service"));
         assert_se(hashmap_put_strdup(&m->unit_id_map, "foobar@foobar@456.service", "/custom.service"));
@@ -0,0 +1,306 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "chattr-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "journal-internal.h"
+#include "json.h"
+#include "log.h"
+#include "logs-show.h"
+#include "parse-util.h"
+#include "path-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "tmpfile-util.h"
+#include "utf8.h"
+
+#define JSON_THRESHOLD 4096U
+
+static unsigned arg_n_entries;
+
+/* The JSON output as it was generated before the streaming writer, i.e. by building a JsonVariant for
+ * each entry. The only difference is that an ordered hashmap is used, so that the fields come out in the
+ * same order and we can compare the output byte by byte. */
+
+typedef struct JsonData {
+        JsonVariant *name;
+        size_t n_values;
+        JsonVariant *values[];
+} JsonData;
+
+static void update_json_data(OrderedHashmap *h, OutputFlags flags, const char *name, const void *value, size_t size) {
+        _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
+        JsonData *d;
+
+        if (!(flags & OUTPUT_SHOW_ALL) && strlen(name) + 1 + size >= JSON_THRESHOLD)
+                assert_se(json_variant_new_null(&v) >= 0);
+        else if (utf8_is_printable(value, size))
+                assert_se(json_variant_new_stringn(&v, value, size) >= 0);
+        else
+                assert_se(json_variant_new_array_bytes(&v, value, size) >= 0);
+
+        d = ordered_hashmap_get(h, name);
+        if (d) {
+                assert_se(d = realloc(d, offsetof(JsonData, values) + sizeof(JsonVariant*) * (d->n_values + 1)));
+                assert_se(ordered_hashmap_update(h, json_variant_string(d->name), d) >= 0);
+        } else {
+                _cleanup_(json_variant_unrefp) JsonVariant *n = NULL;
+
+                assert_se(json_variant_new_string(&n, name) >= 0);
+                assert_se(d = malloc0(offsetof(JsonData, values) + sizeof(JsonVariant*)));
+                assert_se(ordered_hashmap_put(h, json_variant_string(n), d) >= 0);
+                d->name = TAKE_PTR(n);
+        }
+
+        d->values[d->n_values++] = TAKE_PTR(v);
+}
+
+static void output_json_variant(FILE *f, sd_journal *j, OutputMode mode, OutputFlags flags) {
+        _cleanup_(json_variant_unrefp) JsonVariant *object = NULL;
+        char usecbuf[DECIMAL_STR_MAX(usec_t)];
+        _cleanup_free_ char *cursor = NULL;
+        uint64_t realtime, monotonic;
+        JsonVariant **array;
+        OrderedHashmap *h;
+        const void *data;
+        sd_id128_t boot_id;
+        size_t size, n = 0;
+        JsonData *d;
+        int r;
+
+        (void) sd_journal_set_data_threshold(j, flags & OUTPUT_SHOW_ALL ? 0 : JSON_THRESHOLD);
+
+        assert_se(sd_journal_get_realtime_usec(j, &realtime) >= 0);
+        assert_se(sd_journal_get_monotonic_usec(j, &monotonic, &boot_id) >= 0);
+        assert_se(sd_journal_get_cursor(j, &cursor) >= 0);
+
+        assert_se(h = ordered_hashmap_new(&string_hash_ops));
+
+        update_json_data(h, flags, "__CURSOR", cursor, strlen(cursor));
+        xsprintf(usecbuf, USEC_FMT, realtime);
+        update_json_data(h, flags, "__REALTIME_TIMESTAMP", usecbuf, strlen(usecbuf));
+        xsprintf(usecbuf, USEC_FMT, monotonic);
+        update_json_data(h, flags, "__MONOTONIC_TIMESTAMP", usecbuf, strlen(usecbuf));
+        update_json_data(h, flags, "_BOOT_ID", SD_ID128_TO_STRING(boot_id), SD_ID128_STRING_MAX - 1);
+
+        JOURNAL_FOREACH_DATA_RETVAL(j, data, size, r) {
+                const char *eq;
+                char *name;
+
+                if (memory_startswith(data, size, "_BOOT_ID="))
+                        continue;
+
+                assert_se(eq = memchr(data, '=', MIN(size, JSON_THRESHOLD)));
+                name = strndupa_safe(data, eq - (const char*) data);
+
+                update_json_data(h, flags, name, eq + 1, size - (eq - (const char*) data) - 1);
+        }
+        assert_se(r >= 0);
+
+        assert_se(array = new(JsonVariant*, ordered_hashmap_size(h) * 2));
+
+        ORDERED_HASHMAP_FOREACH(d, h) {
+                array[n++] = json_variant_ref(d->name);
+
+                if (d->n_values == 1)
+                        array[n++] = json_variant_ref(d->values[0]);
+                else
+                        assert_se(json_variant_new_array(array + n++, d->values, d->n_values) >= 0);
+        }
+
+        assert_se(json_variant_new_object(&object, array, n) >= 0);
+
+        json_variant_dump(object,
+                          output_mode_to_json_format_flags(mode) |
+                          (FLAGS_SET(flags, OUTPUT_COLOR) ? JSON_FORMAT_COLOR : 0),
+                          f, NULL);
+
+        while ((d = ordered_hashmap_steal_first(h))) {
+                json_variant_unref(d->name);
+                json_variant_unref_many(d->values, d->n_values);
+                free(d);
+        }
+        ordered_hashmap_free(h);
+
+        json_variant_unref_many(array, n);
+        free(array);
+}
+
+static void create_journal(const char *dn, unsigned n_entries) {
+        _cleanup_free_ char *fn = NULL, *large = NULL;
+        JournalFile *f;
+        dual_timestamp ts;
+
+        assert_se(fn = path_join(dn, "test.journal"));
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, UINT64_MAX, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        assert_se(large = strrep("x", JSON_THRESHOLD));
+
+        dual_timestamp_get(&ts);
+
+        for (unsigned i = 0; i < n_entries; i++) {
+                char message[LINE_MAX], priority[STRLEN("PRIORITY=") + DECIMAL_STR_MAX(unsigned)],
+                        pid[STRLEN("_PID=") + DECIMAL_STR_MAX(unsigned)], tag[STRLEN("TAG=") + DECIMAL_STR_MAX(unsigned)];
+                _cleanup_free_ char *large_field = NULL;
+                struct iovec iovec[8];
+                size_t n = 0;
+
+                /* Something of everything: strings that need escaping, multi-byte characters, fields that
+                 * show up more than once, binary data, and data that is too large to be shown. */
+                xsprintf(message, "MESSAGE=Entry %u: \"quoted\" \\ back\tslash, \xc3\xbc\nsecond line", i);
+                xsprintf(priority, "PRIORITY=%u", i % 8);
+                xsprintf(pid, "_PID=%u", 1000 + i % 100);
+                xsprintf(tag, "TAG=%u", i % 3);
+
+                iovec[n++] = IOVEC_MAKE_STRING(message);
+                iovec[n++] = IOVEC_MAKE_STRING(priority);
+                iovec[n++] = IOVEC_MAKE_STRING(pid);
+                iovec[n++] = IOVEC_MAKE_STRING("SYSLOG_IDENTIFIER=test-logs-show");
+
+                if (i % 2 == 0) {
+                        iovec[n++] = IOVEC_MAKE_STRING(tag);
+                        iovec[n++] = IOVEC_MAKE_STRING("TAG=even");
+                }
+
+                if (i % 4 == 0)
+                        iovec[n++] = IOVEC_MAKE("BINARY=\x01\x02\x80", STRLEN("BINARY=\x01\x02\x80"));
+
+                if (i % 16 == 0) {
+                        assert_se(large_field = strjoin("LARGE=", large));
+                        iovec[n++] = IOVEC_MAKE_STRING(large_field);
+                }
+
+                ts.realtime++;
+                ts.monotonic++;
+
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, n, NULL, NULL, NULL) == 0);
+        }
+
+        (void) journal_file_close(f);
+}
+
+static void test_output_json(const char *dn) {
+        static const OutputMode modes[] = {
+                OUTPUT_JSON,
+                OUTPUT_JSON_PRETTY,
+                OUTPUT_JSON_SSE,
+                OUTPUT_JSON_SEQ,
+        };
+        static const OutputFlags flags[] = {
+                0,
+                OUTPUT_COLOR,
+                OUTPUT_SHOW_ALL,
+        };
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+
+        for (size_t m = 0; m < ELEMENTSOF(modes); m++)
+                for (size_t k = 0; k < ELEMENTSOF(flags); k++) {
+                        unsigned n = 0;
+
+                        assert_se(sd_journal_seek_head(j) >= 0);
+
+                        /* The first 64 entries cover all the different kinds of fields */
+                        while (n < 64 && sd_journal_next(j) > 0) {
+                                _cleanup_free_ char *expected = NULL, *got = NULL;
+                                _cleanup_fclose_ FILE *f = NULL, *g = NULL;
+                                size_t expected_size = 0, got_size = 0;
+
+                                assert_se(f = open_memstream_unlocked(&expected, &expected_size));
+                                output_json_variant(f, j, modes[m], flags[k]);
+                                assert_se(fflush_and_check(f) >= 0);
+
+                                assert_se(g = open_memstream_unlocked(&got, &got_size));
+                                assert_se(show_journal_entry(g, j, modes[m], 0, flags[k], NULL, NULL, NULL) >= 0);
+                                assert_se(fflush_and_check(g) >= 0);
+
+                                if (!streq(expected, got)) {
+                                        log_error("Expected:\n%s\nGot:\n%s", expected, got);
+                                        assert_not_reached();
+                                }
+
+                                n++;
+                        }
+
+                        assert_se(n == MIN(64U, arg_n_entries));
+                }
+}
+
+static void test_output_json_benchmark(const char *dn) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        usec_t t[2];
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+        assert_se(f = fopen("/dev/null", "we"));
+
+        for (unsigned k = 0; k < 2; k++) {
+                usec_t start;
+                unsigned n = 0;
+
+                assert_se(sd_journal_seek_head(j) >= 0);
+
+                start = now(CLOCK_MONOTONIC);
+
+                while (sd_journal_next(j) > 0) {
+                        if (k == 0)
+                                output_json_variant(f, j, OUTPUT_JSON, 0);
+                        else
+                                assert_se(show_journal_entry(f, j, OUTPUT_JSON, 0, 0, NULL, NULL, NULL) >= 0);
+                        n++;
+                }
+
+                assert_se(fflush_and_check(f) >= 0);
+
+                t[k] = now(CLOCK_MONOTONIC) - start;
+                assert_se(n == arg_n_entries);
+
+                log_info("%s: wrote %u entries in %s (%.0f entries/s)",
+                         k == 0 ? "JsonVariant" : "streaming", n,
+                         FORMAT_TIMESPAN(t[k], USEC_PER_MSEC), n / ((double) t[k] / USEC_PER_SEC));
+        }
+
+        log_info("Speedup: %.2fx", (double) t[0] / t[1]);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *dn = NULL;
+
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2)
+                assert_se(safe_atou(argv[1], &arg_n_entries) >= 0 && arg_n_entries > 0);
+        else
+                arg_n_entries = slow_tests_enabled() ? 1000000 : 20000;
+
+        assert_se(mkdtemp_malloc("/var/tmp/test-logs-show-XXXXXX", &dn) >= 0);
+        (void) chattr_path(dn, FS_NOCOW_FL, FS_NOCOW_FL, NULL);
+
+        create_journal(dn, arg_n_entries);
+
+        test_output_json(dn);
+        test_output_json_benchmark(dn);
+
+        return 0;
+}
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
 #include "memory-util.h"
+#include "random-util.h"
 #include "siphash24.h"
 
 #define ITERATIONS 10000000ULL
@@ -85,6 +86,32 @@ static void test_short_hashes(void) {
         }
 }
 
+static void test_many(void) {
+        const uint8_t key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+        uint8_t buf[64 + 64];
+        const void *in[64 + 3];
+        size_t inlen[ELEMENTSOF(in)];
+        uint64_t out[ELEMENTSOF(in)];
+
+        random_bytes(buf, sizeof(buf));
+
+        /* All lengths up to 64 bytes at all alignments, so that the lanes get to the end at different
+         * times, plus a few that don't fill all lanes */
+        for (size_t i = 0; i < ELEMENTSOF(in); i++) {
+                inlen[i] = i % 65;
+                in[i] = buf + (i * 7) % 64;
+        }
+
+        for (size_t n = 0; n <= ELEMENTSOF(in); n++) {
+                zero(out);
+                siphash24_many(in, inlen, n, key, out);
+
+                for (size_t i = 0; i < ELEMENTSOF(in); i++)
+                        assert_se(out[i] == (i < n ? siphash24(in[i], inlen[i], key) : 0));
+        }
+}
+
 /* see https://131002.net/siphash/siphash.pdf, Appendix A */
 int main(int argc, char *argv[]) {
         const uint8_t in[15]  = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
@@ -104,4 +131,5 @@ int main(int argc, char *argv[]) {
         do_test(in_buf + 4, sizeof(in), key);
 
         test_short_hashes();
+        test_many();
 }
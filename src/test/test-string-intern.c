@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "hashed-string.h"
+#include "hashmap.h"
+#include "string-intern.h"
+#include "string-util.h"
+#include "tests.h"
+
+static void test_string_intern(void) {
+        const char *a, *b, *c;
+        char buf[] = "/usr/lib/systemd/system/getty@.service";
+        StringInternStats stats;
+
+        log_info("/* %s */", __func__);
+
+        string_intern_get_stats(&stats);
+        assert_se(stats.n_strings == 0);
+
+        assert_se(a = string_intern(buf));
+        assert_se(a != buf);
+        assert_se(streq(a, buf));
+
+        /* The same string, wherever it comes from, is the same pointer */
+        assert_se(b = string_intern("/usr/lib/systemd/system/getty@.service"));
+        assert_se(a == b);
+        assert_se(c = string_intern("/etc/fstab"));
+        assert_se(c != a);
+
+        /* Interned strings are hashed strings */
+        assert_se(hashed_string_hash(a) == hashed_string_hash(hashed_strdupa(buf)));
+
+        string_intern_get_stats(&stats);
+        assert_se(stats.n_strings == 2);
+        assert_se(stats.n_refs == 3);
+        assert_se(stats.n_bytes == sizeof(buf) + STRLEN("/etc/fstab") + 1);
+        assert_se(stats.n_bytes_saved == sizeof(buf));
+        assert_se(stats.n_lookups == 3);
+        assert_se(stats.n_hits == 1);
+
+        assert_se(string_intern_ref(c) == c);
+        assert_se(!string_intern_unref(c));
+        assert_se(!string_intern_unref(c));
+        assert_se(!string_intern_unref(a));
+
+        /* Still referenced by b */
+        assert_se(streq(b, buf));
+        string_intern_get_stats(&stats);
+        assert_se(stats.n_strings == 1);
+        assert_se(stats.n_refs == 1);
+        assert_se(stats.n_bytes_saved == 0);
+
+        assert_se(!string_intern_unref(b));
+        string_intern_get_stats(&stats);
+        assert_se(stats.n_strings == 0);
+}
+
+static void test_string_intern_replace(void) {
+        const char *p = NULL, *q;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(string_intern_replace(&p, "/proc/self/mountinfo") == 1);
+        assert_se(streq(p, "/proc/self/mountinfo"));
+        q = p;
+        assert_se(string_intern_replace(&p, "/proc/self/mountinfo") == 0);
+        assert_se(p == q);
+        assert_se(string_intern_replace(&p, "/etc/fstab") == 1);
+        assert_se(streq(p, "/etc/fstab"));
+        assert_se(string_intern_replace(&p, NULL) == 1);
+        assert_se(!p);
+        assert_se(string_intern_replace(&p, NULL) == 0);
+}
+
+static void test_string_intern_long(void) {
+        _cleanup_(hashed_string_freep) char *h = NULL;
+        _cleanup_free_ char *l = NULL;
+        const char *a, *b;
+        StringInternStats stats;
+
+        log_info("/* %s */", __func__);
+
+        /* Long strings take a different path for the lookup, make sure it finds them all the same */
+        assert_se(l = strrep("/very/long/path", 64 * 1024));
+
+        assert_se(a = string_intern(l));
+        assert_se(streq(a, l));
+        assert_se(b = string_intern(l));
+        assert_se(a == b);
+        assert_se(h = hashed_strdup(l));
+        assert_se(hashed_string_hash(a) == hashed_string_hash(h));
+
+        string_intern_get_stats(&stats);
+        assert_se(stats.n_strings == 1);
+        assert_se(stats.n_refs == 2);
+
+        assert_se(!string_intern_unref(a));
+        assert_se(!string_intern_unref(b));
+
+        string_intern_get_stats(&stats);
+        assert_se(stats.n_strings == 0);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_DEBUG);
+
+        test_string_intern();
+        test_string_intern_replace();
+        test_string_intern_long();
+
+        return 0;
+}
@@ -17,6 +17,14 @@ static void test_utf8_is_printable(void) {
         assert_se(!utf8_is_printable("\r", 1));
         assert_se(utf8_is_printable("\n", 1));
         assert_se(utf8_is_printable("\t", 1));
+
+        /* Longer than the blocks of plain ASCII that are checked at once */
+        assert_se(utf8_is_printable("0123456789abcdef0123456789abcdef\n", 33));
+        assert_se(!utf8_is_printable_newline("0123456789abcdef0123456789abcdef\n", 33, false));
+        assert_se(!utf8_is_printable("0123456789abcdef0123456789abcde\r", 32));
+        assert_se(!utf8_is_printable("0123456789abcdef0123456789abcde\177", 32));
+        assert_se(utf8_is_printable("0123456789abcdef01234567\342\204\242abcdef", 33));
+        assert_se(!utf8_is_printable("0123456789abcdef0123456789abc\302\200", 31));
 }
 
 static void test_utf8_n_is_valid(void) {
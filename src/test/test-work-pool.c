@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "work-pool.h"
+
+static int work_sleep(void *userdata) {
+        unsigned *n = userdata;
+
+        (void) usleep(10 * USEC_PER_MSEC);
+        __atomic_add_fetch(n, 1, __ATOMIC_SEQ_CST);
+        return 7;
+}
+
+static void work_done(WorkItem *w, int result, void *userdata) {
+        assert_se(result == 7);
+}
+
+static void test_submit_wait(void) {
+        _cleanup_(work_pool_freep) WorkPool *p = NULL;
+        WorkItem items[16];
+        unsigned n = 0;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(work_pool_new(4, &p) >= 0);
+
+        for (size_t i = 0; i < ELEMENTSOF(items); i++) {
+                items[i] = (WorkItem) {
+                        .func = work_sleep,
+                        .done = work_done,
+                        .userdata = &n,
+                };
+                assert_se(work_pool_submit(p, items + i) >= 0);
+        }
+
+        for (size_t i = 0; i < ELEMENTSOF(items); i++) {
+                work_pool_wait(p, items + i);
+                assert_se(items[i].state == WORK_ITEM_IDLE);
+        }
+
+        assert_se(n == ELEMENTSOF(items));
+}
+
+static void test_cancel(void) {
+        _cleanup_(work_pool_freep) WorkPool *p = NULL;
+        WorkItem running, queued;
+        unsigned n = 0;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(work_pool_new(1, &p) >= 0);
+
+        running = (WorkItem) { .func = work_sleep, .userdata = &n };
+        queued = (WorkItem) { .func = work_sleep, .userdata = &n };
+        assert_se(work_pool_submit(p, &running) >= 0);
+        assert_se(work_pool_submit(p, &queued) >= 0);
+
+        /* With a single thread, the second item can only be picked up once the first is done */
+        assert_se(work_pool_cancel(p, &queued));
+        assert_se(queued.state == WORK_ITEM_IDLE);
+        assert_se(!work_pool_cancel(p, &queued));
+
+        work_pool_wait(p, &running);
+        assert_se(!work_pool_cancel(p, &running));
+        assert_se(n == 1);
+}
+
+static void test_floating(void) {
+        _cleanup_(work_pool_freep) WorkPool *p = NULL;
+        unsigned n = 0;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(work_pool_new(2, &p) >= 0);
+
+        for (unsigned i = 0; i < 8; i++) {
+                WorkItem *w;
+
+                w = new(WorkItem, 1);
+                assert_se(w);
+                *w = (WorkItem) {
+                        .func = work_sleep,
+                        .userdata = &n,
+                        .floating = true,
+                };
+                assert_se(work_pool_submit(p, w) >= 0);
+        }
+
+        /* Whatever is still queued is freed along with the pool, what is running is waited for */
+        p = work_pool_free(p);
+        assert_se(n <= 8);
+}
+
+static void test_default(void) {
+        WorkPool *a, *b;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(work_pool_get_default(&a) >= 0);
+        assert_se(work_pool_get_default(&b) >= 0);
+        assert_se(a && a == b);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_DEBUG);
+
+        test_submit_wait();
+        test_cancel();
+        test_floating();
+        test_default();
+
+        return 0;
+}